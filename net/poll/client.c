@@ -0,0 +1,1947 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+#include "client.h"
+#include "frame.h"
+#include "ringbuf.h"
+#include "shm.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/queue.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <time.h>
+#include <linux/errqueue.h>
+
+#define DBG(fmt, ...) do { if (debug) printf(fmt, ##__VA_ARGS__); } while (0)
+
+static int debug = 1;
+
+/**
+ * Maximum number of segments written with a single sendmsg(), two per request
+ */
+#define CONN_IOV 128
+
+/**
+ * Minimum payload length sent with MSG_ZEROCOPY, smaller payloads are cheaper
+ * to copy than to pin and get notified about
+ */
+#define CONN_ZEROCOPY_MIN 16384
+
+/**
+ * Delay in ms before retrying a connect() refused with EAGAIN, i.e. while
+ * the listen backlog of a Unix socket is full
+ */
+#define CONN_BUSY_RETRY 10
+
+
+struct request
+{
+    uint8_t hdr[FRAME_HDR];
+    /* payload, handed over to the zerocopy list once written with it */
+    char *buf;
+    size_t len;
+    /* id of the last MSG_ZEROCOPY send referencing buf, if zc */
+    uint32_t zc_id;
+    bool zc;
+    /* zerocopy list entry, allocated before buf is sent with MSG_ZEROCOPY */
+    struct zcbuf *zcbuf;
+    /* time in ms the request fails at, if the connection has a timeout */
+    uint64_t deadline;
+    /* NULL once timed out, the response is discarded when it arrives */
+    callback cb;
+    void *user;
+    TAILQ_ENTRY(request) entries;
+};
+
+TAILQ_HEAD(requestlist, request);
+
+/**
+ * Payload sent with MSG_ZEROCOPY, the kernel may read it until notified
+ */
+struct zcbuf
+{
+    char *buf;
+    uint32_t id;
+    TAILQ_ENTRY(zcbuf) entries;
+};
+
+TAILQ_HEAD(zclist, zcbuf);
+
+/**
+ * Event registration of a client connection
+ */
+struct event_reg
+{
+    char *name;
+    event_cb cb;
+    void *user;
+    /* cleared by unregister_event(), freed once the server confirmed */
+    bool active;
+    /* confirmed by the server, registered again after reconnecting */
+    bool confirmed;
+    LIST_ENTRY(event_reg) entries;
+};
+
+LIST_HEAD(reglist, event_reg);
+
+/**
+ * Address a connection connects to, resolved once
+ */
+struct conn_addr
+{
+	int family;
+	int socktype;
+	int protocol;
+	socklen_t len;
+	struct sockaddr_storage addr;
+};
+
+enum conn_state {
+	/** waiting for a non-blocking connect() to complete */
+	CONN_CONNECTING,
+	CONN_CONNECTED,
+	/** waiting to reconnect, see conn_set_reconnect() */
+	CONN_WAITING,
+	/** failed for good, requests fail right away */
+	CONN_FAILED,
+};
+
+struct conn
+{
+    int s;
+    enum conn_state state;
+    /* error the connection failed with */
+    int err;
+    /* addresses to connect to, tried in order starting at next */
+    struct conn_addr *addrs;
+    int addr_count;
+    int addr_next;
+    /* requests not completely written yet, the head partially by off */
+    struct requestlist out;
+    size_t off;
+    /* written requests waiting for their response, in order */
+    struct requestlist sent;
+    /* number of requests in out and sent */
+    int queued;
+    /* payloads the kernel did not release yet, ordered by id */
+    struct zclist zc;
+    /* id of the next MSG_ZEROCOPY send, counted by the kernel the same way */
+    uint32_t zc_next;
+    /* MSG_ZEROCOPY enabled, i.e. supported and not copied anyway */
+    bool zerocopy;
+    /* ring size offered to the server once connected, 0 for the socket */
+    size_t shm_size;
+    /* offer sent, requests are held back until the server answered */
+    bool shm_offered;
+    /* fds received with the answer, -1 if none */
+    int shm_fds[SHM_FDS];
+    /* shared memory accepted by the server, in use if map is set */
+    struct shm shm;
+    /* epoll of the socket and the doorbell, watched instead of the socket */
+    int ep;
+    /* event registrations, including those waiting for confirmation */
+    struct reglist events;
+    /* received responses not processed yet */
+    struct ringbuf rb;
+    fdcb fdcb;
+    timercb timercb;
+    void *user;
+    void *iodata;
+    enum fdops ops;
+    /* time in ms the timer got started for, 0 if not */
+    uint64_t armed;
+    /* request timeout in ms, see conn_set_timeout() */
+    unsigned int timeout;
+    /* reconnect delays in ms, no reconnecting if 0 */
+    unsigned int retry_min, retry_max;
+    /* delay before the next reconnect attempt and when it is due */
+    unsigned int backoff;
+    uint64_t retry;
+    /* processing I/O, disconnect() is deferred until done */
+    int busy;
+    bool closed;
+};
+
+/**
+ * View of a response payload in the receive ring of a connection
+ */
+struct response {
+	enum packet_type type;
+	struct iovec seg[2];
+	int count;
+	size_t len;
+	/* contiguous copy of a wrapped payload, see response_get_data() */
+	char *linear;
+};
+
+/**
+ * Connections of a pool, see pool_create()
+ */
+struct pool
+{
+	struct conn **conns;
+	int count;
+	fdcb fdcb;
+	timercb timercb;
+	void *user;
+	unsigned int retry_min, retry_max;
+};
+
+void client_set_debug(int level)
+{
+	debug = level;
+}
+
+static void conn_destroy(struct conn *c);
+static void conn_read(struct conn *c);
+static void conn_write(struct conn *c);
+static void conn_shm_io(struct conn *c);
+static void conn_zerocopy_done(struct conn *c);
+static void conn_zerocopy_release(struct conn *c, uint32_t id);
+static void conn_close(struct conn *c);
+static int conn_start(struct conn *c);
+
+static uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static int update_ops(struct conn *c, enum fdops ops)
+{
+	int ret;
+
+	if (c->ep >= 0 && ops)
+	{	/* the doorbell signals both data and space in the rings */
+		ops = READ;
+	}
+	if (ops == c->ops)
+	{
+		return 0;
+	}
+	ret = c->fdcb(c, c->ep >= 0 ? c->ep : c->s, ops, c->user);
+	if (ret == 0)
+	{
+		c->ops = ops;
+	}
+	return -abs(ret);
+}
+
+static void request_destroy(struct request *r)
+{
+	free(r->zcbuf);
+	free(r->buf);
+	free(r);
+}
+
+/**
+ * Stop using shared memory, or drop the fds of an unanswered offer, once
+ * the fd got removed with update_ops()
+ */
+static void conn_shm_close(struct conn *c)
+{
+	int i;
+
+	if (c->shm.map)
+	{
+		shm_destroy(&c->shm);
+	}
+	if (c->ep >= 0)
+	{
+		close(c->ep);
+		c->ep = -1;
+	}
+	for (i = 0; i < SHM_FDS; i++)
+	{
+		if (c->shm_fds[i] >= 0)
+		{
+			close(c->shm_fds[i]);
+			c->shm_fds[i] = -1;
+		}
+	}
+	c->shm_offered = false;
+}
+
+/**
+ * Remove and free a request of out or sent
+ */
+static void conn_release(struct conn *c, struct requestlist *list,
+						 struct request *r)
+{
+	TAILQ_REMOVE(list, r, entries);
+	request_destroy(r);
+	c->queued--;
+}
+
+/**
+ * Start the timer for the next reconnect attempt or request deadline
+ */
+static void conn_arm(struct conn *c)
+{
+	struct requestlist *lists[] = { &c->sent, &c->out };
+	struct request *r;
+	uint64_t due = 0, now;
+	int i;
+
+	if (!c->timercb || c->closed)
+	{
+		return;
+	}
+	if (c->state == CONN_WAITING)
+	{
+		due = c->retry;
+	}
+	for (i = 0; i < 2; i++)
+	{	/* queued in order of their deadline, timed out ones first */
+		TAILQ_FOREACH(r, lists[i], entries)
+		{
+			if (r->cb && r->deadline)
+			{
+				due = due && due < r->deadline ? due : r->deadline;
+				i = 2;
+				break;
+			}
+		}
+	}
+	if (!due || (c->armed && c->armed <= due))
+	{
+		return;
+	}
+	c->armed = due;
+	now = now_ms();
+	c->timercb(c, due > now ? due - now : 0, c->user);
+}
+
+/**
+ * Complete the oldest request waiting for a response
+ */
+static void conn_complete(struct conn *c, int err, struct response *res)
+{
+	struct request *r;
+
+	r = TAILQ_FIRST(&c->sent);
+	if (!r)
+	{
+		DBG("FD_CLIENT unexpected response\n");
+		return;
+	}
+	TAILQ_REMOVE(&c->sent, r, entries);
+	c->queued--;
+	if (r->cb)
+	{
+		r->cb(c, err, "do client callback function", res, r->user);
+	}
+	request_destroy(r);
+}
+
+/**
+ * Fail and remove all requests of a list
+ */
+static void conn_fail_requests(struct conn *c, struct requestlist *list,
+							   int err)
+{
+	struct request *r;
+
+	while ((r = TAILQ_FIRST(list)))
+	{
+		TAILQ_REMOVE(list, r, entries);
+		c->queued--;
+		if (r->cb)
+		{
+			r->cb(c, err, "do client callback function", NULL, r->user);
+		}
+		request_destroy(r);
+	}
+}
+
+/**
+ * Fail all pending requests and registrations of a connection for good
+ */
+static void conn_fail(struct conn *c, int err)
+{
+	struct event_reg *reg;
+
+	c->state = CONN_FAILED;
+	c->err = err;
+	TAILQ_CONCAT(&c->sent, &c->out, entries);
+	c->off = 0;
+	conn_fail_requests(c, &c->sent, err);
+	/* no more events for confirmed registrations */
+	while ((reg = LIST_FIRST(&c->events)))
+	{
+		LIST_REMOVE(reg, entries);
+		if (reg->active)
+		{
+			reg->cb(c, err, reg->name, NULL, reg->user);
+		}
+		free(reg->name);
+		free(reg);
+	}
+}
+
+/**
+ * Schedule a reconnect attempt with exponential backoff, or fail for good
+ */
+static void conn_retry(struct conn *c, int err)
+{
+	if (!c->retry_min)
+	{
+		conn_fail(c, err);
+		return;
+	}
+	DBG("FD_CLIENT reconnecting in %u ms: %s\n", c->backoff, strerror(-err));
+	c->state = CONN_WAITING;
+	c->err = err;
+	c->retry = now_ms() + c->backoff;
+	c->backoff = c->backoff * 2 < c->retry_max ? c->backoff * 2 : c->retry_max;
+	conn_arm(c);
+}
+
+/**
+ * Close the socket of a lost connection. Requests written already fail, as
+ * they might have been processed, the others are kept for reconnecting.
+ */
+static void conn_down(struct conn *c, int err)
+{
+	struct request *r;
+
+	update_ops(c, 0);
+	conn_shm_close(c);
+	conn_close(c);
+	ringbuf_free(&c->rb);
+	c->zc_next = 0;
+	/* a partially written request is sent again from the start */
+	c->off = 0;
+	r = TAILQ_FIRST(&c->out);
+	if (r)
+	{
+		r->zc = false;
+	}
+	if (c->retry_min)
+	{
+		conn_fail_requests(c, &c->sent, err);
+	}
+	if (c->state != CONN_FAILED && !c->closed)
+	{
+		conn_retry(c, err);
+	}
+}
+
+/**
+ * Offer the server to continue over shared memory, requests are held back
+ * until it answered
+ */
+static void conn_shm_offer(struct conn *c)
+{
+	uint8_t buf[FRAME_HDR + sizeof(uint32_t)];
+	uint32_t size = htonl(c->shm_size);
+
+	frame_header(buf, SHM_OFFER, sizeof(size));
+	memcpy(buf + FRAME_HDR, &size, sizeof(size));
+	/* the first data on the socket, it does not get split */
+	if (send(c->s, buf, sizeof(buf), MSG_NOSIGNAL | MSG_DONTWAIT) ==
+		sizeof(buf))
+	{
+		c->shm_offered = true;
+	}
+}
+
+/**
+ * Connected, register events again and write queued requests
+ */
+static void conn_established(struct conn *c)
+{
+	struct event_reg *reg;
+	struct request *r;
+	size_t len;
+
+	DBG("FD_CLIENT connected %d\n", c->s);
+	c->state = CONN_CONNECTED;
+	c->backoff = c->retry_min;
+	if (c->shm_size)
+	{
+		conn_shm_offer(c);
+	}
+	LIST_FOREACH(reg, &c->events, entries)
+	{
+		if (reg->active && reg->confirmed)
+		{	/* confirmation of the new registration is ignored */
+			len = strlen(reg->name);
+			r = calloc(1, sizeof(*r));
+			frame_header(r->hdr, EVENT_REGISTER, len);
+			r->buf = strdup(reg->name);
+			r->len = len;
+			TAILQ_INSERT_HEAD(&c->out, r, entries);
+			c->queued++;
+		}
+	}
+	if (TAILQ_EMPTY(&c->out) || c->shm_offered)
+	{
+		update_ops(c, READ);
+		return;
+	}
+	conn_write(c);
+}
+
+/**
+ * Open a socket to the next address, non-blocking
+ *
+ * @return		0 if connected, 1 if in progress, negative errno if all
+ *				remaining addresses failed
+ */
+static int conn_connect(struct conn *c)
+{
+	struct conn_addr *a;
+	int err = -EHOSTUNREACH;
+#ifdef SO_ZEROCOPY
+	int on = 1;
+#endif
+
+	while (c->addr_next < c->addr_count)
+	{
+		a = &c->addrs[c->addr_next++];
+		c->s = socket(a->family, a->socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+					  a->protocol);
+		if (c->s < 0)
+		{
+			err = -errno;
+			continue;
+		}
+#ifdef SO_ZEROCOPY
+		/* not supported by all families, e.g. AF_UNIX, copied then */
+		c->zerocopy = setsockopt(c->s, SOL_SOCKET, SO_ZEROCOPY, &on,
+								 sizeof(on)) == 0;
+#endif
+		if (connect(c->s, (struct sockaddr*)&a->addr, a->len) == 0)
+		{
+			return 0;
+		}
+		if (errno == EINPROGRESS)
+		{
+			c->state = CONN_CONNECTING;
+			return 1;
+		}
+		if (errno == EAGAIN && a->family == AF_UNIX)
+		{	/* listen backlog full, nothing to wait for on the socket */
+			if (c->timercb)
+			{
+				close(c->s);
+				c->s = -1;
+				c->addr_next--;
+				c->state = CONN_WAITING;
+				c->retry = now_ms() + CONN_BUSY_RETRY;
+				conn_arm(c);
+				return 1;
+			}
+			/* without a timer the caller retries on -EAGAIN, blocking
+			 * until the server accepts would stall its loop */
+		}
+		err = -errno;
+		close(c->s);
+		c->s = -1;
+	}
+	return err;
+}
+
+/**
+ * Connect to the first reachable address, schedules a retry if none is
+ *
+ * @return		0 if connected, in progress or retried, negative errno if
+ *				failed for good
+ */
+static int conn_start(struct conn *c)
+{
+	int ret;
+
+	c->addr_next = 0;
+	ret = conn_connect(c);
+	if (ret == 0)
+	{
+		conn_established(c);
+	}
+	else if (ret == 1)
+	{
+		if (c->state == CONN_CONNECTING)
+		{
+			update_ops(c, WRITE);
+		}
+	}
+	else
+	{
+		conn_retry(c, ret);
+		if (c->state == CONN_FAILED)
+		{
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * A non-blocking connect() completed, continue with the next address if it
+ * failed
+ */
+static void conn_connected(struct conn *c)
+{
+	socklen_t len = sizeof(int);
+	int err = 0, ret;
+
+	if (getsockopt(c->s, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+	{
+		err = errno;
+	}
+	if (!err)
+	{
+		conn_established(c);
+		return;
+	}
+	DBG("FD_CLIENT connect failed: %s\n", strerror(err));
+	update_ops(c, 0);
+	close(c->s);
+	c->s = -1;
+	ret = conn_connect(c);
+	if (ret == 0)
+	{
+		conn_established(c);
+	}
+	else if (ret == 1)
+	{
+		if (c->state == CONN_CONNECTING)
+		{
+			update_ops(c, WRITE);
+		}
+	}
+	else
+	{
+		conn_retry(c, -err);
+	}
+}
+
+void conn_ready(struct conn *c, int ops)
+{
+	c->busy++;
+	if (c->state == CONN_CONNECTING)
+	{
+		conn_connected(c);
+	}
+	else if (c->state == CONN_CONNECTED && c->shm.map)
+	{
+		conn_shm_io(c);
+	}
+	else if (c->state == CONN_CONNECTED)
+	{
+		if (ops & ERROR)
+		{	/* zerocopy completions are reported on the error queue */
+			conn_zerocopy_done(c);
+		}
+		if (ops & WRITE)
+		{
+			conn_write(c);
+		}
+		if (ops & (READ | ERROR) && !c->closed)
+		{
+			conn_read(c);
+		}
+	}
+	if (--c->busy == 0 && c->closed)
+	{
+		conn_destroy(c);
+	}
+}
+
+/**
+ * Complete requests past their deadline with -ETIMEDOUT. Requests not
+ * written yet are dropped, others stay queued so their responses still get
+ * matched in order.
+ */
+static void conn_expire(struct conn *c, uint64_t now)
+{
+	struct requestlist *lists[] = { &c->sent, &c->out };
+	struct {
+		callback cb;
+		void *user;
+	} *expired = NULL;
+	struct request *r, *next;
+	int i, j, count = 0;
+
+	for (i = 0; i < 2; i++)
+	{
+		for (r = TAILQ_FIRST(lists[i]); r; r = next)
+		{
+			next = TAILQ_NEXT(r, entries);
+			if (!r->cb || !r->deadline)
+			{
+				continue;
+			}
+			if (r->deadline > now)
+			{	/* queued in order of their deadline */
+				i = 2;
+				break;
+			}
+			/* collected first, as callbacks may queue or disconnect */
+			expired = realloc(expired, (count + 1) * sizeof(*expired));
+			expired[count].cb = r->cb;
+			expired[count++].user = r->user;
+			r->cb = NULL;
+			if (lists[i] == &c->out && (r != TAILQ_FIRST(&c->out) || !c->off))
+			{
+				conn_release(c, &c->out, r);
+			}
+		}
+	}
+	for (j = 0; j < count; j++)
+	{
+		expired[j].cb(c, -ETIMEDOUT, "do client callback function", NULL,
+					  expired[j].user);
+	}
+	free(expired);
+}
+
+void conn_timer(struct conn *c)
+{
+	uint64_t now = now_ms();
+
+	c->busy++;
+	c->armed = 0;
+	if (c->state == CONN_WAITING && c->retry <= now)
+	{
+		conn_start(c);
+	}
+	conn_expire(c, now);
+	conn_arm(c);
+	if (--c->busy == 0 && c->closed)
+	{
+		conn_destroy(c);
+	}
+}
+
+void conn_set_timercb(struct conn *c, timercb timercb)
+{
+	c->timercb = timercb;
+}
+
+void conn_set_timeout(struct conn *c, unsigned int ms)
+{
+	c->timeout = ms;
+}
+
+int conn_set_reconnect(struct conn *c, unsigned int min, unsigned int max)
+{
+	if (!c->timercb)
+	{
+		return -ENOTSUP;
+	}
+	c->retry_min = min;
+	c->retry_max = max > min ? max : min;
+	c->backoff = min;
+	return 0;
+}
+
+void conn_set_iodata(struct conn *c, void *data)
+{
+	c->iodata = data;
+}
+
+void *conn_get_iodata(struct conn *c)
+{
+	return c->iodata;
+}
+
+int conn_set_shm(struct conn *c, size_t size)
+{
+	if (c->addrs[0].family != AF_UNIX)
+	{
+		return -ENOTSUP;
+	}
+	c->shm_size = size;
+	if (size && c->state == CONN_CONNECTED && !c->shm.map &&
+		!c->shm_offered && TAILQ_EMPTY(&c->out) && TAILQ_EMPTY(&c->sent))
+	{
+		conn_shm_offer(c);
+	}
+	return 0;
+}
+
+size_t conn_get_shm(struct conn *c)
+{
+	return c->shm.map ? c->shm.size : 0;
+}
+
+
+/**
+ * Skip bytes at the start of the payload of a response
+ */
+static void response_skip(struct response *res, size_t len)
+{
+	res->len -= len;
+	if (len >= res->seg[0].iov_len)
+	{
+		len -= res->seg[0].iov_len;
+		res->seg[0] = res->seg[1];
+		res->count--;
+	}
+	if (res->count)
+	{
+		res->seg[0].iov_base = (char*)res->seg[0].iov_base + len;
+		res->seg[0].iov_len -= len;
+		if (!res->seg[0].iov_len)
+		{
+			res->seg[0] = res->seg[1];
+			res->count--;
+		}
+	}
+}
+
+/**
+ * Copy bytes at the start of the payload of a response
+ */
+static void response_copy(struct response *res, void *out, size_t len)
+{
+	size_t first = len < res->seg[0].iov_len ? len : res->seg[0].iov_len;
+
+	memcpy(out, res->seg[0].iov_base, first);
+	if (len > first)
+	{
+		memcpy((char*)out + first, res->seg[1].iov_base, len - first);
+	}
+}
+
+/**
+ * Pass an event, a length prefixed name followed by data, to the callback
+ * registered for it
+ */
+static void conn_event(struct conn *c, struct response *res)
+{
+	struct event_reg *reg;
+	char name[UINT8_MAX + 1];
+	uint8_t len;
+
+	if (res->len < 1)
+	{
+		return;
+	}
+	response_copy(res, &len, 1);
+	if (res->len < 1 + len)
+	{
+		return;
+	}
+	response_copy(res, name, 1 + len);
+	memmove(name, name + 1, len);
+	name[len] = '\0';
+	response_skip(res, 1 + len);
+
+	LIST_FOREACH(reg, &c->events, entries)
+	{
+		if (reg->active && strcmp(reg->name, name) == 0)
+		{
+			reg->cb(c, 0, reg->name, res, reg->user);
+			return;
+		}
+	}
+	DBG("FD_CLIENT unexpected event '%s'\n", name);
+}
+
+/**
+ * Switch to shared memory if the server accepted the offer, else keep using
+ * the socket. Requests held back get written either way.
+ */
+static void conn_shm_answer(struct conn *c, struct response *res)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+	};
+	uint32_t size;
+	int ep = -1, err = -EPROTO;
+
+	c->shm_offered = false;
+	if (res->type != SHM_ACCEPT)
+	{
+		DBG("FD_CLIENT shared memory refused, using the socket\n");
+		conn_shm_close(c);
+		conn_write(c);
+		return;
+	}
+	if (res->len == sizeof(size) && c->shm_fds[SHM_FDS - 1] >= 0)
+	{
+		response_copy(res, &size, sizeof(size));
+		err = shm_attach(&c->shm, ntohl(size), c->shm_fds);
+	}
+	if (err == 0)
+	{	/* EOF on the socket is all that still arrives there */
+		ep = epoll_create1(EPOLL_CLOEXEC);
+		if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, c->shm.efd, &ev) != 0 ||
+			(ev.events = EPOLLIN | EPOLLRDHUP,
+			 epoll_ctl(ep, EPOLL_CTL_ADD, c->s, &ev) != 0))
+		{
+			err = -errno;
+		}
+	}
+	if (err == 0)
+	{
+		update_ops(c, 0);
+		c->ep = ep;
+		c->zerocopy = false;
+		err = update_ops(c, READ);
+	}
+	else if (ep >= 0)
+	{
+		close(ep);
+	}
+	if (err)
+	{	/* the server switched already, don't offer again */
+		DBG("FD_CLIENT using shared memory failed: %s\n", strerror(-err));
+		c->shm_size = 0;
+		conn_down(c, err);
+		return;
+	}
+	DBG("FD_CLIENT using shared memory rings of %zu bytes\n", c->shm.size);
+	conn_write(c);
+}
+
+/**
+ * Match a response frame to the oldest request
+ */
+static void conn_frame(struct conn *c, struct response *res)
+{
+	if (c->shm_offered)
+	{	/* the first frame answers the offer */
+		conn_shm_answer(c, res);
+		free(res->linear);
+		return;
+	}
+	switch (res->type)
+	{
+		case EVENT:
+			conn_event(c, res);
+			break;
+		case EVENT_CONFIRM:
+			conn_complete(c, 0, res);
+			break;
+		case EVENT_UNKNOWN:
+			conn_complete(c, -ENOENT, res);
+			break;
+		case CMD_RESPONSE:
+			if (debug)
+			{
+				size_t len;
+				const char *data = response_get_data(res, &len);
+
+				printf("FD_CLIENT read : '%.*s'\n", (int)len, data);
+			}
+			conn_complete(c, 0, res);
+			break;
+		case CMD_UNKNOWN:
+			conn_complete(c, -ENOENT, res);
+			break;
+		default:
+			DBG("FD_CLIENT unexpected packet type %d\n", res->type);
+			break;
+	}
+	free(res->linear);
+}
+
+/**
+ * Pass on all complete frames in the receive ring, in place
+ *
+ * @return		0, -EMSGSIZE for an invalid frame, or -ENOMEM if it can't
+ *				be buffered
+ */
+static int conn_parse(struct conn *c)
+{
+	uint8_t hdr[FRAME_HDR];
+	struct response res;
+	size_t len;
+
+	while (c->rb.len >= FRAME_HDR)
+	{
+		ringbuf_copy(&c->rb, 0, FRAME_HDR, hdr);
+		len = frame_length(hdr);
+		if (len == SIZE_MAX || len > SIZE_MAX - FRAME_HDR)
+		{
+			return -EMSGSIZE;
+		}
+		if (c->rb.len < FRAME_HDR + len)
+		{	/* grow the ring if the frame does not fit */
+			return ringbuf_reserve(&c->rb, FRAME_HDR + len);
+		}
+		res = (struct response){
+			.type = hdr[4],
+			.len = len,
+		};
+		res.count = ringbuf_peek(&c->rb, FRAME_HDR, len, res.seg);
+		conn_frame(c, &res);
+		if (c->closed || c->state != CONN_CONNECTED)
+		{	/* disconnected by a callback, or lost while writing */
+			return 0;
+		}
+		ringbuf_consume(&c->rb, FRAME_HDR + len);
+	}
+	return 0;
+}
+
+/**
+ * Take the fds passed along with the answer to a shared memory offer
+ */
+static void conn_shm_fds(struct conn *c, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	int i, count, fd;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+		{
+			continue;
+		}
+		count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < count; i++)
+		{
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (i < SHM_FDS && c->shm_fds[i] < 0)
+			{
+				c->shm_fds[i] = fd;
+			}
+			else
+			{
+				close(fd);
+			}
+		}
+	}
+}
+
+static void conn_read(struct conn *c)
+{
+	char control[CMSG_SPACE(sizeof(int) * SHM_FDS)];
+	struct iovec iov[2];
+	struct msghdr msg = {
+		.msg_iov = iov,
+	};
+	ssize_t len;
+	int count, err;
+
+	/* edge-triggered, read until the socket is drained */
+	while (c->state == CONN_CONNECTED && c->ops & READ && !c->closed &&
+		   !c->shm.map)
+	{
+		count = ringbuf_writable(&c->rb, iov);
+		if (!count)
+		{
+			err = ringbuf_reserve(&c->rb, c->rb.size * 2);
+			if (err)
+			{
+				conn_down(c, err);
+				return;
+			}
+			continue;
+		}
+		msg.msg_iovlen = count;
+		/* the answer to a shared memory offer carries fds */
+		msg.msg_control = c->shm_offered ? control : NULL;
+		msg.msg_controllen = c->shm_offered ? sizeof(control) : 0;
+		len = recvmsg(c->s, &msg, MSG_CMSG_CLOEXEC);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				conn_down(c, -errno);
+			}
+			else if (!c->rb.len)
+			{	/* idle, don't pin a buffer */
+				ringbuf_free(&c->rb);
+			}
+			return;
+		}
+		if (len == 0)
+		{	/* closed by the server */
+			conn_down(c, -ECONNRESET);
+			return;
+		}
+		if (msg.msg_controllen)
+		{
+			conn_shm_fds(c, &msg);
+		}
+		ringbuf_produce(&c->rb, len);
+		err = conn_parse(c);
+		if (err)
+		{
+			conn_down(c, err);
+			return;
+		}
+	}
+}
+
+/**
+ * Move received data from the shared memory ring to the receive ring
+ *
+ * @return		0, or -ENOMEM if the receive ring can't grow
+ */
+static int conn_shm_move(struct conn *c, size_t len)
+{
+	struct iovec iov[2];
+	int count;
+
+	if (ringbuf_reserve(&c->rb, c->rb.len + len) != 0)
+	{
+		return -ENOMEM;
+	}
+	count = ringbuf_writable(&c->rb, iov);
+	if (iov[0].iov_len >= len)
+	{
+		shm_copy(&c->shm, 0, len, iov[0].iov_base);
+	}
+	else if (count > 1)
+	{
+		shm_copy(&c->shm, 0, iov[0].iov_len, iov[0].iov_base);
+		shm_copy(&c->shm, iov[0].iov_len, len - iov[0].iov_len,
+				 iov[1].iov_base);
+	}
+	ringbuf_produce(&c->rb, len);
+	shm_consume(&c->shm, len);
+	return 0;
+}
+
+/**
+ * Pass on all complete frames in the shared memory ring, in place. Frames
+ * larger than the ring are reassembled in the receive ring instead.
+ *
+ * @param left	receives the number of bytes of a partial frame left
+ * @return		0, -EMSGSIZE for an invalid frame, or -ENOMEM if it can't
+ *				be buffered
+ */
+static int conn_shm_parse(struct conn *c, size_t *left)
+{
+	uint8_t hdr[FRAME_HDR];
+	struct response res;
+	size_t avail, len;
+	int err;
+
+	*left = 0;
+	while ((avail = shm_readable(&c->shm)))
+	{
+		if (!c->rb.len && avail >= FRAME_HDR)
+		{
+			shm_copy(&c->shm, 0, FRAME_HDR, hdr);
+			len = frame_length(hdr);
+			if (len == SIZE_MAX || len > SIZE_MAX - FRAME_HDR)
+			{
+				return -EMSGSIZE;
+			}
+			if (FRAME_HDR + len <= c->shm.size)
+			{
+				if (avail < FRAME_HDR + len)
+				{
+					*left = avail;
+					return 0;
+				}
+				res = (struct response){
+					.type = hdr[4],
+					.len = len,
+				};
+				res.count = shm_peek(&c->shm, FRAME_HDR, len, res.seg);
+				conn_frame(c, &res);
+				if (c->closed || c->state != CONN_CONNECTED)
+				{
+					return 0;
+				}
+				shm_consume(&c->shm, FRAME_HDR + len);
+				continue;
+			}
+		}
+		else if (!c->rb.len)
+		{
+			*left = avail;
+			return 0;
+		}
+		err = conn_shm_move(c, avail);
+		if (!err)
+		{
+			err = conn_parse(c);
+		}
+		if (err)
+		{
+			return err;
+		}
+		if (c->closed || c->state != CONN_CONNECTED)
+		{
+			return 0;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Process the rings after the doorbell got rung or the socket got closed
+ */
+static void conn_shm_io(struct conn *c)
+{
+	ssize_t len;
+	size_t left;
+	char byte;
+	int err;
+
+	shm_doorbell(&c->shm);
+	/* nothing but EOF is expected on the socket */
+	len = recv(c->s, &byte, sizeof(byte), MSG_DONTWAIT);
+	if (len >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+					 errno != EINTR))
+	{
+		conn_down(c, len == 0 ? -ECONNRESET : len > 0 ? -EPROTO : -errno);
+		return;
+	}
+	/* continue writing if waiting for space */
+	conn_write(c);
+	do
+	{
+		if (c->closed || c->state != CONN_CONNECTED)
+		{
+			return;
+		}
+		err = conn_shm_parse(c, &left);
+		if (err)
+		{
+			conn_down(c, err);
+			return;
+		}
+	}
+	while (!c->closed && c->state == CONN_CONNECTED &&
+		   shm_sleep(&c->shm, left));
+}
+
+/**
+ * Keep the payload of a written request until the kernel releases it
+ */
+static void conn_zerocopy_keep(struct conn *c, struct request *r)
+{
+	struct zcbuf *zc = r->zcbuf;
+
+	zc->buf = r->buf;
+	zc->id = r->zc_id;
+	TAILQ_INSERT_TAIL(&c->zc, zc, entries);
+	r->zcbuf = NULL;
+	r->buf = NULL;
+	r->zc = false;
+}
+
+/**
+ * Release payloads of MSG_ZEROCOPY sends up to and including id
+ */
+static void conn_zerocopy_release(struct conn *c, uint32_t id)
+{
+	struct zcbuf *zc;
+
+	while ((zc = TAILQ_FIRST(&c->zc)) && (int32_t)(id - zc->id) >= 0)
+	{
+		TAILQ_REMOVE(&c->zc, zc, entries);
+		free(zc->buf);
+		free(zc);
+	}
+}
+
+/**
+ * Process zerocopy completions queued on the error queue of the socket
+ */
+static void conn_zerocopy_done(struct conn *c)
+{
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+	struct sock_extended_err *err;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+
+	while (true)
+	{
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(c->s, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return;
+		}
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+				!(cmsg->cmsg_level == SOL_IPV6 &&
+				  cmsg->cmsg_type == IPV6_RECVERR))
+			{
+				continue;
+			}
+			err = (struct sock_extended_err*)CMSG_DATA(cmsg);
+			if (err->ee_errno != 0 ||
+				err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			{
+				continue;
+			}
+			if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+			{	/* e.g. over loopback, pinning pages gains nothing */
+				DBG("FD_CLIENT zerocopy fell back to copying\n");
+				c->zerocopy = false;
+			}
+			/* ee_info..ee_data is the range of completed sends */
+			conn_zerocopy_release(c, err->ee_data);
+		}
+	}
+}
+
+/**
+ * Close the socket, without sending anything it still has queued.
+ *
+ * TCP keeps transmitting MSG_ZEROCOPY data after close(), and pinned pages
+ * don't keep freed payloads from getting reused. So payloads not released
+ * yet get the connection reset, which drops its send queue and completes
+ * most of them. Any the kernel still holds, e.g. in a device queue, are
+ * leaked rather than risking other heap contents to get sent.
+ */
+static void conn_close(struct conn *c)
+{
+	struct sockaddr unspec = {
+		.sa_family = AF_UNSPEC,
+	};
+	struct zcbuf *zc;
+
+	if (!TAILQ_EMPTY(&c->zc))
+	{
+		conn_zerocopy_done(c);
+	}
+	if (!TAILQ_EMPTY(&c->zc))
+	{	/* disconnects a TCP socket with a reset */
+		connect(c->s, &unspec, sizeof(unspec));
+		conn_zerocopy_done(c);
+	}
+	close(c->s);
+	c->s = -1;
+	while ((zc = TAILQ_FIRST(&c->zc)))
+	{
+		DBG("FD_CLIENT leaking zerocopy payload %u still used by the "
+			"kernel\n", zc->id);
+		TAILQ_REMOVE(&c->zc, zc, entries);
+		free(zc);
+	}
+}
+
+/**
+ * Collect the unwritten segments of queued requests for a single sendmsg().
+ *
+ * A payload large enough for MSG_ZEROCOPY is sent on its own, so the pinning
+ * overhead is not paid for the small requests around it.
+ *
+ * @param iov		receives up to CONN_IOV segments
+ * @param count		receives the number of segments
+ * @return			TRUE to send with MSG_ZEROCOPY
+ */
+static bool conn_segments(struct conn *c, struct iovec *iov, int *count)
+{
+	struct request *r;
+	size_t off = c->off;
+	bool zc = false;
+	int i = 0;
+
+	TAILQ_FOREACH(r, &c->out, entries)
+	{
+		if (i + 2 > CONN_IOV)
+		{
+			break;
+		}
+		if (c->zerocopy && r->len >= CONN_ZEROCOPY_MIN)
+		{
+			if (i)
+			{	/* flush the small requests first */
+				break;
+			}
+			zc = true;
+		}
+		if (off < FRAME_HDR)
+		{
+			iov[i].iov_base = r->hdr + off;
+			iov[i].iov_len = FRAME_HDR - off;
+			i++;
+			off = 0;
+		}
+		else
+		{
+			off -= FRAME_HDR;
+		}
+		if (r->len)
+		{
+			iov[i].iov_base = r->buf + off;
+			iov[i].iov_len = r->len - off;
+			i++;
+		}
+		off = 0;
+		if (zc)
+		{
+			break;
+		}
+	}
+	*count = i;
+	return zc;
+}
+
+/**
+ * Send collected segments with sendmsg()
+ *
+ * @return			number of bytes sent, -1 if the connection got lost or
+ *					writing is to be retried once writable
+ */
+static ssize_t conn_send(struct conn *c, struct iovec *iov, int count,
+						 bool zc)
+{
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = count,
+	};
+	ssize_t len;
+	int flags;
+
+	while (true)
+	{
+		flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+#ifdef MSG_ZEROCOPY
+		if (zc)
+		{
+			flags |= MSG_ZEROCOPY;
+		}
+#endif
+		len = sendmsg(c->s, &msg, flags);
+		if (len >= 0)
+		{
+			return len;
+		}
+		if (errno == EINTR)
+		{
+			continue;
+		}
+		if (zc && errno == ENOBUFS)
+		{	/* out of optmem for notifications, copy instead */
+			c->zerocopy = zc = false;
+			continue;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{	/* retried once writable */
+			update_ops(c, c->ops | READ | WRITE);
+		}
+		else
+		{
+			conn_down(c, -errno);
+		}
+		return -1;
+	}
+}
+
+/**
+ * Write queued requests with as few sendmsg() calls as possible, a partially
+ * written request is continued once the socket gets writable again. Over
+ * shared memory, requests are copied to the ring instead.
+ */
+static void conn_write(struct conn *c)
+{
+	struct iovec iov[CONN_IOV];
+	struct request *r;
+	ssize_t len;
+	int count;
+	bool zc;
+
+	if (c->shm_offered)
+	{	/* written once the server answered */
+		return;
+	}
+	while (!TAILQ_EMPTY(&c->out))
+	{
+		zc = conn_segments(c, iov, &count);
+		if (c->shm.map)
+		{	/* resumed by the doorbell once the server made space */
+			len = shm_write(&c->shm, iov, count);
+			if (len < 0)
+			{
+				conn_down(c, len);
+				return;
+			}
+			if (!len)
+			{
+				return;
+			}
+		}
+		else
+		{
+			r = TAILQ_FIRST(&c->out);
+			if (zc && !r->zcbuf)
+			{	/* copy the payload if we can't keep track of it */
+				r->zcbuf = malloc(sizeof(*r->zcbuf));
+				zc = r->zcbuf != NULL;
+			}
+			len = conn_send(c, iov, count, zc);
+			if (len < 0)
+			{
+				return;
+			}
+		}
+		if (zc && c->zerocopy)
+		{	/* the kernel counts successful sends, each gets the next id */
+			r = TAILQ_FIRST(&c->out);
+			r->zc_id = c->zc_next++;
+			r->zc = true;
+		}
+		len += c->off;
+		while ((r = TAILQ_FIRST(&c->out)) && len >= FRAME_HDR + r->len)
+		{
+			DBG("FD_CLIENT write : '%.*s'\n", (int)r->len, r->buf);
+			len -= FRAME_HDR + r->len;
+			if (r->zc)
+			{
+				conn_zerocopy_keep(c, r);
+			}
+			TAILQ_REMOVE(&c->out, r, entries);
+			TAILQ_INSERT_TAIL(&c->sent, r, entries);
+		}
+		c->off = len;
+	}
+	update_ops(c, (c->ops | READ) & ~WRITE);
+}
+
+/**
+ * Create a connection to resolved addresses, not connected yet
+ */
+static struct conn *conn_create(struct conn_addr *addrs, int count,
+								fdcb fdcb, void *user)
+{
+	struct conn *c;
+	int i;
+
+	c = calloc(1, sizeof(*c));
+	c->s = -1;
+	c->ep = -1;
+	c->shm.efd = c->shm.peer = -1;
+	for (i = 0; i < SHM_FDS; i++)
+	{
+		c->shm_fds[i] = -1;
+	}
+	c->addrs = addrs;
+	c->addr_count = count;
+	c->fdcb = fdcb;
+	c->user = user;
+	TAILQ_INIT(&c->out);
+	TAILQ_INIT(&c->sent);
+	TAILQ_INIT(&c->zc);
+	LIST_INIT(&c->events);
+	return c;
+}
+
+static struct conn_addr *resolve_unix(const char *path, int *count)
+{
+	struct conn_addr *a;
+	struct sockaddr_un *addr;
+
+	a = calloc(1, sizeof(*a));
+	a->family = AF_UNIX;
+	a->socktype = SOCK_STREAM;
+	addr = (struct sockaddr_un*)&a->addr;
+	addr->sun_family = AF_UNIX;
+	snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+	a->len = offsetof(struct sockaddr_un, sun_path) + strlen(addr->sun_path);
+	*count = 1;
+	return a;
+}
+
+static struct conn_addr *resolve_tcp(const char *host, const char *port,
+									 int *count, int *err)
+{
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	}, *res, *ai;
+	struct conn_addr *addrs;
+	int ret, i = 0;
+
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret != 0)
+	{
+		*err = ret == EAI_SYSTEM ? -errno : -EHOSTUNREACH;
+		return NULL;
+	}
+	for (ai = res; ai; ai = ai->ai_next)
+	{
+		i++;
+	}
+	addrs = calloc(i, sizeof(*addrs));
+	for (i = 0, ai = res; ai; ai = ai->ai_next, i++)
+	{
+		addrs[i].family = ai->ai_family;
+		addrs[i].socktype = ai->ai_socktype;
+		addrs[i].protocol = ai->ai_protocol;
+		addrs[i].len = ai->ai_addrlen;
+		memcpy(&addrs[i].addr, ai->ai_addr, ai->ai_addrlen);
+	}
+	freeaddrinfo(res);
+	*count = i;
+	return addrs;
+}
+
+/**
+ * Create a connection and start connecting it, destroyed if that failed
+ */
+static int conn_open(struct conn_addr *addrs, int count, fdcb fdcb,
+					 timercb timercb, void *user, unsigned int retry_min,
+					 unsigned int retry_max, struct conn **cp)
+{
+	struct conn *c;
+	int ret;
+
+	c = conn_create(addrs, count, fdcb, user);
+	conn_set_timercb(c, timercb);
+	if (retry_min)
+	{
+		conn_set_reconnect(c, retry_min, retry_max);
+	}
+	ret = conn_start(c);
+	if (ret < 0)
+	{
+		conn_destroy(c);
+		return ret;
+	}
+	*cp = c;
+	return 0;
+}
+
+int connect_unix(const char *path, fdcb fdcb, void *user, struct conn **cp)
+{
+	struct conn_addr *addrs;
+	int count;
+
+	addrs = resolve_unix(path, &count);
+	return conn_open(addrs, count, fdcb, NULL, user, 0, 0, cp);
+}
+
+int connect_tcp(const char *host, const char *port, fdcb fdcb, void *user,
+				struct conn **cp)
+{
+	struct conn_addr *addrs;
+	int count, err;
+
+	addrs = resolve_tcp(host, port, &count, &err);
+	if (!addrs)
+	{
+		return err;
+	}
+	return conn_open(addrs, count, fdcb, NULL, user, 0, 0, cp);
+}
+
+static void conn_destroy(struct conn *c)
+{
+	struct event_reg *reg;
+	struct request *r;
+
+	update_ops(c, 0);
+	conn_shm_close(c);
+	if (c->timercb)
+	{
+		c->timercb(c, -1, c->user);
+	}
+	TAILQ_CONCAT(&c->sent, &c->out, entries);
+	while ((r = TAILQ_FIRST(&c->sent)))
+	{
+		TAILQ_REMOVE(&c->sent, r, entries);
+		request_destroy(r);
+	}
+	while ((reg = LIST_FIRST(&c->events)))
+	{
+		LIST_REMOVE(reg, entries);
+		free(reg->name);
+		free(reg);
+	}
+	ringbuf_free(&c->rb);
+	if (c->s >= 0)
+	{
+		conn_close(c);
+	}
+	free(c->addrs);
+	free(c);
+}
+
+void disconnect(struct conn *c)
+{
+	update_ops(c, 0);
+	if (c->busy)
+	{	/* called from a callback, destroyed once done */
+		c->closed = true;
+		return;
+	}
+	conn_destroy(c);
+}
+
+static int create_request(enum packet_type type, char *buf, size_t len,
+						  struct request **rp)
+{
+	struct request *req;
+
+	req = calloc(1, sizeof(*req));
+	frame_header(req->hdr, type, len);
+	req->buf = buf;
+	req->len = len;
+	*rp = req;
+	return 0;
+}
+
+const void *response_get_data(struct response *res, size_t *len)
+{
+	*len = res->len;
+	if (res->count < 2)
+	{
+		return res->count ? res->seg[0].iov_base : "";
+	}
+	if (!res->linear)
+	{	/* wrapped around the end of the ring */
+		res->linear = malloc(res->len);
+		memcpy(res->linear, res->seg[0].iov_base, res->seg[0].iov_len);
+		memcpy(res->linear + res->seg[0].iov_len, res->seg[1].iov_base,
+			   res->seg[1].iov_len);
+	}
+	return res->linear;
+}
+
+int response_get_segments(struct response *res, struct iovec *iov)
+{
+	memcpy(iov, res->seg, res->count * sizeof(*iov));
+	return res->count;
+}
+
+int new_cmd(const char *cmd, struct request **rp)
+{
+	return create_request(CMD_REQUEST, strdup(cmd), strlen(cmd), rp);
+}
+
+int new_cmd_buf(void *buf, size_t len, struct request **rp)
+{
+	return create_request(CMD_REQUEST, buf, len, rp);
+}
+
+static void event_registered(struct conn *c, int err, const char *name,
+							 struct response *res, void *user)
+{
+	struct event_reg *reg = user;
+
+	if (err && reg->active)
+	{	/* unknown event or connection failed */
+		LIST_REMOVE(reg, entries);
+		reg->cb(c, err, reg->name, NULL, reg->user);
+		free(reg->name);
+		free(reg);
+		return;
+	}
+	reg->confirmed = !err;
+}
+
+static void event_unregistered(struct conn *c, int err, const char *name,
+							   struct response *res, void *user)
+{
+	struct event_reg *reg = user;
+
+	LIST_REMOVE(reg, entries);
+	free(reg->name);
+	free(reg);
+}
+
+int register_event(struct conn *c, const char *name, event_cb cb, void *user)
+{
+	struct event_reg *reg;
+	struct request *r;
+
+	if (strlen(name) > UINT8_MAX)
+	{
+		return -ENAMETOOLONG;
+	}
+	reg = calloc(1, sizeof(*reg));
+	reg->name = strdup(name);
+	reg->cb = cb;
+	reg->user = user;
+	reg->active = true;
+	LIST_INSERT_HEAD(&c->events, reg, entries);
+
+	create_request(EVENT_REGISTER, strdup(name), strlen(name), &r);
+	return queue(c, r, event_registered, reg);
+}
+
+int unregister_event(struct conn *c, const char *name)
+{
+	struct event_reg *reg;
+	struct request *r;
+
+	LIST_FOREACH(reg, &c->events, entries)
+	{
+		if (reg->active && strcmp(reg->name, name) == 0)
+		{
+			break;
+		}
+	}
+	if (!reg)
+	{
+		return -ENOENT;
+	}
+	reg->active = false;
+	create_request(EVENT_UNREGISTER, strdup(name), strlen(name), &r);
+	return queue(c, r, event_unregistered, reg);
+}
+
+int queue(struct conn *c, struct request *r, callback cmd_cb, void *user)
+{
+	int err;
+
+	r->cb = cmd_cb;
+	r->user = user;
+	if (c->state == CONN_FAILED)
+	{
+		err = c->err;
+		request_destroy(r);
+		cmd_cb(c, err, "do client callback function", NULL, user);
+		return err;
+	}
+	if (c->timeout)
+	{
+		r->deadline = now_ms() + c->timeout;
+	}
+	TAILQ_INSERT_TAIL(&c->out, r, entries);
+	c->queued++;
+	if (r->deadline && !c->armed)
+	{
+		conn_arm(c);
+	}
+	if (c->state != CONN_CONNECTED)
+	{	/* written once connected */
+		return 0;
+	}
+	if (c->queued == 1 || c->shm.map)
+	{	/* idle, write right away instead of waiting for writability. The
+		 * rings have no writability to wait for, copying there is cheap */
+		c->busy++;
+		conn_write(c);
+		if (--c->busy == 0 && c->closed)
+		{
+			conn_destroy(c);
+		}
+		return 0;
+	}
+	/* pipelined, written together with requests queued until writable */
+	return update_ops(c, c->ops | READ | WRITE);
+}
+
+struct pool *pool_create(fdcb fdcb, timercb timercb, void *user)
+{
+	struct pool *p;
+
+	p = calloc(1, sizeof(*p));
+	p->fdcb = fdcb;
+	p->timercb = timercb;
+	p->user = user;
+	return p;
+}
+
+void pool_set_reconnect(struct pool *p, unsigned int min, unsigned int max)
+{
+	p->retry_min = min;
+	p->retry_max = max;
+}
+
+static int pool_add(struct pool *p, struct conn_addr *addrs, int count,
+					struct conn **cp)
+{
+	struct conn *c;
+	int ret;
+
+	ret = conn_open(addrs, count, p->fdcb, p->timercb, p->user,
+					p->timercb ? p->retry_min : 0, p->retry_max, &c);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	p->conns = realloc(p->conns, (p->count + 1) * sizeof(*p->conns));
+	p->conns[p->count++] = c;
+	if (cp)
+	{
+		*cp = c;
+	}
+	return 0;
+}
+
+int pool_add_unix(struct pool *p, const char *path, struct conn **cp)
+{
+	struct conn_addr *addrs;
+	int count;
+
+	addrs = resolve_unix(path, &count);
+	return pool_add(p, addrs, count, cp);
+}
+
+int pool_add_tcp(struct pool *p, const char *host, const char *port,
+				 struct conn **cp)
+{
+	struct conn_addr *addrs;
+	int count, err;
+
+	addrs = resolve_tcp(host, port, &count, &err);
+	if (!addrs)
+	{
+		return err;
+	}
+	return pool_add(p, addrs, count, cp);
+}
+
+int pool_queue(struct pool *p, struct request *r, callback cmd_cb,
+			   void *user)
+{
+	struct conn *c, *best = NULL;
+	int i;
+
+	for (i = 0; i < p->count; i++)
+	{
+		c = p->conns[i];
+		if (c->state == CONN_FAILED)
+		{
+			continue;
+		}
+		/* connected ones first, then the least loaded */
+		if (!best ||
+			(c->state == CONN_CONNECTED && best->state != CONN_CONNECTED) ||
+			((c->state == CONN_CONNECTED) == (best->state == CONN_CONNECTED) &&
+			 c->queued < best->queued))
+		{
+			best = c;
+		}
+	}
+	if (!best)
+	{
+		request_destroy(r);
+		cmd_cb(NULL, -ENOTCONN, "do client callback function", NULL, user);
+		return -ENOTCONN;
+	}
+	return queue(best, r, cmd_cb, user);
+}
+
+void pool_destroy(struct pool *p)
+{
+	int i;
+
+	for (i = 0; i < p->count; i++)
+	{
+		disconnect(p->conns[i]);
+	}
+	free(p->conns);
+	free(p);
+}
@@ -0,0 +1,105 @@
+#ifndef __MY_CLIENT_H__
+#define __MY_CLIENT_H__
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+enum packet_type {
+	CMD_REQUEST = 0,
+	CMD_RESPONSE = 1,
+	CMD_UNKNOWN = 2,
+	EVENT_REGISTER = 3,
+	EVENT_UNREGISTER = 4,
+	EVENT_CONFIRM = 5,
+	EVENT_UNKNOWN = 6,
+	EVENT = 7,
+	SHM_OFFER = 8,
+	SHM_ACCEPT = 9,
+};
+
+struct conn;
+struct response;
+struct request;
+struct pool;
+
+enum fdops {
+	/** request read-ready notifications */
+	READ = (1<<0),
+	/** request write-ready notifications */
+	WRITE = (1<<1),
+	/** error pending, only reported to conn_ready(), never requested */
+	ERROR = (1<<2),
+};
+
+typedef void (*callback)(struct conn *conn, int err, const char *name, struct response *res, void *user);
+/* watch fd for ops and call conn_ready() once ready, stop watching it if
+ * ops is 0. Called again with a new fd after reconnecting */
+typedef int (*fdcb)(struct conn *conn, int fd, int ops, void *user);
+/* call conn_timer() in ms, stop the timer if ms is negative. Replaces a timer
+ * started before, which may still fire without harm */
+typedef void (*timercb)(struct conn *conn, int ms, void *user);
+/* invoked for each event with err 0, once with err set if the registration
+ * failed or the connection got closed */
+typedef void (*event_cb)(struct conn *conn, int err, const char *name,
+						 struct response *res, void *user);
+
+/* connect without blocking, requests get queued until connected. Fails if
+ * no address is reachable at all, e.g. if nothing listens on path, or with
+ * -EAGAIN if the listen backlog of the server is full, retry later then */
+int connect_unix(const char *path, fdcb fdcb, void *user, struct conn **cp);
+/* resolves host synchronously, tries each address in turn */
+int connect_tcp(const char *host, const char *port, fdcb fdcb, void *user,
+				struct conn **cp);
+/* process I/O once the fd passed to fdcb is ready, ops as enum fdops */
+void conn_ready(struct conn *c, int ops);
+/* required by timeouts and reconnecting, the user of fdcb gets passed */
+void conn_set_timercb(struct conn *c, timercb timercb);
+/* process timeouts once the timer started by timercb expired */
+void conn_timer(struct conn *c);
+/* complete requests not answered within ms with -ETIMEDOUT, 0 to disable */
+void conn_set_timeout(struct conn *c, unsigned int ms);
+/* reconnect after min ms once the connection got lost, doubling the delay up
+ * to max ms while failing. Requests written already fail with the error,
+ * others are sent once reconnected and events registered again. Returns
+ * -ENOTSUP without timercb */
+int conn_set_reconnect(struct conn *c, unsigned int min, unsigned int max);
+/* offer the server to continue over shared memory rings of size bytes per
+ * direction once connected, 0 to use the socket only. Unix sockets only, the
+ * socket is used if the server refuses. Set right after connecting, else it
+ * is offered after reconnecting. fdcb gets called with another fd then */
+int conn_set_shm(struct conn *c, size_t size);
+/* ring size if shared memory is used, 0 if the socket */
+size_t conn_get_shm(struct conn *c);
+/* storage of the fdcb/timercb implementation, e.g. for its watch */
+void conn_set_iodata(struct conn *c, void *data);
+void *conn_get_iodata(struct conn *c);
+void disconnect(struct conn *c);
+
+const void *response_get_data(struct response *res, size_t *len);
+int response_get_segments(struct response *res, struct iovec *iov);
+
+int new_cmd(const char *cmd, struct request **rp);
+/* takes ownership of the malloc()ed buf, sent without copying it */
+int new_cmd_buf(void *buf, size_t len, struct request **rp);
+/* many requests may be queued, they are written back to back. If the
+ * connection failed for good, cmd_cb is invoked right away with the error */
+int queue(struct conn *c, struct request *r, callback cmd_cb, void *user);
+int register_event(struct conn *c, const char *name, event_cb cb, void *user);
+int unregister_event(struct conn *c, const char *name);
+
+/* connections created by pool_add_*() share fdcb, timercb and user */
+struct pool *pool_create(fdcb fdcb, timercb timercb, void *user);
+/* reconnect settings of connections added afterwards, see
+ * conn_set_reconnect(). Unreachable addresses get added anyway if set */
+void pool_set_reconnect(struct pool *p, unsigned int min, unsigned int max);
+int pool_add_unix(struct pool *p, const char *path, struct conn **cp);
+int pool_add_tcp(struct pool *p, const char *host, const char *port,
+				 struct conn **cp);
+/* queue to the connected connection with the fewest requests pending */
+int pool_queue(struct pool *p, struct request *r, callback cmd_cb,
+			   void *user);
+void pool_destroy(struct pool *p);
+
+void client_set_debug(int level);
+
+#endif
@@ -0,0 +1,117 @@
+#include "frame.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+void frame_header(uint8_t *hdr, uint8_t type, size_t len)
+{
+	uint32_t total = len + 1;
+
+	hdr[0] = total >> 24;
+	hdr[1] = total >> 16;
+	hdr[2] = total >> 8;
+	hdr[3] = total;
+	hdr[4] = type;
+}
+
+size_t frame_length(const uint8_t *hdr)
+{
+	uint32_t total;
+
+	total = ((uint32_t)hdr[0] << 24) | ((uint32_t)hdr[1] << 16) |
+			((uint32_t)hdr[2] << 8) | hdr[3];
+	return total ? total - 1 : SIZE_MAX;
+}
+
+void frame_decoder_reset(struct frame_decoder *d)
+{
+	free(d->buf);
+	d->buf = NULL;
+	d->hdr_len = d->len = d->have = 0;
+}
+
+int frame_decode(struct frame_decoder *d, const void *data, size_t len,
+				 frame_cb cb, void *user)
+{
+	const uint8_t *pos = data, *end = pos + len;
+	size_t need;
+	char *buf;
+	int ret;
+
+	while (pos < end)
+	{
+		if (d->hdr_len < FRAME_HDR)
+		{
+			if (d->hdr_len == 0 && end - pos >= FRAME_HDR)
+			{	/* header is contiguous, frame might be as well */
+				memcpy(d->hdr, pos, FRAME_HDR);
+				pos += FRAME_HDR;
+			}
+			else
+			{
+				need = FRAME_HDR - d->hdr_len;
+				if (need > end - pos)
+				{
+					need = end - pos;
+				}
+				memcpy(d->hdr + d->hdr_len, pos, need);
+				d->hdr_len += need;
+				pos += need;
+				if (d->hdr_len < FRAME_HDR)
+				{
+					return 0;
+				}
+			}
+			d->hdr_len = FRAME_HDR;
+			d->len = frame_length(d->hdr);
+			if (d->len == SIZE_MAX || (d->max && d->len > d->max))
+			{
+				frame_decoder_reset(d);
+				return -EMSGSIZE;
+			}
+			d->have = 0;
+			if (end - pos >= d->len)
+			{	/* complete payload in the received data */
+				need = d->len;
+				d->hdr_len = 0;
+				ret = cb(user, d->hdr[4], pos, need);
+				pos += need;
+				if (ret)
+				{
+					return ret;
+				}
+				continue;
+			}
+			d->buf = malloc(d->len);
+			if (!d->buf)
+			{
+				frame_decoder_reset(d);
+				return -ENOMEM;
+			}
+		}
+
+		need = d->len - d->have;
+		if (need > end - pos)
+		{
+			need = end - pos;
+		}
+		memcpy(d->buf + d->have, pos, need);
+		d->have += need;
+		pos += need;
+		if (d->have < d->len)
+		{
+			return 0;
+		}
+		/* the callback might destroy the decoder */
+		buf = d->buf;
+		d->buf = NULL;
+		d->hdr_len = 0;
+		ret = cb(user, d->hdr[4], buf, d->len);
+		free(buf);
+		if (ret)
+		{
+			return ret;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef __MY_FRAME_H__
+#define __MY_FRAME_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Frames carry a 32-bit big-endian length of the rest of the frame, a
+ * one byte enum packet_type and the payload.
+ */
+#define FRAME_HDR 5
+
+/**
+ * Callback invoked for each decoded frame.
+ *
+ * The payload is only valid during the callback. It points into the data
+ * passed to frame_decode() if the frame was received contiguously.
+ *
+ * @param user		user context passed to frame_decode()
+ * @param type		enum packet_type of the frame
+ * @param data		payload
+ * @param len		length of payload
+ * @return			0 to continue decoding, anything else to stop
+ */
+typedef int (*frame_cb)(void *user, uint8_t type, const void *data,
+						size_t len);
+
+/**
+ * Incremental decoder state, keeps a partially received frame
+ */
+struct frame_decoder {
+	/** maximum payload length accepted, 0 for no limit */
+	size_t max;
+	/* header bytes received so far */
+	uint8_t hdr[FRAME_HDR];
+	size_t hdr_len;
+	/* payload received so far of a frame split across frame_decode() */
+	char *buf;
+	size_t len;
+	size_t have;
+};
+
+/**
+ * Write the header of a frame.
+ *
+ * @param hdr		buffer receiving FRAME_HDR bytes
+ * @param type		enum packet_type
+ * @param len		length of the payload following the header
+ */
+void frame_header(uint8_t *hdr, uint8_t type, size_t len);
+
+/**
+ * Parse the header of a frame.
+ *
+ * @param hdr		FRAME_HDR bytes of header
+ * @return			length of the payload, SIZE_MAX if invalid
+ */
+size_t frame_length(const uint8_t *hdr);
+
+/**
+ * Feed received data to a decoder.
+ *
+ * @param d			decoder, zero-initialized before first use
+ * @param data		received data, may contain several and partial frames
+ * @param len		length of data
+ * @param cb		callback invoked for each complete frame
+ * @param user		user context passed to cb
+ * @return			0 if all data was consumed, -EMSGSIZE if a frame is too
+ *					long, -ENOMEM if it can't be buffered, or the non-zero
+ *					return value of cb
+ */
+int frame_decode(struct frame_decoder *d, const void *data, size_t len,
+				 frame_cb cb, void *user);
+
+/**
+ * Release a partially received frame.
+ */
+void frame_decoder_reset(struct frame_decoder *d);
+
+#endif
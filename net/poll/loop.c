@@ -0,0 +1,529 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+#include "loop_backend.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+struct loop *loop_create(enum loop_type type)
+{
+	const struct loop_backend *backend;
+	struct loop *loop;
+	const char *name;
+
+	if (type == LOOP_DEFAULT)
+	{
+		type = LOOP_EPOLL;
+		name = getenv("LOOP_BACKEND");
+		if (name && strcmp(name, "poll") == 0)
+		{
+			type = LOOP_POLL;
+		}
+		else if (name && strcmp(name, "io_uring") == 0)
+		{
+			type = LOOP_URING;
+		}
+	}
+	switch (type)
+	{
+		case LOOP_POLL:
+			backend = &loop_poll_backend;
+			break;
+		case LOOP_EPOLL:
+			backend = &loop_epoll_backend;
+			break;
+#ifdef HAVE_LINUX_IO_URING_H
+		case LOOP_URING:
+			backend = &loop_uring_backend;
+			break;
+#endif
+		default:
+			errno = ENOSYS;
+			return NULL;
+	}
+
+	loop = calloc(1, sizeof(*loop));
+	loop->backend = backend;
+	loop_timers_init(loop);
+	if (backend->init(loop) != 0)
+	{
+		free(loop);
+		return NULL;
+	}
+	return loop;
+}
+
+const char *loop_get_name(struct loop *loop)
+{
+	return loop->backend->name;
+}
+
+static struct watch *watch_create(int fd, enum watch_kind kind, void *user)
+{
+	struct watch *w;
+
+	w = calloc(1, sizeof(*w));
+	w->fd = fd;
+	w->kind = kind;
+	w->user = user;
+	w->refs = 1;
+	return w;
+}
+
+void watch_ref(struct watch *w)
+{
+	w->refs++;
+}
+
+struct loop_buf *loop_buf_ref(struct loop_buf *buf)
+{
+	/* shared buffers may be queued to loops of different threads */
+	__atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+	return buf;
+}
+
+void loop_buf_unref(struct loop_buf *buf)
+{
+	if (__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		free(buf);
+	}
+}
+
+const void *loop_buf_data(struct loop_buf *buf, size_t *len)
+{
+	*len = buf->len;
+	return buf->data;
+}
+
+struct loop_buf *loop_buf_append(struct loop_buf *buf, const struct iovec *iov,
+								 int count)
+{
+	size_t len = 0, size;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		len += iov[i].iov_len;
+	}
+	if (!buf)
+	{
+		buf = calloc(1, sizeof(*buf) + len);
+		buf->refs = 1;
+		buf->size = len;
+	}
+	else if (buf->len + len > buf->size)
+	{
+		size = max(buf->size * 2, buf->len + len);
+		buf = realloc(buf, sizeof(*buf) + size);
+		buf->size = size;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (iov[i].iov_len)
+		{
+			memcpy(buf->data + buf->len, iov[i].iov_base, iov[i].iov_len);
+			buf->len += iov[i].iov_len;
+		}
+	}
+	return buf;
+}
+
+struct loop_buf *loop_buf_create(const struct iovec *iov, int count)
+{
+	struct loop_buf *buf;
+
+	buf = loop_buf_append(NULL, iov, count);
+	buf->shared = true;
+	return buf;
+}
+
+/**
+ * Release the first queued segment of a watch
+ */
+static void out_pop(struct watch *w)
+{
+	struct loop_seg *seg = w->out;
+
+	w->out = seg->next;
+	if (!w->out)
+	{
+		w->out_last = NULL;
+	}
+	loop_buf_unref(seg->buf);
+	free(seg);
+}
+
+/**
+ * Queue a buffer to a watch, taking over the reference
+ */
+static void out_push(struct watch *w, struct loop_buf *buf)
+{
+	struct loop_seg *seg;
+
+	seg = calloc(1, sizeof(*seg));
+	seg->buf = buf;
+	if (w->out_last)
+	{
+		w->out_last->next = seg;
+	}
+	else
+	{
+		w->out = seg;
+	}
+	w->out_last = seg;
+}
+
+void watch_unref(struct watch *w)
+{
+	if (--w->refs == 0)
+	{
+		while (w->out)
+		{
+			out_pop(w);
+		}
+		free(w->priv);
+		free(w);
+	}
+}
+
+static int watch_register(struct loop *loop, struct watch *w,
+						  int (*start)(struct loop*, struct watch*),
+						  struct watch **wp)
+{
+	int ret;
+
+	ret = start(loop, w);
+	if (ret != 0)
+	{
+		watch_unref(w);
+		return ret;
+	}
+	*wp = w;
+	return 0;
+}
+
+int loop_add(struct loop *loop, int fd, int ops, int flags, loop_cb cb,
+			 void *user, struct watch **wp)
+{
+	struct watch *w;
+
+	w = watch_create(fd, WATCH_READY, user);
+	w->ops = ops;
+	w->flags = flags;
+	w->cb = cb;
+	return watch_register(loop, w, loop->backend->add, wp);
+}
+
+int loop_mod(struct loop *loop, struct watch *w, int ops)
+{
+	if (w->ops == ops)
+	{
+		return 0;
+	}
+	w->ops = ops;
+	return loop->backend->mod(loop, w);
+}
+
+int loop_accept(struct loop *loop, int fd, loop_accept_cb cb, void *user,
+				struct watch **wp)
+{
+	struct watch *w;
+
+	w = watch_create(fd, WATCH_ACCEPT, user);
+	w->accept_cb = cb;
+	if (loop->backend->accept)
+	{
+		return watch_register(loop, w, loop->backend->accept, wp);
+	}
+	/* accept until EAGAIN, see accept_ready() */
+	w->ops = LOOP_READ;
+	w->flags = LOOP_EDGE;
+	return watch_register(loop, w, loop->backend->add, wp);
+}
+
+int loop_recv(struct loop *loop, int fd, loop_recv_cb cb, void *user,
+			  struct watch **wp)
+{
+	struct watch *w;
+
+	w = watch_create(fd, WATCH_RECV, user);
+	w->recv_cb = cb;
+	if (loop->backend->recv)
+	{
+		return watch_register(loop, w, loop->backend->recv, wp);
+	}
+	/* receive until EAGAIN, see recv_ready() */
+	w->ops = LOOP_READ;
+	w->flags = LOOP_EDGE;
+	return watch_register(loop, w, loop->backend->add, wp);
+}
+
+/**
+ * Write as much pending output as possible, gathered from the queued buffers,
+ * watch for writability if some is left
+ */
+static int flush_out(struct loop *loop, struct watch *w)
+{
+	struct iovec iov[LOOP_IOV];
+	struct msghdr msg = {
+		.msg_iov = iov,
+	};
+	struct loop_seg *seg;
+	size_t rest;
+	ssize_t len;
+	int count;
+
+	while (w->out)
+	{
+		count = 0;
+		for (seg = w->out; seg && count < LOOP_IOV; seg = seg->next)
+		{
+			iov[count].iov_base = seg->buf->data + seg->off;
+			iov[count].iov_len = seg->buf->len - seg->off;
+			count++;
+		}
+		msg.msg_iovlen = count;
+		len = sendmsg(w->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break;
+			}
+			return -errno;
+		}
+		w->queued -= len;
+		while (len)
+		{
+			seg = w->out;
+			rest = seg->buf->len - seg->off;
+			if (len < rest)
+			{
+				seg->off += len;
+				break;
+			}
+			len -= rest;
+			out_pop(w);
+		}
+	}
+	return loop_mod(loop, w, w->out ? LOOP_READ | LOOP_WRITE : LOOP_READ);
+}
+
+int loop_send(struct loop *loop, struct watch *w, const void *buf, size_t len)
+{
+	struct iovec iov = {
+		.iov_base = (void*)buf,
+		.iov_len = len,
+	};
+
+	return loop_sendv(loop, w, &iov, 1);
+}
+
+int loop_sendv(struct loop *loop, struct watch *w, const struct iovec *iov,
+			   int count)
+{
+	struct loop_seg *last = w->out_last;
+	size_t len = 0;
+	int i;
+
+	if (w->dead)
+	{
+		return -EPIPE;
+	}
+	if (loop->backend->send)
+	{
+		return loop->backend->send(loop, w, iov, count);
+	}
+	for (i = 0; i < count; i++)
+	{
+		len += iov[i].iov_len;
+	}
+	if (!len)
+	{
+		return 0;
+	}
+	w->queued += len;
+	if (last && !last->buf->shared && last->buf->len + len <= LOOP_MERGE)
+	{	/* append to the last private buffer */
+		last->buf = loop_buf_append(last->buf, iov, count);
+	}
+	else
+	{
+		out_push(w, loop_buf_append(NULL, iov, count));
+	}
+	if (w->ops & LOOP_WRITE)
+	{	/* flushed once writable */
+		return 0;
+	}
+	return flush_out(loop, w);
+}
+
+int loop_send_buf(struct loop *loop, struct watch *w, struct loop_buf *buf)
+{
+	if (w->dead)
+	{
+		return -EPIPE;
+	}
+	if (loop->backend->send_buf)
+	{
+		return loop->backend->send_buf(loop, w, buf);
+	}
+	if (!buf->len)
+	{
+		return 0;
+	}
+	w->queued += buf->len;
+	out_push(w, loop_buf_ref(buf));
+	if (w->ops & LOOP_WRITE)
+	{
+		return 0;
+	}
+	return flush_out(loop, w);
+}
+
+size_t loop_queued(struct loop *loop, struct watch *w)
+{
+	return w->queued;
+}
+
+/**
+ * Accept all pending connections of an emulated loop_accept()
+ */
+static void accept_ready(struct loop *loop, struct watch *w)
+{
+	int fd;
+
+	while (!w->dead)
+	{
+		fd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				w->accept_cb(loop, w, -errno, w->user);
+			}
+			return;
+		}
+		w->accept_cb(loop, w, fd, w->user);
+	}
+}
+
+/**
+ * Receive all pending data of an emulated loop_recv()
+ */
+static void recv_ready(struct loop *loop, struct watch *w)
+{
+	ssize_t len;
+
+	while (!w->dead)
+	{
+		len = recv(w->fd, loop->buf, sizeof(loop->buf), 0);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				w->recv_cb(loop, w, NULL, -errno, w->user);
+			}
+			return;
+		}
+		w->recv_cb(loop, w, loop->buf, len, w->user);
+		if (len == 0)
+		{
+			return;
+		}
+	}
+}
+
+void loop_ready(struct loop *loop, struct watch *w, int revents)
+{
+	int ret;
+
+	if (w->dead)
+	{
+		return;
+	}
+	switch (w->kind)
+	{
+		case WATCH_READY:
+			w->cb(loop, w, w->fd, revents, w->user);
+			break;
+		case WATCH_ACCEPT:
+			accept_ready(loop, w);
+			break;
+		case WATCH_RECV:
+			if (revents & LOOP_WRITE)
+			{
+				ret = flush_out(loop, w);
+				if (ret != 0)
+				{
+					w->recv_cb(loop, w, NULL, ret, w->user);
+				}
+			}
+			if (revents & (LOOP_READ | LOOP_ERROR))
+			{
+				recv_ready(loop, w);
+			}
+			break;
+	}
+}
+
+void loop_del(struct loop *loop, struct watch *w)
+{
+	if (w->dead)
+	{
+		return;
+	}
+	loop->backend->del(loop, w);
+	w->dead = true;
+	w->next_dead = loop->dead;
+	loop->dead = w;
+}
+
+static void release_dead(struct loop *loop)
+{
+	struct watch *w;
+
+	while (loop->dead)
+	{
+		w = loop->dead;
+		loop->dead = w->next_dead;
+		watch_unref(w);
+	}
+}
+
+int loop_run_once(struct loop *loop, int timeout)
+{
+	int n, expired;
+
+	n = loop->backend->wait(loop, loop_timers_timeout(loop, timeout));
+	expired = loop_timers_expire(loop);
+	release_dead(loop);
+	return n < 0 ? n : n + expired;
+}
+
+void loop_destroy(struct loop *loop)
+{
+	release_dead(loop);
+	loop->backend->destroy(loop);
+	free(loop);
+}
@@ -0,0 +1,308 @@
+#ifndef __MY_LOOP_H__
+#define __MY_LOOP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct loop;
+struct watch;
+struct loop_buf;
+struct loop_timer;
+
+/**
+ * Resolution of timers in ms, see loop_timer_create()
+ */
+#define LOOP_TICK 4
+
+/**
+ * Backend used to wait for and perform I/O
+ */
+enum loop_type {
+	/** $LOOP_BACKEND if set ("poll", "epoll" or "io_uring"), epoll otherwise */
+	LOOP_DEFAULT = 0,
+	/** poll(2) over a dynamic array */
+	LOOP_POLL,
+	/** epoll(7) */
+	LOOP_EPOLL,
+	/** io_uring(7), completion-based accept, recv and send */
+	LOOP_URING,
+};
+
+/**
+ * Readiness reported to loop callbacks, READ and WRITE match enum fdops
+ */
+enum loop_events {
+	/** fd is readable, or the peer closed the connection */
+	LOOP_READ = (1<<0),
+	/** fd is writable */
+	LOOP_WRITE = (1<<1),
+	/** peer hung up, remaining data can still be read */
+	LOOP_HUP = (1<<2),
+	/** error pending on the fd */
+	LOOP_ERROR = (1<<3),
+};
+
+enum loop_flags {
+	/**
+	 * Edge-triggered, readiness is only reported when it changes. The
+	 * callback must read/write until EAGAIN.
+	 */
+	LOOP_EDGE = (1<<0),
+};
+
+/**
+ * Callback invoked for a ready fd.
+ *
+ * @param loop		loop the fd is registered with
+ * @param w			watch of the fd
+ * @param fd		ready fd
+ * @param revents	enum loop_events
+ * @param user		user context passed to loop_add()
+ */
+typedef void (*loop_cb)(struct loop *loop, struct watch *w, int fd,
+						int revents, void *user);
+
+/**
+ * Callback invoked for each connection accepted by loop_accept().
+ *
+ * @param w			watch of the listening socket
+ * @param fd		accepted non-blocking socket, negative errno on error
+ * @param user		user context passed to loop_accept()
+ */
+typedef void (*loop_accept_cb)(struct loop *loop, struct watch *w, int fd,
+							   void *user);
+
+/**
+ * Callback invoked for data received by loop_recv().
+ *
+ * The data is only valid during the callback.
+ *
+ * @param w			watch of the socket
+ * @param buf		received data
+ * @param len		length of data, 0 if the peer closed the connection,
+ *					negative errno if receiving or sending failed
+ * @param user		user context passed to loop_recv()
+ */
+typedef void (*loop_recv_cb)(struct loop *loop, struct watch *w,
+							 const void *buf, ssize_t len, void *user);
+
+/**
+ * Create an event loop.
+ *
+ * @param type		backend to use
+ * @return			loop, NULL on error
+ */
+struct loop *loop_create(enum loop_type type);
+
+/**
+ * Get the name of the backend a loop uses.
+ */
+const char *loop_get_name(struct loop *loop);
+
+/**
+ * Register an fd with the loop.
+ *
+ * @param fd		fd to watch
+ * @param ops		LOOP_READ and/or LOOP_WRITE, may be 0
+ * @param flags		enum loop_flags
+ * @param cb		callback invoked when the fd gets ready
+ * @param user		user context passed to cb
+ * @param wp		receives the watch of the fd
+ * @return			0 on success, negative errno on error
+ */
+int loop_add(struct loop *loop, int fd, int ops, int flags, loop_cb cb,
+			 void *user, struct watch **wp);
+
+/**
+ * Change the readiness an fd is watched for.
+ *
+ * @param w			watch returned by loop_add()
+ * @param ops		LOOP_READ and/or LOOP_WRITE, may be 0
+ * @return			0 on success, negative errno on error
+ */
+int loop_mod(struct loop *loop, struct watch *w, int ops);
+
+/**
+ * Accept connections on a listening socket until the watch is removed.
+ *
+ * @param fd		non-blocking listening socket
+ * @param cb		callback invoked for each accepted connection
+ * @param user		user context passed to cb
+ * @param wp		receives the watch of the fd
+ * @return			0 on success, negative errno on error
+ */
+int loop_accept(struct loop *loop, int fd, loop_accept_cb cb, void *user,
+				struct watch **wp);
+
+/**
+ * Receive data from a connected socket until the watch is removed.
+ *
+ * @param fd		non-blocking connected socket
+ * @param cb		callback invoked for received data
+ * @param user		user context passed to cb
+ * @param wp		receives the watch of the fd
+ * @return			0 on success, negative errno on error
+ */
+int loop_recv(struct loop *loop, int fd, loop_recv_cb cb, void *user,
+			  struct watch **wp);
+
+/**
+ * Send data over a socket registered with loop_recv().
+ *
+ * The data is copied, sends on the same watch are delivered in order.
+ * Asynchronous send errors are reported to the recv callback.
+ *
+ * @param w			watch returned by loop_recv()
+ * @param buf		data to send
+ * @param len		length of data
+ * @return			0 on success, negative errno on error
+ */
+int loop_send(struct loop *loop, struct watch *w, const void *buf, size_t len);
+
+/**
+ * Send data from multiple buffers over a socket registered with loop_recv().
+ *
+ * Same as loop_send(), but gathers the data from an iovec array.
+ *
+ * @param w			watch returned by loop_recv()
+ * @param iov		buffers to send
+ * @param count		number of buffers
+ * @return			0 on success, negative errno on error
+ */
+int loop_sendv(struct loop *loop, struct watch *w, const struct iovec *iov,
+			   int count);
+
+/**
+ * Create a reference counted buffer that can be queued to multiple watches
+ * without copying it, e.g. to broadcast a message. References may be held by
+ * loops of different threads.
+ *
+ * @param iov		data to copy into the buffer
+ * @param count		number of iov
+ * @return			buffer holding one reference
+ */
+struct loop_buf *loop_buf_create(const struct iovec *iov, int count);
+
+/**
+ * Get an additional reference of a buffer returned by loop_buf_create().
+ */
+struct loop_buf *loop_buf_ref(struct loop_buf *buf);
+
+/**
+ * Release a reference of a buffer returned by loop_buf_create().
+ */
+void loop_buf_unref(struct loop_buf *buf);
+
+/**
+ * Get the data of a buffer returned by loop_buf_create().
+ *
+ * @param len		receives the length of the data
+ * @return			data, not to be modified
+ */
+const void *loop_buf_data(struct loop_buf *buf, size_t *len);
+
+/**
+ * Send a shared buffer over a socket registered with loop_recv().
+ *
+ * Same as loop_send(), but instead of copying the data a reference of buf is
+ * kept until it got written. The buffer must not be modified afterwards.
+ *
+ * @param w			watch returned by loop_recv()
+ * @param buf		buffer to send, the reference of the caller is not taken
+ * @return			0 on success, negative errno on error
+ */
+int loop_send_buf(struct loop *loop, struct watch *w, struct loop_buf *buf);
+
+/**
+ * Get the amount of data sent over a watch but not written to the socket yet.
+ *
+ * @param w			watch returned by loop_recv()
+ * @return			number of queued bytes
+ */
+size_t loop_queued(struct loop *loop, struct watch *w);
+
+/**
+ * Unregister an fd, the fd itself is not closed.
+ *
+ * May be called from any callback, also for other watches ready in the same
+ * iteration. Pending sends are discarded.
+ *
+ * @param w			watch returned by loop_add(), loop_accept() or loop_recv()
+ */
+void loop_del(struct loop *loop, struct watch *w);
+
+/**
+ * Callback invoked for an expired timer.
+ *
+ * The timer is not pending anymore, it may be started again or destroyed.
+ *
+ * @param loop		loop the timer belongs to
+ * @param timer		expired timer
+ * @param user		user context passed to loop_timer_create()
+ */
+typedef void (*loop_timer_cb)(struct loop *loop, struct loop_timer *timer,
+							  void *user);
+
+/**
+ * Create a timer, expiring on a hashed wheel of LOOP_TICK ms slots.
+ *
+ * Timers are checked by loop_run_once(), which waits at most until the next
+ * slot holding a timer. They must be destroyed before the loop.
+ *
+ * @param cb		callback invoked once the timer expires
+ * @param user		user context passed to cb
+ * @return			stopped timer
+ */
+struct loop_timer *loop_timer_create(struct loop *loop, loop_timer_cb cb,
+									 void *user);
+
+/**
+ * Start or restart a timer, relative to loop_now().
+ *
+ * Pushing the expiry of a pending timer further out is cheap, so this may be
+ * called for every received message to implement idle timeouts.
+ *
+ * @param timer		timer to start
+ * @param ms		time until the timer expires, rounded up to LOOP_TICK
+ */
+void loop_timer_start(struct loop *loop, struct loop_timer *timer,
+					  unsigned int ms);
+
+/**
+ * Stop a timer, may be called from any callback.
+ */
+void loop_timer_stop(struct loop *loop, struct loop_timer *timer);
+
+/**
+ * Check if a timer is started and did not expire yet.
+ */
+int loop_timer_pending(struct loop_timer *timer);
+
+/**
+ * Stop and free a timer, may be called from its own callback.
+ */
+void loop_timer_destroy(struct loop *loop, struct loop_timer *timer);
+
+/**
+ * Monotonic time in ms timers are relative to.
+ */
+uint64_t loop_now(struct loop *loop);
+
+/**
+ * Wait for ready fds once and invoke their callbacks and those of expired
+ * timers.
+ *
+ * @param timeout	maximum time to wait in ms, -1 to wait forever
+ * @return			number of events and expired timers, negative errno on
+ *					error
+ */
+int loop_run_once(struct loop *loop, int timeout);
+
+/**
+ * Destroy a loop, registered fds are not closed.
+ */
+void loop_destroy(struct loop *loop);
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef __MY_LOOP_BACKEND_H__
+#define __MY_LOOP_BACKEND_H__
+
+#include "loop.h"
+#include <stdbool.h>
+
+/**
+ * Size of the buffer readiness-based backends receive into
+ */
+#define LOOP_RECV_SIZE 65536
+
+/**
+ * Sends queued back to back are copied into the same buffer up to this size
+ */
+#define LOOP_MERGE 65536
+
+/**
+ * Maximum number of queued buffers written with a single sendmsg()
+ */
+#define LOOP_IOV 64
+
+/**
+ * Number of slots of the timer wheel, a power of two. Timers further out
+ * than a full turn are moved once their slot comes up.
+ */
+#define LOOP_WHEEL 1024
+
+/**
+ * Reference counted send buffer, see loop_buf_create()
+ */
+struct loop_buf
+{
+	int refs;
+	/* created by loop_buf_create(), must not be appended to */
+	bool shared;
+	size_t len;
+	size_t size;
+	char data[];
+};
+
+/**
+ * Queued send buffer of a watch, readiness-based backends only
+ */
+struct loop_seg
+{
+	struct loop_buf *buf;
+	/* bytes of buf already written */
+	size_t off;
+	struct loop_seg *next;
+};
+
+/**
+ * Timer hashed to slot tick % LOOP_WHEEL of the wheel, see loop_timer_start()
+ */
+struct loop_timer
+{
+	/* tick the timer expires at, might be later than its slot for a turn */
+	uint64_t tick;
+	/* in a slot or the expired list if pending, NULL otherwise */
+	struct loop_timer *next, **pprev;
+	loop_timer_cb cb;
+	void *user;
+};
+
+enum watch_kind {
+	/** readiness reported to a loop_cb, see loop_add() */
+	WATCH_READY,
+	/** connections accepted for a loop_accept_cb, see loop_accept() */
+	WATCH_ACCEPT,
+	/** data received for a loop_recv_cb, see loop_recv() */
+	WATCH_RECV,
+};
+
+struct watch
+{
+	int fd;
+	/* readiness the backend currently watches for */
+	int ops;
+	int flags;
+	enum watch_kind kind;
+	union {
+		loop_cb cb;
+		loop_accept_cb accept_cb;
+		loop_recv_cb recv_cb;
+	};
+	void *user;
+	/* unregistered, but might still be referenced by the backend */
+	bool dead;
+	/* freed when this drops to 0, the registration holds one reference */
+	int refs;
+	struct watch *next_dead;
+	/* data loop_send() could not write yet, readiness-based backends only */
+	struct loop_seg *out, *out_last;
+	/* number of bytes passed to loop_send*() not written yet */
+	size_t queued;
+	/* backend specific, freed with the watch */
+	void *priv;
+	int index;
+};
+
+/**
+ * Operations implemented by a backend
+ */
+struct loop_backend
+{
+	const char *name;
+	/** set up loop->priv */
+	int (*init)(struct loop *loop);
+	/** start watching w->fd for w->ops, honouring w->flags */
+	int (*add)(struct loop *loop, struct watch *w);
+	/** change the readiness watched for to w->ops */
+	int (*mod)(struct loop *loop, struct watch *w);
+	/** stop watching a watch */
+	void (*del)(struct loop *loop, struct watch *w);
+	/** wait for events and dispatch them, return the number of events */
+	int (*wait)(struct loop *loop, int timeout);
+	/** release loop->priv */
+	void (*destroy)(struct loop *loop);
+	/**
+	 * Completion-based accept, recv and send. If not implemented, the
+	 * watch is registered with add() and emulated on top of readiness.
+	 */
+	int (*accept)(struct loop *loop, struct watch *w);
+	int (*recv)(struct loop *loop, struct watch *w);
+	int (*send)(struct loop *loop, struct watch *w, const struct iovec *iov,
+				int count);
+	/** queue a reference of buf, if send() is implemented */
+	int (*send_buf)(struct loop *loop, struct watch *w, struct loop_buf *buf);
+};
+
+struct loop
+{
+	const struct loop_backend *backend;
+	void *priv;
+	/* watches unregistered during dispatching, released afterwards */
+	struct watch *dead;
+	/* next tick to check the slot of for expired timers */
+	uint64_t tick;
+	/* number of pending timers */
+	int timers;
+	struct loop_timer *wheel[LOOP_WHEEL];
+	/* timers to invoke in this iteration */
+	struct loop_timer *expired;
+	/* receive buffer of emulated loop_recv() */
+	char buf[LOOP_RECV_SIZE];
+};
+
+/**
+ * Dispatch readiness of a watch, used by readiness-based backends.
+ */
+void loop_ready(struct loop *loop, struct watch *w, int revents);
+
+/**
+ * Copy data to the end of a private send buffer, growing it as required.
+ *
+ * @param buf		buffer to append to, NULL to allocate one
+ * @param iov		data to append
+ * @param count		number of iov
+ * @return			buf, or the reallocated buffer
+ */
+struct loop_buf *loop_buf_append(struct loop_buf *buf, const struct iovec *iov,
+								 int count);
+
+/**
+ * Initialize the timer wheel of a loop.
+ */
+void loop_timers_init(struct loop *loop);
+
+/**
+ * Limit the time to wait for events to the next slot holding a timer.
+ *
+ * @param timeout	maximum time to wait in ms, -1 to wait forever
+ * @return			timeout, or a shorter one
+ */
+int loop_timers_timeout(struct loop *loop, int timeout);
+
+/**
+ * Invoke the callbacks of all expired timers.
+ *
+ * @return			number of expired timers
+ */
+int loop_timers_expire(struct loop *loop);
+
+/**
+ * Keep a watch allocated while the backend references it.
+ */
+void watch_ref(struct watch *w);
+
+/**
+ * Release a reference, frees the watch when the last one is gone.
+ */
+void watch_unref(struct watch *w);
+
+extern const struct loop_backend loop_poll_backend;
+extern const struct loop_backend loop_epoll_backend;
+extern const struct loop_backend loop_uring_backend;
+
+#endif
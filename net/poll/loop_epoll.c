@@ -0,0 +1,136 @@
+#include "loop_backend.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+/**
+ * Number of ready fds fetched per epoll_wait()
+ */
+#define EPOLL_EVENTS 256
+
+struct epoll_loop
+{
+	int epfd;
+	struct epoll_event events[EPOLL_EVENTS];
+};
+
+static int epoll_init(struct loop *loop)
+{
+	struct epoll_loop *this;
+
+	this = calloc(1, sizeof(*this));
+	this->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (this->epfd == -1)
+	{
+		free(this);
+		return -errno;
+	}
+	loop->priv = this;
+	return 0;
+}
+
+static uint32_t epoll_events(struct watch *w)
+{
+	uint32_t events = EPOLLRDHUP;
+
+	if (w->ops & LOOP_READ)
+	{
+		events |= EPOLLIN;
+	}
+	if (w->ops & LOOP_WRITE)
+	{
+		events |= EPOLLOUT;
+	}
+	if (w->flags & LOOP_EDGE)
+	{
+		events |= EPOLLET;
+	}
+	return events;
+}
+
+static int epoll_ctl_watch(struct loop *loop, struct watch *w, int op)
+{
+	struct epoll_loop *this = loop->priv;
+	struct epoll_event ev = {};
+
+	ev.events = epoll_events(w);
+	ev.data.ptr = w;
+	if (epoll_ctl(this->epfd, op, w->fd, &ev) != 0)
+	{
+		return -errno;
+	}
+	return 0;
+}
+
+static int epoll_add(struct loop *loop, struct watch *w)
+{
+	return epoll_ctl_watch(loop, w, EPOLL_CTL_ADD);
+}
+
+static int epoll_mod(struct loop *loop, struct watch *w)
+{
+	return epoll_ctl_watch(loop, w, EPOLL_CTL_MOD);
+}
+
+static void epoll_del(struct loop *loop, struct watch *w)
+{
+	struct epoll_loop *this = loop->priv;
+
+	epoll_ctl(this->epfd, EPOLL_CTL_DEL, w->fd, NULL);
+}
+
+static int epoll_wait_events(struct loop *loop, int timeout)
+{
+	struct epoll_loop *this = loop->priv;
+	struct epoll_event *ev;
+	int i, n, revents;
+
+	n = epoll_wait(this->epfd, this->events, EPOLL_EVENTS, timeout);
+	if (n < 0)
+	{
+		return errno == EINTR ? 0 : -errno;
+	}
+	for (i = 0; i < n; i++)
+	{
+		ev = &this->events[i];
+		revents = 0;
+		if (ev->events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+		{
+			revents |= LOOP_READ;
+		}
+		if (ev->events & EPOLLOUT)
+		{
+			revents |= LOOP_WRITE;
+		}
+		if (ev->events & (EPOLLRDHUP | EPOLLHUP))
+		{
+			revents |= LOOP_HUP;
+		}
+		if (ev->events & EPOLLERR)
+		{
+			revents |= LOOP_ERROR;
+		}
+		loop_ready(loop, ev->data.ptr, revents);
+	}
+	return n;
+}
+
+static void epoll_destroy(struct loop *loop)
+{
+	struct epoll_loop *this = loop->priv;
+
+	close(this->epfd);
+	free(this);
+}
+
+const struct loop_backend loop_epoll_backend = {
+	.name = "epoll",
+	.init = epoll_init,
+	.add = epoll_add,
+	.mod = epoll_mod,
+	.del = epoll_del,
+	.wait = epoll_wait_events,
+	.destroy = epoll_destroy,
+};
@@ -0,0 +1,143 @@
+#include "loop_backend.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+
+/**
+ * poll(2) backend, level-triggered only. Callbacks of edge-triggered
+ * watches read/write until EAGAIN anyway, so ignoring LOOP_EDGE is safe.
+ */
+struct poll_loop
+{
+	/* registered fds and their watches, w->index is the position */
+	struct pollfd *pfds;
+	struct watch **watches;
+	int count;
+	int size;
+};
+
+static int poll_init(struct loop *loop)
+{
+	loop->priv = calloc(1, sizeof(struct poll_loop));
+	return 0;
+}
+
+static short poll_events(struct watch *w)
+{
+	short events = 0;
+
+	if (w->ops & LOOP_READ)
+	{
+		events |= POLLIN;
+	}
+	if (w->ops & LOOP_WRITE)
+	{
+		events |= POLLOUT;
+	}
+	return events;
+}
+
+static int poll_add(struct loop *loop, struct watch *w)
+{
+	struct poll_loop *this = loop->priv;
+
+	if (this->count == this->size)
+	{
+		this->size = this->size ? this->size * 2 : 64;
+		this->pfds = realloc(this->pfds, this->size * sizeof(*this->pfds));
+		this->watches = realloc(this->watches,
+								this->size * sizeof(*this->watches));
+	}
+	w->index = this->count++;
+	this->pfds[w->index] = (struct pollfd){
+		.fd = w->fd,
+		.events = poll_events(w),
+	};
+	this->watches[w->index] = w;
+	return 0;
+}
+
+static int poll_mod(struct loop *loop, struct watch *w)
+{
+	struct poll_loop *this = loop->priv;
+
+	this->pfds[w->index].events = poll_events(w);
+	return 0;
+}
+
+static void poll_del(struct loop *loop, struct watch *w)
+{
+	struct poll_loop *this = loop->priv;
+	int last = --this->count;
+
+	/* fill the gap with the last entry. If it was not dispatched yet, it is
+	 * reported again by the next poll() */
+	if (w->index != last)
+	{
+		this->pfds[w->index] = this->pfds[last];
+		this->watches[w->index] = this->watches[last];
+		this->watches[w->index]->index = w->index;
+	}
+}
+
+static int poll_wait(struct loop *loop, int timeout)
+{
+	struct poll_loop *this = loop->priv;
+	int i, n, count, revents;
+	short ev;
+
+	n = poll(this->pfds, this->count, timeout);
+	if (n < 0)
+	{
+		return errno == EINTR ? 0 : -errno;
+	}
+	/* skip fds added while dispatching */
+	count = this->count;
+	for (i = 0; i < count && i < this->count; i++)
+	{
+		ev = this->pfds[i].revents;
+		if (!ev)
+		{
+			continue;
+		}
+		this->pfds[i].revents = 0;
+		revents = 0;
+		if (ev & (POLLIN | POLLHUP))
+		{
+			revents |= LOOP_READ;
+		}
+		if (ev & POLLOUT)
+		{
+			revents |= LOOP_WRITE;
+		}
+		if (ev & POLLHUP)
+		{
+			revents |= LOOP_HUP;
+		}
+		if (ev & (POLLERR | POLLNVAL))
+		{
+			revents |= LOOP_ERROR;
+		}
+		loop_ready(loop, this->watches[i], revents);
+	}
+	return n;
+}
+
+static void poll_destroy(struct loop *loop)
+{
+	struct poll_loop *this = loop->priv;
+
+	free(this->pfds);
+	free(this->watches);
+	free(this);
+}
+
+const struct loop_backend loop_poll_backend = {
+	.name = "poll",
+	.init = poll_init,
+	.add = poll_add,
+	.mod = poll_mod,
+	.del = poll_del,
+	.wait = poll_wait,
+	.destroy = poll_destroy,
+};
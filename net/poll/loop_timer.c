@@ -0,0 +1,179 @@
+#include "loop_backend.h"
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+
+static void timer_insert(struct loop_timer **head, struct loop_timer *timer)
+{
+	timer->next = *head;
+	if (timer->next)
+	{
+		timer->next->pprev = &timer->next;
+	}
+	timer->pprev = head;
+	*head = timer;
+}
+
+static void timer_remove(struct loop_timer *timer)
+{
+	*timer->pprev = timer->next;
+	if (timer->next)
+	{
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+/**
+ * Link a timer to the slot of its tick, overdue ones to the next checked
+ */
+static void timer_link(struct loop *loop, struct loop_timer *timer)
+{
+	uint64_t tick = timer->tick > loop->tick ? timer->tick : loop->tick;
+
+	timer_insert(&loop->wheel[tick & (LOOP_WHEEL - 1)], timer);
+}
+
+void loop_timers_init(struct loop *loop)
+{
+	loop->tick = loop_now(loop) / LOOP_TICK;
+}
+
+struct loop_timer *loop_timer_create(struct loop *loop, loop_timer_cb cb,
+									 void *user)
+{
+	struct loop_timer *timer;
+
+	timer = calloc(1, sizeof(*timer));
+	timer->cb = cb;
+	timer->user = user;
+	return timer;
+}
+
+void loop_timer_start(struct loop *loop, struct loop_timer *timer,
+					  unsigned int ms)
+{
+	/* rounded up, so timers never expire early */
+	uint64_t tick = (loop_now(loop) + ms + LOOP_TICK - 1) / LOOP_TICK;
+
+	if (timer->pprev)
+	{
+		if (tick >= timer->tick && timer->tick >= loop->tick)
+		{	/* still in the slot of its tick, moved once that comes up */
+			timer->tick = tick;
+			return;
+		}
+		timer_remove(timer);
+		loop->timers--;
+	}
+	timer->tick = tick;
+	timer_link(loop, timer);
+	loop->timers++;
+}
+
+void loop_timer_stop(struct loop *loop, struct loop_timer *timer)
+{
+	if (timer->pprev)
+	{
+		timer_remove(timer);
+		loop->timers--;
+	}
+}
+
+int loop_timer_pending(struct loop_timer *timer)
+{
+	return timer->pprev != NULL;
+}
+
+void loop_timer_destroy(struct loop *loop, struct loop_timer *timer)
+{
+	if (timer)
+	{
+		loop_timer_stop(loop, timer);
+		free(timer);
+	}
+}
+
+uint64_t loop_now(struct loop *loop)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+int loop_timers_timeout(struct loop *loop, int timeout)
+{
+	uint64_t due, now;
+	int i;
+
+	if (!loop->timers)
+	{
+		return timeout;
+	}
+	for (i = 0; i < LOOP_WHEEL; i++)
+	{
+		if (loop->wheel[(loop->tick + i) & (LOOP_WHEEL - 1)])
+		{
+			break;
+		}
+	}
+	/* the slot might only hold timers of a later turn, woken up anyway */
+	due = (loop->tick + i) * LOOP_TICK;
+	now = loop_now(loop);
+	due = due > now ? due - now : 0;
+	if (due > INT_MAX)
+	{
+		due = INT_MAX;
+	}
+	if (timeout < 0 || due < timeout)
+	{
+		return due;
+	}
+	return timeout;
+}
+
+int loop_timers_expire(struct loop *loop)
+{
+	struct loop_timer *timer, *slot;
+	uint64_t now;
+	int count = 0;
+
+	now = loop_now(loop) / LOOP_TICK;
+	if (now >= loop->tick + LOOP_WHEEL)
+	{	/* a full turn passed, check each slot once */
+		loop->tick = now - LOOP_WHEEL + 1;
+	}
+	for (; loop->tick <= now; loop->tick++)
+	{
+		/* detached first, timers of a later turn are linked to it again */
+		slot = loop->wheel[loop->tick & (LOOP_WHEEL - 1)];
+		loop->wheel[loop->tick & (LOOP_WHEEL - 1)] = NULL;
+		if (slot)
+		{
+			slot->pprev = &slot;
+		}
+		while ((timer = slot))
+		{
+			timer_remove(timer);
+			if (timer->tick <= now)
+			{
+				timer_insert(&loop->expired, timer);
+			}
+			else
+			{
+				timer_link(loop, timer);
+			}
+		}
+	}
+	/* callbacks may stop or destroy any timer, so take them one by one */
+	while ((timer = loop->expired))
+	{
+		timer_remove(timer);
+		loop->timers--;
+		timer->cb(loop, timer, timer->user);
+		count++;
+	}
+	return count;
+}
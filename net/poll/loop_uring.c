@@ -0,0 +1,914 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#define _GNU_SOURCE
+#include "loop_backend.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/**
+ * io_uring backend, using raw syscalls as liburing is not required.
+ *
+ * Listening sockets use a multishot accept and connections a multishot recv
+ * into a provided buffer ring, so a single io_uring_enter() reaps many
+ * connections and messages. Sends queued on a connection while processing
+ * events are submitted as one linked chain, which keeps them in order.
+ * Plain readiness watches use multishot poll.
+ */
+
+/** submission queue size, the completion queue is twice as large */
+#define URING_ENTRIES 1024
+/** number of provided receive buffers */
+#define URING_BUFS 512
+/** size of each provided receive buffer */
+#define URING_BUF_SIZE 4096
+/** buffer group of the provided buffer ring */
+#define URING_BGID 0
+/** maximum number of sends linked in one chain */
+#define URING_CHAIN 64
+
+enum uring_op_type {
+	OP_POLL,
+	OP_ACCEPT,
+	OP_RECV,
+	OP_SEND,
+};
+
+/**
+ * A submitted request, passed as user_data. Holds a reference to the watch
+ * until its final completion arrived.
+ */
+struct uring_op
+{
+	enum uring_op_type type;
+	struct watch *w;
+	/* data of OP_SEND, private unless queued by uring_send_buf() */
+	struct loop_buf *buf;
+	struct uring_op *next;
+};
+
+/**
+ * Backend data of a watch, w->priv
+ */
+struct uring_watch
+{
+	/* armed multishot poll, accept or recv, NULL if none */
+	struct uring_op *multi;
+	/* sends not submitted yet */
+	struct uring_op *pending;
+	struct uring_op *last;
+	/* number of submitted sends not completed yet */
+	int inflight;
+	/* queued in uring_loop.flush */
+	bool flush;
+	struct watch *next_flush;
+};
+
+struct uring_loop
+{
+	int fd;
+	/* submission queue */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sqe_tail;
+	struct io_uring_sqe *sqes;
+	/* completion queue */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	/* mappings */
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	/* provided receive buffers */
+	struct io_uring_buf_ring *br;
+	size_t br_size;
+	char *bufs;
+	unsigned short br_tail;
+	/* watches with sends to submit */
+	struct watch *flush;
+	/* number of allocated requests */
+	int ops;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+							  unsigned flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+				   arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+								 unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Return a receive buffer to the provided buffer ring
+ */
+static void buf_recycle(struct uring_loop *this, unsigned short bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &this->br->bufs[this->br_tail & (URING_BUFS - 1)];
+	buf->addr = (uintptr_t)(this->bufs + (size_t)bid * URING_BUF_SIZE);
+	buf->len = URING_BUF_SIZE;
+	buf->bid = bid;
+	this->br_tail++;
+	__atomic_store_n(&this->br->tail, this->br_tail, __ATOMIC_RELEASE);
+}
+
+static int buf_ring_setup(struct uring_loop *this)
+{
+	struct io_uring_buf_reg reg = {};
+	int i;
+
+	this->br_size = URING_BUFS * sizeof(struct io_uring_buf);
+	this->br = mmap(NULL, this->br_size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (this->br == MAP_FAILED)
+	{
+		this->br = NULL;
+		return -errno;
+	}
+	this->bufs = malloc((size_t)URING_BUFS * URING_BUF_SIZE);
+
+	reg.ring_addr = (uintptr_t)this->br;
+	reg.ring_entries = URING_BUFS;
+	reg.bgid = URING_BGID;
+	if (sys_io_uring_register(this->fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+	{
+		return -errno;
+	}
+	for (i = 0; i < URING_BUFS; i++)
+	{
+		buf_recycle(this, i);
+	}
+	return 0;
+}
+
+static void uring_unmap(struct uring_loop *this)
+{
+	if (this->sqes)
+	{
+		munmap(this->sqes, this->sqes_size);
+	}
+	if (this->cq_ring && this->cq_ring != this->sq_ring)
+	{
+		munmap(this->cq_ring, this->cq_ring_size);
+	}
+	if (this->sq_ring)
+	{
+		munmap(this->sq_ring, this->sq_ring_size);
+	}
+	if (this->br)
+	{
+		munmap(this->br, this->br_size);
+	}
+	free(this->bufs);
+	if (this->fd != -1)
+	{
+		close(this->fd);
+	}
+	free(this);
+}
+
+static int uring_init(struct loop *loop)
+{
+	struct io_uring_params p = {};
+	struct uring_loop *this;
+	int ret;
+
+	this = calloc(1, sizeof(*this));
+	p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	this->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+	if (this->fd == -1 && errno == EINVAL)
+	{	/* flags not supported by older kernels */
+		memset(&p, 0, sizeof(p));
+		this->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+	}
+	if (this->fd == -1)
+	{
+		ret = -errno;
+		uring_unmap(this);
+		return ret;
+	}
+
+	this->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	this->cq_ring_size = p.cq_off.cqes +
+						 p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (this->cq_ring_size > this->sq_ring_size)
+		{
+			this->sq_ring_size = this->cq_ring_size;
+		}
+		this->cq_ring_size = this->sq_ring_size;
+	}
+	this->sq_ring = mmap(NULL, this->sq_ring_size, PROT_READ | PROT_WRITE,
+						 MAP_SHARED | MAP_POPULATE, this->fd,
+						 IORING_OFF_SQ_RING);
+	if (this->sq_ring == MAP_FAILED)
+	{
+		this->sq_ring = NULL;
+		goto failed;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		this->cq_ring = this->sq_ring;
+	}
+	else
+	{
+		this->cq_ring = mmap(NULL, this->cq_ring_size, PROT_READ | PROT_WRITE,
+							 MAP_SHARED | MAP_POPULATE, this->fd,
+							 IORING_OFF_CQ_RING);
+		if (this->cq_ring == MAP_FAILED)
+		{
+			this->cq_ring = NULL;
+			goto failed;
+		}
+	}
+	this->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	this->sqes = mmap(NULL, this->sqes_size, PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES);
+	if (this->sqes == MAP_FAILED)
+	{
+		this->sqes = NULL;
+		goto failed;
+	}
+
+	this->sq_head = this->sq_ring + p.sq_off.head;
+	this->sq_tail = this->sq_ring + p.sq_off.tail;
+	this->sq_array = this->sq_ring + p.sq_off.array;
+	this->sq_mask = *(unsigned*)(this->sq_ring + p.sq_off.ring_mask);
+	this->sq_entries = p.sq_entries;
+	this->sqe_tail = *this->sq_tail;
+	this->cq_head = this->cq_ring + p.cq_off.head;
+	this->cq_tail = this->cq_ring + p.cq_off.tail;
+	this->cq_mask = *(unsigned*)(this->cq_ring + p.cq_off.ring_mask);
+	this->cqes = this->cq_ring + p.cq_off.cqes;
+
+	ret = buf_ring_setup(this);
+	if (ret != 0)
+	{
+		uring_unmap(this);
+		return ret;
+	}
+	loop->priv = this;
+	return 0;
+
+failed:
+	ret = -errno;
+	uring_unmap(this);
+	return ret;
+}
+
+/**
+ * Submit queued entries, optionally waiting for completions
+ */
+static int uring_enter(struct uring_loop *this, unsigned wait, int timeout)
+{
+	struct io_uring_getevents_arg arg = {};
+	struct __kernel_timespec ts;
+	unsigned flags = 0, submit;
+	int ret;
+
+	__atomic_store_n(this->sq_tail, this->sqe_tail, __ATOMIC_RELEASE);
+	submit = this->sqe_tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+	if (wait)
+	{
+		flags |= IORING_ENTER_GETEVENTS;
+		if (timeout >= 0)
+		{
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000LL;
+			arg.ts = (uintptr_t)&ts;
+			flags |= IORING_ENTER_EXT_ARG;
+		}
+	}
+	else if (!submit)
+	{
+		return 0;
+	}
+	ret = sys_io_uring_enter(this->fd, submit, wait, flags,
+							 flags & IORING_ENTER_EXT_ARG ? &arg : NULL,
+							 flags & IORING_ENTER_EXT_ARG ? sizeof(arg) : 0);
+	if (ret < 0 && errno != EINTR && errno != ETIME && errno != EBUSY)
+	{
+		return -errno;
+	}
+	return 0;
+}
+
+static unsigned sq_space(struct uring_loop *this)
+{
+	return this->sq_entries - (this->sqe_tail -
+							__atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * Submit queued entries to make room in the SQ
+ *
+ * @return			0 if some got submitted, negative errno otherwise,
+ *					-EBUSY if completions must be reaped first
+ */
+static int uring_submit(struct uring_loop *this)
+{
+	unsigned submit;
+	int ret;
+
+	__atomic_store_n(this->sq_tail, this->sqe_tail, __ATOMIC_RELEASE);
+	submit = this->sqe_tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+	do
+	{
+		ret = sys_io_uring_enter(this->fd, submit, 0, 0, NULL, 0);
+	}
+	while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+	{
+		return -errno;
+	}
+	return ret ? 0 : -EAGAIN;
+}
+
+/**
+ * Get a free SQE, submits queued ones if the SQ is full
+ *
+ * @return			0 on success, negative errno if none is free
+ */
+static int get_sqe(struct uring_loop *this, struct io_uring_sqe **sqe)
+{
+	unsigned idx;
+	int ret;
+
+	while (!sq_space(this))
+	{
+		ret = uring_submit(this);
+		if (ret < 0)
+		{
+			return ret;
+		}
+	}
+	idx = this->sqe_tail & this->sq_mask;
+	this->sq_array[idx] = idx;
+	this->sqe_tail++;
+	*sqe = &this->sqes[idx];
+	memset(*sqe, 0, sizeof(**sqe));
+	return 0;
+}
+
+static struct uring_op *op_create(struct uring_loop *this,
+								  enum uring_op_type type, struct watch *w)
+{
+	struct uring_op *op;
+
+	this->ops++;
+	op = calloc(1, sizeof(*op));
+	op->type = type;
+	op->w = w;
+	watch_ref(w);
+	return op;
+}
+
+static void op_destroy(struct uring_loop *this, struct uring_op *op)
+{
+	this->ops--;
+	watch_unref(op->w);
+	if (op->buf)
+	{
+		loop_buf_unref(op->buf);
+	}
+	free(op);
+}
+
+static struct uring_watch *uring_watch(struct watch *w)
+{
+	struct uring_watch *uw = w->priv;
+
+	if (!uw)
+	{
+		uw = w->priv = calloc(1, sizeof(*uw));
+	}
+	return uw;
+}
+
+/**
+ * Arm the multishot request of a watch
+ */
+static int arm(struct uring_loop *this, struct watch *w)
+{
+	struct uring_watch *uw = uring_watch(w);
+	struct io_uring_sqe *sqe;
+	struct uring_op *op;
+	int ret;
+
+	ret = get_sqe(this, &sqe);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	sqe->fd = w->fd;
+	switch (w->kind)
+	{
+		case WATCH_READY:
+			op = op_create(this, OP_POLL, w);
+			sqe->opcode = IORING_OP_POLL_ADD;
+			if (w->flags & LOOP_EDGE)
+			{
+				sqe->len = IORING_POLL_ADD_MULTI;
+			}
+			/* else oneshot, re-armed once it completes to report it again
+			 * while ready; IORING_POLL_ADD_LEVEL is rejected with EINVAL */
+			if (w->ops & LOOP_READ)
+			{
+				sqe->poll32_events |= POLLIN | POLLRDHUP;
+			}
+			if (w->ops & LOOP_WRITE)
+			{
+				sqe->poll32_events |= POLLOUT;
+			}
+			break;
+		case WATCH_ACCEPT:
+			op = op_create(this, OP_ACCEPT, w);
+			sqe->opcode = IORING_OP_ACCEPT;
+			sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+			sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+			break;
+		case WATCH_RECV:
+		default:
+			op = op_create(this, OP_RECV, w);
+			sqe->opcode = IORING_OP_RECV;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = URING_BGID;
+			break;
+	}
+	sqe->user_data = (uintptr_t)op;
+	uw->multi = op;
+	return 0;
+}
+
+/**
+ * Cancel the multishot request of a watch, its final completion releases it
+ */
+static int disarm(struct uring_loop *this, struct watch *w)
+{
+	struct uring_watch *uw = uring_watch(w);
+	struct io_uring_sqe *sqe;
+	int ret;
+
+	if (!uw->multi)
+	{
+		return 0;
+	}
+	ret = get_sqe(this, &sqe);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	if (uw->multi->type == OP_POLL)
+	{
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+	}
+	else
+	{
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	}
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t)uw->multi;
+	/* user_data 0 marks completions to ignore */
+	sqe->user_data = 0;
+	uw->multi = NULL;
+	return 0;
+}
+
+static int uring_add(struct loop *loop, struct watch *w)
+{
+	uring_watch(w);
+	if (w->ops)
+	{
+		return arm(loop->priv, w);
+	}
+	return 0;
+}
+
+static int uring_mod(struct loop *loop, struct watch *w)
+{
+	int ret;
+
+	ret = disarm(loop->priv, w);
+	if (ret == 0 && w->ops)
+	{
+		ret = arm(loop->priv, w);
+	}
+	return ret;
+}
+
+static int uring_start(struct loop *loop, struct watch *w)
+{
+	return arm(loop->priv, w);
+}
+
+static void uring_del(struct loop *loop, struct watch *w)
+{
+	struct uring_watch *uw = uring_watch(w);
+	struct uring_op *op;
+
+	if (disarm(loop->priv, w) != 0)
+	{	/* completions of the dead watch are ignored, the request ends
+		 * once the fd gets closed */
+		uw->multi = NULL;
+	}
+	while (uw->pending)
+	{
+		op = uw->pending;
+		uw->pending = op->next;
+		op_destroy(loop->priv, op);
+	}
+	uw->last = NULL;
+}
+
+/**
+ * Queue a send to be submitted with the next chain of the watch
+ */
+static void queue_send(struct uring_loop *this, struct watch *w,
+					   struct uring_op *op)
+{
+	struct uring_watch *uw = uring_watch(w);
+
+	if (uw->last)
+	{
+		uw->last->next = op;
+	}
+	else
+	{
+		uw->pending = op;
+	}
+	uw->last = op;
+	w->queued += op->buf->len;
+
+	if (!uw->flush && !uw->inflight)
+	{
+		uw->flush = true;
+		uw->next_flush = this->flush;
+		this->flush = w;
+	}
+}
+
+static int uring_send(struct loop *loop, struct watch *w,
+					  const struct iovec *iov, int count)
+{
+	struct uring_watch *uw = uring_watch(w);
+	struct uring_op *op = uw->last;
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		len += iov[i].iov_len;
+	}
+	if (!len)
+	{
+		return 0;
+	}
+	if (op && !op->buf->shared && op->buf->len + len <= LOOP_MERGE)
+	{	/* append to the last send not submitted yet */
+		op->buf = loop_buf_append(op->buf, iov, count);
+		w->queued += len;
+		return 0;
+	}
+	op = op_create(loop->priv, OP_SEND, w);
+	op->buf = loop_buf_append(NULL, iov, count);
+	queue_send(loop->priv, w, op);
+	return 0;
+}
+
+static int uring_send_buf(struct loop *loop, struct watch *w,
+						  struct loop_buf *buf)
+{
+	struct uring_op *op;
+
+	if (!buf->len)
+	{
+		return 0;
+	}
+	op = op_create(loop->priv, OP_SEND, w);
+	op->buf = loop_buf_ref(buf);
+	queue_send(loop->priv, w, op);
+	return 0;
+}
+
+/**
+ * Submit the pending sends of all watches, as one linked chain per watch.
+ * A chain is only started once the previous one completed, as links do not
+ * span submissions.
+ */
+static void flush_sends(struct uring_loop *this)
+{
+	struct io_uring_sqe *sqe, *prev;
+	struct uring_watch *uw;
+	struct uring_op *op;
+	struct watch *w;
+	int chain;
+
+	while (this->flush)
+	{
+		w = this->flush;
+		uw = w->priv;
+		this->flush = uw->next_flush;
+		uw->flush = false;
+		if (w->dead || !uw->pending)
+		{
+			continue;
+		}
+		if (sq_space(this) < URING_CHAIN)
+		{
+			uring_enter(this, 0, 0);
+		}
+		for (chain = 0, prev = NULL; uw->pending && chain < URING_CHAIN;
+			 chain++, prev = sqe)
+		{
+			if (get_sqe(this, &sqe) != 0)
+			{	/* end the chain, the rest follows once it completed, or
+				 * with the next flush if none got queued */
+				if (prev)
+				{
+					prev->flags &= ~IOSQE_IO_LINK;
+				}
+				if (!uw->inflight)
+				{
+					uw->flush = true;
+					uw->next_flush = this->flush;
+					this->flush = w;
+				}
+				return;
+			}
+			op = uw->pending;
+			uw->pending = op->next;
+			op->next = NULL;
+
+			sqe->opcode = IORING_OP_SEND;
+			sqe->fd = w->fd;
+			sqe->addr = (uintptr_t)op->buf->data;
+			sqe->len = op->buf->len;
+			sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+			sqe->user_data = (uintptr_t)op;
+			if (uw->pending && chain + 1 < URING_CHAIN)
+			{
+				sqe->flags = IOSQE_IO_LINK;
+			}
+			uw->inflight++;
+		}
+		if (!uw->pending)
+		{
+			uw->last = NULL;
+		}
+	}
+}
+
+static void complete_poll(struct loop *loop, struct uring_op *op,
+						  struct io_uring_cqe *cqe)
+{
+	struct watch *w = op->w;
+	int revents = 0;
+
+	/* ignore events of a poll replaced by uring_mod() */
+	if (cqe->res > 0 && ((struct uring_watch*)w->priv)->multi == op)
+	{
+		if (cqe->res & (POLLIN | POLLRDHUP | POLLHUP))
+		{
+			revents |= LOOP_READ;
+		}
+		if (cqe->res & POLLOUT)
+		{
+			revents |= LOOP_WRITE;
+		}
+		if (cqe->res & (POLLRDHUP | POLLHUP))
+		{
+			revents |= LOOP_HUP;
+		}
+		if (cqe->res & POLLERR)
+		{
+			revents |= LOOP_ERROR;
+		}
+		loop_ready(loop, w, revents);
+	}
+}
+
+static void complete_accept(struct loop *loop, struct uring_op *op,
+							struct io_uring_cqe *cqe)
+{
+	struct watch *w = op->w;
+
+	if (w->dead || ((struct uring_watch*)w->priv)->multi != op)
+	{
+		if (cqe->res >= 0)
+		{	/* accepted while being cancelled */
+			close(cqe->res);
+		}
+		return;
+	}
+	if (cqe->res != -ECANCELED)
+	{
+		w->accept_cb(loop, w, cqe->res, w->user);
+	}
+}
+
+static void complete_recv(struct loop *loop, struct uring_op *op,
+						  struct io_uring_cqe *cqe)
+{
+	struct uring_loop *this = loop->priv;
+	struct watch *w = op->w;
+	unsigned short bid;
+	bool current;
+
+	current = !w->dead && ((struct uring_watch*)w->priv)->multi == op;
+	if (cqe->flags & IORING_CQE_F_BUFFER)
+	{
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		if (current)
+		{
+			w->recv_cb(loop, w, this->bufs + (size_t)bid * URING_BUF_SIZE,
+					   cqe->res, w->user);
+		}
+		buf_recycle(this, bid);
+	}
+	else if (current && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+	{	/* end of file or error */
+		((struct uring_watch*)w->priv)->multi = NULL;
+		w->recv_cb(loop, w, NULL, cqe->res, w->user);
+	}
+}
+
+static void complete_send(struct loop *loop, struct uring_op *op,
+						  struct io_uring_cqe *cqe)
+{
+	struct uring_loop *this = loop->priv;
+	struct watch *w = op->w;
+	struct uring_watch *uw = w->priv;
+
+	uw->inflight--;
+	w->queued -= op->buf->len;
+	if (w->dead)
+	{
+		return;
+	}
+	if (cqe->res < 0 && cqe->res != -ECANCELED)
+	{
+		w->recv_cb(loop, w, NULL, cqe->res, w->user);
+		return;
+	}
+	if (!uw->inflight && uw->pending && !uw->flush)
+	{
+		uw->flush = true;
+		uw->next_flush = this->flush;
+		this->flush = w;
+	}
+}
+
+/**
+ * Re-arm a terminated multishot request, reports an error to the watch if
+ * that fails
+ */
+static void rearm(struct loop *loop, struct watch *w)
+{
+	int ret;
+
+	ret = arm(loop->priv, w);
+	if (ret == 0)
+	{
+		return;
+	}
+	switch (w->kind)
+	{
+		case WATCH_READY:
+			loop_ready(loop, w, LOOP_ERROR);
+			break;
+		case WATCH_ACCEPT:
+			w->accept_cb(loop, w, ret, w->user);
+			break;
+		case WATCH_RECV:
+		default:
+			w->recv_cb(loop, w, NULL, ret, w->user);
+			break;
+	}
+}
+
+static void complete(struct loop *loop, struct io_uring_cqe *cqe)
+{
+	struct uring_op *op = (struct uring_op*)(uintptr_t)cqe->user_data;
+	struct uring_watch *uw;
+	bool more;
+
+	if (!op)
+	{
+		return;
+	}
+	more = cqe->flags & IORING_CQE_F_MORE;
+	switch (op->type)
+	{
+		case OP_POLL:
+			complete_poll(loop, op, cqe);
+			break;
+		case OP_ACCEPT:
+			complete_accept(loop, op, cqe);
+			break;
+		case OP_RECV:
+			complete_recv(loop, op, cqe);
+			break;
+		case OP_SEND:
+			complete_send(loop, op, cqe);
+			op_destroy(loop->priv, op);
+			return;
+	}
+	if (!more)
+	{
+		uw = op->w->priv;
+		if (!op->w->dead && uw->multi == op)
+		{	/* multishot terminated, e.g. out of provided buffers */
+			uw->multi = NULL;
+			rearm(loop, op->w);
+		}
+		op_destroy(loop->priv, op);
+	}
+}
+
+static int uring_wait(struct loop *loop, int timeout)
+{
+	struct uring_loop *this = loop->priv;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	int ret, n = 0;
+
+	flush_sends(this);
+	head = *this->cq_head;
+	tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+	/* don't block if completions are ready already */
+	ret = uring_enter(this, head == tail, head == tail ? timeout : 0);
+	if (ret < 0)
+	{
+		return ret;
+	}
+	while (true)
+	{
+		tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+		{
+			break;
+		}
+		cqe = &this->cqes[head & this->cq_mask];
+		complete(loop, cqe);
+		__atomic_store_n(this->cq_head, ++head, __ATOMIC_RELEASE);
+		n++;
+	}
+	return n;
+}
+
+static void uring_destroy(struct loop *loop)
+{
+	struct uring_loop *this = loop->priv;
+
+	/* reap the cancellations of removed watches to release them */
+	while (this->ops && uring_wait(loop, 100) > 0);
+	uring_unmap(this);
+}
+
+const struct loop_backend loop_uring_backend = {
+	.name = "io_uring",
+	.init = uring_init,
+	.add = uring_add,
+	.mod = uring_mod,
+	.del = uring_del,
+	.wait = uring_wait,
+	.destroy = uring_destroy,
+	.accept = uring_start,
+	.recv = uring_start,
+	.send = uring_send,
+	.send_buf = uring_send_buf,
+};
+
+#endif /* HAVE_LINUX_IO_URING_H */
@@ -0,0 +1,167 @@
+#include "ringbuf.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+/**
+ * Maximum number of unused blocks kept in the pool of a thread
+ */
+#define POOL_MAX 64
+
+/**
+ * Unused blocks, per thread as rings are only used by their loop thread
+ */
+static __thread struct {
+	char *blocks[POOL_MAX];
+	int count;
+} pool;
+
+static char *pool_get()
+{
+	if (pool.count)
+	{
+		return pool.blocks[--pool.count];
+	}
+	return malloc(RINGBUF_BLOCK);
+}
+
+static void pool_put(char *block)
+{
+	if (pool.count < POOL_MAX)
+	{
+		pool.blocks[pool.count++] = block;
+		return;
+	}
+	free(block);
+}
+
+void ringbuf_pool_flush()
+{
+	while (pool.count)
+	{
+		free(pool.blocks[--pool.count]);
+	}
+}
+
+void ringbuf_free(struct ringbuf *rb)
+{
+	if (rb->buf)
+	{
+		if (rb->size == RINGBUF_BLOCK)
+		{
+			pool_put(rb->buf);
+		}
+		else
+		{
+			free(rb->buf);
+		}
+	}
+	rb->buf = NULL;
+	rb->size = rb->head = rb->len = 0;
+}
+
+/**
+ * Get up to two segments of the ring starting at an absolute offset
+ */
+static int segments(struct ringbuf *rb, size_t pos, size_t len,
+					struct iovec *iov)
+{
+	size_t start = pos & (rb->size - 1), first;
+
+	if (!len)
+	{
+		return 0;
+	}
+	first = rb->size - start;
+	iov[0].iov_base = rb->buf + start;
+	if (len <= first)
+	{
+		iov[0].iov_len = len;
+		return 1;
+	}
+	iov[0].iov_len = first;
+	iov[1].iov_base = rb->buf;
+	iov[1].iov_len = len - first;
+	return 2;
+}
+
+int ringbuf_writable(struct ringbuf *rb, struct iovec *iov)
+{
+	if (!rb->buf)
+	{
+		rb->buf = pool_get();
+		rb->size = RINGBUF_BLOCK;
+		rb->head = rb->len = 0;
+	}
+	return segments(rb, rb->head + rb->len, rb->size - rb->len, iov);
+}
+
+void ringbuf_produce(struct ringbuf *rb, size_t len)
+{
+	rb->len += len;
+}
+
+int ringbuf_peek(struct ringbuf *rb, size_t off, size_t len,
+				 struct iovec *iov)
+{
+	return segments(rb, rb->head + off, len, iov);
+}
+
+void ringbuf_copy(struct ringbuf *rb, size_t off, size_t len, void *out)
+{
+	struct iovec iov[2];
+	int count;
+
+	count = ringbuf_peek(rb, off, len, iov);
+	if (count > 0)
+	{
+		memcpy(out, iov[0].iov_base, iov[0].iov_len);
+	}
+	if (count > 1)
+	{
+		memcpy((char*)out + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+	}
+}
+
+void ringbuf_consume(struct ringbuf *rb, size_t len)
+{
+	rb->head = (rb->head + len) & (rb->size - 1);
+	rb->len -= len;
+	if (!rb->len)
+	{
+		ringbuf_free(rb);
+	}
+}
+
+int ringbuf_reserve(struct ringbuf *rb, size_t len)
+{
+	size_t size = rb->size ? rb->size : RINGBUF_BLOCK;
+	char *buf;
+
+	if (len <= rb->size)
+	{
+		return 0;
+	}
+	while (size < len)
+	{
+		if (size > SIZE_MAX / 2)
+		{
+			return -ENOMEM;
+		}
+		size *= 2;
+	}
+	/* linearize the unconsumed data into the new buffer */
+	buf = malloc(size);
+	if (!buf)
+	{
+		return -ENOMEM;
+	}
+	ringbuf_copy(rb, 0, rb->len, buf);
+	len = rb->len;
+	ringbuf_free(rb);
+	rb->buf = buf;
+	rb->size = size;
+	rb->len = len;
+	return 0;
+}
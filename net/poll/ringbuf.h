@@ -0,0 +1,91 @@
+#ifndef __MY_RINGBUF_H__
+#define __MY_RINGBUF_H__
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/**
+ * Size of the buffers shared from the pool, the minimum size of a ring
+ */
+#define RINGBUF_BLOCK 16384
+
+/**
+ * Circular receive buffer.
+ *
+ * Memory is taken from a per-thread pool when data arrives and returned as
+ * soon as all data got consumed, so idle rings don't pin any memory. A ring
+ * only grows beyond RINGBUF_BLOCK to hold a single larger message.
+ */
+struct ringbuf {
+	/* buffer, NULL while empty */
+	char *buf;
+	/* size of buf, a power of two */
+	size_t size;
+	/* offset of the first unconsumed byte */
+	size_t head;
+	/* number of unconsumed bytes */
+	size_t len;
+};
+
+/**
+ * Get the free space of a ring to receive into, acquires a buffer if the
+ * ring has none.
+ *
+ * @param iov		receives up to two segments of free space
+ * @return			number of segments, 0 if the ring is full
+ */
+int ringbuf_writable(struct ringbuf *rb, struct iovec *iov);
+
+/**
+ * Add data received into the space returned by ringbuf_writable().
+ *
+ * @param len		number of bytes received
+ */
+void ringbuf_produce(struct ringbuf *rb, size_t len);
+
+/**
+ * Get a view of unconsumed data, without copying it.
+ *
+ * @param off		offset relative to the first unconsumed byte
+ * @param len		number of bytes, off + len must not exceed rb->len
+ * @param iov		receives up to two segments
+ * @return			number of segments
+ */
+int ringbuf_peek(struct ringbuf *rb, size_t off, size_t len,
+				 struct iovec *iov);
+
+/**
+ * Copy unconsumed data to a contiguous buffer.
+ *
+ * @param off		offset relative to the first unconsumed byte
+ * @param len		number of bytes, off + len must not exceed rb->len
+ * @param out		buffer receiving len bytes
+ */
+void ringbuf_copy(struct ringbuf *rb, size_t off, size_t len, void *out);
+
+/**
+ * Consume data, releases the buffer to the pool if none is left.
+ *
+ * @param len		number of bytes to consume
+ */
+void ringbuf_consume(struct ringbuf *rb, size_t len);
+
+/**
+ * Make sure the ring can hold len bytes, grows it if necessary.
+ *
+ * @param len		number of bytes the ring must hold
+ * @return			0, or -ENOMEM if it can't grow, the ring is unchanged
+ */
+int ringbuf_reserve(struct ringbuf *rb, size_t len);
+
+/**
+ * Release the buffer of a ring, discarding unconsumed data.
+ */
+void ringbuf_free(struct ringbuf *rb);
+
+/**
+ * Free the unused buffers pooled by the calling thread, before it exits.
+ */
+void ringbuf_pool_flush();
+
+#endif
@@ -0,0 +1,334 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+#include "shm.h"
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+/**
+ * Producer and consumer state are kept on separate cache lines
+ */
+#define SHM_LINE 64
+
+/**
+ * Ring of a direction, followed by its data. Positions count all bytes ever
+ * produced and consumed, so a full ring is distinguished from an empty one.
+ */
+struct shm_ring
+{
+	/* only written by the producer */
+	_Alignas(SHM_LINE) uint64_t head;
+	/* set by the producer waiting for space */
+	uint32_t blocked;
+	/* only written by the consumer */
+	_Alignas(SHM_LINE) uint64_t tail;
+	/* set by the consumer waiting for data */
+	uint32_t sleeping;
+	_Alignas(SHM_LINE) char data[];
+};
+
+static int ring(int efd)
+{
+	uint64_t one = 1;
+
+	return write(efd, &one, sizeof(one)) < 0 ? -errno : 0;
+}
+
+static size_t ring_size(size_t size)
+{
+	size_t pow = SHM_RING_MIN;
+
+	while (pow < size && pow < SHM_RING_MAX)
+	{
+		pow *= 2;
+	}
+	return pow;
+}
+
+/**
+ * Get the ring of a direction, 0 from client to server
+ */
+static struct shm_ring *ring_get(struct shm *shm, int dir)
+{
+	return (struct shm_ring*)((char*)shm->map +
+							  dir * (sizeof(struct shm_ring) + shm->size));
+}
+
+int shm_create(struct shm *shm, size_t size, int *fds)
+{
+#ifdef HAVE_MEMFD_CREATE
+	int err;
+
+	*shm = (struct shm){
+		.size = ring_size(size),
+		.efd = -1,
+		.peer = -1,
+	};
+	shm->map_len = 2 * (sizeof(struct shm_ring) + shm->size);
+	fds[0] = memfd_create("poll-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fds[0] < 0)
+	{
+		return -errno;
+	}
+	/* the client can't shrink it, which would fault on access */
+	if (ftruncate(fds[0], shm->map_len) != 0 ||
+		fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+			  F_SEAL_SEAL) != 0)
+	{
+		err = -errno;
+		close(fds[0]);
+		return err;
+	}
+	shm->map = mmap(NULL, shm->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+					fds[0], 0);
+	shm->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	shm->peer = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (shm->map == MAP_FAILED || shm->efd < 0 || shm->peer < 0)
+	{
+		err = -errno;
+		if (shm->map == MAP_FAILED)
+		{
+			shm->map = NULL;
+		}
+		close(fds[0]);
+		shm_destroy(shm);
+		return err;
+	}
+	shm->rx = ring_get(shm, 0);
+	shm->tx = ring_get(shm, 1);
+	/* both consumers start out waiting */
+	shm->rx->sleeping = shm->tx->sleeping = 1;
+	fds[1] = shm->peer;
+	fds[2] = shm->efd;
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+int shm_attach(struct shm *shm, size_t size, int *fds)
+{
+	struct stat st;
+	int i, err = -EINVAL;
+
+	*shm = (struct shm){
+		.size = size,
+		.map_len = 2 * (sizeof(struct shm_ring) + size),
+		.efd = fds[1],
+		.peer = fds[2],
+	};
+	if (size == ring_size(size) && fstat(fds[0], &st) == 0 &&
+		st.st_size == shm->map_len)
+	{
+		shm->map = mmap(NULL, shm->map_len, PROT_READ | PROT_WRITE,
+						MAP_SHARED, fds[0], 0);
+		err = -errno;
+	}
+	close(fds[0]);
+	for (i = 0; i < SHM_FDS; i++)
+	{
+		fds[i] = -1;
+	}
+	if (!shm->map || shm->map == MAP_FAILED)
+	{
+		shm->map = NULL;
+		shm_destroy(shm);
+		return err;
+	}
+	shm->rx = ring_get(shm, 1);
+	shm->tx = ring_get(shm, 0);
+	return 0;
+}
+
+void shm_destroy(struct shm *shm)
+{
+	if (shm->map)
+	{
+		munmap(shm->map, shm->map_len);
+	}
+	if (shm->efd >= 0)
+	{
+		close(shm->efd);
+	}
+	if (shm->peer >= 0)
+	{
+		close(shm->peer);
+	}
+	*shm = (struct shm){
+		.efd = -1,
+		.peer = -1,
+	};
+}
+
+/**
+ * Make written data visible, ring the doorbell if the peer waits for it
+ */
+static void publish(struct shm *shm, uint64_t head)
+{
+	struct shm_ring *r = shm->tx;
+
+	shm->head = head;
+	__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+	/* pairs with the fence in shm_sleep(), one of us sees the other */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->sleeping, __ATOMIC_RELAXED) &&
+		__atomic_exchange_n(&r->sleeping, 0, __ATOMIC_RELAXED))
+	{
+		ring(shm->peer);
+	}
+}
+
+ssize_t shm_write(struct shm *shm, const struct iovec *iov, int count)
+{
+	struct shm_ring *r = shm->tx;
+	uint64_t head, tail, published;
+	size_t done = 0, off = 0, len, pos, first;
+	int i = 0;
+
+	head = published = shm->head;
+	tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	while (i < count)
+	{
+		if (!iov[i].iov_len)
+		{
+			i++;
+			continue;
+		}
+		if (head - tail > shm->size)
+		{	/* the peer moved its tail past what we wrote */
+			return -EPROTO;
+		}
+		if (head - tail == shm->size)
+		{
+			if (head != published)
+			{	/* let the peer consume what fit so far */
+				publish(shm, head);
+				published = head;
+			}
+			/* announce waiting for space, check again to not miss it */
+			__atomic_store_n(&r->blocked, 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+			if (head - tail >= shm->size)
+			{	/* still full, or invalid, checked once written again */
+				break;
+			}
+			__atomic_store_n(&r->blocked, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		len = iov[i].iov_len - off;
+		if (len > shm->size - (head - tail))
+		{
+			len = shm->size - (head - tail);
+		}
+		pos = head & (shm->size - 1);
+		first = shm->size - pos < len ? shm->size - pos : len;
+		memcpy(r->data + pos, (char*)iov[i].iov_base + off, first);
+		memcpy(r->data, (char*)iov[i].iov_base + off + first, len - first);
+		head += len;
+		off += len;
+		done += len;
+		if (off == iov[i].iov_len)
+		{
+			i++;
+			off = 0;
+		}
+	}
+	if (head != published)
+	{
+		publish(shm, head);
+	}
+	return done;
+}
+
+size_t shm_readable(struct shm *shm)
+{
+	struct shm_ring *r = shm->rx;
+	uint64_t len;
+
+	len = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - shm->tail;
+	/* never trust the peer to stay within the ring */
+	return len < shm->size ? len : shm->size;
+}
+
+int shm_peek(struct shm *shm, size_t off, size_t len, struct iovec *iov)
+{
+	struct shm_ring *r = shm->rx;
+	size_t pos = (shm->tail + off) & (shm->size - 1), first;
+
+	if (!len)
+	{
+		return 0;
+	}
+	first = shm->size - pos;
+	iov[0].iov_base = r->data + pos;
+	if (len <= first)
+	{
+		iov[0].iov_len = len;
+		return 1;
+	}
+	iov[0].iov_len = first;
+	iov[1].iov_base = r->data;
+	iov[1].iov_len = len - first;
+	return 2;
+}
+
+void shm_copy(struct shm *shm, size_t off, size_t len, void *out)
+{
+	struct iovec iov[2];
+	int count;
+
+	count = shm_peek(shm, off, len, iov);
+	if (count > 0)
+	{
+		memcpy(out, iov[0].iov_base, iov[0].iov_len);
+	}
+	if (count > 1)
+	{
+		memcpy((char*)out + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+	}
+}
+
+void shm_consume(struct shm *shm, size_t len)
+{
+	struct shm_ring *r = shm->rx;
+
+	shm->tail += len;
+	__atomic_store_n(&r->tail, shm->tail, __ATOMIC_RELEASE);
+	/* pairs with the fence in shm_write() waiting for space */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->blocked, __ATOMIC_RELAXED) &&
+		__atomic_exchange_n(&r->blocked, 0, __ATOMIC_RELAXED))
+	{
+		ring(shm->peer);
+	}
+}
+
+int shm_sleep(struct shm *shm, size_t seen)
+{
+	struct shm_ring *r = shm->rx;
+
+	__atomic_store_n(&r->sleeping, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (shm_readable(shm) > seen)
+	{
+		__atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+		return 1;
+	}
+	return 0;
+}
+
+int shm_doorbell(struct shm *shm)
+{
+	uint64_t count;
+
+	return read(shm->efd, &count, sizeof(count)) < 0 ? -errno : 0;
+}
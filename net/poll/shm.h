@@ -0,0 +1,130 @@
+#ifndef __MY_SHM_H__
+#define __MY_SHM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * Ring sizes, per direction, a power of two
+ */
+#define SHM_RING_MIN (64 * 1024)
+#define SHM_RING_DEFAULT (4 * 1024 * 1024)
+#define SHM_RING_MAX (64 * 1024 * 1024)
+
+/**
+ * Number of fds passed to the client, see shm_create()
+ */
+#define SHM_FDS 3
+
+struct shm_ring;
+
+/**
+ * Shared memory transport between a client and a server on the same host.
+ *
+ * A sealed memfd holds a single-producer single-consumer byte ring per
+ * direction, carrying the same frames as the socket. Each side has an
+ * eventfd doorbell the other one rings after producing to a sleeping
+ * consumer, or consuming from a producer waiting for space. Doorbells are
+ * only rung if the peer announced to wait, so a busy peer is not woken.
+ */
+struct shm {
+	/* mapping of both rings, NULL if not in use */
+	void *map;
+	size_t map_len;
+	/* size of the data of each ring */
+	size_t size;
+	struct shm_ring *tx;
+	struct shm_ring *rx;
+	/* own positions, the copies in the rings can be written by the peer */
+	uint64_t head;
+	uint64_t tail;
+	/* doorbell rung by the peer, readable once woken */
+	int efd;
+	/* doorbell of the peer */
+	int peer;
+};
+
+/**
+ * Create the rings on the server side.
+ *
+ * @param size		requested size of each ring, rounded and clamped
+ * @param fds		receives the memfd and the doorbells to pass to the
+ *					client, the memfd is to be closed once passed
+ * @return			0 on success, negative errno on error, -ENOTSUP if
+ *					memfd_create() is not available
+ */
+int shm_create(struct shm *shm, size_t size, int *fds);
+
+/**
+ * Map the rings created by the server on the client side.
+ *
+ * @param size		size of each ring, as announced by the server
+ * @param fds		fds received from the server, taken over and set to -1
+ * @return			0 on success, negative errno on error
+ */
+int shm_attach(struct shm *shm, size_t size, int *fds);
+
+/**
+ * Unmap the rings and close the doorbells.
+ */
+void shm_destroy(struct shm *shm);
+
+/**
+ * Copy data to the transmit ring, as much as fits. If it did not fit
+ * completely, the doorbell gets rung once the peer consumed some.
+ *
+ * @param iov		data to write
+ * @param count		number of iov
+ * @return			number of bytes written, -EPROTO if the peer claims
+ *					to have consumed more than was written
+ */
+ssize_t shm_write(struct shm *shm, const struct iovec *iov, int count);
+
+/**
+ * Get the number of bytes in the receive ring.
+ */
+size_t shm_readable(struct shm *shm);
+
+/**
+ * Get a view of received data, without copying it.
+ *
+ * @param off		offset relative to the first unconsumed byte
+ * @param len		number of bytes, off + len must not exceed shm_readable()
+ * @param iov		receives up to two segments
+ * @return			number of segments
+ */
+int shm_peek(struct shm *shm, size_t off, size_t len, struct iovec *iov);
+
+/**
+ * Copy received data to a contiguous buffer.
+ *
+ * @param off		offset relative to the first unconsumed byte
+ * @param len		number of bytes, off + len must not exceed shm_readable()
+ * @param out		buffer receiving len bytes
+ */
+void shm_copy(struct shm *shm, size_t off, size_t len, void *out);
+
+/**
+ * Consume received data, rings the doorbell of a peer waiting for space.
+ */
+void shm_consume(struct shm *shm, size_t len);
+
+/**
+ * Announce to wait for the doorbell before returning to the loop.
+ *
+ * @param seen		number of bytes left in the ring, e.g. a partial frame
+ * @return			0 if waiting, 1 if more data arrived in the meantime and
+ *					the ring is to be read again instead
+ */
+int shm_sleep(struct shm *shm, size_t seen);
+
+/**
+ * Reset the doorbell after it got rung, before reading the ring.
+ *
+ * @return			0 if it was rung, -EAGAIN if not
+ */
+int shm_doorbell(struct shm *shm);
+
+#endif
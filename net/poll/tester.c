@@ -1,164 +1,1109 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
 #include "tester.h"
+#include "loop.h"
+#include "frame.h"
+#include "ringbuf.h"
+#include "shm.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/queue.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <unistd.h>
-#include <poll.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <limits.h>
+#include <pthread.h>
+#ifdef HAVE_LIBPROCESSOR
+#include <processor.h>
+#endif
+
+#define DBG(fmt, ...) do { if (debug) printf(fmt, ##__VA_ARGS__); } while (0)
+
+static int debug = 1;
+
 
-enum tester_fd {
-	FD_CLIENT = 0,
-	FD_LISTEN = 1,
-	FD_SERVER = 2,
-	FD_COUNT
+/**
+ * Server side of an accepted connection
+ */
+struct session
+{
+	int fd;
+	/* partially received request */
+	struct frame_decoder dec;
+	struct watch *watch;
+	struct tester *t;
+	/* loop thread owning the session, all callbacks run on it */
+	struct worker *worker;
+	/* events the client registered for */
+	LIST_HEAD(, subscription) subs;
+	/* disconnected as slow consumer, closed once the loop notices */
+	bool closing;
+	/* closes the session if it does not send anything for a while */
+	struct loop_timer *idle;
+	/* offloaded work not done yet, freed once closed and 0 */
+	int refs;
+	bool closed;
+	/* shared memory negotiated with SHM_OFFER, in use if map is set */
+	struct shm shm;
+	struct watch *shm_watch;
+	/* replies not fitting into the shared memory ring yet */
+	struct ringbuf backlog;
+	LIST_ENTRY(session) entries;
 };
 
-struct request
+LIST_HEAD(sessionlist, session);
+
+/**
+ * Registration of a session for an event
+ */
+struct subscription
 {
-    char *buf;
-    size_t used;
-    callback cb;
-    void *user;
+	struct event *ev;
+	struct session *s;
+	LIST_ENTRY(subscription) by_event;
+	LIST_ENTRY(subscription) by_session;
 };
 
-struct packet
+LIST_HEAD(sublist, subscription);
+
+/**
+ * Event clients can register for, see tester_add_event()
+ */
+struct event
 {
-    unsigned int received;
-    char buf[1024];
+	char *name;
+	/* subscriptions, per worker as each is only touched by its thread */
+	struct sublist *subs;
+	/* number of subscriptions of all workers */
+	int count;
+	LIST_ENTRY(event) entries;
+};
+
+LIST_HEAD(eventlist, event);
+
+enum message_type {
+	/** accepted connection assigned to the worker */
+	MSG_SESSION,
+	/** event to send to the subscribers of the worker */
+	MSG_EVENT,
+	/** offloaded work is done */
+	MSG_DONE,
+	/** terminate the worker thread */
+	MSG_STOP,
 };
 
-struct conn
+/**
+ * Message passed to the thread of a worker, see worker_post()
+ */
+struct message
 {
-    int s;
-    struct request *reqs;
-    struct packet pkt;
-    fdcb fdcb;
-    void *user;
-    enum fdops ops;
+	enum message_type type;
+	union {
+		int fd;
+		struct {
+			struct event *ev;
+			struct loop_buf *buf;
+			size_t size;
+		} event;
+		struct {
+			struct session *s;
+			tester_done done;
+			void *data;
+			/* the processor destroyed the work without running it */
+			bool canceled;
+		} done;
+	};
+	struct message *next;
 };
 
-struct response {
-	struct packet pkt;
+/**
+ * A loop and the sessions assigned to it
+ */
+struct worker
+{
+	struct tester *t;
+	int index;
+	struct loop *loop;
+	/* runs the loop in its own thread, else the loop of the tester */
+	bool threaded;
+	pthread_t thread;
+	bool running;
+	bool stop;
+	struct sessionlist sessions;
+	/* number of sessions assigned, read by other threads to balance load */
+	int session_count;
+	/* messages posted by other threads, signalled with efd */
+	pthread_mutex_t mutex;
+	struct message *messages;
+	struct message **last;
+	int efd;
+	struct watch *efd_watch;
 };
 
 struct tester {
-	struct pollfd pfd[FD_COUNT];
+	/* accepts connections, runs client connections */
+	struct loop *loop;
+	int listen;
+	struct watch *listen_watch;
+	struct worker *workers;
+	int worker_count;
+	enum tester_balance balance;
+	/* next worker for TESTER_ROUND_ROBIN */
+	int next;
 	const char *path;
 	tester_srvcb srvcb;
+	/* events may be looked up by all workers */
+	pthread_rwlock_t events_lock;
+	struct eventlist events;
+	/* what to do with sessions having more than backlog bytes queued */
+	enum event_policy policy;
+	size_t backlog;
+	/* time in ms sessions may be idle, 0 for no limit */
+	unsigned int idle;
+	/* maximum payload of requests, 0 for no limit */
+	size_t max_frame;
+	/* maximum size of shared memory rings offered by clients, 0 to refuse */
+	size_t shm;
+	struct processor_t *processor;
 	int complete;
 };
 
+/**
+ * Worker served by the loop of this thread, NULL on other threads
+ */
+static __thread struct worker *current;
+
+void tester_set_debug(int level)
+{
+	debug = level;
+	client_set_debug(level);
+}
+
+/**
+ * Registrations of a client connection with the tester loop
+ */
+struct tester_io
+{
+	struct tester *t;
+	struct watch *watch;
+	struct loop_timer *timer;
+};
+
+static struct tester_io *tester_io(struct conn *c, struct tester *t)
+{
+	struct tester_io *io = conn_get_iodata(c);
+
+	if (!io)
+	{
+		io = calloc(1, sizeof(*io));
+		io->t = t;
+		conn_set_iodata(c, io);
+	}
+	return io;
+}
+
+/**
+ * Release the registrations once neither is in use anymore
+ */
+static void tester_io_release(struct conn *c, struct tester_io *io)
+{
+	if (!io->watch && !io->timer)
+	{
+		conn_set_iodata(c, NULL);
+		free(io);
+	}
+}
+
+static void conn_io(struct loop *loop, struct watch *w, int fd, int revents,
+					void *user)
+{
+	int ops = 0;
+
+	if (revents & LOOP_READ)
+	{
+		ops |= READ;
+	}
+	if (revents & LOOP_WRITE)
+	{
+		ops |= WRITE;
+	}
+	if (revents & LOOP_ERROR)
+	{
+		ops |= ERROR;
+	}
+	conn_ready(user, ops);
+}
+
 int tester_iocb(struct conn *c, int fd, int ops, void *user)
 {
 	struct tester *t = user;
+	struct tester_io *io;
+	int lops = 0;
 
-	t->pfd[FD_CLIENT].fd = fd;
-	t->pfd[FD_CLIENT].events = 0;
 	if (ops & READ)
 	{
-		t->pfd[FD_CLIENT].events |= POLLIN;
+		lops |= LOOP_READ;
 	}
 	if (ops & WRITE)
 	{
-		t->pfd[FD_CLIENT].events |= POLLOUT;
+		lops |= LOOP_WRITE;
+	}
+	if (!ops)
+	{	/* connection gets closed */
+		io = conn_get_iodata(c);
+		if (io && io->watch)
+		{
+			loop_del(t->loop, io->watch);
+			io->watch = NULL;
+			tester_io_release(c, io);
+		}
+		return 0;
+	}
+	io = tester_io(c, t);
+	if (io->watch)
+	{
+		return loop_mod(t->loop, io->watch, lops);
+	}
+	/* the connection reads and writes until EAGAIN, so edge-triggered */
+	return loop_add(t->loop, fd, lops, LOOP_EDGE, conn_io, c, &io->watch);
+}
+
+static void conn_expired(struct loop *loop, struct loop_timer *timer,
+						 void *user)
+{
+	conn_timer(user);
+}
+
+void tester_timercb(struct conn *c, int ms, void *user)
+{
+	struct tester *t = user;
+	struct tester_io *io;
+
+	if (ms < 0)
+	{
+		io = conn_get_iodata(c);
+		if (io && io->timer)
+		{
+			loop_timer_destroy(t->loop, io->timer);
+			io->timer = NULL;
+			tester_io_release(c, io);
+		}
+		return;
+	}
+	io = tester_io(c, t);
+	if (!io->timer)
+	{
+		io->timer = loop_timer_create(t->loop, conn_expired, c);
+	}
+	loop_timer_start(t->loop, io->timer, ms);
+}
+
+static void session_free(struct session *s)
+{
+	frame_decoder_reset(&s->dec);
+	free(s);
+}
+
+static void session_close(struct session *s)
+{
+	struct worker *w = s->worker;
+	struct subscription *sub;
+
+	DBG("FD_SERVER close %d\n", s->fd);
+	while ((sub = LIST_FIRST(&s->subs)))
+	{
+		LIST_REMOVE(sub, by_event);
+		LIST_REMOVE(sub, by_session);
+		__atomic_sub_fetch(&sub->ev->count, 1, __ATOMIC_RELAXED);
+		free(sub);
+	}
+	loop_timer_destroy(w->loop, s->idle);
+	s->idle = NULL;
+	if (s->shm.map)
+	{
+		loop_del(w->loop, s->shm_watch);
+		shm_destroy(&s->shm);
+		ringbuf_free(&s->backlog);
+	}
+	loop_del(w->loop, s->watch);
+	close(s->fd);
+	LIST_REMOVE(s, entries);
+	__atomic_sub_fetch(&w->session_count, 1, __ATOMIC_RELAXED);
+	s->closed = true;
+	if (!s->refs)
+	{
+		session_free(s);
+	}
+}
+
+static struct event *find_event(struct tester *t, const char *name,
+								size_t len)
+{
+	struct event *ev;
+
+	pthread_rwlock_rdlock(&t->events_lock);
+	LIST_FOREACH(ev, &t->events, entries)
+	{
+		if (strlen(ev->name) == len && memcmp(ev->name, name, len) == 0)
+		{
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&t->events_lock);
+	return ev;
+}
+
+/**
+ * Handle EVENT_REGISTER and EVENT_UNREGISTER, the payload is the event name
+ */
+static void session_event(struct session *s, enum packet_type type,
+						  const char *name, size_t len)
+{
+	struct subscription *sub;
+	struct event *ev;
+
+	ev = find_event(s->t, name, len);
+	if (!ev)
+	{
+		DBG("FD_SERVER unknown event '%.*s'\n", (int)len, name);
+		tester_reply(s, EVENT_UNKNOWN, NULL, 0);
+		return;
+	}
+	LIST_FOREACH(sub, &s->subs, by_session)
+	{
+		if (sub->ev == ev)
+		{
+			break;
+		}
+	}
+	if (type == EVENT_REGISTER && !sub)
+	{
+		sub = calloc(1, sizeof(*sub));
+		sub->ev = ev;
+		sub->s = s;
+		LIST_INSERT_HEAD(&ev->subs[s->worker->index], sub, by_event);
+		LIST_INSERT_HEAD(&s->subs, sub, by_session);
+		__atomic_add_fetch(&ev->count, 1, __ATOMIC_RELAXED);
+	}
+	else if (type == EVENT_UNREGISTER && sub)
+	{
+		LIST_REMOVE(sub, by_event);
+		LIST_REMOVE(sub, by_session);
+		__atomic_sub_fetch(&ev->count, 1, __ATOMIC_RELAXED);
+		free(sub);
+	}
+	DBG("FD_SERVER %sregistered %d for '%s'\n",
+		type == EVENT_REGISTER ? "" : "un", s->fd, ev->name);
+	tester_reply(s, EVENT_CONFIRM, NULL, 0);
+}
+
+static void session_shm_offer(struct session *s, const void *data,
+							  size_t len);
+
+static int session_frame(void *user, uint8_t type, const void *data,
+						 size_t len)
+{
+	struct session *s = user;
+
+	switch (type)
+	{
+		case EVENT_REGISTER:
+		case EVENT_UNREGISTER:
+			session_event(s, type, data, len);
+			break;
+		case SHM_OFFER:
+			session_shm_offer(s, data, len);
+			break;
+		default:
+			s->t->srvcb(s->t, s, type, data, len);
+			break;
+	}
+	return 0;
+}
+
+static void session_recv(struct loop *loop, struct watch *w, const void *buf,
+						 ssize_t len, void *user)
+{
+	struct session *s = user;
+
+	if (len > 0 && s->idle)
+	{
+		loop_timer_start(loop, s->idle, s->t->idle);
+	}
+	if (len <= 0 || s->shm.map ||
+		frame_decode(&s->dec, buf, len, session_frame, s) != 0)
+	{	/* closed by the client, failed, invalid frame or not using shared
+		 * memory as agreed */
+		session_close(s);
+	}
+}
+
+/**
+ * Queue data to send once the client made space in the ring
+ *
+ * @param skip		number of bytes of iov written to the ring already
+ * @return			0, or -ENOMEM if the backlog can't grow
+ */
+static int session_backlog(struct session *s, const struct iovec *iov,
+						   int count, size_t skip)
+{
+	struct iovec seg[2];
+	size_t len, first;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (skip >= iov[i].iov_len)
+		{
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		len = iov[i].iov_len - skip;
+		if (ringbuf_reserve(&s->backlog, s->backlog.len + len) != 0)
+		{
+			return -ENOMEM;
+		}
+		ringbuf_writable(&s->backlog, seg);
+		first = len < seg[0].iov_len ? len : seg[0].iov_len;
+		memcpy(seg[0].iov_base, (char*)iov[i].iov_base + skip, first);
+		if (len > first)
+		{
+			memcpy(seg[1].iov_base, (char*)iov[i].iov_base + skip + first,
+				   len - first);
+		}
+		ringbuf_produce(&s->backlog, len);
+		skip = 0;
+	}
+	return 0;
+}
+
+/**
+ * Disconnect a session using shared memory, the loop reports the shutdown
+ * to session_recv()
+ */
+static void session_shm_abort(struct session *s, const char *reason)
+{
+	DBG("FD_SERVER disconnecting %d, %s\n", s->fd, reason);
+	s->closing = true;
+	shutdown(s->fd, SHUT_RDWR);
+}
+
+/**
+ * Send over the shared memory ring, in order after the backlog. The session
+ * gets disconnected if the data can't be queued, as the stream would be
+ * incomplete.
+ */
+static int session_shm_send(struct session *s, const struct iovec *iov,
+							int count)
+{
+	ssize_t done = 0;
+
+	if (!s->backlog.len)
+	{
+		done = shm_write(&s->shm, iov, count);
+		if (done < 0)
+		{
+			session_shm_abort(s, "invalid ring state");
+			return done;
+		}
+	}
+	if (session_backlog(s, iov, count, done) != 0)
+	{
+		session_shm_abort(s, "out of memory");
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/**
+ * Move the backlog to the ring as far as the client made space
+ */
+static void session_shm_flush(struct session *s)
+{
+	struct iovec seg[2];
+	ssize_t len;
+	int count;
+
+	while (s->backlog.len)
+	{
+		count = ringbuf_peek(&s->backlog, 0, s->backlog.len, seg);
+		len = shm_write(&s->shm, seg, count);
+		if (len < 0)
+		{
+			session_shm_abort(s, "invalid ring state");
+			return;
+		}
+		if (!len)
+		{
+			return;
+		}
+		ringbuf_consume(&s->backlog, len);
+	}
+}
+
+/**
+ * Data not written to the client yet, see loop_queued()
+ */
+static size_t session_queued(struct session *s)
+{
+	if (s->shm.map)
+	{
+		return s->backlog.len;
+	}
+	return loop_queued(s->worker->loop, s->watch);
+}
+
+/**
+ * Process requests in the ring once the client rang the doorbell, or
+ * continue writing once it made space
+ */
+static void session_doorbell(struct loop *loop, struct watch *w, int fd,
+							 int revents, void *user)
+{
+	struct session *s = user;
+	struct iovec iov[2];
+	size_t len, total = 0;
+	int count, i;
+
+	shm_doorbell(&s->shm);
+	session_shm_flush(s);
+	do
+	{
+		while ((len = shm_readable(&s->shm)))
+		{
+			if (s->idle)
+			{
+				loop_timer_start(loop, s->idle, s->t->idle);
+			}
+			/* frames are passed in place, those wrapping the ring copied */
+			count = shm_peek(&s->shm, 0, len, iov);
+			for (i = 0; i < count; i++)
+			{
+				if (frame_decode(&s->dec, iov[i].iov_base, iov[i].iov_len,
+								 session_frame, s) != 0)
+				{
+					session_close(s);
+					return;
+				}
+			}
+			shm_consume(&s->shm, len);
+			total += len;
+			if (total >= s->shm.size)
+			{	/* let other sessions run, continue in the next iteration */
+				eventfd_write(s->shm.efd, 1);
+				return;
+			}
+		}
+	}
+	while (shm_sleep(&s->shm, 0));
+}
+
+/**
+ * Accept an offer to continue over shared memory, unless disabled. The fds
+ * are passed with the answer, which is sent directly if nothing is queued to
+ * keep it in order, frames following are exchanged over the rings.
+ */
+static void session_shm_offer(struct session *s, const void *data,
+							  size_t len)
+{
+	struct worker *w = s->worker;
+	uint8_t buf[FRAME_HDR + sizeof(uint32_t)];
+	char control[CMSG_SPACE(sizeof(int) * SHM_FDS)] = {};
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = sizeof(buf),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+	int fds[SHM_FDS];
+	uint32_t size;
+
+	if (len != sizeof(size) || s->shm.map || !s->t->shm ||
+		loop_queued(w->loop, s->watch))
+	{
+		tester_reply(s, CMD_UNKNOWN, NULL, 0);
+		return;
+	}
+	memcpy(&size, data, sizeof(size));
+	size = ntohl(size);
+	if (!size || size > s->t->shm)
+	{
+		size = s->t->shm;
+	}
+	if (shm_create(&s->shm, size, fds) != 0)
+	{
+		DBG("FD_SERVER creating shared memory failed\n");
+		tester_reply(s, CMD_UNKNOWN, NULL, 0);
+		return;
+	}
+	frame_header(buf, SHM_ACCEPT, sizeof(size));
+	size = htonl(s->shm.size);
+	memcpy(buf + FRAME_HDR, &size, sizeof(size));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (sendmsg(s->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(buf) ||
+		loop_add(w->loop, s->shm.efd, LOOP_READ, 0, session_doorbell, s,
+				 &s->shm_watch) != 0)
+	{	/* the client sees the socket closing if the answer got sent */
+		DBG("FD_SERVER passing shared memory failed\n");
+		close(fds[0]);
+		shm_destroy(&s->shm);
+		shutdown(s->fd, SHUT_RDWR);
+		return;
+	}
+	close(fds[0]);
+	DBG("FD_SERVER %d uses shared memory rings of %zu bytes\n", s->fd,
+		s->shm.size);
+}
+
+int tester_reply(struct session *s, enum packet_type type, const void *buf,
+				 size_t len)
+{
+	uint8_t hdr[FRAME_HDR];
+	struct iovec iov[] = {
+		{ .iov_base = hdr, .iov_len = sizeof(hdr), },
+		{ .iov_base = (void*)buf, .iov_len = len, },
+	};
+
+	frame_header(hdr, type, len);
+	if (s->shm.map)
+	{
+		return session_shm_send(s, iov, 2);
+	}
+	return loop_sendv(s->worker->loop, s->watch, iov, 2);
+}
+
+static void session_idle(struct loop *loop, struct loop_timer *timer,
+						 void *user)
+{
+	struct session *s = user;
+
+	DBG("FD_SERVER idle %d\n", s->fd);
+	session_close(s);
+}
+
+/**
+ * Start serving an accepted connection on the thread of a worker
+ */
+static void session_create(struct worker *w, int fd)
+{
+	struct session *s;
+
+	s = calloc(1, sizeof(*s));
+	s->fd = fd;
+	s->t = w->t;
+	s->worker = w;
+	s->dec.max = w->t->max_frame;
+	LIST_INIT(&s->subs);
+	if (loop_recv(w->loop, fd, session_recv, s, &s->watch) != 0)
+	{
+		__atomic_sub_fetch(&w->session_count, 1, __ATOMIC_RELAXED);
+		close(fd);
+		free(s);
+		return;
+	}
+	if (w->t->idle)
+	{
+		s->idle = loop_timer_create(w->loop, session_idle, s);
+		loop_timer_start(w->loop, s->idle, w->t->idle);
+	}
+	LIST_INSERT_HEAD(&w->sessions, s, entries);
+}
+
+/**
+ * Send an event to the subscribers of a worker, on its thread
+ */
+static void worker_event(struct worker *w, struct event *ev,
+						 struct loop_buf *msg, size_t size)
+{
+	struct tester *t = w->t;
+	struct subscription *sub;
+	struct session *s;
+	struct iovec iov;
+
+	LIST_FOREACH(sub, &ev->subs[w->index], by_event)
+	{
+		s = sub->s;
+		if (s->closing)
+		{
+			continue;
+		}
+		if (session_queued(s) + size > t->backlog)
+		{
+			if (t->policy == EVENT_DISCONNECT)
+			{	/* the loop reports the shutdown to session_recv() */
+				DBG("FD_SERVER disconnecting slow consumer %d\n", s->fd);
+				s->closing = true;
+				shutdown(s->fd, SHUT_RDWR);
+			}
+			else
+			{
+				DBG("FD_SERVER dropping event for slow consumer %d\n", s->fd);
+			}
+			continue;
+		}
+		if (s->shm.map)
+		{
+			iov.iov_base = (void*)loop_buf_data(msg, &iov.iov_len);
+			session_shm_send(s, &iov, 1);
+			continue;
+		}
+		loop_send_buf(w->loop, s->watch, msg);
+	}
+}
+
+/**
+ * Pass the result of offloaded work to its session, on the worker thread
+ */
+static void worker_done(struct worker *w, struct message *msg)
+{
+	struct session *s = msg->done.s;
+
+	s->refs--;
+	msg->done.done(w->t, s->closed || msg->done.canceled ? NULL : s,
+				   msg->done.data);
+	if (s->closed && !s->refs)
+	{
+		session_free(s);
+	}
+}
+
+static void worker_process(struct worker *w, struct message *msg)
+{
+	switch (msg->type)
+	{
+		case MSG_SESSION:
+			session_create(w, msg->fd);
+			break;
+		case MSG_EVENT:
+			worker_event(w, msg->event.ev, msg->event.buf, msg->event.size);
+			loop_buf_unref(msg->event.buf);
+			break;
+		case MSG_DONE:
+			worker_done(w, msg);
+			break;
+		case MSG_STOP:
+			w->stop = true;
+			break;
+	}
+	free(msg);
+}
+
+/**
+ * Queue a message to the thread of a worker, may be called from any thread
+ */
+static void worker_post(struct worker *w, struct message *msg)
+{
+	uint64_t one = 1;
+	bool wakeup;
+
+	pthread_mutex_lock(&w->mutex);
+	wakeup = !w->messages;
+	*w->last = msg;
+	w->last = &msg->next;
+	pthread_mutex_unlock(&w->mutex);
+	if (wakeup && write(w->efd, &one, sizeof(one)) < 0)
+	{
+		DBG("FD_SERVER waking up worker %d failed\n", w->index);
+	}
+}
+
+/**
+ * Process posted messages, the list is only taken after the eventfd got
+ * read, so a message posted concurrently is either taken or signalled again
+ */
+static void worker_wakeup(struct loop *loop, struct watch *watch, int fd,
+						  int revents, void *user)
+{
+	struct worker *w = user;
+	struct message *msg, *next;
+	uint64_t count;
+
+	if (read(w->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+	{
+		return;
+	}
+	pthread_mutex_lock(&w->mutex);
+	msg = w->messages;
+	w->messages = NULL;
+	w->last = &w->messages;
+	pthread_mutex_unlock(&w->mutex);
+
+	for (; msg; msg = next)
+	{
+		next = msg->next;
+		worker_process(w, msg);
+	}
+}
+
+static void *worker_run(void *user)
+{
+	struct worker *w = user;
+
+	current = w;
+	while (!w->stop)
+	{
+		if (loop_run_once(w->loop, -1) < 0 && errno != EINTR)
+		{
+			fprintf(stderr, "worker loop failed: %s\n", strerror(errno));
+			break;
+		}
+	}
+	ringbuf_pool_flush();
+	return NULL;
+}
+
+/**
+ * Pick the worker to assign a new connection to
+ */
+static struct worker *worker_select(struct tester *t)
+{
+	struct worker *w;
+	int i, load, min = INT_MAX;
+
+	if (t->balance == TESTER_ROUND_ROBIN)
+	{
+		w = &t->workers[t->next];
+		t->next = (t->next + 1) % t->worker_count;
+		return w;
+	}
+	w = &t->workers[0];
+	for (i = 0; i < t->worker_count; i++)
+	{
+		load = __atomic_load_n(&t->workers[i].session_count,
+							   __ATOMIC_RELAXED);
+		if (load < min)
+		{
+			min = load;
+			w = &t->workers[i];
+		}
 	}
+	return w;
+}
+
+static void listen_accept(struct loop *loop, struct watch *watch, int fd,
+						  void *user)
+{
+	struct tester *t = user;
+	struct message *msg;
+	struct worker *w;
+
+	if (fd < 0)
+	{
+		fprintf(stderr, "accept failed: %s\n", strerror(-fd));
+		return;
+	}
+	w = worker_select(t);
+	DBG("FD_LISTEN new client %d for worker %d\n", fd, w->index);
+
+	/* counted right away to balance connections accepted back to back */
+	__atomic_add_fetch(&w->session_count, 1, __ATOMIC_RELAXED);
+	if (!w->threaded)
+	{
+		session_create(w, fd);
+		return;
+	}
+	msg = calloc(1, sizeof(*msg));
+	msg->type = MSG_SESSION;
+	msg->fd = fd;
+	worker_post(w, msg);
+}
+
+static int worker_init(struct tester *t, struct worker *w, enum loop_type type,
+					   bool threaded)
+{
+	w->t = t;
+	w->index = w - t->workers;
+	w->threaded = threaded;
+	w->last = &w->messages;
+	LIST_INIT(&w->sessions);
+	pthread_mutex_init(&w->mutex, NULL);
+	w->loop = threaded ? loop_create(type) : t->loop;
+	if (!w->loop)
+	{
+		return -errno;
+	}
+	w->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (w->efd < 0 ||
+		loop_add(w->loop, w->efd, LOOP_READ, 0, worker_wakeup, w,
+				 &w->efd_watch) != 0)
+	{
+		return -errno;
+	}
+	if (!threaded)
+	{	/* runs on the thread calling tester_runio() */
+		current = w;
+		return 0;
+	}
+	errno = pthread_create(&w->thread, NULL, worker_run, w);
+	if (errno)
+	{
+		return -errno;
+	}
+	w->running = true;
 	return 0;
 }
 
+/**
+ * Stop the thread of a worker and release its sessions and messages
+ */
+static void worker_deinit(struct worker *w)
+{
+	struct message *msg;
+
+	if (w->running)
+	{
+		msg = calloc(1, sizeof(*msg));
+		msg->type = MSG_STOP;
+		worker_post(w, msg);
+		pthread_join(w->thread, NULL);
+	}
+	if (current == w)
+	{
+		current = NULL;
+	}
+	while (!LIST_EMPTY(&w->sessions))
+	{
+		session_close(LIST_FIRST(&w->sessions));
+	}
+	while ((msg = w->messages))
+	{
+		w->messages = msg->next;
+		if (msg->type == MSG_SESSION)
+		{
+			close(msg->fd);
+			free(msg);
+			continue;
+		}
+		/* sessions got closed, completions only release their data */
+		worker_process(w, msg);
+	}
+	if (w->efd_watch)
+	{
+		loop_del(w->loop, w->efd_watch);
+	}
+	if (w->efd > 0)
+	{
+		close(w->efd);
+	}
+	if (w->threaded && w->loop)
+	{
+		loop_destroy(w->loop);
+	}
+	pthread_mutex_destroy(&w->mutex);
+}
+
 struct tester *tester_create(tester_srvcb srvcb)
+{
+	return tester_create_loop(srvcb, LOOP_DEFAULT);
+}
+
+struct tester *tester_create_loop(tester_srvcb srvcb, enum loop_type type)
+{
+	return tester_create_threads(srvcb, type, 0, TESTER_ROUND_ROBIN);
+}
+
+struct tester *tester_create_threads(tester_srvcb srvcb, enum loop_type type,
+									 int threads, enum tester_balance balance)
 {
     struct sockaddr_un addr;
     struct tester *t;
-    int len;
+    int i, len;
 
     t = calloc(1, sizeof(*t));
     t->path = "/tmp/test.sock";
     t->srvcb = srvcb;
+    t->balance = balance;
+    t->listen = -1;
+    t->policy = EVENT_DROP;
+    t->backlog = TESTER_EVENT_BACKLOG;
+    t->shm = SHM_RING_DEFAULT;
+    t->max_frame = TESTER_MAX_FRAME;
+    LIST_INIT(&t->events);
+    pthread_rwlock_init(&t->events_lock, NULL);
 
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
     snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", t->path);
     len = offsetof(struct sockaddr_un, sun_path) + strlen(addr.sun_path);
 
-    t->pfd[FD_LISTEN].fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    t->pfd[FD_LISTEN].events = POLLIN;
-    t->pfd[FD_SERVER].fd = -1;
-    t->pfd[FD_SERVER].events = POLLIN;
+    t->loop = loop_create(type);
+    if (!t->loop)
+    {
+        fprintf(stderr, "creating event loop failed: %s\n", strerror(errno));
+        free(t);
+        return NULL;
+    }
+    /* without threads, sessions are served by the loop of the tester */
+    t->worker_count = threads > 0 ? threads : 1;
+    t->workers = calloc(t->worker_count, sizeof(*t->workers));
+    for (i = 0; i < t->worker_count; i++)
+    {
+        if (worker_init(t, &t->workers[i], type, threads > 0) != 0)
+        {
+            fprintf(stderr, "creating worker failed: %s\n", strerror(errno));
+            t->worker_count = i + 1;
+            tester_cleanup(t);
+            return NULL;
+        }
+    }
+    t->listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
     unlink(t->path);
-    if (bind(t->pfd[FD_LISTEN].fd, (struct sockaddr *)&addr, len) < 0)
+    if (bind(t->listen, (struct sockaddr *)&addr, len) < 0)
     {
         fprintf(stderr, "bind failed\n");
-        close(t->pfd[FD_LISTEN].fd );
-        free(t);
+        tester_cleanup(t);
         return NULL;
     }
-    listen(t->pfd[FD_LISTEN].fd, 2);
+    listen(t->listen, SOMAXCONN);
+    loop_accept(t->loop, t->listen, listen_accept, t, &t->listen_watch);
 
     return t;
 }
 
-static int update_ops(struct conn *c, enum fdops ops)
-{
-	int ret;
-
-	if (ops == c->ops)
-	{
-		return 0;
-	}
-	ret = c->fdcb(c, c->s, ops, c->user);
-	if (ret == 0)
-	{
-		c->ops = ops;
-	}
-	return -abs(ret);
-}
 
 void tester_complete(struct tester *t)
 {
 	t->complete = 1;
 }
 
+
+int tester_runonce(struct tester *t, int timeout)
+{
+	return loop_run_once(t->loop, timeout);
+}
+
 void tester_runio(struct tester *t, struct conn *c)
 {
-    int err = 0;
     while (!t->complete)
     {
-        int fd;
-        poll(t->pfd, sizeof(t->pfd)/sizeof(t->pfd[0]), -1);
-        if (t->pfd[FD_CLIENT].revents & POLLIN)
+        if (loop_run_once(t->loop, -1) < 0)
         {
-            struct response res;
-            printf("FD_CLIENT read : ");
-            res.pkt.received = recv(t->pfd[FD_CLIENT].fd, res.pkt.buf, sizeof(res.pkt.buf), 0);
-            printf("'%s'\n", res.pkt.buf);
-            c->reqs->cb(c, err, "do client callback function", &res, t);
-        }
-        if (t->pfd[FD_CLIENT].revents & POLLOUT)
-        {
-            printf("FD_CLIENT write : ");
-            write(c->s, c->reqs->buf, c->reqs->used);
-            printf("'%s'\n", c->reqs->buf);
-            update_ops(c, c->ops | READ);
-            update_ops(c, c->ops & ~WRITE);
-        }
-        if (t->pfd[FD_LISTEN].revents & POLLIN)
-        {
-            printf("FD_LISTEN new client ");
-            fd = accept(t->pfd[FD_LISTEN].fd, NULL, NULL);
-            t->pfd[FD_SERVER].fd = fd;
-            printf("%d\n", fd);
-        }
-        if (t->pfd[FD_SERVER].revents & POLLIN)
-        {
-            t->srvcb(t, t->pfd[FD_SERVER].fd);
+            fprintf(stderr, "event loop failed: %s\n", strerror(errno));
+            break;
         }
     }
+    t->complete = 0;
 }
 
 const char *tester_getpath(struct tester *t)
@@ -166,80 +1111,261 @@ const char *tester_getpath(struct tester *t)
 	return t->path;
 }
 
-void tester_cleanup(struct tester *t)
+const char *tester_get_backend(struct tester *t)
 {
-	close(t->pfd[FD_LISTEN].fd);
-	close(t->pfd[FD_SERVER].fd);
-	free(t);
+	return loop_get_name(t->loop);
 }
 
-static int connect_and_fcntl(int fd, const char *path)
+int tester_get_sessions(struct tester *t)
 {
-	struct sockaddr_un addr;
-	int len, flags;
+	int i, count = 0;
+
+	for (i = 0; i < t->worker_count; i++)
+	{
+		count += __atomic_load_n(&t->workers[i].session_count,
+								 __ATOMIC_RELAXED);
+	}
+	return count;
+}
 
-	memset(&addr, 0, sizeof(addr));
-	addr.sun_family = AF_UNIX;
-	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
-	len = offsetof(struct sockaddr_un, sun_path) + strlen(addr.sun_path);
+int tester_add_event(struct tester *t, const char *name)
+{
+	struct event *ev;
+	int i;
 
-	if (connect(fd, (struct sockaddr*)&addr, len) != 0)
+	if (strlen(name) > UINT8_MAX)
 	{
-		return -errno;
+		return -ENAMETOOLONG;
 	}
-	flags = fcntl(fd, F_GETFL);
-	if (flags == -1)
+	if (find_event(t, name, strlen(name)))
 	{
-		return -errno;
+		return -EEXIST;
 	}
-#ifdef O_CLOEXEC
-	flags |= O_CLOEXEC;
-#endif
-	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+	ev = calloc(1, sizeof(*ev));
+	ev->name = strdup(name);
+	ev->subs = calloc(t->worker_count, sizeof(*ev->subs));
+	for (i = 0; i < t->worker_count; i++)
 	{
-		return -errno;
+		LIST_INIT(&ev->subs[i]);
 	}
+	pthread_rwlock_wrlock(&t->events_lock);
+	LIST_INSERT_HEAD(&t->events, ev, entries);
+	pthread_rwlock_unlock(&t->events_lock);
 	return 0;
 }
 
-int connect_unix(const char *path, fdcb fdcb, void *user, struct conn **cp)
+void tester_set_event_policy(struct tester *t, enum event_policy policy,
+							 size_t backlog)
 {
-    struct conn *c;
+	t->policy = policy;
+	t->backlog = backlog;
+}
 
-    c = calloc(1, sizeof(*c));
-    c->fdcb = fdcb;
-    c->user = user;
+int tester_event(struct tester *t, const char *name, const void *buf,
+				 size_t len)
+{
+	struct loop_buf *encoded;
+	struct message *msg;
+	struct worker *w;
+	struct event *ev;
+	uint8_t hdr[FRAME_HDR + 1];
+	struct iovec iov[3];
+	size_t size;
+	int i;
 
-    c->s = socket(AF_UNIX, SOCK_STREAM, 0);
-    connect_and_fcntl(c->s, path);
-    *cp = c;
+	ev = find_event(t, name, strlen(name));
+	if (!ev)
+	{
+		return -ENOENT;
+	}
+	if (!__atomic_load_n(&ev->count, __ATOMIC_RELAXED))
+	{
+		return 0;
+	}
+	/* encoded once as length prefixed name and data, shared by all */
+	frame_header(hdr, EVENT, 1 + strlen(ev->name) + len);
+	hdr[FRAME_HDR] = strlen(ev->name);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = ev->name;
+	iov[1].iov_len = strlen(ev->name);
+	iov[2].iov_base = (void*)buf;
+	iov[2].iov_len = len;
+	encoded = loop_buf_create(iov, 3);
+	size = sizeof(hdr) + strlen(ev->name) + len;
 
-    return 0;
+	for (i = 0; i < t->worker_count; i++)
+	{
+		w = &t->workers[i];
+		if (w == current)
+		{
+			worker_event(w, ev, encoded, size);
+			continue;
+		}
+		msg = calloc(1, sizeof(*msg));
+		msg->type = MSG_EVENT;
+		msg->event.ev = ev;
+		msg->event.buf = loop_buf_ref(encoded);
+		msg->event.size = size;
+		worker_post(w, msg);
+	}
+	loop_buf_unref(encoded);
+	return 0;
 }
 
-static int create_request(enum packet_type type, const char *name, struct request **rp)
+void tester_set_idle_timeout(struct tester *t, unsigned int ms)
 {
-    struct request *req;
-    
-    req = calloc(1, sizeof(*req));
-    req->used = strlen(name) + 1;
-    req->buf = malloc(req->used);
-    memcpy(req->buf, name, req->used);
-    *rp = req;
-    return 0;
+	t->idle = ms;
 }
 
-int new_cmd(const char *cmd, struct request **rp)
+void tester_set_max_frame(struct tester *t, size_t max)
 {
-	return create_request(CMD_REQUEST, cmd, rp);
+	t->max_frame = max;
 }
 
-int queue(struct conn *c, struct request *r, callback cmd_cb, void *user)
+void tester_set_shm(struct tester *t, size_t size)
 {
-    r->cb = cmd_cb;
-    r->user = user;
+	t->shm = size;
+}
 
-    c->reqs = r;
+void tester_set_timeout(struct tester *t, struct conn *c, unsigned int ms)
+{
+	conn_set_timercb(c, tester_timercb);
+	conn_set_timeout(c, ms);
+}
 
-    return update_ops(c, c->ops | WRITE);
+void tester_set_processor(struct tester *t, struct processor_t *processor)
+{
+	t->processor = processor;
+}
+
+#ifdef HAVE_LIBPROCESSOR
+
+/**
+ * Work offloaded to the processor
+ */
+struct offload
+{
+	job_t public;
+	struct worker *w;
+	struct session *s;
+	tester_work work;
+	tester_done done;
+	void *data;
+	/* not set if dropped from the queue or canceled */
+	bool executed;
+};
+
+/**
+ * Pass the work back to the loop thread of its session
+ */
+static void offload_post(struct offload *this, bool canceled)
+{
+	struct message *msg;
+
+	msg = calloc(1, sizeof(*msg));
+	msg->type = MSG_DONE;
+	msg->done.s = this->s;
+	msg->done.done = this->done;
+	msg->done.data = this->data;
+	msg->done.canceled = canceled;
+	worker_post(this->w, msg);
+}
+
+static job_requeue_t offload_execute(job_t *job)
+{
+	struct offload *this = (struct offload*)job;
+
+	this->work(this->data);
+	this->executed = true;
+	offload_post(this, false);
+	return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_NONE };
+}
+
+static job_priority_t offload_get_priority(job_t *job)
+{
+	return JOB_PRIO_MEDIUM;
+}
+
+static void offload_destroy(job_t *job)
+{
+	struct offload *this = (struct offload*)job;
+
+	if (!this->executed)
+	{	/* the session still holds a ref for it */
+		offload_post(this, true);
+	}
+	free(this);
+}
+
+int tester_offload(struct session *s, tester_work work, tester_done done,
+				   void *data)
+{
+	struct processor_t *processor = s->t->processor;
+	struct offload *this;
+	int ret;
+
+	if (!processor)
+	{
+		return -ENOTSUP;
+	}
+	this = calloc(1, sizeof(*this));
+	this->public.execute = offload_execute;
+	this->public.get_priority = offload_get_priority;
+	this->public.destroy = offload_destroy;
+	this->w = s->worker;
+	this->s = s;
+	this->work = work;
+	this->done = done;
+	this->data = data;
+
+	s->refs++;
+	ret = processor->queue_job(processor, &this->public);
+	if (ret != 0)
+	{
+		s->refs--;
+		free(this);
+	}
+	return ret;
+}
+
+#else /* HAVE_LIBPROCESSOR */
+
+int tester_offload(struct session *s, tester_work work, tester_done done,
+				   void *data)
+{
+	return -ENOTSUP;
+}
+
+#endif /* HAVE_LIBPROCESSOR */
+
+void tester_cleanup(struct tester *t)
+{
+	struct event *ev;
+	int i;
+
+	for (i = 0; i < t->worker_count; i++)
+	{
+		worker_deinit(&t->workers[i]);
+	}
+	while ((ev = LIST_FIRST(&t->events)))
+	{
+		LIST_REMOVE(ev, entries);
+		free(ev->subs);
+		free(ev->name);
+		free(ev);
+	}
+	pthread_rwlock_destroy(&t->events_lock);
+	if (t->listen_watch)
+	{
+		loop_del(t->loop, t->listen_watch);
+	}
+	if (t->listen >= 0)
+	{
+		close(t->listen);
+		unlink(t->path);
+	}
+	loop_destroy(t->loop);
+	free(t->workers);
+	free(t);
 }
@@ -1,44 +1,93 @@
 #ifndef __MY_DAVICI_T__
 #define __MY_DAVICI_T__
 
-enum packet_type {
-	CMD_REQUEST = 0,
-	CMD_RESPONSE = 1,
-	CMD_UNKNOWN = 2,
-	EVENT_REGISTER = 3,
-	EVENT_UNREGISTER = 4,
-	EVENT_CONFIRM = 5,
-	EVENT_UNKNOWN = 6,
-	EVENT = 7,
-};
+#include <stddef.h>
+#include <sys/uio.h>
+#include "loop.h"
+#include "client.h"
 
 struct tester;
-struct conn;
-struct response;
-struct request;
-
-enum fdops {
-	/** request read-ready notifications */
-	READ = (1<<0),
-	/** request write-ready notifications */
-	WRITE = (1<<1),
+struct session;
+struct processor_t;
+
+/**
+ * Handling of event subscribers not reading fast enough
+ */
+enum event_policy {
+	/** events exceeding the backlog are not sent to the subscriber */
+	EVENT_DROP,
+	/** subscribers exceeding the backlog get disconnected */
+	EVENT_DISCONNECT,
 };
 
-typedef void (*callback)(struct conn *conn, int err, const char *name, struct response *res, void *user);
-typedef void (*tester_srvcb)(struct tester *tester, int fd);
-typedef int (*fdcb)(struct conn *conn, int fd, int ops, void *user);
+/**
+ * Default number of bytes queued to a subscriber before applying the policy
+ */
+#define TESTER_EVENT_BACKLOG (1024 * 1024)
 
+/**
+ * Default maximum payload of a request accepted from a client
+ */
+#define TESTER_MAX_FRAME (16 * 1024 * 1024)
+
+/**
+ * Assignment of accepted connections to the loop threads of a tester
+ */
+enum tester_balance {
+	/** each thread in turn */
+	TESTER_ROUND_ROBIN,
+	/** the thread serving the fewest connections */
+	TESTER_LEAST_SESSIONS,
+};
+
+typedef void (*tester_srvcb)(struct tester *tester, struct session *s,
+							 enum packet_type type, const void *buf,
+							 size_t len);
+/* work offloaded with tester_offload(), runs on a processor thread */
+typedef void (*tester_work)(void *data);
+/* invoked on the loop thread of the session once the work is done, s is NULL
+ * if the session got closed in the meantime, or if the processor dropped or
+ * canceled the work without running it */
+typedef void (*tester_done)(struct tester *tester, struct session *s,
+							void *data);
 
 struct tester* tester_create(tester_srvcb srvcb);
+struct tester* tester_create_loop(tester_srvcb srvcb, enum loop_type type);
+struct tester* tester_create_threads(tester_srvcb srvcb, enum loop_type type,
+									 int threads, enum tester_balance balance);
+const char *tester_get_backend(struct tester *t);
+int tester_reply(struct session *s, enum packet_type type, const void *buf,
+				 size_t len);
+/* fdcb and timercb running client connections in the loop of the tester */
 int tester_iocb(struct conn *c, int fd, int ops, void *user);
+void tester_timercb(struct conn *c, int ms, void *user);
+int tester_add_event(struct tester *t, const char *name);
+int tester_event(struct tester *t, const char *name, const void *buf,
+				 size_t len);
+void tester_set_event_policy(struct tester *t, enum event_policy policy,
+							 size_t backlog);
+/* cancel the processor before calling tester_cleanup() */
+void tester_set_processor(struct tester *t, struct processor_t *processor);
+int tester_offload(struct session *s, tester_work work, tester_done done,
+				   void *data);
+/* close sessions not sending anything for ms, 0 to disable, set before
+ * connections get accepted */
+void tester_set_idle_timeout(struct tester *t, unsigned int ms);
+/* close sessions sending requests with a payload larger than max, 0 for no
+ * limit, set before connections get accepted. Defaults to TESTER_MAX_FRAME */
+void tester_set_max_frame(struct tester *t, size_t max);
+/* maximum size of the shared memory rings clients may use per direction,
+ * see conn_set_shm(), 0 to refuse. Defaults to 4 MB */
+void tester_set_shm(struct tester *t, size_t size);
+/* complete requests of a tester_iocb() connection not answered within ms
+ * with -ETIMEDOUT, 0 to disable */
+void tester_set_timeout(struct tester *t, struct conn *c, unsigned int ms);
 void tester_runio(struct tester *t, struct conn *c);
+int tester_runonce(struct tester *t, int timeout);
 void tester_complete(struct tester *t);
 const char *tester_getpath(struct tester *tester);
+int tester_get_sessions(struct tester *t);
+void tester_set_debug(int level);
 void tester_cleanup(struct tester *t);
 
-int connect_unix(const char *path, fdcb fdcb, void *user, struct conn **cp);
-
-
-int new_cmd(const char *cmd, struct request **rp);
-int queue(struct conn *c, struct request *r, callback cmd_cb, void *user);
 #endif
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "tester.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/**
+ * Connects an increasing number of clients to a single tester, then sends one
+ * echo request over each of them. Reports the time to accept all clients, the
+ * time until every client got its response and the memory the then idle
+ * connections occupy.
+ */
+
+/* clients connected before the listener gets to accept them */
+#define BATCH 256
+
+struct bench {
+	struct tester *t;
+	int pending;
+};
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static long rss_kb()
+{
+	long pages = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f)
+	{
+		fscanf(f, "%*s %ld", &pages);
+		fclose(f);
+	}
+	return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
+{
+	tester_reply(s, CMD_RESPONSE, buf, len);
+}
+
+static void client_cb(struct conn *c, int err, const char *name,
+					  struct response *res, void *user)
+{
+	struct bench *b = user;
+
+	if (--b->pending == 0)
+	{
+		tester_complete(b->t);
+	}
+}
+
+/**
+ * Raise the fd limit as far as allowed, each client needs two fds
+ */
+static int max_clients()
+{
+	struct rlimit rl;
+
+	getrlimit(RLIMIT_NOFILE, &rl);
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+	getrlimit(RLIMIT_NOFILE, &rl);
+	return (rl.rlim_cur - 32) / 2;
+}
+
+static void run(int count)
+{
+	struct bench b = {};
+	struct conn **conns;
+	struct request *r;
+	uint64_t start, connected, rtt;
+	long rss;
+	int i, batch;
+
+	b.t = tester_create(server_cb);
+	if (!b.t)
+	{
+		return;
+	}
+	conns = calloc(count, sizeof(*conns));
+
+	rss = rss_kb();
+	start = now_us();
+	for (i = 0; i < count; i += batch)
+	{
+		batch = count - i < BATCH ? count - i : BATCH;
+		for (int j = i; j < i + batch; j++)
+		{
+			while (connect_unix(tester_getpath(b.t), tester_iocb, b.t,
+								&conns[j]) == -EAGAIN)
+			{	/* listen backlog full, let the server accept */
+				tester_runonce(b.t, 0);
+			}
+		}
+		while (tester_get_sessions(b.t) < i + batch)
+		{
+			tester_runonce(b.t, 1000);
+		}
+	}
+	connected = now_us() - start;
+
+	start = now_us();
+	b.pending = count;
+	for (i = 0; i < count; i++)
+	{
+		new_cmd("ping", &r);
+		queue(conns[i], r, client_cb, &b);
+	}
+	tester_runio(b.t, NULL);
+	rtt = now_us() - start;
+
+	printf("%6d clients  connect %7.2f ms  round-trip %7.2f ms  "
+		   "(%5.2f us/client)  idle %5.2f KB/client\n", count,
+		   connected / 1000.0, rtt / 1000.0, (double)rtt / count,
+		   (double)(rss_kb() - rss) / count);
+
+	for (i = 0; i < count; i++)
+	{
+		disconnect(conns[i]);
+	}
+	free(conns);
+	tester_cleanup(b.t);
+}
+
+int main(int argc, char **argv)
+{
+	int counts[] = { 100, 1000, 10000 };
+	int i, max;
+
+	tester_set_debug(0);
+	max = max_clients();
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+	{
+		if (counts[i] > max)
+		{
+			printf("%6d clients  capped to %d by RLIMIT_NOFILE\n", counts[i],
+				   max);
+			counts[i] = max;
+		}
+		run(counts[i]);
+	}
+	return 0;
+}
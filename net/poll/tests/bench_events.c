@@ -0,0 +1,143 @@
+#include "tester.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Streams events to many subscribers, each event is encoded once and shared
+ * by all of them. An additional subscriber never reads, it gets its events
+ * dropped or gets disconnected once its backlog is exceeded.
+ */
+
+#define SUBSCRIBERS 1000
+#define EVENTS 1000
+#define EVENT_SIZE 128
+#define BATCH 64
+#define BACKLOG (64 * 1024)
+
+struct bench {
+	struct tester *t;
+	int confirmed;
+	uint64_t received;
+	int failed;
+};
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
+{
+	tester_reply(s, CMD_RESPONSE, buf, len);
+}
+
+static void state_cb(struct conn *c, int err, const char *name,
+					 struct response *res, void *user)
+{
+	struct bench *b = user;
+	size_t len;
+
+	if (err)
+	{
+		b->failed++;
+		return;
+	}
+	response_get_data(res, &len);
+	if (len == EVENT_SIZE)
+	{
+		b->received++;
+	}
+}
+
+static void confirm_cb(struct conn *c, int err, const char *name,
+					   struct response *res, void *user)
+{
+	struct bench *b = user;
+
+	/* queued after the registration, so that got confirmed too */
+	if (++b->confirmed == SUBSCRIBERS)
+	{
+		tester_complete(b->t);
+	}
+}
+
+/**
+ * The slow subscriber is not watched by the loop, so it never reads
+ */
+static int slow_fdcb(struct conn *c, int fd, int ops, void *user)
+{
+	return 0;
+}
+
+static void run(enum event_policy policy)
+{
+	struct bench b = {};
+	struct conn **conns, *slow;
+	struct request *r;
+	char data[EVENT_SIZE];
+	uint64_t start;
+	int i, pushed = 0;
+
+	b.t = tester_create(server_cb);
+	if (!b.t)
+	{
+		return;
+	}
+	tester_add_event(b.t, "state");
+	tester_set_event_policy(b.t, policy, BACKLOG);
+	memset(data, 'e', sizeof(data));
+
+	conns = calloc(SUBSCRIBERS, sizeof(*conns));
+	for (i = 0; i < SUBSCRIBERS; i++)
+	{
+		connect_unix(tester_getpath(b.t), tester_iocb, b.t, &conns[i]);
+		register_event(conns[i], "state", state_cb, &b);
+		new_cmd("ping", &r);
+		queue(conns[i], r, confirm_cb, &b);
+	}
+	connect_unix(tester_getpath(b.t), slow_fdcb, NULL, &slow);
+	register_event(slow, "state", state_cb, &b);
+	tester_runio(b.t, NULL);
+
+	start = now_us();
+	while (pushed < EVENTS)
+	{
+		for (i = 0; i < BATCH && pushed < EVENTS; i++, pushed++)
+		{
+			tester_event(b.t, "state", data, sizeof(data));
+		}
+		while (b.received < (uint64_t)pushed * SUBSCRIBERS)
+		{
+			tester_runonce(b.t, 100);
+		}
+	}
+	start = now_us() - start;
+
+	printf("%-10s %d events to %d subscribers in %7.2f ms  %9.0f events/s  "
+		   "%d sessions left\n", policy == EVENT_DROP ? "drop" : "disconnect",
+		   EVENTS, SUBSCRIBERS, start / 1000.0,
+		   b.received * 1000000.0 / start, tester_get_sessions(b.t));
+
+	for (i = 0; i < SUBSCRIBERS; i++)
+	{
+		disconnect(conns[i]);
+	}
+	disconnect(slow);
+	free(conns);
+	tester_cleanup(b.t);
+}
+
+int main(int argc, char **argv)
+{
+	tester_set_debug(0);
+	run(EVENT_DROP);
+	run(EVENT_DISCONNECT);
+	return 0;
+}
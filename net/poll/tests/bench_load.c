@@ -0,0 +1,389 @@
+#include "tester.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Load generator for the echo path over the Unix socket of the tester.
+ *
+ * Closed loop (default), each connection keeps a number of requests
+ * outstanding and sends the next one once a response arrived. Open loop
+ * (-r), requests are sent at a fixed rate regardless of the responses, and
+ * latency is measured from the time a request should have been sent, so a
+ * stalled server shows up in the latency instead of lowering the rate. Due
+ * requests are sent once per ms, which adds up to a ms to their latency.
+ *
+ * Requests are sized by a weighted mix, e.g. -s 64:90,4096:9,65536:1.
+ */
+
+#define MAX_MIX 16
+/* sub-buckets per power of two, about 3% precision */
+#define HIST_SUB 32
+#define HIST_BUCKETS (60 * HIST_SUB)
+
+struct mix {
+	size_t size;
+	int weight;
+};
+
+struct bench {
+	struct tester *t;
+	int conns;
+	int depth;
+	uint64_t rate;
+	int duration;
+	int threads;
+	struct mix mix[MAX_MIX];
+	int mix_count;
+	int mix_total;
+	unsigned int seed;
+	bool running;
+	uint64_t sent;
+	uint64_t done;
+	uint64_t failed;
+	uint64_t bytes;
+	uint64_t hist[HIST_BUCKETS];
+	uint64_t max;
+};
+
+/**
+ * Send times of the requests a connection waits for, in order
+ */
+struct client {
+	struct bench *b;
+	struct conn *c;
+	uint64_t *starts;
+	size_t size;
+	size_t head;
+	size_t count;
+};
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int hist_index(uint64_t us)
+{
+	int e;
+
+	if (us < HIST_SUB)
+	{
+		return us;
+	}
+	e = 63 - __builtin_clzll(us);
+	return (e - 4) * HIST_SUB + ((us >> (e - 5)) & (HIST_SUB - 1));
+}
+
+/**
+ * Lowest latency in us counted in a bucket
+ */
+static uint64_t hist_value(int index)
+{
+	int e;
+
+	if (index < HIST_SUB)
+	{
+		return index;
+	}
+	e = index / HIST_SUB + 4;
+	return (uint64_t)(HIST_SUB + index % HIST_SUB) << (e - 5);
+}
+
+static uint64_t percentile(struct bench *b, double p)
+{
+	uint64_t want, seen = 0;
+	int i;
+
+	want = b->done * p / 100.0;
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += b->hist[i];
+		if (seen > want)
+		{
+			return hist_value(i);
+		}
+	}
+	return b->max;
+}
+
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
+{
+	tester_reply(s, CMD_RESPONSE, buf, len);
+}
+
+static size_t pick_size(struct bench *b)
+{
+	int i, w;
+
+	w = rand_r(&b->seed) % b->mix_total;
+	for (i = 0; i < b->mix_count - 1; i++)
+	{
+		w -= b->mix[i].weight;
+		if (w < 0)
+		{
+			break;
+		}
+	}
+	return b->mix[i].size;
+}
+
+static void client_cb(struct conn *c, int err, const char *name,
+					  struct response *res, void *user);
+
+/**
+ * Queue a request, latency is measured from start
+ */
+static void client_send(struct client *cl, uint64_t start)
+{
+	struct bench *b = cl->b;
+	struct request *r;
+	size_t len;
+	char *buf;
+
+	if (cl->count == cl->size)
+	{
+		cl->size = cl->size ? cl->size * 2 : 16;
+		cl->starts = realloc(cl->starts, cl->size * sizeof(*cl->starts));
+		/* unwrap the ring into the grown array */
+		memmove(cl->starts + cl->count, cl->starts, cl->head *
+				sizeof(*cl->starts));
+		memmove(cl->starts, cl->starts + cl->head, cl->count *
+				sizeof(*cl->starts));
+		cl->head = 0;
+	}
+	cl->starts[(cl->head + cl->count++) % cl->size] = start;
+
+	len = pick_size(b);
+	buf = malloc(len);
+	memset(buf, 'x', len);
+	new_cmd_buf(buf, len, &r);
+	b->sent++;
+	b->bytes += len;
+	queue(cl->c, r, client_cb, cl);
+}
+
+static void client_cb(struct conn *c, int err, const char *name,
+					  struct response *res, void *user)
+{
+	struct client *cl = user;
+	struct bench *b = cl->b;
+	uint64_t us;
+
+	us = now_us() - cl->starts[cl->head];
+	cl->head = (cl->head + 1) % cl->size;
+	cl->count--;
+	b->done++;
+	if (err)
+	{
+		b->failed++;
+	}
+	b->hist[hist_index(us)]++;
+	if (us > b->max)
+	{
+		b->max = us;
+	}
+	if (b->running && !b->rate)
+	{
+		client_send(cl, now_us());
+	}
+}
+
+static void report(struct bench *b, uint64_t elapsed)
+{
+	uint64_t peak = 0, count;
+	int i, j, bar;
+
+	printf("%s backend, %d server threads, %d connections, ",
+		   tester_get_backend(b->t), b->threads, b->conns);
+	if (b->rate)
+	{
+		printf("open loop at %lu req/s\n", (unsigned long)b->rate);
+	}
+	else
+	{
+		printf("closed loop with %d outstanding each\n", b->depth);
+	}
+	printf("%lu requests, %lu failed in %.2f s: %.0f req/s, %.2f MB/s\n",
+		   (unsigned long)b->done, (unsigned long)b->failed, elapsed / 1e6,
+		   b->done * 1e6 / elapsed, b->bytes / (double)elapsed);
+	printf("latency us: p50 %lu  p90 %lu  p99 %lu  p999 %lu  max %lu\n",
+		   (unsigned long)percentile(b, 50), (unsigned long)percentile(b, 90),
+		   (unsigned long)percentile(b, 99), (unsigned long)percentile(b, 99.9),
+		   (unsigned long)b->max);
+
+	/* one line per power of two */
+	for (i = 0; i < HIST_BUCKETS; i += HIST_SUB)
+	{
+		for (count = 0, j = i; j < i + HIST_SUB; j++)
+		{
+			count += b->hist[j];
+		}
+		peak = count > peak ? count : peak;
+	}
+	for (i = 0; i < HIST_BUCKETS && peak; i += HIST_SUB)
+	{
+		for (count = 0, j = i; j < i + HIST_SUB; j++)
+		{
+			count += b->hist[j];
+		}
+		if (!count)
+		{
+			continue;
+		}
+		bar = count * 50 / peak;
+		printf("  >= %8lu us %10lu %6.2f%% %.*s\n",
+			   (unsigned long)hist_value(i), (unsigned long)count,
+			   count * 100.0 / b->done, bar > 0 ? bar : 1,
+			   "##################################################");
+	}
+}
+
+static int parse_mix(struct bench *b, char *arg)
+{
+	char *pos, *size;
+
+	b->mix_count = b->mix_total = 0;
+	for (size = strtok_r(arg, ",", &pos); size && b->mix_count < MAX_MIX;
+		 size = strtok_r(NULL, ",", &pos))
+	{
+		b->mix[b->mix_count].size = strtoul(size, &size, 10);
+		b->mix[b->mix_count].weight = *size == ':' ? atoi(size + 1) : 1;
+		if (b->mix[b->mix_count].weight <= 0)
+		{
+			return -1;
+		}
+		b->mix_total += b->mix[b->mix_count++].weight;
+	}
+	return b->mix_count ? 0 : -1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-c connections] [-p outstanding] "
+			"[-r req/s] [-d seconds] [-s size[:weight],...] [-t threads]\n"
+			"  -r sends at a fixed rate instead of waiting for responses\n"
+			"  the backend is selected with $LOOP_BACKEND\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.conns = 16,
+		.depth = 4,
+		.duration = 5,
+		.mix = { { .size = 64, .weight = 1, }, },
+		.mix_count = 1,
+		.mix_total = 1,
+		.seed = 1,
+	};
+	struct client *clients;
+	uint64_t start, end, due;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "c:p:r:d:s:t:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'c':
+				b.conns = atoi(optarg);
+				break;
+			case 'p':
+				b.depth = atoi(optarg);
+				break;
+			case 'r':
+				b.rate = strtoull(optarg, NULL, 10);
+				break;
+			case 'd':
+				b.duration = atoi(optarg);
+				break;
+			case 's':
+				if (parse_mix(&b, optarg) != 0)
+				{
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 't':
+				b.threads = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (b.conns <= 0 || b.depth <= 0 || b.duration <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	tester_set_debug(0);
+	b.t = tester_create_threads(server_cb, LOOP_DEFAULT, b.threads,
+								TESTER_LEAST_SESSIONS);
+	if (!b.t)
+	{
+		return 1;
+	}
+	clients = calloc(b.conns, sizeof(*clients));
+	for (i = 0; i < b.conns; i++)
+	{
+		clients[i].b = &b;
+		while (connect_unix(tester_getpath(b.t), tester_iocb, b.t,
+							&clients[i].c) == -EAGAIN)
+		{	/* listen backlog full, let the server accept */
+			tester_runonce(b.t, 0);
+		}
+	}
+
+	b.running = true;
+	start = now_us();
+	end = start + b.duration * 1000000ULL;
+	if (!b.rate)
+	{
+		for (i = 0; i < b.conns * b.depth; i++)
+		{
+			client_send(&clients[i % b.conns], start);
+		}
+	}
+	while (now_us() < end)
+	{
+		if (b.rate)
+		{	/* catch up with the schedule, spread over the connections */
+			due = (now_us() - start) * b.rate / 1000000;
+			while (b.sent < due)
+			{
+				client_send(&clients[b.sent % b.conns],
+							start + b.sent * 1000000 / b.rate);
+			}
+		}
+		tester_runonce(b.t, 1);
+	}
+	b.running = false;
+	end = now_us();
+	/* latency of the remaining requests still counts */
+	while (b.done < b.sent && now_us() < end + 5000000)
+	{
+		tester_runonce(b.t, 10);
+	}
+
+	report(&b, end - start);
+
+	for (i = 0; i < b.conns; i++)
+	{
+		disconnect(clients[i].c);
+		free(clients[i].starts);
+	}
+	free(clients);
+	tester_cleanup(b.t);
+	return b.failed || b.done < b.sent;
+}
@@ -0,0 +1,126 @@
+#include "tester.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Loads a batch of commands over a single connection, once waiting for each
+ * response before queueing the next command, and once queueing all of them
+ * up front so they are pipelined. Large payloads are pipelined as well, to
+ * exercise partial writes.
+ */
+
+#define COMMANDS 100000
+#define LARGE_COMMANDS 1000
+#define LARGE_SIZE (256 * 1024)
+
+struct bench {
+	struct tester *t;
+	struct conn *c;
+	int commands;
+	size_t size;
+	int queued;
+	int done;
+	int failed;
+	int pipelined;
+};
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void client_cb(struct conn *c, int err, const char *name,
+					  struct response *res, void *user);
+
+static void queue_cmd(struct bench *b)
+{
+	struct request *r;
+	void *buf;
+
+	b->queued++;
+	if (b->size)
+	{
+		buf = malloc(b->size);
+		memset(buf, 'x', b->size);
+		new_cmd_buf(buf, b->size, &r);
+	}
+	else
+	{
+		new_cmd("set key value", &r);
+	}
+	queue(b->c, r, client_cb, b);
+}
+
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
+{
+	tester_reply(s, CMD_RESPONSE, buf, len);
+}
+
+static void client_cb(struct conn *c, int err, const char *name,
+					  struct response *res, void *user)
+{
+	struct bench *b = user;
+
+	if (err)
+	{
+		b->failed++;
+	}
+	if (++b->done == b->commands)
+	{
+		tester_complete(b->t);
+	}
+	else if (!b->pipelined && b->queued < b->commands)
+	{
+		queue_cmd(b);
+	}
+}
+
+static void run(const char *name, int pipelined, int commands, size_t size)
+{
+	struct bench b = {
+		.pipelined = pipelined,
+		.commands = commands,
+		.size = size,
+	};
+	uint64_t start;
+
+	b.t = tester_create(server_cb);
+	if (!b.t)
+	{
+		return;
+	}
+	connect_unix(tester_getpath(b.t), tester_iocb, b.t, &b.c);
+
+	start = now_us();
+	do
+	{
+		queue_cmd(&b);
+	}
+	while (pipelined && b.queued < commands);
+	tester_runio(b.t, NULL);
+	start = now_us() - start;
+
+	printf("%-10s %6d commands in %7.2f ms  %8.0f cmd/s  %7.1f MB/s  "
+		   "%d failed\n", name, commands, start / 1000.0,
+		   commands * 1000000.0 / start, commands * (double)size / start,
+		   b.failed);
+
+	disconnect(b.c);
+	tester_cleanup(b.t);
+}
+
+int main(int argc, char **argv)
+{
+	tester_set_debug(0);
+	run("sequential", 0, COMMANDS, 0);
+	run("pipelined", 1, COMMANDS, 0);
+	run("large", 1, LARGE_COMMANDS, LARGE_SIZE);
+	return 0;
+}
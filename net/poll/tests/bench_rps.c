@@ -0,0 +1,120 @@
+#include "tester.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Echo requests per second over a Unix socket for each loop backend. Every
+ * client keeps one request outstanding and sends the next one as soon as
+ * the response arrived. Clients and server share the loop, so the client
+ * side is included in the cost.
+ */
+
+#define REQUESTS 200000
+
+struct bench {
+	struct tester *t;
+	int sent;
+	int done;
+};
+
+struct client {
+	struct bench *b;
+	struct conn *c;
+};
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
+{
+	tester_reply(s, CMD_RESPONSE, buf, len);
+}
+
+static void client_cb(struct conn *c, int err, const char *name,
+					  struct response *res, void *user)
+{
+	struct client *cl = user;
+	struct bench *b = cl->b;
+	struct request *r;
+
+	if (++b->done == REQUESTS)
+	{
+		tester_complete(b->t);
+	}
+	else if (b->sent < REQUESTS)
+	{
+		b->sent++;
+		new_cmd("ping", &r);
+		queue(cl->c, r, client_cb, cl);
+	}
+}
+
+static void run(enum loop_type type, int count)
+{
+	struct bench b = {};
+	struct client *clients;
+	struct request *r;
+	uint64_t start;
+	int i;
+
+	b.t = tester_create_loop(server_cb, type);
+	if (!b.t)
+	{
+		return;
+	}
+	clients = calloc(count, sizeof(*clients));
+	for (i = 0; i < count; i++)
+	{
+		clients[i].b = &b;
+		connect_unix(tester_getpath(b.t), tester_iocb, b.t, &clients[i].c);
+	}
+	while (tester_get_sessions(b.t) < count)
+	{
+		tester_runonce(b.t, 1000);
+	}
+
+	start = now_us();
+	for (i = 0; i < count && b.sent < REQUESTS; i++)
+	{
+		b.sent++;
+		new_cmd("ping", &r);
+		queue(clients[i].c, r, client_cb, &clients[i]);
+	}
+	tester_runio(b.t, NULL);
+	start = now_us() - start;
+
+	printf("%-8s %4d clients  %8.0f req/s\n", tester_get_backend(b.t),
+		   count, REQUESTS * 1000000.0 / start);
+
+	for (i = 0; i < count; i++)
+	{
+		disconnect(clients[i].c);
+	}
+	free(clients);
+	tester_cleanup(b.t);
+}
+
+int main(int argc, char **argv)
+{
+	enum loop_type types[] = { LOOP_POLL, LOOP_EPOLL, LOOP_URING };
+	int counts[] = { 8, 128 };
+	int i, j;
+
+	tester_set_debug(0);
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+	{
+		for (j = 0; j < sizeof(types) / sizeof(types[0]); j++)
+		{
+			run(types[j], counts[i]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,275 @@
+#include "tester.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Echo throughput over the Unix socket compared to shared memory rings, for
+ * each message size. A connection keeps a number of requests outstanding
+ * and sends the next once a response arrived. Payloads are copied into a
+ * newly allocated request for both transports alike.
+ *
+ * A connection offering shared memory to a server refusing it is checked to
+ * fall back to the socket.
+ */
+
+#define MAX_SIZES 8
+/* size of the shared memory rings per direction */
+#define RING (4 * 1024 * 1024)
+
+struct bench {
+	struct tester *t;
+	struct conn *c;
+	char *payload;
+	size_t size;
+	int depth;
+	bool running;
+	uint64_t sent;
+	uint64_t done;
+	uint64_t failed;
+};
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
+{
+	tester_reply(s, CMD_RESPONSE, buf, len);
+}
+
+static void client_cb(struct conn *c, int err, const char *name,
+					  struct response *res, void *user);
+
+static void client_send(struct bench *b)
+{
+	struct request *r;
+	char *buf;
+
+	buf = malloc(b->size);
+	memcpy(buf, b->payload, b->size);
+	new_cmd_buf(buf, b->size, &r);
+	b->sent++;
+	queue(b->c, r, client_cb, b);
+}
+
+static void client_cb(struct conn *c, int err, const char *name,
+					  struct response *res, void *user)
+{
+	struct bench *b = user;
+	struct iovec iov[2];
+	size_t len = 0;
+	int i, count;
+
+	b->done++;
+	if (!err)
+	{
+		count = response_get_segments(res, iov);
+		for (i = 0; i < count; i++)
+		{
+			len += iov[i].iov_len;
+		}
+	}
+	if (err || len != b->size)
+	{
+		b->failed++;
+	}
+	if (b->running)
+	{
+		client_send(b);
+	}
+}
+
+static void wait_done(struct bench *b)
+{
+	uint64_t end = now_us() + 5000000;
+
+	while (b->done < b->sent && now_us() < end)
+	{
+		tester_runonce(b->t, 10);
+	}
+}
+
+/**
+ * Connect, optionally offering shared memory, and wait for the answer by
+ * completing a first request
+ */
+static struct conn *bench_connect(struct bench *b, size_t shm)
+{
+	size_t size = b->size;
+
+	if (connect_unix(tester_getpath(b->t), tester_iocb, b->t, &b->c) != 0)
+	{
+		return NULL;
+	}
+	if (shm)
+	{
+		conn_set_shm(b->c, shm);
+	}
+	b->size = 1;
+	client_send(b);
+	wait_done(b);
+	b->size = size;
+	b->sent = b->done = b->failed = 0;
+	return b->c;
+}
+
+/**
+ * Run the echo loop over a connection for some time
+ *
+ * @return		throughput in MB/s
+ */
+static double bench_run(struct bench *b, int duration)
+{
+	uint64_t start, end;
+	int i;
+
+	b->running = true;
+	start = now_us();
+	end = start + duration * 1000000ULL;
+	for (i = 0; i < b->depth; i++)
+	{
+		client_send(b);
+	}
+	while (now_us() < end)
+	{
+		tester_runonce(b->t, 1);
+	}
+	b->running = false;
+	end = now_us();
+	wait_done(b);
+	b->failed += b->sent - b->done;
+	return b->done * (double)b->size / (end - start);
+}
+
+static int parse_sizes(char *arg, size_t *sizes)
+{
+	char *pos, *size;
+	int count = 0;
+
+	for (size = strtok_r(arg, ",", &pos); size && count < MAX_SIZES;
+		 size = strtok_r(NULL, ",", &pos))
+	{
+		sizes[count] = strtoul(size, NULL, 10);
+		if (!sizes[count])
+		{
+			return 0;
+		}
+		count++;
+	}
+	return count;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-s size,...] [-p outstanding] [-d seconds] "
+			"[-t threads]\n"
+			"  the backend is selected with $LOOP_BACKEND\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SIZES] = { 64, 4096, 1024 * 1024, };
+	struct bench b = {
+		.depth = 16,
+	};
+	int i, opt, count = 3, duration = 1, threads = 1, failed = 0;
+	double socket, shm;
+
+	while ((opt = getopt(argc, argv, "s:p:d:t:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				count = parse_sizes(optarg, sizes);
+				break;
+			case 'p':
+				b.depth = atoi(optarg);
+				break;
+			case 'd':
+				duration = atoi(optarg);
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (!count || b.depth <= 0 || duration <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	tester_set_debug(0);
+	b.t = tester_create_threads(server_cb, LOOP_DEFAULT, threads,
+								TESTER_ROUND_ROBIN);
+	if (!b.t)
+	{
+		return 1;
+	}
+	printf("%s backend, %d server threads, %d outstanding\n",
+		   tester_get_backend(b.t), threads, b.depth);
+	printf("%10s %14s %14s %8s\n", "size", "socket MB/s", "shm MB/s",
+		   "speedup");
+	for (i = 0; i < count; i++)
+	{
+		b.size = sizes[i];
+		b.payload = malloc(b.size);
+		memset(b.payload, 'x', b.size);
+
+		if (!bench_connect(&b, 0))
+		{
+			return 1;
+		}
+		socket = bench_run(&b, duration);
+		failed += b.failed;
+		disconnect(b.c);
+
+		if (!bench_connect(&b, RING))
+		{
+			return 1;
+		}
+		if (!conn_get_shm(b.c))
+		{
+			fprintf(stderr, "shared memory not used\n");
+			failed++;
+		}
+		shm = bench_run(&b, duration);
+		failed += b.failed;
+		disconnect(b.c);
+
+		printf("%10zu %14.2f %14.2f %7.2fx\n", b.size, socket, shm,
+			   shm / socket);
+		free(b.payload);
+	}
+
+	/* a server refusing shared memory keeps using the socket */
+	tester_set_shm(b.t, 0);
+	b.size = 4096;
+	b.payload = calloc(1, b.size);
+	if (bench_connect(&b, RING))
+	{
+		b.depth = 1;
+		bench_run(&b, 1);
+		printf("refused by the server: %s, %lu requests, %lu failed\n",
+			   conn_get_shm(b.c) ? "shared memory" : "socket",
+			   (unsigned long)b.done, (unsigned long)b.failed);
+		failed += b.failed + (conn_get_shm(b.c) != 0) + !b.done;
+		disconnect(b.c);
+	}
+	free(b.payload);
+	tester_cleanup(b.t);
+	return failed != 0;
+}
@@ -0,0 +1,238 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "tester.h"
+#include "frame.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef HAVE_LIBPROCESSOR
+#include <processor.h>
+#include <thread.h>
+#endif
+
+/**
+ * Echo throughput of the test1 server with 1, 2 and 4 loop threads. Clients
+ * run in their own threads with blocking sockets, each writing a batch of
+ * requests and reading the responses, so they don't limit the server.
+ * Requests marked heavy are hashed for a while before they are answered,
+ * either on the loop thread or offloaded to the threads_pool processor.
+ */
+
+#define CLIENTS 8
+#define REQUESTS 20000
+#define BATCH 16
+#define HEAVY_ROUNDS 2000
+
+enum mode {
+	MODE_ECHO,
+	MODE_HEAVY,
+	MODE_OFFLOAD,
+};
+
+static const char *names[] = {
+	[MODE_ECHO] = "echo",
+	[MODE_HEAVY] = "heavy",
+	[MODE_OFFLOAD] = "offload",
+};
+
+static enum mode mode;
+static int finished;
+
+struct work {
+	char data[16];
+	size_t len;
+};
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void hash(void *data)
+{
+	struct work *work = data;
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < HEAVY_ROUNDS; i++)
+	{
+		h = (h ^ work->data[i % work->len]) * 16777619u;
+	}
+	work->data[0] = h & 0x7f;
+}
+
+static void hashed(struct tester *t, struct session *s, void *data)
+{
+	struct work *work = data;
+
+	if (s)
+	{
+		tester_reply(s, CMD_RESPONSE, work->data, work->len);
+	}
+	free(work);
+}
+
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
+{
+	struct work *work;
+
+	if (mode == MODE_ECHO || len > sizeof(work->data))
+	{
+		tester_reply(s, CMD_RESPONSE, buf, len);
+		return;
+	}
+	work = malloc(sizeof(*work));
+	memcpy(work->data, buf, len);
+	work->len = len;
+	if (mode == MODE_HEAVY || tester_offload(s, hash, hashed, work) != 0)
+	{
+		hash(work);
+		hashed(t, s, work);
+	}
+}
+
+static void *client_run(void *user)
+{
+	const char *path = user;
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	uint8_t out[BATCH * (FRAME_HDR + 4)], in[sizeof(out)];
+	size_t want, have;
+	ssize_t len;
+	int s, i, done;
+
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		perror("connect");
+		close(s);
+		__atomic_add_fetch(&finished, 1, __ATOMIC_RELEASE);
+		return NULL;
+	}
+	for (i = 0; i < BATCH; i++)
+	{
+		frame_header(out + i * (FRAME_HDR + 4), CMD_REQUEST, 4);
+		memcpy(out + i * (FRAME_HDR + 4) + FRAME_HDR, "ping", 4);
+	}
+	/* responses have the same length as the requests */
+	for (done = 0; done < REQUESTS; done += BATCH)
+	{
+		if (write(s, out, sizeof(out)) != sizeof(out))
+		{
+			break;
+		}
+		want = sizeof(in);
+		for (have = 0; have < want; have += len)
+		{
+			len = read(s, in + have, want - have);
+			if (len <= 0)
+			{
+				done = REQUESTS;
+				break;
+			}
+		}
+	}
+	close(s);
+	__atomic_add_fetch(&finished, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void run(int threads)
+{
+	pthread_t clients[CLIENTS];
+	struct tester *t;
+	uint64_t start;
+	int i;
+#ifdef HAVE_LIBPROCESSOR
+	processor_t *processor = NULL;
+#endif
+
+	t = tester_create_threads(server_cb, LOOP_EPOLL, threads,
+							  TESTER_LEAST_SESSIONS);
+	if (!t)
+	{
+		return;
+	}
+#ifdef HAVE_LIBPROCESSOR
+	if (mode == MODE_OFFLOAD)
+	{
+		processor = processor_create();
+		processor->set_threads(processor, threads);
+		tester_set_processor(t, (struct processor_t*)processor);
+	}
+#endif
+
+	finished = 0;
+	start = now_us();
+	for (i = 0; i < CLIENTS; i++)
+	{
+		pthread_create(&clients[i], NULL, client_run,
+					   (void*)tester_getpath(t));
+	}
+	/* the acceptor runs on this thread, join once all are served */
+	while (__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < CLIENTS)
+	{
+		tester_runonce(t, 1);
+	}
+	start = now_us() - start;
+	for (i = 0; i < CLIENTS; i++)
+	{
+		pthread_join(clients[i], NULL);
+	}
+
+	printf("%-8s %d loop threads %d requests in %8.2f ms  %9.0f req/s\n",
+		   names[mode], threads, CLIENTS * REQUESTS, start / 1000.0,
+		   CLIENTS * REQUESTS * 1000000.0 / start);
+
+#ifdef HAVE_LIBPROCESSOR
+	if (processor)
+	{
+		processor->cancel(processor);
+		processor->destroy(processor);
+	}
+#endif
+	tester_cleanup(t);
+}
+
+int main(int argc, char **argv)
+{
+	int threads[] = { 1, 2, 4 };
+	int i;
+
+	tester_set_debug(0);
+#ifdef HAVE_LIBPROCESSOR
+	threads_init();
+#endif
+	printf("%ld CPUs online\n", sysconf(_SC_NPROCESSORS_ONLN));
+	for (mode = MODE_ECHO; mode <= MODE_OFFLOAD; mode++)
+	{
+#ifndef HAVE_LIBPROCESSOR
+		if (mode == MODE_OFFLOAD)
+		{
+			break;
+		}
+#endif
+		for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+		{
+			run(threads[i]);
+		}
+	}
+#ifdef HAVE_LIBPROCESSOR
+	threads_deinit();
+#endif
+	return 0;
+}
@@ -3,22 +3,24 @@
 #include <unistd.h>
 #include <stdio.h>
 
-static void server_cb(struct tester *t, int fd)
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
 {
-	char buf[1024];
-	uint32_t len;
-
     printf("\n[%s][%d] do server callback function\n", __func__, __LINE__);
-    len = read(fd, buf, sizeof(buf));
-    printf("FD_SERVER read '%s'\n", buf);
-    printf("FD_SERVER write '%s' back\n\n", buf);
-    write(fd, buf, len);
+    printf("FD_SERVER read '%.*s'\n", (int)len, (const char*)buf);
+    printf("FD_SERVER write '%.*s' back\n\n", (int)len, (const char*)buf);
+    tester_reply(s, CMD_RESPONSE, buf, len);
 }
 
 static void client_cb(struct conn *c, int err, const char *name,
 				  struct response *res, void *user)
 {
-    printf("\n[%s][%d] %s\n", __func__, __LINE__, name);
+    const char *data;
+    size_t len;
+
+    data = response_get_data(res, &len);
+    printf("\n[%s][%d] %s: '%.*s'\n", __func__, __LINE__, name, (int)len,
+           data);
     tester_complete(user);
 }
 
@@ -0,0 +1,332 @@
+#include "tester.h"
+#include "frame.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * Runs client connections in a loop of their own through fdcb and timercb.
+ * A pool queues requests before the server exists and reconnects once the
+ * server closed its idle sessions. A TCP connection completes its connect()
+ * asynchronously and pipelines requests to a blocking echo server thread.
+ */
+
+#define PATH "/tmp/test.sock"
+#define REQUESTS 200
+#define IDLE 150
+#define TCP_REQUESTS 1000
+
+struct io
+{
+	struct watch *watch;
+	struct loop_timer *timer;
+};
+
+static struct loop *loop;
+static int done, failed;
+
+static uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static struct io *get_io(struct conn *c)
+{
+	struct io *io = conn_get_iodata(c);
+
+	if (!io)
+	{
+		io = calloc(1, sizeof(*io));
+		conn_set_iodata(c, io);
+	}
+	return io;
+}
+
+static void put_io(struct conn *c, struct io *io)
+{
+	if (!io->watch && !io->timer)
+	{
+		conn_set_iodata(c, NULL);
+		free(io);
+	}
+}
+
+static void io_ready(struct loop *loop, struct watch *w, int fd, int revents,
+					 void *user)
+{
+	conn_ready(user, (revents & LOOP_READ ? READ : 0) |
+				(revents & LOOP_WRITE ? WRITE : 0) |
+				(revents & LOOP_ERROR ? ERROR : 0));
+}
+
+/* level-triggered, unlike tester_iocb() */
+static int io_fdcb(struct conn *c, int fd, int ops, void *user)
+{
+	struct io *io = get_io(c);
+	int lops = (ops & READ ? LOOP_READ : 0) | (ops & WRITE ? LOOP_WRITE : 0);
+
+	if (!ops)
+	{
+		if (io->watch)
+		{
+			loop_del(loop, io->watch);
+			io->watch = NULL;
+		}
+		put_io(c, io);
+		return 0;
+	}
+	if (io->watch)
+	{
+		return loop_mod(loop, io->watch, lops);
+	}
+	return loop_add(loop, fd, lops, 0, io_ready, c, &io->watch);
+}
+
+static void io_expired(struct loop *loop, struct loop_timer *timer,
+					   void *user)
+{
+	conn_timer(user);
+}
+
+static void io_timercb(struct conn *c, int ms, void *user)
+{
+	struct io *io = get_io(c);
+
+	if (ms < 0)
+	{
+		loop_timer_destroy(loop, io->timer);
+		io->timer = NULL;
+		put_io(c, io);
+		return;
+	}
+	if (!io->timer)
+	{
+		io->timer = loop_timer_create(loop, io_expired, c);
+	}
+	loop_timer_start(loop, io->timer, ms);
+}
+
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
+{
+	tester_reply(s, CMD_RESPONSE, buf, len);
+}
+
+static void client_cb(struct conn *c, int err, const char *name,
+					  struct response *res, void *user)
+{
+	size_t len;
+
+	done++;
+	if (err || (response_get_data(res, &len), len != (size_t)user))
+	{
+		failed++;
+	}
+}
+
+/**
+ * Run the client loop and the acceptor of the tester, if any
+ */
+static void run(struct tester *t, int want, int ms)
+{
+	uint64_t end = now_ms() + ms;
+
+	while ((want < 0 || done < want) && now_ms() < end)
+	{
+		loop_run_once(loop, t ? 1 : 10);
+		if (t)
+		{
+			tester_runonce(t, 0);
+		}
+	}
+}
+
+/**
+ * Send a request claiming a payload of almost 4 GB, the server should close
+ * the session rather than buffering it
+ */
+static int oversized(struct tester *t)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+		.sun_path = PATH,
+	};
+	uint8_t hdr[FRAME_HDR];
+	char buf[1];
+	int fd, i, n = -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	frame_header(hdr, CMD_REQUEST, 0xfffffff0);
+	if (write(fd, hdr, sizeof(hdr)) == sizeof(hdr))
+	{
+		for (i = 0; i < 1000 && n != 0; i++)
+		{
+			run(t, -1, 1);
+			n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		}
+	}
+	close(fd);
+	printf("session sending an oversized request %s\n",
+		   n == 0 ? "closed" : "kept");
+	return n == 0 ? 0 : -1;
+}
+
+static void pipelined(struct conn *c, struct pool *p, int count)
+{
+	struct request *r;
+	size_t len;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		len = 1 + i % 3000;
+		new_cmd_buf(memset(malloc(len), 'p', len), len, &r);
+		if (p)
+		{
+			pool_queue(p, r, client_cb, (void*)len);
+		}
+		else
+		{
+			queue(c, r, client_cb, (void*)len);
+		}
+	}
+}
+
+static void *echo_run(void *user)
+{
+	int fd, s = *(int*)user;
+	uint8_t hdr[FRAME_HDR];
+	char *buf;
+	size_t len;
+
+	fd = accept(s, NULL, NULL);
+	while (fd >= 0 && recv(fd, hdr, sizeof(hdr), MSG_WAITALL) == sizeof(hdr))
+	{
+		len = frame_length(hdr);
+		buf = malloc(len + 1);
+		if (recv(fd, buf, len, MSG_WAITALL) != len)
+		{
+			free(buf);
+			break;
+		}
+		frame_header(hdr, CMD_RESPONSE, len);
+		send(fd, hdr, sizeof(hdr), MSG_NOSIGNAL);
+		send(fd, buf, len, MSG_NOSIGNAL);
+		free(buf);
+	}
+	close(fd);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(addr);
+	struct conn *c;
+	struct pool *p;
+	struct tester *t;
+	pthread_t thread;
+	char port[8];
+	int s, ret;
+
+	tester_set_debug(0);
+	loop = loop_create(LOOP_DEFAULT);
+	unlink(PATH);
+
+	ret = connect_unix(PATH, io_fdcb, NULL, &c);
+	printf("connecting without server and reconnecting: %s\n",
+		   strerror(-ret));
+	if (ret == 0)
+	{
+		return 1;
+	}
+
+	p = pool_create(io_fdcb, io_timercb, NULL);
+	pool_set_reconnect(p, 10, 80);
+	pool_add_unix(p, PATH, NULL);
+	pool_add_unix(p, PATH, NULL);
+	pipelined(NULL, p, REQUESTS);
+	run(NULL, -1, 100);
+	printf("%d of %d requests done before the server is up\n", done,
+		   REQUESTS);
+	if (done)
+	{
+		return 1;
+	}
+
+	t = tester_create_threads(server_cb, LOOP_DEFAULT, 1, TESTER_ROUND_ROBIN);
+	tester_set_idle_timeout(t, IDLE);
+	run(t, REQUESTS, 5000);
+	printf("%d requests done once the server is up, %d failed\n", done,
+		   failed);
+	if (done != REQUESTS || failed)
+	{
+		return 1;
+	}
+
+	/* wait for the sessions to get closed as idle, and reconnected */
+	while (tester_get_sessions(t))
+	{
+		run(t, -1, 10);
+	}
+	while (tester_get_sessions(t) < 2)
+	{
+		run(t, -1, 1);
+	}
+	pipelined(NULL, p, REQUESTS);
+	run(t, 2 * REQUESTS, 5000);
+	printf("%d requests done after reconnecting, %d failed\n",
+		   done - REQUESTS, failed);
+	if (done != 2 * REQUESTS || failed)
+	{
+		return 1;
+	}
+	if (oversized(t) != 0)
+	{
+		return 1;
+	}
+	pool_destroy(p);
+	tester_cleanup(t);
+
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+		listen(s, 1) != 0 ||
+		getsockname(s, (struct sockaddr*)&addr, &len) != 0)
+	{
+		return 1;
+	}
+	snprintf(port, sizeof(port), "%u", ntohs(addr.sin_port));
+	pthread_create(&thread, NULL, echo_run, &s);
+	done = 0;
+	if (connect_tcp("127.0.0.1", port, io_fdcb, NULL, &c) != 0)
+	{
+		return 1;
+	}
+	pipelined(c, NULL, TCP_REQUESTS);
+	run(NULL, TCP_REQUESTS, 5000);
+	printf("%d requests pipelined over TCP, %d failed\n", done, failed);
+	disconnect(c);
+	pthread_join(thread, NULL);
+	close(s);
+	loop_destroy(loop);
+	return done != TCP_REQUESTS || failed;
+}
@@ -0,0 +1,119 @@
+#include "tester.h"
+#include "frame.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+/**
+ * Decodes the same stream of frames fed in one piece, byte by byte and in
+ * uneven chunks, including a frame larger than any receive buffer.
+ */
+
+#define LARGE (4 * 1024 * 1024)
+
+struct check {
+	const uint8_t *stream;
+	int frames;
+	size_t bytes;
+	int copies;
+};
+
+static int check_frame(void *user, uint8_t type, const void *data, size_t len)
+{
+	struct check *c = user;
+	const uint8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (p[i] != (uint8_t)(c->frames + i))
+		{
+			printf("frame %d corrupted at %zu\n", c->frames, i);
+			exit(1);
+		}
+	}
+	if (type != (c->frames % 2 ? EVENT : CMD_REQUEST))
+	{
+		printf("frame %d has type %d\n", c->frames, type);
+		exit(1);
+	}
+	if (len && (p < c->stream || p > c->stream + c->bytes))
+	{
+		c->copies++;
+	}
+	c->frames++;
+	return 0;
+}
+
+static uint8_t *build(size_t *total, int *count)
+{
+	size_t sizes[] = { 0, 1, 5, 1000, 70000, LARGE, 3 };
+	uint8_t *stream, *pos;
+	size_t i, j;
+
+	*count = sizeof(sizes) / sizeof(sizes[0]);
+	*total = 0;
+	for (i = 0; i < *count; i++)
+	{
+		*total += FRAME_HDR + sizes[i];
+	}
+	stream = pos = malloc(*total);
+	for (i = 0; i < *count; i++)
+	{
+		frame_header(pos, i % 2 ? EVENT : CMD_REQUEST, sizes[i]);
+		pos += FRAME_HDR;
+		for (j = 0; j < sizes[i]; j++)
+		{
+			*pos++ = i + j;
+		}
+	}
+	return stream;
+}
+
+static void run(const char *name, const uint8_t *stream, size_t total,
+				int count, size_t chunk)
+{
+	struct frame_decoder d = {};
+	struct check c = { .stream = stream, .bytes = total };
+	size_t off, len;
+
+	for (off = 0; off < total; off += len)
+	{
+		len = total - off < chunk ? total - off : chunk;
+		if (frame_decode(&d, stream + off, len, check_frame, &c) != 0)
+		{
+			printf("%s: decoding failed\n", name);
+			exit(1);
+		}
+	}
+	if (c.frames != count)
+	{
+		printf("%s: decoded %d of %d frames\n", name, c.frames, count);
+		exit(1);
+	}
+	printf("%-8s %d frames, %d copied\n", name, c.frames, c.copies);
+}
+
+int main(int argc, char **argv)
+{
+	struct frame_decoder d = { .max = 1000 };
+	struct check c = {};
+	uint8_t *stream;
+	size_t total;
+	int count;
+
+	stream = build(&total, &count);
+	run("whole", stream, total, count, total);
+	run("bytes", stream, total, count, 1);
+	run("chunks", stream, total, count, 4093);
+
+	if (frame_decode(&d, stream, total, check_frame, &c) != -EMSGSIZE)
+	{
+		printf("frame exceeding the limit accepted\n");
+		return 1;
+	}
+	free(stream);
+	return 0;
+}
@@ -0,0 +1,153 @@
+#include "tester.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+/**
+ * A request the server answers late fails with -ETIMEDOUT, its response is
+ * discarded and the next request still gets its own. Idle sessions are
+ * closed after the idle timeout, while a session sending requests stays.
+ */
+
+#define TIMEOUT 50
+#define IDLE 200
+#define IDLERS 2000
+
+static struct session *stalled;
+static uint64_t start;
+static int timedout, answered;
+
+static uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void server_cb(struct tester *t, struct session *s,
+					  enum packet_type type, const void *buf, size_t len)
+{
+	if (len == 5 && memcmp(buf, "stall", 5) == 0)
+	{	/* answered once the client gave up */
+		stalled = s;
+		return;
+	}
+	tester_reply(s, CMD_RESPONSE, buf, len);
+}
+
+static void ping_cb(struct conn *c, int err, const char *name,
+					struct response *res, void *user)
+{
+	const char *data;
+	size_t len;
+
+	data = err ? NULL : response_get_data(res, &len);
+	if (!data || len != 4 || memcmp(data, "ping", 4) != 0)
+	{
+		printf("ping failed: %s\n", err ? strerror(-err) : "wrong response");
+		exit(1);
+	}
+	answered++;
+	if (user)
+	{
+		tester_complete(user);
+	}
+}
+
+static void stall_cb(struct conn *c, int err, const char *name,
+					 struct response *res, void *user)
+{
+	struct tester *t = user;
+	struct request *r;
+
+	if (err != -ETIMEDOUT || !stalled)
+	{
+		printf("stalled request completed with %d\n", err);
+		exit(1);
+	}
+	timedout = now_ms() - start;
+	new_cmd("ping", &r);
+	queue(c, r, ping_cb, t);
+	tester_reply(stalled, CMD_RESPONSE, "late", 4);
+}
+
+static int idle_fdcb(struct conn *c, int fd, int ops, void *user)
+{
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct conn *c, **idlers;
+	struct request *r;
+	struct tester *t;
+	uint64_t last;
+	int i, loops = 0;
+
+	tester_set_debug(0);
+	t = tester_create(server_cb);
+	if (!t)
+	{
+		return 1;
+	}
+	tester_set_idle_timeout(t, IDLE);
+	connect_unix(tester_getpath(t), tester_iocb, t, &c);
+	tester_set_timeout(t, c, TIMEOUT);
+
+	start = now_ms();
+	new_cmd("stall", &r);
+	queue(c, r, stall_cb, t);
+	tester_runio(t, c);
+	printf("request timed out after %d ms, next one answered\n", timedout);
+	if (timedout < TIMEOUT)
+	{
+		return 1;
+	}
+
+	idlers = calloc(IDLERS, sizeof(*idlers));
+	for (i = 0; i < IDLERS; i++)
+	{
+		connect_unix(tester_getpath(t), idle_fdcb, NULL, &idlers[i]);
+		if (i % 256 == 0)
+		{	/* accept some before the backlog is full */
+			tester_runonce(t, 0);
+		}
+	}
+	while (tester_get_sessions(t) < IDLERS + 1)
+	{
+		tester_runonce(t, 10);
+	}
+
+	start = last = now_ms();
+	while (tester_get_sessions(t) > 1 && now_ms() - start < 10 * IDLE)
+	{
+		if (now_ms() - last >= TIMEOUT)
+		{	/* keeps the session of c alive */
+			new_cmd("ping", &r);
+			queue(c, r, ping_cb, NULL);
+			last = now_ms();
+		}
+		tester_runonce(t, TIMEOUT);
+		loops++;
+	}
+	printf("%d idle sessions closed after %d ms in %d iterations, "
+		   "%d sessions left, %d pings answered\n", IDLERS,
+		   (int)(now_ms() - start), loops, tester_get_sessions(t), answered);
+	if (tester_get_sessions(t) != 1)
+	{
+		return 1;
+	}
+
+	for (i = 0; i < IDLERS; i++)
+	{
+		disconnect(idlers[i]);
+	}
+	free(idlers);
+	disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include "bench.h"
+
+uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int enter_netns()
+{
+	if (unshare(CLONE_NEWNET) == 0 ||
+		unshare(CLONE_NEWUSER | CLONE_NEWNET) == 0)
+	{
+		return 0;
+	}
+	perror("unshare");
+	return -1;
+}
+
+int report(requests_t *requests, int items, int failed)
+{
+	int i, err;
+
+	if (failed < 0)
+	{
+		fprintf(stderr, "sending %d %s requests failed: %s\n", items,
+				requests->what, strerror(-failed));
+		return items;
+	}
+	for (i = 0; failed && i < items; i++)
+	{
+		err = requests->get_error(requests->ctx, i);
+		if (err)
+		{
+			fprintf(stderr, "%d of %d %s requests failed, item %d: %s\n",
+					failed, items, requests->what, i, strerror(-err));
+			break;
+		}
+	}
+	return failed;
+}
+
+/**
+ * Store the requests per second since start
+ */
+static void set_rate(double *rate, int count, uint64_t start)
+{
+	if (rate)
+	{
+		*rate = count * 1000000.0 / (now_us() - start + 1);
+	}
+}
+
+int serial(requests_t *requests, int count, double *rate)
+{
+	uint64_t start;
+	int i;
+
+	start = now_us();
+	for (i = 0; i < count; i++)
+	{
+		if (requests->send(requests->ctx, i) != 0)
+		{
+			fprintf(stderr, "%s request %d of %d failed\n", requests->what,
+					i, count);
+			return 1;
+		}
+	}
+	set_rate(rate, count, start);
+	return 0;
+}
+
+int batched(requests_t *requests, int count, int size, double *rate)
+{
+	uint64_t start;
+	int i, n, failed = 0;
+
+	if (!size)
+	{
+		size = count;
+	}
+	start = now_us();
+	for (i = 0; i < count && !failed; i += n)
+	{
+		for (n = 0; n < size && i + n < count; n++)
+		{
+			requests->queue(requests->ctx, i + n);
+		}
+		failed = report(requests, n, requests->commit(requests->ctx));
+	}
+	set_rate(rate, count, start);
+	return failed;
+}
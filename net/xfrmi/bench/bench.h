@@ -0,0 +1,67 @@
+#ifndef __MY_BENCH_H__
+#define __MY_BENCH_H__
+
+#include <stdint.h>
+
+/**
+ * Helpers shared by the benches, linked into each of them.
+ */
+
+/**
+ * Requests of a bench, sent one at a time or in batches. The callbacks get
+ * ctx and the index of an item.
+ */
+typedef struct {
+	/* name of the requests in messages */
+	const char *what;
+	void *ctx;
+	/* send a request and wait for it, 0 on success */
+	int (*send)(void *ctx, int i);
+	/* queue a request to the batch */
+	void (*queue)(void *ctx, int i);
+	/* send the queued requests and wait for them, number of failed items */
+	int (*commit)(void *ctx);
+	/* result of an item of the last commit */
+	int (*get_error)(void *ctx, int item);
+} requests_t;
+
+/**
+ * Get the current monotonic time in microseconds.
+ */
+uint64_t now_us();
+
+/**
+ * Get a network namespace to ourselves, owned by a user namespace if we
+ * are not privileged.
+ *
+ * @return			0 on success, -1 otherwise
+ */
+int enter_netns();
+
+/**
+ * Print the first failed item of a commit, if any.
+ *
+ * @param items		number of items committed
+ * @param failed	number of failed items returned by commit
+ * @return			failed, all items if they could not be sent
+ */
+int report(requests_t *requests, int items, int failed);
+
+/**
+ * Send count requests one at a time, stops at the first that fails.
+ *
+ * @param rate		receives the requests per second, if not NULL
+ * @return			number of failed requests
+ */
+int serial(requests_t *requests, int count, double *rate);
+
+/**
+ * Send count requests in batches, stops at the first batch that fails.
+ *
+ * @param size		requests per batch, 0 for a single batch
+ * @param rate		receives the requests per second, if not NULL
+ * @return			number of failed requests
+ */
+int batched(requests_t *requests, int count, int size, double *rate);
+
+#endif
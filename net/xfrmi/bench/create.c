@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <net/if.h>
+
+#include "nl_xfrmi.h"
+#include "bench.h"
+
+/**
+ * Creates, brings up and deletes XFRM interfaces in a network namespace of
+ * its own. Compares a round trip per request with batches of requests.
+ */
+
+#define COUNT		5000
+#define IF_ID		1000
+
+typedef struct {
+	nl_xfrmi_t *xfrmi;
+	nl_xfrmi_batch_t *batch;
+} ctx_t;
+
+static char *if_name(char *buf, int i)
+{
+	snprintf(buf, IFNAMSIZ, "xfrmb%d", i);
+	return buf;
+}
+
+static int send_create(void *user, int i)
+{
+	ctx_t *ctx = user;
+	char name[IFNAMSIZ];
+
+	return ctx->xfrmi->create(ctx->xfrmi, if_name(name, i), IF_ID + i, NULL,
+							  0, 1);
+}
+
+static int send_delete(void *user, int i)
+{
+	ctx_t *ctx = user;
+	char name[IFNAMSIZ];
+
+	return ctx->xfrmi->delete(ctx->xfrmi, if_name(name, i));
+}
+
+static void queue_create(void *user, int i)
+{
+	ctx_t *ctx = user;
+	char name[IFNAMSIZ];
+
+	ctx->batch->create(ctx->batch, if_name(name, i), IF_ID + i, NULL, 0, 1);
+}
+
+static void queue_delete(void *user, int i)
+{
+	ctx_t *ctx = user;
+	char name[IFNAMSIZ];
+
+	ctx->batch->delete(ctx->batch, if_name(name, i));
+}
+
+static int commit(void *user)
+{
+	ctx_t *ctx = user;
+
+	return ctx->batch->commit(ctx->batch);
+}
+
+static int get_error(void *user, int item)
+{
+	ctx_t *ctx = user;
+
+	return ctx->batch->get_error(ctx->batch, item);
+}
+
+int main(int argc, char *argv[])
+{
+	ctx_t ctx = {};
+	requests_t create = {
+		.what = "create",
+		.ctx = &ctx,
+		.send = send_create,
+		.queue = queue_create,
+		.commit = commit,
+		.get_error = get_error,
+	};
+	requests_t delete = {
+		.what = "delete",
+		.ctx = &ctx,
+		.send = send_delete,
+		.queue = queue_delete,
+		.commit = commit,
+		.get_error = get_error,
+	};
+	int count = COUNT, failed;
+	double rate;
+
+	if (argc > 1)
+	{
+		count = atoi(argv[1]);
+	}
+	if (count <= 0 || enter_netns() != 0)
+	{
+		fprintf(stderr, "usage: %s [count]\n", argv[0]);
+		return 1;
+	}
+	ctx.xfrmi = nl_xfrmi_create();
+	if (!ctx.xfrmi)
+	{
+		perror("netlink socket");
+		return 1;
+	}
+	ctx.batch = ctx.xfrmi->batch(ctx.xfrmi);
+
+	/* check the kernel supports them before flooding it */
+	failed = batched(&create, 1, 0, NULL);
+	if (!failed)
+	{
+		failed = batched(&delete, 1, 0, NULL);
+	}
+	if (failed)
+	{
+		goto out;
+	}
+
+	printf("%d interfaces, created and set up per second:\n", count);
+	failed = serial(&create, count, &rate);
+	failed += serial(&delete, count, NULL);
+	if (failed)
+	{
+		goto out;
+	}
+	printf("  round trip per request %10.0f\n", rate);
+
+	failed = batched(&create, count, 0, &rate);
+	failed += batched(&delete, count, 0, NULL);
+	if (failed)
+	{
+		goto out;
+	}
+	printf("  batched                %10.0f\n", rate);
+
+out:
+	ctx.batch->destroy(ctx.batch);
+	ctx.xfrmi->destroy(ctx.xfrmi);
+	return failed != 0;
+}
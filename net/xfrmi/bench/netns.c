@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <net/if.h>
+
+#include "thread.h"
+#include "processor.h"
+#include "nl_xfrmi_ns.h"
+#include "bench.h"
+
+/**
+ * Creates, brings up and deletes XFRM interfaces in many network namespaces
+ * of its own. Compares a single worker, i.e. one namespace after the other,
+ * with a worker per CPU.
+ */
+
+#define NETNS		16
+#define COUNT		200
+#define IF_ID		1000
+
+static char *if_name(char *buf, int i)
+{
+	snprintf(buf, IFNAMSIZ, "xfrmn%d", i);
+	return buf;
+}
+
+/**
+ * Create namespaces owned by a user namespace if we are not privileged,
+ * kept by their fd. Done before any thread exists, as unshare() of a user
+ * namespace requires.
+ */
+static int create_netns(int *fds, int count)
+{
+	int self, i;
+
+	if (unshare(CLONE_NEWNET) != 0 &&
+		unshare(CLONE_NEWUSER | CLONE_NEWNET) != 0)
+	{
+		perror("unshare");
+		return -1;
+	}
+	self = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+	for (i = 0; i < count; i++)
+	{
+		if (unshare(CLONE_NEWNET) != 0)
+		{
+			perror("unshare");
+			return -1;
+		}
+		fds[i] = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+	}
+	if (setns(self, CLONE_NEWNET) != 0)
+	{
+		perror("setns");
+		return -1;
+	}
+	close(self);
+	return 0;
+}
+
+static int report_ns(nl_xfrmi_ns_t *engine, int netns, int items, int failed,
+					 const char *what)
+{
+	int i, j, err;
+
+	for (i = 0; failed && i < netns; i++)
+	{
+		for (j = 0; j < items; j++)
+		{
+			err = engine->get_error(engine, i, j);
+			if (err)
+			{
+				fprintf(stderr, "%d %s requests failed, namespace %d item %d: "
+						"%s\n", failed, what, i, j, strerror(-err));
+				return failed;
+			}
+		}
+	}
+	return failed;
+}
+
+static int provision(nl_xfrmi_ns_t *engine, int netns, int count)
+{
+	char name[IFNAMSIZ];
+	int i, j;
+
+	for (i = 0; i < netns; i++)
+	{
+		for (j = 0; j < count; j++)
+		{
+			engine->create(engine, i, if_name(name, j), IF_ID + j, NULL, 0, 1);
+		}
+	}
+	return report_ns(engine, netns, count, engine->commit(engine), "create");
+}
+
+static int deprovision(nl_xfrmi_ns_t *engine, int netns, int count)
+{
+	char name[IFNAMSIZ];
+	int i, j;
+
+	for (i = 0; i < netns; i++)
+	{
+		for (j = 0; j < count; j++)
+		{
+			engine->delete(engine, i, if_name(name, j));
+		}
+	}
+	return report_ns(engine, netns, count, engine->commit(engine), "delete");
+}
+
+static int run(processor_t *processor, nl_xfrmi_ns_t *engine, int threads,
+			   int netns, int count)
+{
+	uint64_t start;
+	int failed;
+
+	processor->set_threads(processor, threads);
+	start = now_us();
+	failed = provision(engine, netns, count);
+	if (!failed)
+	{
+		printf("  %2d threads %10.0f\n", threads,
+			   netns * count * 1000000.0 / (now_us() - start));
+	}
+	failed += deprovision(engine, netns, count);
+	return failed;
+}
+
+int main(int argc, char *argv[])
+{
+	processor_t *processor;
+	nl_xfrmi_ns_t *engine;
+	char path[64];
+	int fds[NETNS], count = COUNT, threads, failed, i;
+
+	if (argc > 1)
+	{
+		count = atoi(argv[1]);
+	}
+	if (count <= 0 || create_netns(fds, NETNS) != 0)
+	{
+		fprintf(stderr, "usage: %s [count per namespace]\n", argv[0]);
+		return 1;
+	}
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	threads_init();
+	processor = processor_create();
+	engine = nl_xfrmi_ns_create(processor);
+	for (i = 0; i < NETNS; i++)
+	{
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fds[i]);
+		engine->add_netns(engine, path);
+		close(fds[i]);
+	}
+
+	/* check the kernel supports them before flooding it, and warm up every
+	 * namespace so the first run doesn't pay for setting them up */
+	processor->set_threads(processor, 1);
+	failed = provision(engine, NETNS, 1);
+	if (!failed)
+	{
+		failed = deprovision(engine, NETNS, 1);
+	}
+	if (failed)
+	{
+		goto out;
+	}
+
+	printf("%d interfaces in each of %d namespaces, created and set up per "
+		   "second:\n", count, NETNS);
+	failed = run(processor, engine, 1, NETNS, count);
+	if (!failed && threads > 1)
+	{
+		failed = run(processor, engine, threads, NETNS, count);
+	}
+
+out:
+	engine->destroy(engine);
+	processor->destroy(processor);
+	threads_deinit();
+	return failed != 0;
+}
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "nl_xfrmi.h"
+#include "bench.h"
+
+/**
+ * Installs and deletes SAs bound to an XFRM interface if_id in a network
+ * namespace of its own. Compares a round trip per SA with batches of SAs,
+ * and looks all of them up in the cache afterwards.
+ */
+
+#define COUNT		100000
+#define BATCH		5000
+#define IF_ID		1000
+
+typedef struct {
+	nl_xfrm_t *xfrm;
+	nl_xfrm_batch_t *batch;
+} ctx_t;
+
+/**
+ * Get the i-th SA, outbound to one of many peers
+ */
+static nl_xfrm_sa_t *get_sa(nl_xfrm_sa_t *sa, int i)
+{
+	*sa = (nl_xfrm_sa_t){
+		.family = AF_INET,
+		.spi = 0x1000 + i,
+		.proto = IPPROTO_ESP,
+		.mode = XFRM_MODE_TUNNEL,
+		.reqid = 1 + i,
+		.if_id = IF_ID,
+		.enc = {
+			.name = "rfc4106(gcm(aes))",
+			.key_len = 20,
+			.icv_len = 128,
+		},
+	};
+	sa->src.a4 = htonl(0x0a000001);
+	sa->dst.a4 = htonl(0x0b000000 + i);
+	memset(sa->enc.key, i, sa->enc.key_len);
+	return sa;
+}
+
+static int send_add(void *user, int i)
+{
+	ctx_t *ctx = user;
+	nl_xfrm_sa_t sa;
+
+	return ctx->xfrm->add_sa(ctx->xfrm, get_sa(&sa, i));
+}
+
+static int send_del(void *user, int i)
+{
+	ctx_t *ctx = user;
+	nl_xfrm_sa_t sa;
+
+	return ctx->xfrm->del_sa(ctx->xfrm, get_sa(&sa, i));
+}
+
+static void queue_add(void *user, int i)
+{
+	ctx_t *ctx = user;
+	nl_xfrm_sa_t sa;
+
+	ctx->batch->add_sa(ctx->batch, get_sa(&sa, i));
+}
+
+static void queue_del(void *user, int i)
+{
+	ctx_t *ctx = user;
+	nl_xfrm_sa_t sa;
+
+	ctx->batch->del_sa(ctx->batch, get_sa(&sa, i));
+}
+
+static int commit(void *user)
+{
+	ctx_t *ctx = user;
+
+	return ctx->batch->commit(ctx->batch);
+}
+
+static int get_error(void *user, int item)
+{
+	ctx_t *ctx = user;
+
+	return ctx->batch->get_error(ctx->batch, item);
+}
+
+/**
+ * Look up all SAs by SPI, after applying the notifications
+ */
+static double lookup(nl_xfrm_t *xfrm, int count, int *missing)
+{
+	uint64_t start;
+	int i;
+
+	xfrm->sync(xfrm);
+	*missing = 0;
+	start = now_us();
+	for (i = 0; i < count; i++)
+	{
+		*missing += xfrm->get_sa(xfrm, 0x1000 + i) == NULL;
+	}
+	return count * 1000000.0 / (now_us() - start + 1);
+}
+
+int main(int argc, char *argv[])
+{
+	ctx_t ctx = {};
+	requests_t add = {
+		.what = "add",
+		.ctx = &ctx,
+		.send = send_add,
+		.queue = queue_add,
+		.commit = commit,
+		.get_error = get_error,
+	};
+	requests_t del = {
+		.what = "delete",
+		.ctx = &ctx,
+		.send = send_del,
+		.queue = queue_del,
+		.commit = commit,
+		.get_error = get_error,
+	};
+	nl_xfrmi_t *xfrmi;
+	int count = COUNT, failed, missing;
+	double rate;
+
+	if (argc > 1)
+	{
+		count = atoi(argv[1]);
+	}
+	if (count <= 0 || enter_netns() != 0)
+	{
+		fprintf(stderr, "usage: %s [count]\n", argv[0]);
+		return 1;
+	}
+	xfrmi = nl_xfrmi_create();
+	ctx.xfrm = xfrmi ? xfrmi->get_xfrm(xfrmi) : NULL;
+	if (!ctx.xfrm)
+	{
+		perror("netlink socket");
+		if (xfrmi)
+		{
+			xfrmi->destroy(xfrmi);
+		}
+		return 1;
+	}
+	ctx.batch = ctx.xfrm->batch(ctx.xfrm);
+
+	/* check the kernel supports them before flooding it */
+	failed = batched(&add, 1, 0, NULL);
+	if (!failed)
+	{
+		failed = batched(&del, 1, 0, NULL);
+	}
+	if (failed)
+	{
+		goto out;
+	}
+
+	printf("%d SAs, installed per second:\n", count);
+	failed = serial(&add, count, &rate);
+	failed += serial(&del, count, NULL);
+	if (failed)
+	{
+		goto out;
+	}
+	printf("  round trip per request %10.0f\n", rate);
+
+	failed = batched(&add, count, BATCH, &rate);
+	if (failed)
+	{
+		goto out;
+	}
+	printf("  batches of %-12d %10.0f\n", BATCH, rate);
+
+	rate = lookup(ctx.xfrm, count, &missing);
+	printf("  cached lookups by SPI  %10.0f, %d missing\n", rate, missing);
+	failed = batched(&del, count, BATCH, NULL);
+
+out:
+	ctx.batch->destroy(ctx.batch);
+	xfrmi->destroy(xfrmi);
+	return failed != 0;
+}
@@ -0,0 +1,42 @@
+#include <string.h>
+
+#include "nl_attr.h"
+
+void nl_attr_parse(struct rtattr **attrs, int max, struct rtattr *rta,
+				   size_t len)
+{
+	memset(attrs, 0, (max + 1) * sizeof(*attrs));
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+	{
+		/* some nested attributes carry NLA_F_NESTED */
+		if ((rta->rta_type & NLA_TYPE_MASK) <= max)
+		{
+			attrs[rta->rta_type & NLA_TYPE_MASK] = rta;
+		}
+	}
+}
+
+void nl_attr_parse_nested(struct rtattr **attrs, int max, struct rtattr *rta)
+{
+	nl_attr_parse(attrs, max, RTA_DATA(rta), RTA_PAYLOAD(rta));
+}
+
+int nl_attr_parse_msg(struct rtattr **attrs, int max, struct nlmsghdr *msg,
+					  size_t hdrlen)
+{
+	size_t len = 0;
+
+	if (msg->nlmsg_len < NLMSG_LENGTH(hdrlen))
+	{
+		memset(attrs, 0, (max + 1) * sizeof(*attrs));
+		return -1;
+	}
+	if (msg->nlmsg_len > NLMSG_SPACE(hdrlen))
+	{
+		len = msg->nlmsg_len - NLMSG_SPACE(hdrlen);
+	}
+	nl_attr_parse(attrs, max,
+				  (struct rtattr*)((char*)NLMSG_DATA(msg) + NLMSG_ALIGN(hdrlen)),
+				  len);
+	return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef __NL_ATTR_H__
+#define __NL_ATTR_H__
+
+#include <stddef.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/**
+ * Index attributes by type, so each is found without scanning again.
+ * Types above max are skipped, of repeated types the last one is kept.
+ *
+ * @param attrs		table of max + 1 entries, NULL for types not found
+ * @param max		highest type indexed
+ * @param rta		first attribute
+ * @param len		length of all attributes
+ */
+void nl_attr_parse(struct rtattr **attrs, int max, struct rtattr *rta,
+				   size_t len);
+
+/**
+ * Index the attributes nested in an attribute.
+ */
+void nl_attr_parse_nested(struct rtattr **attrs, int max, struct rtattr *rta);
+
+/**
+ * Index the attributes of a message, following its fixed header.
+ *
+ * @param hdrlen	size of the fixed header, e.g. struct ifinfomsg
+ * @return			0 on success, -1 if the message is too short
+ */
+int nl_attr_parse_msg(struct rtattr **attrs, int max, struct nlmsghdr *msg,
+					  size_t hdrlen);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <errno.h>
+
+#include "nl_batch.h"
+
+typedef struct private_nl_batch_t private_nl_batch_t;
+
+/**
+ * Item of a batch in flight
+ */
+typedef struct {
+	private_nl_batch_t *batch;
+	int error;
+} batch_item_t;
+
+struct private_nl_batch_t {
+	nl_batch_t public;
+	nl_socket_t *socket;
+	/* queued messages */
+	nl_msg_t *msg;
+	/* result of each item of the last commit */
+	batch_item_t *items;
+	int count;
+	int committed;
+	/* number of items not completed yet */
+	int pending;
+	nl_batch_cb_t cb;
+	void *user;
+};
+
+static nl_msg_t *_next(nl_batch_t *public)
+{
+	private_nl_batch_t *this = (private_nl_batch_t*)public;
+
+	if (this->committed)
+	{
+		if (this->pending)
+		{
+			return NULL;
+		}
+		this->msg->reset(this->msg);
+		this->count = this->committed = 0;
+	}
+	return this->msg;
+}
+
+static int _queued(nl_batch_t *public, struct nlmsghdr *hdr)
+{
+	private_nl_batch_t *this = (private_nl_batch_t*)public;
+
+	return hdr ? this->msg->get_count(this->msg) - 1 : -1;
+}
+
+static void batch_cb(void *user, struct nlmsghdr *msg, int err)
+{
+	batch_item_t *item = user;
+	private_nl_batch_t *this = item->batch;
+
+	if (msg)
+	{
+		return;
+	}
+	item->error = err;
+	this->pending--;
+	if (this->cb)
+	{
+		this->cb(this->user, item - this->items, err);
+	}
+}
+
+static int _send(nl_batch_t *public, nl_batch_cb_t cb, void *user)
+{
+	private_nl_batch_t *this = (private_nl_batch_t*)public;
+	nl_socket_t *socket = this->socket;
+	struct nlmsghdr *hdr;
+	batch_item_t *items;
+	size_t len;
+	int i, count;
+
+	if (this->committed)
+	{
+		return -EALREADY;
+	}
+	hdr = this->msg->get_data(this->msg, &len);
+	count = this->msg->get_count(this->msg);
+	items = realloc(this->items, count * sizeof(*items));
+	if (count && !items)
+	{
+		return -ENOMEM;
+	}
+	this->items = items;
+	this->count = count;
+	this->committed = 1;
+	this->cb = cb;
+	this->user = user;
+	for (i = 0; i < this->count; i++, hdr = NLMSG_NEXT(hdr, len))
+	{
+		this->items[i] = (batch_item_t){
+			.batch = this,
+			.error = -EINPROGRESS,
+		};
+		if (socket->send(socket, hdr, batch_cb, &this->items[i]) < 0)
+		{
+			this->items[i].error = -ENOMEM;
+			continue;
+		}
+		this->pending++;
+	}
+	return socket->flush(socket);
+}
+
+static int _commit(nl_batch_t *public)
+{
+	private_nl_batch_t *this = (private_nl_batch_t*)public;
+	int i, ret, failed = 0;
+
+	ret = _send(public, NULL, NULL);
+	if (ret == -EALREADY)
+	{
+		return 0;
+	}
+	if (ret < 0 && !this->committed)
+	{
+		return ret;
+	}
+	this->socket->wait(this->socket, 1000);
+	for (i = 0; i < this->count; i++)
+	{
+		if (this->items[i].error)
+		{
+			failed++;
+		}
+	}
+	return failed;
+}
+
+static int _get_error(nl_batch_t *public, int item)
+{
+	private_nl_batch_t *this = (private_nl_batch_t*)public;
+
+	if (!this->committed || item < 0 || item >= this->count)
+	{
+		return -EINVAL;
+	}
+	return this->items[item].error;
+}
+
+static void _destroy(nl_batch_t *public)
+{
+	private_nl_batch_t *this = (private_nl_batch_t*)public;
+
+	/* the socket refers to the items until they completed */
+	if (this->pending)
+	{
+		this->socket->wait(this->socket, 1000);
+	}
+	this->msg->destroy(this->msg);
+	free(this->items);
+	free(this);
+}
+
+nl_batch_t *nl_batch_create(nl_socket_t *socket)
+{
+	private_nl_batch_t *this;
+
+	this = calloc(1, sizeof(*this));
+	this->msg = nl_msg_create();
+	if (!this->msg)
+	{
+		free(this);
+		return NULL;
+	}
+	this->socket = socket;
+
+	this->public.next = _next;
+	this->public.queued = _queued;
+	this->public.send = _send;
+	this->public.commit = _commit;
+	this->public.get_error = _get_error;
+	this->public.destroy = _destroy;
+	return &this->public;
+}
@@ -0,0 +1,76 @@
+#ifndef __NL_BATCH_H__
+#define __NL_BATCH_H__
+
+#include "nl_socket.h"
+
+typedef struct nl_batch_t nl_batch_t;
+
+/**
+ * Callback of an item of a batch sent with send().
+ *
+ * @param item		index of the item
+ * @param err		0 on success, negative errno otherwise
+ */
+typedef void (*nl_batch_cb_t)(void *user, int item, int err);
+
+/**
+ * Requests built back to back and sent together over a netlink socket, each
+ * with its own sequence number. Items are numbered in the order they got
+ * built, starting with 0 for each batch.
+ */
+struct nl_batch_t
+{
+	/**
+	 * Get the builder for the next item, starting a new batch if the last
+	 * one got sent.
+	 *
+	 * @return			builder, NULL while items sent are pending
+	 */
+	nl_msg_t *(*next)(nl_batch_t *this);
+
+	/**
+	 * Get the index of an item built with next().
+	 *
+	 * @param hdr		message ended, NULL if it failed
+	 * @return			index of the item, -1 if hdr is NULL
+	 */
+	int (*queued)(nl_batch_t *this, struct nlmsghdr *hdr);
+
+	/**
+	 * Send the queued requests without waiting for their ACKs. Items
+	 * can't be queued until all completed, then they start a new batch.
+	 *
+	 * @param cb		invoked for each item as its ACK arrives, or NULL
+	 * @return			0 on success, negative errno otherwise
+	 */
+	int (*send)(nl_batch_t *this, nl_batch_cb_t cb, void *user);
+
+	/**
+	 * Send the queued requests and wait for their ACKs. Items queued
+	 * afterwards start a new batch.
+	 *
+	 * @return			number of failed items, negative errno if the
+	 *					batch could not be sent
+	 */
+	int (*commit)(nl_batch_t *this);
+
+	/**
+	 * Get the result of an item of the batch sent last.
+	 *
+	 * @return			0 on success, -EINPROGRESS if pending, negative
+	 *					errno otherwise
+	 */
+	int (*get_error)(nl_batch_t *this, int item);
+
+	/**
+	 * Destroy the batch, waiting for items still pending.
+	 */
+	void (*destroy)(nl_batch_t *this);
+};
+
+/**
+ * Create a batch sending over a socket, which must outlive it.
+ */
+nl_batch_t *nl_batch_create(nl_socket_t *socket);
+
+#endif
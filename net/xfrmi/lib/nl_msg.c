@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/rtnetlink.h>
+
+#include "nl_msg.h"
+
+/**
+ * Initial size of the arena
+ */
+#define NL_MSG_SIZE 4096
+
+/**
+ * Depth of nested attributes at most
+ */
+#define NL_MSG_NESTS 8
+
+typedef struct private_nl_msg_t private_nl_msg_t;
+
+struct private_nl_msg_t {
+	nl_msg_t public;
+	char *buf;
+	/* end of the data, always aligned */
+	size_t len;
+	size_t size;
+	/* offset of the message begun, if building */
+	size_t cur;
+	int building;
+	/* the message begun failed */
+	int failed;
+	/* offsets of open nested attributes */
+	size_t nests[NL_MSG_NESTS];
+	int depth;
+	/* number of messages ended */
+	int count;
+};
+
+/**
+ * Get len zeroed bytes at the end of the data, growing the arena
+ */
+static void *append(private_nl_msg_t *this, size_t len)
+{
+	size_t size = this->size;
+	char *buf;
+
+	if (this->failed || !this->building)
+	{
+		return NULL;
+	}
+	if (this->len + len > this->size)
+	{
+		while (size < this->len + len)
+		{
+			size *= 2;
+		}
+		buf = realloc(this->buf, size);
+		if (!buf)
+		{
+			this->failed = 1;
+			return NULL;
+		}
+		this->buf = buf;
+		this->size = size;
+	}
+	buf = this->buf + this->len;
+	memset(buf, 0, len);
+	this->len += len;
+	return buf;
+}
+
+static struct nlmsghdr *_end(nl_msg_t *public)
+{
+	private_nl_msg_t *this = (private_nl_msg_t*)public;
+	struct nlmsghdr *hdr;
+
+	if (!this->building)
+	{
+		return NULL;
+	}
+	while (this->depth)
+	{
+		public->nest_end(public);
+	}
+	this->building = 0;
+	if (this->failed)
+	{
+		fprintf(stderr, "unable to build netlink message, out of memory or "
+				"nested too deep\n");
+		this->len = this->cur;
+		return NULL;
+	}
+	hdr = (struct nlmsghdr*)(this->buf + this->cur);
+	hdr->nlmsg_len = this->len - this->cur;
+	this->count++;
+	return hdr;
+}
+
+static void *_begin(nl_msg_t *public, uint16_t type, uint16_t flags,
+					size_t hdrlen)
+{
+	private_nl_msg_t *this = (private_nl_msg_t*)public;
+	struct nlmsghdr *hdr;
+
+	_end(public);
+	this->cur = this->len;
+	this->building = 1;
+	this->failed = 0;
+	hdr = append(this, NLMSG_SPACE(hdrlen));
+	if (!hdr)
+	{
+		return NULL;
+	}
+	hdr->nlmsg_type = type;
+	hdr->nlmsg_flags = flags;
+	return NLMSG_DATA(hdr);
+}
+
+static void *_reserve(nl_msg_t *public, int type, size_t len)
+{
+	private_nl_msg_t *this = (private_nl_msg_t*)public;
+	struct rtattr *rta;
+
+	rta = append(this, RTA_SPACE(len));
+	if (!rta)
+	{
+		return NULL;
+	}
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	return RTA_DATA(rta);
+}
+
+static int _put(nl_msg_t *public, int type, const void *data, size_t len)
+{
+	void *payload;
+
+	payload = _reserve(public, type, len);
+	if (!payload)
+	{
+		return -1;
+	}
+	if (len)
+	{
+		memcpy(payload, data, len);
+	}
+	return 0;
+}
+
+static int _put_u32(nl_msg_t *public, int type, uint32_t value)
+{
+	return _put(public, type, &value, sizeof(value));
+}
+
+static int _put_str(nl_msg_t *public, int type, const char *str)
+{
+	return _put(public, type, str, strlen(str));
+}
+
+static int _nest(nl_msg_t *public, int type)
+{
+	private_nl_msg_t *this = (private_nl_msg_t*)public;
+	size_t off = this->len;
+
+	if (this->depth == NL_MSG_NESTS)
+	{
+		this->failed = 1;
+	}
+	if (_put(public, type, NULL, 0) != 0)
+	{
+		return -1;
+	}
+	this->nests[this->depth++] = off;
+	return 0;
+}
+
+static void _nest_end(nl_msg_t *public)
+{
+	private_nl_msg_t *this = (private_nl_msg_t*)public;
+	struct rtattr *rta;
+
+	if (this->depth)
+	{
+		this->depth--;
+		rta = (struct rtattr*)(this->buf + this->nests[this->depth]);
+		rta->rta_len = this->len - this->nests[this->depth];
+	}
+}
+
+static struct nlmsghdr *_get_data(nl_msg_t *public, size_t *len)
+{
+	private_nl_msg_t *this = (private_nl_msg_t*)public;
+
+	*len = this->building ? this->cur : this->len;
+	return (struct nlmsghdr*)this->buf;
+}
+
+static int _get_count(nl_msg_t *public)
+{
+	private_nl_msg_t *this = (private_nl_msg_t*)public;
+
+	return this->count;
+}
+
+static void _reset(nl_msg_t *public)
+{
+	private_nl_msg_t *this = (private_nl_msg_t*)public;
+
+	this->len = this->cur = 0;
+	this->count = this->depth = 0;
+	this->building = this->failed = 0;
+}
+
+static void _destroy(nl_msg_t *public)
+{
+	private_nl_msg_t *this = (private_nl_msg_t*)public;
+
+	free(this->buf);
+	free(this);
+}
+
+nl_msg_t *nl_msg_create()
+{
+	private_nl_msg_t *this;
+
+	this = calloc(1, sizeof(*this));
+	this->buf = malloc(NL_MSG_SIZE);
+	if (!this->buf)
+	{
+		free(this);
+		return NULL;
+	}
+	this->size = NL_MSG_SIZE;
+
+	this->public.begin = _begin;
+	this->public.put = _put;
+	this->public.reserve = _reserve;
+	this->public.put_u32 = _put_u32;
+	this->public.put_str = _put_str;
+	this->public.nest = _nest;
+	this->public.nest_end = _nest_end;
+	this->public.end = _end;
+	this->public.get_data = _get_data;
+	this->public.get_count = _get_count;
+	this->public.reset = _reset;
+	this->public.destroy = _destroy;
+	return &this->public;
+}
@@ -0,0 +1,90 @@
+#ifndef __NL_MSG_H__
+#define __NL_MSG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/netlink.h>
+
+typedef struct nl_msg_t nl_msg_t;
+
+/**
+ * Builds netlink messages back to back in an arena growing on demand.
+ *
+ * Attributes get appended to the message begun last, into the attribute
+ * nested last if any. If the arena can't grow, the message fails as a whole
+ * instead of getting truncated. reset() keeps the memory, so building does
+ * not allocate once the arena fits the largest batch.
+ *
+ * Pointers into the arena, e.g. returned by begin(), are only valid until
+ * the next attribute gets added.
+ */
+struct nl_msg_t
+{
+	/**
+	 * Begin a message, ending the one before if necessary.
+	 *
+	 * @param hdrlen	size of the fixed header following the nlmsghdr
+	 * @return			zeroed fixed header, e.g. struct ifinfomsg
+	 */
+	void *(*begin)(nl_msg_t *this, uint16_t type, uint16_t flags,
+				   size_t hdrlen);
+
+	/**
+	 * Add an attribute.
+	 *
+	 * @return			0 on success, -1 if the message failed
+	 */
+	int (*put)(nl_msg_t *this, int type, const void *data, size_t len);
+
+	/**
+	 * Add an attribute to fill in place, e.g. one of variable size.
+	 *
+	 * @return			zeroed payload, NULL if the message failed
+	 */
+	void *(*reserve)(nl_msg_t *this, int type, size_t len);
+
+	int (*put_u32)(nl_msg_t *this, int type, uint32_t value);
+
+	/**
+	 * Add a string attribute, without the terminating zero.
+	 */
+	int (*put_str)(nl_msg_t *this, int type, const char *str);
+
+	/**
+	 * Add an attribute the following ones get nested in, until nest_end().
+	 */
+	int (*nest)(nl_msg_t *this, int type);
+
+	void (*nest_end)(nl_msg_t *this);
+
+	/**
+	 * End the message, closing any nested attribute.
+	 *
+	 * @return			the message, NULL if it failed and got dropped
+	 */
+	struct nlmsghdr *(*end)(nl_msg_t *this);
+
+	/**
+	 * Get the messages ended so far, back to back.
+	 *
+	 * @param len		receives the total length
+	 * @return			first message
+	 */
+	struct nlmsghdr *(*get_data)(nl_msg_t *this, size_t *len);
+
+	/**
+	 * Get the number of messages ended so far.
+	 */
+	int (*get_count)(nl_msg_t *this);
+
+	/**
+	 * Drop all messages, keeping the memory.
+	 */
+	void (*reset)(nl_msg_t *this);
+
+	void (*destroy)(nl_msg_t *this);
+};
+
+nl_msg_t *nl_msg_create();
+
+#endif
@@ -0,0 +1,665 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "uthash.h"
+#include "nl_attr.h"
+#include "nl_socket.h"
+
+/**
+ * Requests in flight at most, the ACK of each takes about a kilobyte of the
+ * default receive buffer of 208 KB
+ */
+#define NL_WINDOW 128
+
+/**
+ * Bytes sent in a datagram at most, the kernel limits it to the send buffer
+ */
+#define NL_BURST 65536
+
+/**
+ * Initial size of a receive slot, the kernel fills dump datagrams up to
+ * 32 KB
+ */
+#define NL_RECV_SIZE 32768
+
+/**
+ * Datagrams received with a single call at most, each into a slot of its own
+ */
+#define NL_RECV_BATCH 8
+
+/**
+ * Receive buffer requested for multicast messages, the kernel doesn't
+ * throttle them
+ */
+#define NL_NOTIFY_RCVBUF (4 * 1024 * 1024)
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK 10
+#endif
+
+typedef struct private_nl_socket_t private_nl_socket_t;
+typedef struct nl_request_t nl_request_t;
+
+struct nl_request_t {
+	unsigned int seq;
+	nl_socket_cb_t cb;
+	void *user;
+	UT_hash_handle hh;
+	/* next unused request */
+	nl_request_t *next;
+};
+
+struct private_nl_socket_t {
+	nl_socket_t public;
+	int fd;
+	/* sequence number of the next request */
+	unsigned int seq;
+	/* pending requests, by sequence number */
+	nl_request_t *requests;
+	/* number of requests in the table */
+	int pending;
+	/* number of them not sent yet */
+	int queued;
+	/* queued requests, back to back, the ones before tx_off got sent */
+	char *tx;
+	size_t tx_off;
+	size_t tx_len;
+	size_t tx_size;
+	/* page aligned receive slots, grown to the largest datagram */
+	char *rx;
+	size_t rx_size;
+	/* attribute table of dump(), max + 1 entries */
+	struct rtattr **attrs;
+	int attrs_max;
+	/* callback for multicast messages */
+	nl_socket_cb_t notify;
+	void *notify_user;
+	/* arena for requests built by the user */
+	nl_msg_t *msg;
+	/* completed requests for reuse */
+	nl_request_t *unused;
+};
+
+/**
+ * Get the sequence number following seq, 0 is used by notifications
+ */
+static unsigned int next_seq(unsigned int seq)
+{
+	return seq < INT_MAX ? seq + 1 : 1;
+}
+
+static nl_request_t *request_get(private_nl_socket_t *this)
+{
+	nl_request_t *req = this->unused;
+
+	if (req)
+	{
+		this->unused = req->next;
+		return req;
+	}
+	return malloc(sizeof(*req));
+}
+
+static void request_put(private_nl_socket_t *this, nl_request_t *req)
+{
+	req->next = this->unused;
+	this->unused = req;
+}
+
+/**
+ * Remove a request from the table and invoke its callback a last time
+ */
+static void complete(private_nl_socket_t *this, unsigned int seq, int err)
+{
+	nl_request_t *req;
+
+	HASH_FIND_INT(this->requests, &seq, req);
+	if (!req)
+	{
+		return;
+	}
+	HASH_DEL(this->requests, req);
+	this->pending--;
+	req->cb(req->user, NULL, err);
+	request_put(this, req);
+}
+
+/**
+ * Complete all pending requests, including queued ones
+ */
+static void cancel(private_nl_socket_t *this, int err)
+{
+	nl_request_t *requests = this->requests, *req, *tmp;
+
+	/* callbacks may queue new requests */
+	this->requests = NULL;
+	this->pending = this->queued = 0;
+	this->tx_off = this->tx_len = 0;
+	HASH_ITER(hh, requests, req, tmp)
+	{
+		HASH_DEL(requests, req);
+		req->cb(req->user, NULL, err);
+		request_put(this, req);
+	}
+}
+
+/**
+ * Allocate NL_RECV_BATCH receive slots of size bytes, page aligned as the
+ * kernel copies datagrams to them as a whole
+ */
+static int rx_alloc(private_nl_socket_t *this, size_t size)
+{
+	void *rx;
+
+	if (posix_memalign(&rx, sysconf(_SC_PAGESIZE), size * NL_RECV_BATCH))
+	{
+		return -ENOMEM;
+	}
+	free(this->rx);
+	this->rx = rx;
+	this->rx_size = size;
+	return 0;
+}
+
+static int _get_fd(nl_socket_t *public)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+
+	return this->fd;
+}
+
+static nl_msg_t *_get_msg(nl_socket_t *public)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+
+	this->msg->reset(this->msg);
+	return this->msg;
+}
+
+static int _send(nl_socket_t *public, struct nlmsghdr *msg, nl_socket_cb_t cb,
+				 void *user)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+	struct nlmsghdr *hdr;
+	nl_request_t *req;
+	size_t len = NLMSG_ALIGN(msg->nlmsg_len), size;
+	char *tx;
+
+	if (this->tx_off && this->tx_len + len > this->tx_size)
+	{	/* drop what got sent before growing */
+		memmove(this->tx, this->tx + this->tx_off,
+				this->tx_len - this->tx_off);
+		this->tx_len -= this->tx_off;
+		this->tx_off = 0;
+	}
+	if (this->tx_len + len > this->tx_size)
+	{
+		size = this->tx_size ? this->tx_size : NL_BURST;
+		while (size < this->tx_len + len)
+		{
+			size *= 2;
+		}
+		tx = realloc(this->tx, size);
+		if (!tx)
+		{
+			return -1;
+		}
+		this->tx = tx;
+		this->tx_size = size;
+	}
+	req = request_get(this);
+	if (!req)
+	{
+		return -1;
+	}
+	*req = (nl_request_t){
+		.seq = this->seq,
+		.cb = cb,
+		.user = user,
+	};
+	this->seq = next_seq(this->seq);
+
+	hdr = (struct nlmsghdr*)(this->tx + this->tx_len);
+	memcpy(hdr, msg, msg->nlmsg_len);
+	hdr->nlmsg_seq = req->seq;
+	hdr->nlmsg_flags |= NLM_F_ACK;
+	this->tx_len += len;
+
+	HASH_ADD_INT(this->requests, seq, req);
+	this->pending++;
+	this->queued++;
+	return req->seq;
+}
+
+static int _flush(nl_socket_t *public)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+	};
+	struct nlmsghdr *hdr;
+	unsigned int seq;
+	size_t end, len;
+	int count, ret, err = 0;
+
+	while (this->queued && this->pending - this->queued < NL_WINDOW)
+	{
+		hdr = (struct nlmsghdr*)(this->tx + this->tx_off);
+		seq = hdr->nlmsg_seq;
+		for (end = this->tx_off, count = 0;
+			 count < this->queued &&
+			 this->pending - this->queued + count < NL_WINDOW; count++)
+		{
+			hdr = (struct nlmsghdr*)(this->tx + end);
+			len = NLMSG_ALIGN(hdr->nlmsg_len);
+			if (count && end + len - this->tx_off > NL_BURST)
+			{
+				break;
+			}
+			end += len;
+		}
+
+		ret = sendto(this->fd, this->tx + this->tx_off, end - this->tx_off, 0,
+					 (struct sockaddr*)&addr, sizeof(addr));
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		this->queued -= count;
+		this->tx_off = end;
+		if (this->tx_off == this->tx_len)
+		{
+			this->tx_off = this->tx_len = 0;
+		}
+		/* netlink sends a datagram completely or not at all */
+		if (ret < 0)
+		{
+			err = -errno;
+			fprintf(stderr, "sendto failed: %s(%d)\n", strerror(-err), -err);
+			/* sequence numbers in the queue are consecutive */
+			while (count--)
+			{
+				complete(this, seq, err);
+				seq = next_seq(seq);
+			}
+		}
+	}
+	return err;
+}
+
+/**
+ * Pass a received message to the request it replies to
+ */
+static void dispatch(private_nl_socket_t *this, struct nlmsghdr *hdr)
+{
+	nl_request_t *req;
+	struct nlmsgerr *err;
+	int *done;
+
+	HASH_FIND_INT(this->requests, &hdr->nlmsg_seq, req);
+	if (!req)
+	{	/* multicast or late replies of cancelled requests */
+		if (this->notify)
+		{
+			this->notify(this->notify_user, hdr, 0);
+		}
+		return;
+	}
+	switch (hdr->nlmsg_type)
+	{
+		case NLMSG_ERROR:
+			err = NLMSG_DATA(hdr);
+			complete(this, hdr->nlmsg_seq,
+					 hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(*err)) ?
+					 err->error : -EBADMSG);
+			break;
+		case NLMSG_DONE:
+			/* the end of a dump may carry its result */
+			done = NLMSG_DATA(hdr);
+			complete(this, hdr->nlmsg_seq,
+					 hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(*done)) ? *done : 0);
+			break;
+		case NLMSG_NOOP:
+			break;
+		default:
+			req->cb(req->user, hdr, 0);
+			break;
+	}
+}
+
+/**
+ * Handle a datagram that did not fit into a slot, its first message header
+ * is intact but the rest is lost
+ */
+static void truncated(private_nl_socket_t *this, struct nlmsghdr *hdr,
+					  size_t len)
+{
+	nl_request_t *req;
+
+	fprintf(stderr, "netlink datagram of %zu bytes truncated\n", len);
+	HASH_FIND_INT(this->requests, &hdr->nlmsg_seq, req);
+	if (req)
+	{
+		complete(this, hdr->nlmsg_seq, -EMSGSIZE);
+	}
+	else if (this->notify)
+	{	/* like dropped notifications */
+		this->notify(this->notify_user, NULL, -ENOBUFS);
+	}
+}
+
+static int _receive(nl_socket_t *public)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+	struct mmsghdr msgs[NL_RECV_BATCH];
+	struct iovec iov[NL_RECV_BATCH];
+	struct nlmsghdr *hdr;
+	size_t len, grow = 0;
+	int i, count, err;
+
+	while (1)
+	{
+		for (i = 0; i < NL_RECV_BATCH; i++)
+		{
+			iov[i] = (struct iovec){
+				.iov_base = this->rx + i * this->rx_size,
+				.iov_len = this->rx_size,
+			};
+			msgs[i] = (struct mmsghdr){
+				.msg_hdr = {
+					.msg_iov = &iov[i],
+					.msg_iovlen = 1,
+				},
+			};
+		}
+		/* MSG_TRUNC gets the real length of datagrams that did not fit */
+		count = recvmmsg(this->fd, msgs, NL_RECV_BATCH,
+						 MSG_DONTWAIT | MSG_TRUNC, NULL);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break;
+			}
+			/* ENOBUFS if replies got dropped, they time out */
+			err = -errno;
+			if (err == -ENOBUFS && this->notify)
+			{
+				this->notify(this->notify_user, NULL, err);
+				continue;
+			}
+			fprintf(stderr, "recv failed: %s(%d)\n", strerror(-err), -err);
+			return err;
+		}
+		for (i = 0; i < count; i++)
+		{
+			hdr = iov[i].iov_base;
+			len = msgs[i].msg_len;
+			if (len > this->rx_size)
+			{
+				if (len > grow)
+				{
+					grow = len;
+				}
+				truncated(this, hdr, len);
+				continue;
+			}
+			for (; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len))
+			{
+				dispatch(this, hdr);
+			}
+		}
+		if (grow)
+		{
+			for (len = this->rx_size; len < grow; len *= 2);
+			rx_alloc(this, len);
+			grow = 0;
+		}
+		/* the queue got drained */
+		if (count < NL_RECV_BATCH)
+		{
+			break;
+		}
+	}
+	return _flush(public);
+}
+
+static int _get_pending(nl_socket_t *public)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+
+	return this->pending;
+}
+
+static int _wait(nl_socket_t *public, int timeout_ms)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+	struct pollfd pfd = {
+		.fd = this->fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	while (this->pending)
+	{
+		_flush(public);
+		if (!this->pending)
+		{
+			break;
+		}
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0 && errno != EINTR)
+		{
+			ret = -errno;
+			cancel(this, ret);
+			return ret;
+		}
+		if (ret == 0)
+		{
+			fprintf(stderr, "%d netlink requests timed out\n", this->pending);
+			cancel(this, -ETIMEDOUT);
+			return -ETIMEDOUT;
+		}
+		_receive(public);
+	}
+	return 0;
+}
+
+static int _subscribe(nl_socket_t *public, unsigned int group,
+					  nl_socket_cb_t cb, void *user)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+	int size = NL_NOTIFY_RCVBUF;
+
+	if (setsockopt(this->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group,
+				   sizeof(group)) != 0)
+	{
+		return -errno;
+	}
+	/* exceeding rmem_max requires CAP_NET_ADMIN */
+	if (setsockopt(this->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+				   sizeof(size)) != 0)
+	{
+		setsockopt(this->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+	this->notify = cb;
+	this->notify_user = user;
+	return 0;
+}
+
+static void ack_cb(void *user, struct nlmsghdr *msg, int err)
+{
+	if (!msg)
+	{
+		*(int*)user = err;
+	}
+}
+
+static int _send_ack(nl_socket_t *public, struct nlmsghdr *msg)
+{
+	int err = -EINPROGRESS;
+
+	if (_send(public, msg, ack_cb, &err) < 0)
+	{
+		return -1;
+	}
+	_wait(public, 1000);
+	switch (err)
+	{
+		case 0:
+			return 0;
+		case -EEXIST:
+			return 3;
+		case -ESRCH:
+			return 6;
+		default:
+			return -1;
+	}
+}
+
+typedef struct {
+	private_nl_socket_t *this;
+	size_t hdrlen;
+	int max;
+	nl_socket_dump_cb_t cb;
+	void *user;
+	int err;
+} dump_ctx_t;
+
+static void dump_cb(void *user, struct nlmsghdr *msg, int err)
+{
+	dump_ctx_t *ctx = user;
+	private_nl_socket_t *this = ctx->this;
+
+	if (!msg)
+	{
+		ctx->err = err;
+	}
+	else if (nl_attr_parse_msg(this->attrs, ctx->max, msg, ctx->hdrlen) == 0)
+	{
+		ctx->cb(ctx->user, msg, this->attrs);
+	}
+}
+
+static int _dump(nl_socket_t *public, struct nlmsghdr *msg, size_t hdrlen,
+				 int max, nl_socket_dump_cb_t cb, void *user)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+	struct rtattr **attrs;
+	dump_ctx_t ctx = {
+		.this = this,
+		.hdrlen = hdrlen,
+		.max = max,
+		.cb = cb,
+		.user = user,
+		.err = -EINPROGRESS,
+	};
+
+	if (max > this->attrs_max)
+	{
+		attrs = realloc(this->attrs, (max + 1) * sizeof(*attrs));
+		if (!attrs)
+		{
+			return -ENOMEM;
+		}
+		this->attrs = attrs;
+		this->attrs_max = max;
+	}
+	msg->nlmsg_flags |= NLM_F_DUMP;
+	if (_send(public, msg, dump_cb, &ctx) < 0)
+	{
+		return -ENOMEM;
+	}
+	_wait(public, 1000);
+	return ctx.err;
+}
+
+static void _destroy(nl_socket_t *public)
+{
+	private_nl_socket_t *this = (private_nl_socket_t*)public;
+	nl_request_t *req, *tmp;
+
+	HASH_ITER(hh, this->requests, req, tmp)
+	{
+		HASH_DEL(this->requests, req);
+		free(req);
+	}
+	while ((req = this->unused))
+	{
+		this->unused = req->next;
+		free(req);
+	}
+	if (this->msg)
+	{
+		this->msg->destroy(this->msg);
+	}
+	if (this->fd != -1)
+	{
+		close(this->fd);
+	}
+	free(this->tx);
+	free(this->rx);
+	free(this->attrs);
+	free(this);
+}
+
+nl_socket_t *nl_socket_create(int protocol)
+{
+	private_nl_socket_t *this;
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+	};
+	int on = 1;
+
+	this = calloc(1, sizeof(*this));
+	this->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+	this->msg = nl_msg_create();
+	/* get a port id, multicast messages are not delivered to port 0 */
+	if (this->fd < 0 || rx_alloc(this, NL_RECV_SIZE) != 0 || !this->msg ||
+		bind(this->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		if (this->fd >= 0)
+		{
+			close(this->fd);
+		}
+		if (this->msg)
+		{
+			this->msg->destroy(this->msg);
+		}
+		free(this->rx);
+		free(this);
+		return NULL;
+	}
+	/* don't echo failed requests in their ACK, keeping it small */
+	setsockopt(this->fd, SOL_NETLINK, NETLINK_CAP_ACK, &on, sizeof(on));
+	this->seq = 1;
+	this->attrs_max = -1;
+
+	this->public.get_fd = _get_fd;
+	this->public.get_msg = _get_msg;
+	this->public.send = _send;
+	this->public.flush = _flush;
+	this->public.receive = _receive;
+	this->public.get_pending = _get_pending;
+	this->public.wait = _wait;
+	this->public.subscribe = _subscribe;
+	this->public.send_ack = _send_ack;
+	this->public.dump = _dump;
+	this->public.destroy = _destroy;
+	return &this->public;
+}
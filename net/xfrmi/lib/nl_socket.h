@@ -0,0 +1,127 @@
+#ifndef __NL_SOCKET_H__
+#define __NL_SOCKET_H__
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "nl_msg.h"
+
+typedef struct nl_socket_t nl_socket_t;
+
+/**
+ * Callback of a request, invoked with each message received in reply, and
+ * once with msg NULL when the request completed.
+ *
+ * @param user		user data passed to send()
+ * @param msg		reply message, NULL once complete
+ * @param err		0 or negative errno of the request, once complete
+ */
+typedef void (*nl_socket_cb_t)(void *user, struct nlmsghdr *msg, int err);
+
+/**
+ * Callback of dump(), invoked with each message dumped.
+ *
+ * @param msg		message, valid during the callback only
+ * @param attrs		its attributes by type, see nl_attr_parse()
+ */
+typedef void (*nl_socket_dump_cb_t)(void *user, struct nlmsghdr *msg,
+									struct rtattr **attrs);
+
+/**
+ * Netlink socket with any number of requests in flight.
+ *
+ * Requests get queued with their own sequence number and are sent together
+ * on flush(), replies are dispatched to their request by it. The fd gets
+ * readable once replies arrived, call receive() then, e.g. from an epoll
+ * loop. Requests are kept in flight within a window, as each ACK is queued
+ * to the socket on its own and too many would overflow its receive buffer.
+ *
+ * Datagrams are received in batches into page aligned slots, and messages
+ * are dispatched in place without being copied.
+ */
+struct nl_socket_t
+{
+	int (*get_fd)(nl_socket_t *this);
+
+	/**
+	 * Get the message builder of the socket, reset for a new request.
+	 * Messages built with it are valid until the next get_msg().
+	 */
+	nl_msg_t *(*get_msg)(nl_socket_t *this);
+
+	/**
+	 * Queue a request, sent with the next flush(). NLM_F_ACK is added,
+	 * so every request completes with an ACK or the end of a dump.
+	 *
+	 * @return			sequence number of the request, -1 on error
+	 */
+	int (*send)(nl_socket_t *this, struct nlmsghdr *msg, nl_socket_cb_t cb,
+				void *user);
+
+	/**
+	 * Send as many queued requests as the window allows, in one datagram.
+	 *
+	 * @return			0 on success, negative errno otherwise
+	 */
+	int (*flush)(nl_socket_t *this);
+
+	/**
+	 * Dispatch all replies received so far without blocking, and flush
+	 * requests the window got opened for.
+	 *
+	 * @return			0 on success, negative errno otherwise
+	 */
+	int (*receive)(nl_socket_t *this);
+
+	/**
+	 * Get the number of requests queued or in flight.
+	 */
+	int (*get_pending)(nl_socket_t *this);
+
+	/**
+	 * Flush and receive until no request is pending. If nothing arrives
+	 * for timeout_ms, pending requests complete with -ETIMEDOUT, if polling
+	 * fails they complete with its error.
+	 *
+	 * @return			0 on success, negative errno otherwise
+	 */
+	int (*wait)(nl_socket_t *this, int timeout_ms);
+
+	/**
+	 * Join a multicast group, messages not replying to a request are
+	 * passed to the callback with err 0. If some got dropped as the
+	 * receive buffer overflowed, it is invoked with msg NULL and -ENOBUFS.
+	 *
+	 * @param group		group to join, e.g. RTNLGRP_LINK
+	 * @return			0 on success, negative errno otherwise
+	 */
+	int (*subscribe)(nl_socket_t *this, unsigned int group, nl_socket_cb_t cb,
+					 void *user);
+
+	/**
+	 * Send a request and wait for it, and any other pending one.
+	 *
+	 * @return			0 on success, 3 if it exists, 6 if not found,
+	 *					-1 otherwise
+	 */
+	int (*send_ack)(nl_socket_t *this, struct nlmsghdr *in);
+
+	/**
+	 * Send a dump request and stream the messages of the reply to cb as
+	 * they arrive, however many datagrams it takes. Other pending requests
+	 * are waited for as well.
+	 *
+	 * @param msg		request, NLM_F_DUMP is added
+	 * @param hdrlen	size of the fixed header of the messages dumped
+	 * @param max		highest attribute type to index
+	 * @return			0 on success, negative errno otherwise
+	 */
+	int (*dump)(nl_socket_t *this, struct nlmsghdr *msg, size_t hdrlen,
+				int max, nl_socket_dump_cb_t cb, void *user);
+
+	void (*destroy)(nl_socket_t *this);
+};
+
+nl_socket_t *nl_socket_create(int protocol);
+
+#endif
@@ -0,0 +1,833 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/xfrm.h>
+#include <linux/ipsec.h>
+
+#include "uthash.h"
+#include "nl_attr.h"
+#include "nl_socket.h"
+#include "nl_batch.h"
+#include "nl_xfrm.h"
+
+/**
+ * Cached SA, by SPI
+ */
+typedef struct {
+	nl_xfrm_sa_t sa;
+	UT_hash_handle hh;
+} sa_entry_t;
+
+typedef struct private_nl_xfrm_t private_nl_xfrm_t;
+
+struct private_nl_xfrm_t {
+	nl_xfrm_t public;
+	nl_socket_t *socket;
+	/* XFRMNLGRP_SA notifications, NULL if the cache is not used */
+	nl_socket_t *events;
+	/* cached SAs by SPI */
+	sa_entry_t *sas;
+	/* notifications got dropped, dump again */
+	int resync;
+};
+
+typedef struct private_nl_xfrm_batch_t private_nl_xfrm_batch_t;
+
+struct private_nl_xfrm_batch_t {
+	nl_xfrm_batch_t public;
+	nl_batch_t *batch;
+};
+
+static void set_lifetime(struct xfrm_lifetime_cfg *lft)
+{
+	lft->soft_byte_limit = XFRM_INF;
+	lft->hard_byte_limit = XFRM_INF;
+	lft->soft_packet_limit = XFRM_INF;
+	lft->hard_packet_limit = XFRM_INF;
+}
+
+/**
+ * Add an algorithm attribute, its key follows the fixed part
+ */
+static void put_alg(nl_msg_t *msg, int type, const nl_xfrm_alg_t *alg)
+{
+	struct xfrm_algo_aead *aead;
+	struct xfrm_algo_auth *auth;
+	struct xfrm_algo *crypt;
+
+	switch (type)
+	{
+		case XFRMA_ALG_AEAD:
+			aead = msg->reserve(msg, type, sizeof(*aead) + alg->key_len);
+			if (aead)
+			{
+				memcpy(aead->alg_name, alg->name, sizeof(aead->alg_name));
+				aead->alg_key_len = alg->key_len * 8;
+				aead->alg_icv_len = alg->icv_len;
+				memcpy(aead->alg_key, alg->key, alg->key_len);
+			}
+			break;
+		case XFRMA_ALG_AUTH_TRUNC:
+			auth = msg->reserve(msg, type, sizeof(*auth) + alg->key_len);
+			if (auth)
+			{
+				memcpy(auth->alg_name, alg->name, sizeof(auth->alg_name));
+				auth->alg_key_len = alg->key_len * 8;
+				auth->alg_trunc_len = alg->icv_len;
+				memcpy(auth->alg_key, alg->key, alg->key_len);
+			}
+			break;
+		default:
+			crypt = msg->reserve(msg, type, sizeof(*crypt) + alg->key_len);
+			if (crypt)
+			{
+				memcpy(crypt->alg_name, alg->name, sizeof(crypt->alg_name));
+				crypt->alg_key_len = alg->key_len * 8;
+				memcpy(crypt->alg_key, alg->key, alg->key_len);
+			}
+			break;
+	}
+}
+
+/**
+ * Build a XFRM_MSG_NEWSA or XFRM_MSG_UPDSA request
+ */
+static struct nlmsghdr *nl_build_sa(nl_msg_t *msg, uint16_t type,
+									const nl_xfrm_sa_t *sa)
+{
+	struct xfrm_usersa_info info = {};
+	void *hdr;
+
+	if (sa->enc.key_len > NL_XFRM_KEY_SIZE ||
+		sa->integ.key_len > NL_XFRM_KEY_SIZE)
+	{
+		fprintf(stderr, "key of SA 0x%08x too long\n", sa->spi);
+		return NULL;
+	}
+	info.family = sa->family;
+	info.saddr = sa->src;
+	info.id.daddr = sa->dst;
+	info.id.spi = htonl(sa->spi);
+	info.id.proto = sa->proto;
+	info.mode = sa->mode;
+	info.reqid = sa->reqid;
+	info.replay_window = sa->replay_window;
+	set_lifetime(&info.lft);
+	hdr = msg->begin(msg, type, NLM_F_REQUEST | NLM_F_ACK, sizeof(info));
+	if (hdr)
+	{
+		memcpy(hdr, &info, sizeof(info));
+	}
+	if (sa->enc.icv_len)
+	{
+		put_alg(msg, XFRMA_ALG_AEAD, &sa->enc);
+	}
+	else
+	{
+		if (sa->enc.name[0])
+		{
+			put_alg(msg, XFRMA_ALG_CRYPT, &sa->enc);
+		}
+		if (sa->integ.name[0])
+		{
+			put_alg(msg, XFRMA_ALG_AUTH_TRUNC, &sa->integ);
+		}
+	}
+	if (sa->if_id)
+	{
+		msg->put_u32(msg, XFRMA_IF_ID, sa->if_id);
+	}
+	return msg->end(msg);
+}
+
+/**
+ * Build a XFRM_MSG_DELSA request
+ */
+static struct nlmsghdr *nl_build_del_sa(nl_msg_t *msg, const nl_xfrm_sa_t *sa)
+{
+	struct xfrm_usersa_id *id;
+
+	id = msg->begin(msg, XFRM_MSG_DELSA, NLM_F_REQUEST | NLM_F_ACK,
+					sizeof(*id));
+	if (id)
+	{
+		id->daddr = sa->dst;
+		id->spi = htonl(sa->spi);
+		id->family = sa->family;
+		id->proto = sa->proto;
+	}
+	return msg->end(msg);
+}
+
+static void set_selector(struct xfrm_selector *sel,
+						 const nl_xfrm_policy_t *policy)
+{
+	sel->family = policy->family;
+	sel->saddr = policy->src;
+	sel->daddr = policy->dst;
+	sel->prefixlen_s = policy->src_len;
+	sel->prefixlen_d = policy->dst_len;
+}
+
+/**
+ * Build a XFRM_MSG_NEWPOLICY or XFRM_MSG_UPDPOLICY request
+ */
+static struct nlmsghdr *nl_build_policy(nl_msg_t *msg, uint16_t type,
+										const nl_xfrm_policy_t *policy)
+{
+	struct xfrm_userpolicy_info info = {};
+	struct xfrm_user_tmpl *tmpl;
+	void *hdr;
+
+	set_selector(&info.sel, policy);
+	info.dir = policy->dir;
+	info.priority = policy->priority;
+	info.action = XFRM_POLICY_ALLOW;
+	info.share = XFRM_SHARE_ANY;
+	set_lifetime(&info.lft);
+	hdr = msg->begin(msg, type, NLM_F_REQUEST | NLM_F_ACK, sizeof(info));
+	if (hdr)
+	{
+		memcpy(hdr, &info, sizeof(info));
+	}
+	tmpl = msg->reserve(msg, XFRMA_TMPL, sizeof(*tmpl));
+	if (tmpl)
+	{
+		tmpl->family = policy->family;
+		tmpl->saddr = policy->tmpl_src;
+		tmpl->id.daddr = policy->tmpl_dst;
+		tmpl->id.proto = policy->proto;
+		tmpl->mode = policy->mode;
+		tmpl->reqid = policy->reqid;
+		tmpl->aalgos = tmpl->ealgos = tmpl->calgos = ~0;
+	}
+	if (policy->if_id)
+	{
+		msg->put_u32(msg, XFRMA_IF_ID, policy->if_id);
+	}
+	return msg->end(msg);
+}
+
+/**
+ * Build a XFRM_MSG_DELPOLICY request
+ */
+static struct nlmsghdr *nl_build_del_policy(nl_msg_t *msg,
+											const nl_xfrm_policy_t *policy)
+{
+	struct xfrm_userpolicy_id *id;
+
+	id = msg->begin(msg, XFRM_MSG_DELPOLICY, NLM_F_REQUEST | NLM_F_ACK,
+					sizeof(*id));
+	if (id)
+	{
+		set_selector(&id->sel, policy);
+		id->dir = policy->dir;
+	}
+	if (policy->if_id)
+	{
+		msg->put_u32(msg, XFRMA_IF_ID, policy->if_id);
+	}
+	return msg->end(msg);
+}
+
+static void cache_remove(private_nl_xfrm_t *this, sa_entry_t *entry)
+{
+	HASH_DEL(this->sas, entry);
+	free(entry);
+}
+
+static void cache_flush(private_nl_xfrm_t *this)
+{
+	sa_entry_t *entry, *tmp;
+
+	HASH_ITER(hh, this->sas, entry, tmp)
+	{
+		cache_remove(this, entry);
+	}
+}
+
+/**
+ * Remove an SA if it is the one cached for its SPI
+ */
+static void cache_del(private_nl_xfrm_t *this, struct xfrm_usersa_id *id)
+{
+	sa_entry_t *entry;
+	uint32_t spi = ntohl(id->spi);
+
+	HASH_FIND(hh, this->sas, &spi, sizeof(spi), entry);
+	if (entry && entry->sa.proto == id->proto &&
+		entry->sa.family == id->family &&
+		memcmp(&entry->sa.dst, &id->daddr, sizeof(id->daddr)) == 0)
+	{
+		cache_remove(this, entry);
+	}
+}
+
+/**
+ * Copy an algorithm from its attribute, if the key fits
+ */
+static void cache_parse_alg(struct rtattr *rta, nl_xfrm_alg_t *alg)
+{
+	struct xfrm_algo_aead *aead = RTA_DATA(rta);
+	struct xfrm_algo_auth *auth = RTA_DATA(rta);
+	struct xfrm_algo *crypt = RTA_DATA(rta);
+	size_t len = RTA_PAYLOAD(rta), hdrlen;
+	unsigned int key_bits, icv_len = 0;
+	char *key;
+
+	switch (rta->rta_type)
+	{
+		case XFRMA_ALG_AEAD:
+			hdrlen = sizeof(*aead);
+			if (len < hdrlen)
+			{
+				return;
+			}
+			key_bits = aead->alg_key_len;
+			icv_len = aead->alg_icv_len;
+			key = aead->alg_key;
+			break;
+		case XFRMA_ALG_AUTH_TRUNC:
+			hdrlen = sizeof(*auth);
+			if (len < hdrlen)
+			{
+				return;
+			}
+			key_bits = auth->alg_key_len;
+			icv_len = auth->alg_trunc_len;
+			key = auth->alg_key;
+			break;
+		default:
+			hdrlen = sizeof(*crypt);
+			if (len < hdrlen)
+			{
+				return;
+			}
+			key_bits = crypt->alg_key_len;
+			key = crypt->alg_key;
+			break;
+	}
+	if (key_bits / 8 > NL_XFRM_KEY_SIZE || hdrlen + key_bits / 8 > len)
+	{
+		return;
+	}
+	/* the name comes first in each */
+	snprintf(alg->name, sizeof(alg->name), "%.*s", (int)sizeof(alg->name) - 1,
+			 crypt->alg_name);
+	alg->key_len = key_bits / 8;
+	alg->icv_len = icv_len;
+	memcpy(alg->key, key, alg->key_len);
+}
+
+/**
+ * Add or update an SA from a XFRM_MSG_NEWSA or XFRM_MSG_UPDSA message
+ *
+ * @param attrs		its attributes, up to XFRMA_MAX
+ */
+static void cache_put(private_nl_xfrm_t *this, struct nlmsghdr *hdr,
+					  struct rtattr **attrs)
+{
+	struct xfrm_usersa_info info;
+	sa_entry_t *entry;
+	nl_xfrm_sa_t sa = {};
+
+	if (hdr->nlmsg_len < NLMSG_LENGTH(sizeof(info)))
+	{
+		return;
+	}
+	/* messages are only aligned to 4 bytes, it has 64-bit members */
+	memcpy(&info, NLMSG_DATA(hdr), sizeof(info));
+	sa.family = info.family;
+	sa.src = info.saddr;
+	sa.dst = info.id.daddr;
+	sa.spi = ntohl(info.id.spi);
+	sa.proto = info.id.proto;
+	sa.mode = info.mode;
+	sa.reqid = info.reqid;
+	sa.replay_window = info.replay_window;
+
+	if (attrs[XFRMA_ALG_AEAD])
+	{
+		cache_parse_alg(attrs[XFRMA_ALG_AEAD], &sa.enc);
+	}
+	else if (attrs[XFRMA_ALG_CRYPT])
+	{
+		cache_parse_alg(attrs[XFRMA_ALG_CRYPT], &sa.enc);
+	}
+	if (attrs[XFRMA_ALG_AUTH_TRUNC])
+	{
+		cache_parse_alg(attrs[XFRMA_ALG_AUTH_TRUNC], &sa.integ);
+	}
+	if (attrs[XFRMA_IF_ID] &&
+		RTA_PAYLOAD(attrs[XFRMA_IF_ID]) >= sizeof(sa.if_id))
+	{
+		sa.if_id = *(uint32_t*)RTA_DATA(attrs[XFRMA_IF_ID]);
+	}
+
+	HASH_FIND(hh, this->sas, &sa.spi, sizeof(sa.spi), entry);
+	if (!entry)
+	{
+		entry = malloc(sizeof(*entry));
+		if (!entry)
+		{
+			return;
+		}
+		entry->sa.spi = sa.spi;
+		HASH_ADD(hh, this->sas, sa.spi, sizeof(entry->sa.spi), entry);
+	}
+	entry->sa = sa;
+}
+
+/**
+ * Update the cache from a notification or a dumped SA
+ */
+static void cache_update(private_nl_xfrm_t *this, struct nlmsghdr *hdr)
+{
+	struct rtattr *attrs[XFRMA_MAX + 1];
+	struct xfrm_user_expire expire;
+	struct xfrm_usersa_flush *flush;
+	sa_entry_t *entry, *tmp;
+
+	switch (hdr->nlmsg_type)
+	{
+		case XFRM_MSG_NEWSA:
+		case XFRM_MSG_UPDSA:
+			if (nl_attr_parse_msg(attrs, XFRMA_MAX, hdr,
+								  sizeof(struct xfrm_usersa_info)) == 0)
+			{
+				cache_put(this, hdr, attrs);
+			}
+			break;
+		case XFRM_MSG_DELSA:
+			if (hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(struct xfrm_usersa_id)))
+			{
+				cache_del(this, NLMSG_DATA(hdr));
+			}
+			break;
+		case XFRM_MSG_EXPIRE:
+			if (hdr->nlmsg_len < NLMSG_LENGTH(sizeof(expire)))
+			{
+				break;
+			}
+			memcpy(&expire, NLMSG_DATA(hdr), sizeof(expire));
+			if (expire.hard)
+			{
+				cache_del(this, &(struct xfrm_usersa_id){
+					.daddr = expire.state.id.daddr,
+					.spi = expire.state.id.spi,
+					.family = expire.state.family,
+					.proto = expire.state.id.proto,
+				});
+			}
+			break;
+		case XFRM_MSG_FLUSHSA:
+			flush = NLMSG_DATA(hdr);
+			if (hdr->nlmsg_len < NLMSG_LENGTH(sizeof(*flush)))
+			{
+				break;
+			}
+			HASH_ITER(hh, this->sas, entry, tmp)
+			{
+				if (flush->proto == IPSEC_PROTO_ANY ||
+					flush->proto == entry->sa.proto)
+				{
+					cache_remove(this, entry);
+				}
+			}
+			break;
+	}
+}
+
+static void cache_event(void *user, struct nlmsghdr *msg, int err)
+{
+	private_nl_xfrm_t *this = user;
+
+	if (err == -ENOBUFS)
+	{
+		this->resync = 1;
+	}
+	else if (msg)
+	{
+		cache_update(this, msg);
+	}
+}
+
+static void cache_dump_cb(void *user, struct nlmsghdr *msg,
+						  struct rtattr **attrs)
+{
+	if (msg->nlmsg_type == XFRM_MSG_NEWSA)
+	{
+		cache_put(user, msg, attrs);
+	}
+}
+
+/**
+ * Fill the cache with all SAs, notifications received before the dump
+ * completed are applied afterwards
+ */
+static int cache_dump(private_nl_xfrm_t *this)
+{
+	nl_msg_t *msg = this->socket->get_msg(this->socket);
+	struct nlmsghdr *hdr;
+	int err;
+
+	/* the kernel parses attributes right after the header of dumps */
+	msg->begin(msg, XFRM_MSG_GETSA, NLM_F_REQUEST, 0);
+	hdr = msg->end(msg);
+
+	cache_flush(this);
+	this->resync = 0;
+	if (!hdr)
+	{
+		return -ENOMEM;
+	}
+	err = this->socket->dump(this->socket, hdr,
+							 sizeof(struct xfrm_usersa_info), XFRMA_MAX,
+							 cache_dump_cb, this);
+	if (err)
+	{
+		fprintf(stderr, "dumping SAs failed: %s(%d)\n", strerror(-err), -err);
+	}
+	return err;
+}
+
+static int _nl_xfrm_sync(nl_xfrm_t *public)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+	int err;
+
+	if (!this->events)
+	{
+		return -ENOTSUP;
+	}
+	err = this->events->receive(this->events);
+	if (this->resync)
+	{
+		err = cache_dump(this);
+		this->events->receive(this->events);
+	}
+	return err;
+}
+
+static int _nl_xfrm_get_event_fd(nl_xfrm_t *public)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	return this->events ? this->events->get_fd(this->events) : -1;
+}
+
+static const nl_xfrm_sa_t *_nl_xfrm_get_sa(nl_xfrm_t *public, uint32_t spi)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+	sa_entry_t *entry;
+
+	HASH_FIND(hh, this->sas, &spi, sizeof(spi), entry);
+	return entry ? &entry->sa : NULL;
+}
+
+static int _nl_xfrm_get_sa_count(nl_xfrm_t *public)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	return HASH_COUNT(this->sas);
+}
+
+/**
+ * Create the cache, an error is not fatal as requests work without it
+ */
+static void cache_init(private_nl_xfrm_t *this)
+{
+	this->events = nl_socket_create(NETLINK_XFRM);
+	if (!this->events ||
+		this->events->subscribe(this->events, XFRMNLGRP_SA, cache_event,
+								this) != 0 ||
+		this->events->subscribe(this->events, XFRMNLGRP_EXPIRE, cache_event,
+								this) != 0 ||
+		cache_dump(this) != 0)
+	{
+		fprintf(stderr, "SA cache not available\n");
+		if (this->events)
+		{
+			this->events->destroy(this->events);
+			this->events = NULL;
+		}
+		cache_flush(this);
+		return;
+	}
+	/* apply changes that happened during the dump */
+	this->events->receive(this->events);
+}
+
+/**
+ * Send a request and report failures, what describes it
+ */
+static int send_ack(private_nl_xfrm_t *this, struct nlmsghdr *hdr,
+					const char *what, uint32_t id)
+{
+	if (!hdr)
+	{
+		return -1;
+	}
+	switch (this->socket->send_ack(this->socket, hdr))
+	{
+		case 0:
+			return 0;
+		case 3:
+			fprintf(stderr, "%s 0x%08x already exists\n", what, id);
+			break;
+		case 6:
+			fprintf(stderr, "%s 0x%08x not found\n", what, id);
+			break;
+		default:
+			fprintf(stderr, "request for %s 0x%08x failed\n", what, id);
+			break;
+	}
+	return -1;
+}
+
+static int _nl_xfrm_add_sa(nl_xfrm_t *public, const nl_xfrm_sa_t *sa)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	return send_ack(this, nl_build_sa(this->socket->get_msg(this->socket),
+									  XFRM_MSG_NEWSA, sa), "SA", sa->spi);
+}
+
+static int _nl_xfrm_update_sa(nl_xfrm_t *public, const nl_xfrm_sa_t *sa)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	return send_ack(this, nl_build_sa(this->socket->get_msg(this->socket),
+									  XFRM_MSG_UPDSA, sa), "SA", sa->spi);
+}
+
+static int _nl_xfrm_del_sa(nl_xfrm_t *public, const nl_xfrm_sa_t *sa)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	return send_ack(this, nl_build_del_sa(this->socket->get_msg(this->socket),
+										  sa), "SA", sa->spi);
+}
+
+static int _nl_xfrm_add_policy(nl_xfrm_t *public,
+							   const nl_xfrm_policy_t *policy)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	return send_ack(this, nl_build_policy(this->socket->get_msg(this->socket),
+										  XFRM_MSG_NEWPOLICY, policy),
+					"policy of reqid", policy->reqid);
+}
+
+static int _nl_xfrm_update_policy(nl_xfrm_t *public,
+								  const nl_xfrm_policy_t *policy)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	return send_ack(this, nl_build_policy(this->socket->get_msg(this->socket),
+										  XFRM_MSG_UPDPOLICY, policy),
+					"policy of reqid", policy->reqid);
+}
+
+static int _nl_xfrm_del_policy(nl_xfrm_t *public,
+							   const nl_xfrm_policy_t *policy)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	return send_ack(this,
+				nl_build_del_policy(this->socket->get_msg(this->socket), policy),
+				"policy of reqid", policy->reqid);
+}
+
+static int _nl_xfrm_batch_add_sa(nl_xfrm_batch_t *public,
+								 const nl_xfrm_sa_t *sa)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+	nl_msg_t *msg = this->batch->next(this->batch);
+
+	if (!msg)
+	{
+		return -1;
+	}
+	return this->batch->queued(this->batch,
+							   nl_build_sa(msg, XFRM_MSG_NEWSA, sa));
+}
+
+static int _nl_xfrm_batch_update_sa(nl_xfrm_batch_t *public,
+									const nl_xfrm_sa_t *sa)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+	nl_msg_t *msg = this->batch->next(this->batch);
+
+	if (!msg)
+	{
+		return -1;
+	}
+	return this->batch->queued(this->batch,
+							   nl_build_sa(msg, XFRM_MSG_UPDSA, sa));
+}
+
+static int _nl_xfrm_batch_del_sa(nl_xfrm_batch_t *public,
+								 const nl_xfrm_sa_t *sa)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+	nl_msg_t *msg = this->batch->next(this->batch);
+
+	if (!msg)
+	{
+		return -1;
+	}
+	return this->batch->queued(this->batch, nl_build_del_sa(msg, sa));
+}
+
+static int _nl_xfrm_batch_add_policy(nl_xfrm_batch_t *public,
+									 const nl_xfrm_policy_t *policy)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+	nl_msg_t *msg = this->batch->next(this->batch);
+
+	if (!msg)
+	{
+		return -1;
+	}
+	return this->batch->queued(this->batch,
+							nl_build_policy(msg, XFRM_MSG_NEWPOLICY, policy));
+}
+
+static int _nl_xfrm_batch_update_policy(nl_xfrm_batch_t *public,
+										const nl_xfrm_policy_t *policy)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+	nl_msg_t *msg = this->batch->next(this->batch);
+
+	if (!msg)
+	{
+		return -1;
+	}
+	return this->batch->queued(this->batch,
+							nl_build_policy(msg, XFRM_MSG_UPDPOLICY, policy));
+}
+
+static int _nl_xfrm_batch_del_policy(nl_xfrm_batch_t *public,
+									 const nl_xfrm_policy_t *policy)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+	nl_msg_t *msg = this->batch->next(this->batch);
+
+	if (!msg)
+	{
+		return -1;
+	}
+	return this->batch->queued(this->batch, nl_build_del_policy(msg, policy));
+}
+
+static int _nl_xfrm_batch_send(nl_xfrm_batch_t *public, nl_batch_cb_t cb,
+							   void *user)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+
+	return this->batch->send(this->batch, cb, user);
+}
+
+static int _nl_xfrm_batch_commit(nl_xfrm_batch_t *public)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+
+	return this->batch->commit(this->batch);
+}
+
+static int _nl_xfrm_batch_get_error(nl_xfrm_batch_t *public, int item)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+
+	return this->batch->get_error(this->batch, item);
+}
+
+static void _nl_xfrm_batch_destroy(nl_xfrm_batch_t *public)
+{
+	private_nl_xfrm_batch_t *this = (private_nl_xfrm_batch_t*)public;
+
+	this->batch->destroy(this->batch);
+	free(this);
+}
+
+static nl_xfrm_batch_t *_nl_xfrm_batch(nl_xfrm_t *public)
+{
+	private_nl_xfrm_t *xfrm = (private_nl_xfrm_t*)public;
+	private_nl_xfrm_batch_t *this;
+
+	this = calloc(1, sizeof(*this));
+	this->batch = nl_batch_create(xfrm->socket);
+	if (!this->batch)
+	{
+		free(this);
+		return NULL;
+	}
+	this->public.add_sa = _nl_xfrm_batch_add_sa;
+	this->public.update_sa = _nl_xfrm_batch_update_sa;
+	this->public.del_sa = _nl_xfrm_batch_del_sa;
+	this->public.add_policy = _nl_xfrm_batch_add_policy;
+	this->public.update_policy = _nl_xfrm_batch_update_policy;
+	this->public.del_policy = _nl_xfrm_batch_del_policy;
+	this->public.send = _nl_xfrm_batch_send;
+	this->public.commit = _nl_xfrm_batch_commit;
+	this->public.get_error = _nl_xfrm_batch_get_error;
+	this->public.destroy = _nl_xfrm_batch_destroy;
+	return &this->public;
+}
+
+static nl_socket_t *_nl_xfrm_get_socket(nl_xfrm_t *public)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	return this->socket;
+}
+
+static void _nl_xfrm_destroy(nl_xfrm_t *public)
+{
+	private_nl_xfrm_t *this = (private_nl_xfrm_t*)public;
+
+	if (this->socket)
+	{
+		this->socket->destroy(this->socket);
+	}
+	if (this->events)
+	{
+		this->events->destroy(this->events);
+	}
+	cache_flush(this);
+	free(this);
+}
+
+nl_xfrm_t *nl_xfrm_create()
+{
+	private_nl_xfrm_t *this;
+
+	this = calloc(1, sizeof(*this));
+	this->public.add_sa = _nl_xfrm_add_sa;
+	this->public.update_sa = _nl_xfrm_update_sa;
+	this->public.del_sa = _nl_xfrm_del_sa;
+	this->public.add_policy = _nl_xfrm_add_policy;
+	this->public.update_policy = _nl_xfrm_update_policy;
+	this->public.del_policy = _nl_xfrm_del_policy;
+	this->public.batch = _nl_xfrm_batch;
+	this->public.get_socket = _nl_xfrm_get_socket;
+	this->public.sync = _nl_xfrm_sync;
+	this->public.get_event_fd = _nl_xfrm_get_event_fd;
+	this->public.get_sa = _nl_xfrm_get_sa;
+	this->public.get_sa_count = _nl_xfrm_get_sa_count;
+	this->public.destroy = _nl_xfrm_destroy;
+	this->socket = nl_socket_create(NETLINK_XFRM);
+
+	if (!this->socket)
+	{
+		free(this);
+		return NULL;
+	}
+	cache_init(this);
+	return &this->public;
+}
@@ -0,0 +1,202 @@
+#ifndef __NL_XFRM_H__
+#define __NL_XFRM_H__
+
+#include <stdint.h>
+#include <linux/xfrm.h>
+
+#include "nl_socket.h"
+#include "nl_batch.h"
+
+typedef struct nl_xfrm_t nl_xfrm_t;
+typedef struct nl_xfrm_batch_t nl_xfrm_batch_t;
+typedef struct nl_xfrm_alg_t nl_xfrm_alg_t;
+typedef struct nl_xfrm_sa_t nl_xfrm_sa_t;
+typedef struct nl_xfrm_policy_t nl_xfrm_policy_t;
+
+/**
+ * Keys are 64 bytes at most, e.g. for hmac(sha512)
+ */
+#define NL_XFRM_KEY_SIZE 64
+
+/**
+ * Algorithm of an SA, as named by the kernel crypto API
+ */
+struct nl_xfrm_alg_t
+{
+	/* e.g. "rfc4106(gcm(aes))", empty if not used */
+	char name[64];
+	uint8_t key[NL_XFRM_KEY_SIZE];
+	/* in bytes */
+	unsigned int key_len;
+	/* ICV length in bits of integrity and AEAD algorithms, 0 otherwise */
+	unsigned int icv_len;
+};
+
+/**
+ * SA, identified by destination, SPI and protocol
+ */
+struct nl_xfrm_sa_t
+{
+	/* AF_INET or AF_INET6 */
+	unsigned short family;
+	xfrm_address_t src;
+	xfrm_address_t dst;
+	/* in host order */
+	uint32_t spi;
+	/* IPPROTO_ESP or IPPROTO_AH */
+	uint8_t proto;
+	/* XFRM_MODE_TUNNEL or XFRM_MODE_TRANSPORT */
+	uint8_t mode;
+	uint32_t reqid;
+	uint32_t replay_window;
+	/* XFRM interface the SA is bound to, 0 if none */
+	uint32_t if_id;
+	/* encryption algorithm, AEAD if it has an ICV */
+	nl_xfrm_alg_t enc;
+	/* integrity algorithm, not used with AEAD */
+	nl_xfrm_alg_t integ;
+};
+
+/**
+ * Policy applying an SA to the traffic it selects, identified by selector,
+ * direction and if_id
+ */
+struct nl_xfrm_policy_t
+{
+	/* AF_INET or AF_INET6 */
+	unsigned short family;
+	/* selected traffic */
+	xfrm_address_t src;
+	xfrm_address_t dst;
+	uint8_t src_len;
+	uint8_t dst_len;
+	/* XFRM_POLICY_IN, XFRM_POLICY_OUT or XFRM_POLICY_FWD */
+	uint8_t dir;
+	uint32_t priority;
+	/* XFRM interface the policy is bound to, 0 if none */
+	uint32_t if_id;
+	/* template of the SA, by tunnel endpoints, protocol and reqid */
+	xfrm_address_t tmpl_src;
+	xfrm_address_t tmpl_dst;
+	uint8_t proto;
+	uint8_t mode;
+	uint32_t reqid;
+};
+
+/**
+ * SAs and policies of the network namespace, over a NETLINK_XFRM socket.
+ *
+ * Installed SAs are cached by SPI, dumped once on creation and kept in sync
+ * by XFRMNLGRP_SA notifications. SAs sharing an SPI, e.g. of different
+ * peers, replace each other in the cache.
+ */
+struct nl_xfrm_t
+{
+	/**
+	 * Install an SA.
+	 *
+	 * @return			0 on success, -1 otherwise
+	 */
+	int (*add_sa)(nl_xfrm_t *this, const nl_xfrm_sa_t *sa);
+
+	/**
+	 * Replace an installed SA, e.g. to bind it to another interface.
+	 */
+	int (*update_sa)(nl_xfrm_t *this, const nl_xfrm_sa_t *sa);
+
+	/**
+	 * Delete an SA, only its family, destination, SPI and protocol are used.
+	 */
+	int (*del_sa)(nl_xfrm_t *this, const nl_xfrm_sa_t *sa);
+
+	int (*add_policy)(nl_xfrm_t *this, const nl_xfrm_policy_t *policy);
+
+	int (*update_policy)(nl_xfrm_t *this, const nl_xfrm_policy_t *policy);
+
+	/**
+	 * Delete a policy, its template is not used.
+	 */
+	int (*del_policy)(nl_xfrm_t *this, const nl_xfrm_policy_t *policy);
+
+	/**
+	 * Create a batch sending many requests at once, see nl_xfrm_batch_t.
+	 */
+	nl_xfrm_batch_t *(*batch)(nl_xfrm_t *this);
+
+	/**
+	 * Get the netlink socket, to receive() replies to batches sent
+	 * without waiting once its fd gets readable.
+	 */
+	nl_socket_t *(*get_socket)(nl_xfrm_t *this);
+
+	/**
+	 * Apply pending XFRMNLGRP_SA notifications to the cache, call it before
+	 * lookups or once the fd of get_event_fd() gets readable.
+	 *
+	 * @return			0 on success, negative errno otherwise,
+	 *					-ENOTSUP if the cache is not available
+	 */
+	int (*sync)(nl_xfrm_t *this);
+
+	/**
+	 * Get the fd receiving notifications, -1 if the cache is not available.
+	 */
+	int (*get_event_fd)(nl_xfrm_t *this);
+
+	/**
+	 * Look up a cached SA, without asking the kernel. The returned SA is
+	 * valid until the next sync().
+	 *
+	 * @param spi		SPI in host order
+	 */
+	const nl_xfrm_sa_t *(*get_sa)(nl_xfrm_t *this, uint32_t spi);
+
+	/**
+	 * Get the number of cached SAs.
+	 */
+	int (*get_sa_count)(nl_xfrm_t *this);
+
+	void (*destroy)(nl_xfrm_t *this);
+};
+
+/**
+ * Requests queued to be sent together, each with its own sequence number.
+ *
+ * Queueing returns the index of the item, or -1 if it could not be built.
+ * The batch is sent and completes as described by nl_batch_t.
+ */
+struct nl_xfrm_batch_t
+{
+	int (*add_sa)(nl_xfrm_batch_t *this, const nl_xfrm_sa_t *sa);
+
+	int (*update_sa)(nl_xfrm_batch_t *this, const nl_xfrm_sa_t *sa);
+
+	int (*del_sa)(nl_xfrm_batch_t *this, const nl_xfrm_sa_t *sa);
+
+	int (*add_policy)(nl_xfrm_batch_t *this, const nl_xfrm_policy_t *policy);
+
+	int (*update_policy)(nl_xfrm_batch_t *this,
+						 const nl_xfrm_policy_t *policy);
+
+	int (*del_policy)(nl_xfrm_batch_t *this, const nl_xfrm_policy_t *policy);
+
+	int (*send)(nl_xfrm_batch_t *this, nl_batch_cb_t cb, void *user);
+
+	/**
+	 * @return			number of failed items, negative errno if the
+	 *					batch could not be sent
+	 */
+	int (*commit)(nl_xfrm_batch_t *this);
+
+	/**
+	 * @return			0 on success, -EINPROGRESS if pending, negative
+	 *					errno otherwise
+	 */
+	int (*get_error)(nl_xfrm_batch_t *this, int item);
+
+	void (*destroy)(nl_xfrm_batch_t *this);
+};
+
+nl_xfrm_t *nl_xfrm_create();
+
+#endif
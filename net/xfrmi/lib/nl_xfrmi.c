@@ -9,208 +9,561 @@
 #include <linux/if_link.h>
 
 #include "uthash.h"
+#include "nl_attr.h"
+#include "nl_socket.h"
 #include "nl_xfrmi.h"
 
+/**
+ * Cached XFRM interface, in a table per key
+ */
 typedef struct nl_xfrmi_mgr_t
 {
-	char name[IFNAMSIZ];
-	nl_xfrmi_t *xfrmi;
+	nl_xfrmi_info_t info;
 	UT_hash_handle hh;
+	UT_hash_handle hh_index;
+	UT_hash_handle hh_if_id;
 }nl_xfrmi_mgr_t;
 
-typedef struct private_nl_xfrmi_t private_nl_xfrmi_t;
-typedef struct nl_socket_t nl_socket_t;
-
-struct nl_socket_t
+/**
+ * Physical interface looked up by name, by name and by ifindex
+ */
+typedef struct nl_xfrmi_link_t
 {
-    int fd;
-    int (*send_ack)(nl_socket_t *this, struct nlmsghdr *in);
-    void (*destroy)(nl_socket_t *this);
-};
+	char name[IFNAMSIZ];
+	unsigned int ifindex;
+	UT_hash_handle hh;
+	UT_hash_handle hh_index;
+}nl_xfrmi_link_t;
+
+typedef struct private_nl_xfrmi_t private_nl_xfrmi_t;
 
 struct private_nl_xfrmi_t {
 	nl_xfrmi_t public;
     nl_socket_t *socket;
+	/* RTNLGRP_LINK notifications, NULL if the cache is not used */
+	nl_socket_t *events;
+	/* cached XFRM interfaces by name, ifindex and if_id */
+	nl_xfrmi_mgr_t *by_name;
+	nl_xfrmi_mgr_t *by_index;
+	nl_xfrmi_mgr_t *by_if_id;
+	/* physical interfaces resolved so far, kept by the same notifications */
+	nl_xfrmi_link_t *links;
+	nl_xfrmi_link_t *links_by_index;
+	/* notifications got dropped, dump again */
+	int resync;
+	/* SAs and policies, created on demand */
+	nl_xfrm_t *xfrm;
 };
 
-typedef union {
-	struct nlmsghdr hdr;
-	u_char bytes[1024];
-} netlink_buf_t __attribute__((aligned(RTA_ALIGNTO)));
+typedef struct private_nl_xfrmi_batch_t private_nl_xfrmi_batch_t;
 
-nl_xfrmi_mgr_t *xfrmi_tables = NULL;
+struct private_nl_xfrmi_batch_t {
+	nl_xfrmi_batch_t public;
+	nl_batch_t *batch;
+	private_nl_xfrmi_t *xfrmi;
+};
 
-static void nl_add_attribute(struct nlmsghdr *hdr, int rta_type, unsigned char *ptr, size_t len,
-						  size_t buflen)
+/**
+ * Build a RTM_NEWLINK request creating an XFRM interface, set up in the
+ * same request if up is set
+ *
+ * @param link		ifindex of the physical interface, 0 if none
+ */
+static struct nlmsghdr *nl_build_create(nl_msg_t *msg, char *name,
+						unsigned int if_id, unsigned int link,
+						unsigned int mtu, int up)
 {
-	struct rtattr *rta;
+	struct ifinfomsg *ifi;
 
-	if (NLMSG_ALIGN(hdr->nlmsg_len) + RTA_LENGTH(len) > buflen)
+	ifi = msg->begin(msg, RTM_NEWLINK, NLM_F_REQUEST | NLM_F_ACK |
+					 NLM_F_CREATE | NLM_F_EXCL, sizeof(*ifi));
+	if (ifi)
 	{
-		fprintf(stderr, "unable to add attribute, buffer too small\n");
-		return;
+		ifi->ifi_family = AF_UNSPEC;
+		if (up)
+		{
+			ifi->ifi_change |= IFF_UP;
+			ifi->ifi_flags |= IFF_UP;
+		}
 	}
+	msg->put_str(msg, IFLA_IFNAME, name);
+	if (mtu)
+	{
+		msg->put_u32(msg, IFLA_MTU, mtu);
+	}
+	msg->nest(msg, IFLA_LINKINFO);
+	msg->put_str(msg, IFLA_INFO_KIND, "xfrm");
+	msg->nest(msg, IFLA_INFO_DATA);
+	msg->put_u32(msg, IFLA_XFRM_IF_ID, if_id);
+	if (link)
+	{
+		msg->put_u32(msg, IFLA_XFRM_LINK, link);
+	}
+	return msg->end(msg);
+}
+
+/**
+ * Build a RTM_SETLINK request setting an interface up
+ */
+static struct nlmsghdr *nl_build_up(nl_msg_t *msg, char *name)
+{
+	struct ifinfomsg *ifi;
 
-	rta = (struct rtattr*)(((char*)hdr) + NLMSG_ALIGN(hdr->nlmsg_len));
-	rta->rta_type = rta_type;
-	rta->rta_len = RTA_LENGTH(len);
-	memcpy(RTA_DATA(rta), ptr, len);
-	hdr->nlmsg_len = NLMSG_ALIGN(hdr->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	ifi = msg->begin(msg, RTM_SETLINK, NLM_F_REQUEST | NLM_F_ACK,
+					 sizeof(*ifi));
+	if (ifi)
+	{
+		ifi->ifi_family = AF_UNSPEC;
+		ifi->ifi_change |= IFF_UP;
+		ifi->ifi_flags |= IFF_UP;
+	}
+	msg->put_str(msg, IFLA_IFNAME, name);
+	return msg->end(msg);
 }
 
-static struct rtattr *nl_nested_start(struct nlmsghdr *hdr, int buflen, int type)
+/**
+ * Build a RTM_DELLINK request deleting an XFRM interface
+ */
+static struct nlmsghdr *nl_build_delete(nl_msg_t *msg, char *name)
 {
-	struct rtattr *rta;
+	struct ifinfomsg *ifi;
 
-	if (NLMSG_ALIGN(hdr->nlmsg_len) + RTA_LENGTH(0) > buflen)
+	ifi = msg->begin(msg, RTM_DELLINK, NLM_F_REQUEST | NLM_F_ACK,
+					 sizeof(*ifi));
+	if (ifi)
 	{
-		fprintf(stderr, "unable to add attribute, buffer too small\n");
-		return NULL;
+		ifi->ifi_family = AF_UNSPEC;
 	}
+	msg->put_str(msg, IFLA_IFNAME, name);
+	msg->nest(msg, IFLA_LINKINFO);
+	msg->put_str(msg, IFLA_INFO_KIND, "xfrm");
+	return msg->end(msg);
+}
+
+static void cache_remove(private_nl_xfrmi_t *this, nl_xfrmi_mgr_t *entry)
+{
+	HASH_DELETE(hh, this->by_name, entry);
+	HASH_DELETE(hh_index, this->by_index, entry);
+	HASH_DELETE(hh_if_id, this->by_if_id, entry);
+	free(entry);
+}
 
-	rta = ((void*)hdr) + NLMSG_ALIGN(hdr->nlmsg_len);
-	rta->rta_type = type;
-	rta->rta_len = RTA_LENGTH(0);
-	hdr->nlmsg_len = NLMSG_ALIGN(hdr->nlmsg_len) + RTA_ALIGN(rta->rta_len);
-	return rta;
+static void link_remove(private_nl_xfrmi_t *this, nl_xfrmi_link_t *link)
+{
+	HASH_DELETE(hh, this->links, link);
+	HASH_DELETE(hh_index, this->links_by_index, link);
+	free(link);
 }
 
-static void nl_nested_end(struct nlmsghdr *hdr, void *attr)
+static void link_add(private_nl_xfrmi_t *this, const char *name,
+					 unsigned int ifindex)
 {
-	struct rtattr *rta = attr;
-	void *end;
+	nl_xfrmi_link_t *link;
 
-	if (attr)
+	link = calloc(1, sizeof(*link));
+	if (!link)
 	{
-		end = (char*)hdr + NLMSG_ALIGN(hdr->nlmsg_len);
-		rta->rta_len = end - attr;
+		return;
 	}
+	snprintf(link->name, sizeof(link->name), "%s", name);
+	link->ifindex = ifindex;
+	HASH_ADD_KEYPTR(hh, this->links, link->name, strlen(link->name), link);
+	HASH_ADD(hh_index, this->links_by_index, ifindex, sizeof(link->ifindex),
+			 link);
 }
 
-static int _nl_socket_send_ack(nl_socket_t *this, struct nlmsghdr *msg)
+/**
+ * Follow renames and removals of resolved physical interfaces
+ */
+static void link_update(private_nl_xfrmi_t *this, int type,
+						nl_xfrmi_info_t *info)
 {
-	int len;
-	fd_set set;
-	char buf[1024] = {};
-	struct timeval tv = {};
-	struct nlmsghdr *hdr;
-	struct sockaddr_nl addr = {
-		.nl_family = AF_NETLINK,
-	};
-	
-    len = sendto(this->fd, msg, msg->nlmsg_len, 0,
-					 (struct sockaddr*)&addr, sizeof(addr));
-    if (len != msg->nlmsg_len)
-    {
-        fprintf(stderr, "sendto failed: %d, errno: %s(%d)\n", len, strerror(errno), errno);
-		return -1;
-    }
+	nl_xfrmi_link_t *link;
 
-	FD_ZERO(&set);
-	FD_SET(this->fd, &set);
-	tv.tv_sec = 1;
+	HASH_FIND(hh_index, this->links_by_index, &info->ifindex,
+			  sizeof(info->ifindex), link);
+	if (!link ||
+		(type == RTM_NEWLINK && strcmp(link->name, info->name) == 0))
+	{
+		return;
+	}
+	link_remove(this, link);
+	if (type == RTM_NEWLINK && info->name[0])
+	{
+		link_add(this, info->name, info->ifindex);
+	}
+}
+
+/**
+ * Resolve the ifindex of a physical interface, asking the kernel only for
+ * names not resolved yet. Without notifications every name is asked for.
+ *
+ * @return			ifindex, 0 if not found
+ */
+static unsigned int link_lookup(private_nl_xfrmi_t *this, const char *name)
+{
+	nl_xfrmi_link_t *link;
+	unsigned int ifindex;
 
-	if (select(this->fd + 1, &set, NULL, NULL, &tv) <= 0)
+	if (!this->events)
 	{
-		fprintf(stderr, "select failed: %s(%d)\n", strerror(errno), errno);
-		return -1;
+		return if_nametoindex(name);
+	}
+	HASH_FIND(hh, this->links, name, strlen(name), link);
+	if (link)
+	{
+		return link->ifindex;
+	}
+	ifindex = if_nametoindex(name);
+	if (ifindex)
+	{
+		link_add(this, name, ifindex);
+	}
+	return ifindex;
+}
+
+/**
+ * Get the ifindex of the physical interface to create an interface on
+ *
+ * @param link		ifindex, 0 if phys is NULL
+ * @return			0 on success, -1 if not found
+ */
+static int resolve_phys(private_nl_xfrmi_t *this, char *phys,
+						unsigned int *link)
+{
+	*link = 0;
+	if (phys)
+	{
+		*link = link_lookup(this, phys);
+		if (!*link)
+		{
+			fprintf(stderr, "physical interface '%s' not found\n", phys);
+			return -1;
+		}
 	}
+	return 0;
+}
+
+/**
+ * Forget all cached interfaces, and all resolved physical interfaces as
+ * notifications about them might have been lost as well
+ */
+static void cache_flush(private_nl_xfrmi_t *this)
+{
+	nl_xfrmi_mgr_t *entry, *tmp;
+	nl_xfrmi_link_t *link, *ltmp;
 
-	len = recv(this->fd, buf, sizeof(buf), MSG_TRUNC);
-	if (len < 0)
+	HASH_ITER(hh_index, this->by_index, entry, tmp)
 	{
-		fprintf(stderr, "recv failed: %s(%d)\n", strerror(errno), errno);
-		return -1;
+		cache_remove(this, entry);
+	}
+	HASH_ITER(hh_index, this->links_by_index, link, ltmp)
+	{
+		link_remove(this, link);
 	}
+}
 
-	hdr = (struct nlmsghdr*)buf;
-	while (NLMSG_OK(hdr, len))
+/**
+ * Add or update an interface, replacing stale ones with the same keys
+ */
+static void cache_put(private_nl_xfrmi_t *this, nl_xfrmi_info_t *info)
+{
+	nl_xfrmi_mgr_t *entry, *found;
+
+	HASH_FIND(hh_index, this->by_index, &info->ifindex, sizeof(info->ifindex),
+			  entry);
+	if (entry)
 	{
-		switch (hdr->nlmsg_type)
+		HASH_DELETE(hh, this->by_name, entry);
+		HASH_DELETE(hh_index, this->by_index, entry);
+		HASH_DELETE(hh_if_id, this->by_if_id, entry);
+	}
+	else
+	{
+		entry = malloc(sizeof(*entry));
+		if (!entry)
 		{
-			case NLMSG_ERROR:
-			{
-				struct nlmsgerr *err = NLMSG_DATA(hdr);
-
-				if (err->error)
-				{
-					if (-err->error == EEXIST)
-						return 3;
-					if (-err->error == ESRCH)
-						return 6;
-					return -1;
-				}
-				return 0;
-			}
-			default:
-				hdr = NLMSG_NEXT(hdr, len);
-				continue;
-			case NLMSG_DONE:
-				break;
+			return;
 		}
-		break;
 	}
-    return 0;
+	HASH_FIND(hh, this->by_name, info->name, strlen(info->name), found);
+	if (found)
+	{
+		cache_remove(this, found);
+	}
+	HASH_FIND(hh_if_id, this->by_if_id, &info->if_id, sizeof(info->if_id),
+			  found);
+	if (found)
+	{
+		cache_remove(this, found);
+	}
+	entry->info = *info;
+	HASH_ADD_KEYPTR(hh, this->by_name, entry->info.name,
+					strlen(entry->info.name), entry);
+	HASH_ADD(hh_index, this->by_index, info.ifindex,
+			 sizeof(entry->info.ifindex), entry);
+	HASH_ADD(hh_if_id, this->by_if_id, info.if_id,
+			 sizeof(entry->info.if_id), entry);
 }
 
-static int _nl_xfrmi_create(nl_xfrmi_t *public, char *name,
-                    unsigned int if_id, char *phys, unsigned int mtu)
+/**
+ * Parse the XFRM specific attributes nested in IFLA_LINKINFO
+ *
+ * @return			1 if it is an XFRM interface, 0 otherwise
+ */
+static int cache_parse_linkinfo(struct rtattr *linkinfo, nl_xfrmi_info_t *info)
 {
-    netlink_buf_t request;
-    private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
-	struct nlmsghdr *hdr;
-	struct ifinfomsg *msg;
-	struct rtattr *linkinfo, *info_data;
-	unsigned int ifindex = 0;
+	struct rtattr *attrs[IFLA_INFO_MAX + 1], *data[IFLA_XFRM_MAX + 1];
+	struct rtattr *kind;
 
-	if (phys)
+	nl_attr_parse_nested(attrs, IFLA_INFO_MAX, linkinfo);
+	kind = attrs[IFLA_INFO_KIND];
+	if (!kind || RTA_PAYLOAD(kind) < strlen("xfrm") ||
+		strncmp(RTA_DATA(kind), "xfrm", RTA_PAYLOAD(kind)) != 0)
+	{
+		return 0;
+	}
+	if (!attrs[IFLA_INFO_DATA])
+	{
+		return 1;
+	}
+	nl_attr_parse_nested(data, IFLA_XFRM_MAX, attrs[IFLA_INFO_DATA]);
+	if (data[IFLA_XFRM_IF_ID] &&
+		RTA_PAYLOAD(data[IFLA_XFRM_IF_ID]) >= sizeof(info->if_id))
 	{
-		ifindex = if_nametoindex(phys);
-		if (!ifindex)
+		info->if_id = *(unsigned int*)RTA_DATA(data[IFLA_XFRM_IF_ID]);
+	}
+	if (data[IFLA_XFRM_LINK] &&
+		RTA_PAYLOAD(data[IFLA_XFRM_LINK]) >= sizeof(info->link))
+	{
+		info->link = *(unsigned int*)RTA_DATA(data[IFLA_XFRM_LINK]);
+	}
+	return 1;
+}
+
+/**
+ * Update the cache from a RTM_NEWLINK or RTM_DELLINK message
+ *
+ * @param attrs		its attributes, up to IFLA_MAX
+ */
+static void cache_update(private_nl_xfrmi_t *this, struct nlmsghdr *hdr,
+						 struct rtattr **attrs)
+{
+	struct ifinfomsg *msg = NLMSG_DATA(hdr);
+	nl_xfrmi_info_t info = {};
+	nl_xfrmi_mgr_t *entry;
+	struct rtattr *rta;
+	int xfrm = 0;
+
+	if ((hdr->nlmsg_type != RTM_NEWLINK && hdr->nlmsg_type != RTM_DELLINK) ||
+		hdr->nlmsg_len < NLMSG_LENGTH(sizeof(*msg)))
+	{
+		return;
+	}
+	info.ifindex = msg->ifi_index;
+	info.flags = msg->ifi_flags;
+
+	if (hdr->nlmsg_type == RTM_NEWLINK)
+	{
+		rta = attrs[IFLA_IFNAME];
+		if (rta)
 		{
-			fprintf(stderr, "physical interface '%s' not found\n", phys);
-			return -1;
+			snprintf(info.name, sizeof(info.name), "%.*s",
+					 (int)RTA_PAYLOAD(rta), (char*)RTA_DATA(rta));
+		}
+		rta = attrs[IFLA_MTU];
+		if (rta && RTA_PAYLOAD(rta) >= sizeof(info.mtu))
+		{
+			info.mtu = *(unsigned int*)RTA_DATA(rta);
 		}
+		if (attrs[IFLA_LINKINFO])
+		{
+			xfrm = cache_parse_linkinfo(attrs[IFLA_LINKINFO], &info);
+		}
+	}
+	link_update(this, hdr->nlmsg_type, &info);
+	if (xfrm && info.name[0])
+	{
+		cache_put(this, &info);
+		return;
+	}
+	HASH_FIND(hh_index, this->by_index, &info.ifindex, sizeof(info.ifindex),
+			  entry);
+	if (entry)
+	{
+		cache_remove(this, entry);
 	}
+}
 
-	memset(&request, 0, sizeof(request));
-	hdr = &request.hdr;
-	hdr->nlmsg_pid = getpid();
-	hdr->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE | NLM_F_EXCL;
-	hdr->nlmsg_type = RTM_NEWLINK;
-	hdr->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+static void cache_event(void *user, struct nlmsghdr *msg, int err)
+{
+	private_nl_xfrmi_t *this = user;
+	struct rtattr *attrs[IFLA_MAX + 1];
 
-	msg = NLMSG_DATA(hdr);
-	msg->ifi_family = AF_UNSPEC;
+	if (err == -ENOBUFS)
+	{
+		this->resync = 1;
+	}
+	else if (msg &&
+			 nl_attr_parse_msg(attrs, IFLA_MAX, msg,
+							   sizeof(struct ifinfomsg)) == 0)
+	{
+		cache_update(this, msg, attrs);
+	}
+}
 
-    nl_add_attribute(hdr, IFLA_IFNAME, 
-                (unsigned char *)name, strlen(name), sizeof(request));
+static void cache_dump_cb(void *user, struct nlmsghdr *msg,
+						  struct rtattr **attrs)
+{
+	cache_update(user, msg, attrs);
+}
 
-	if (mtu)
-        nl_add_attribute(hdr, IFLA_MTU, 
-                (unsigned char *)&mtu, sizeof(mtu), sizeof(request));
+/**
+ * Fill the cache with all XFRM interfaces, notifications received before
+ * the dump completed are applied afterwards
+ */
+static int cache_dump(private_nl_xfrmi_t *this)
+{
+	nl_msg_t *msg = this->socket->get_msg(this->socket);
+	struct nlmsghdr *hdr;
+	struct ifinfomsg *ifi;
+	int err;
 
-    linkinfo = nl_nested_start(hdr, sizeof(request), IFLA_LINKINFO);
+	ifi = msg->begin(msg, RTM_GETLINK, NLM_F_REQUEST, sizeof(*ifi));
+	if (ifi)
+	{
+		ifi->ifi_family = AF_UNSPEC;
+	}
+	/* the kernel only dumps links of this kind */
+	msg->nest(msg, IFLA_LINKINFO);
+	msg->put_str(msg, IFLA_INFO_KIND, "xfrm");
+	hdr = msg->end(msg);
+
+	cache_flush(this);
+	this->resync = 0;
+	if (!hdr)
+	{
+		return -ENOMEM;
+	}
+	err = this->socket->dump(this->socket, hdr, sizeof(*ifi), IFLA_MAX,
+							 cache_dump_cb, this);
+	if (err)
+	{
+		fprintf(stderr, "dumping XFRM interfaces failed: %s(%d)\n",
+				strerror(-err), -err);
+	}
+	return err;
+}
 
-	nl_add_attribute(hdr, IFLA_INFO_KIND, (unsigned char *)"xfrm", strlen("xfrm"),
-						  sizeof(request));
+static int _nl_xfrmi_sync(nl_xfrmi_t *public)
+{
+	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
+	int err;
 
-    info_data = nl_nested_start(hdr, sizeof(request), IFLA_INFO_DATA);
+	if (!this->events)
+	{
+		return -ENOTSUP;
+	}
+	err = this->events->receive(this->events);
+	if (this->resync)
+	{
+		err = cache_dump(this);
+		this->events->receive(this->events);
+	}
+	return err;
+}
 
-    nl_add_attribute(hdr, IFLA_XFRM_IF_ID, (unsigned char *)&if_id, sizeof(if_id),
-						  sizeof(request));
+static int _nl_xfrmi_get_event_fd(nl_xfrmi_t *public)
+{
+	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
 
-	if (ifindex)
-		nl_add_attribute(hdr, IFLA_XFRM_LINK, (unsigned char *)&ifindex, sizeof(ifindex),
-							  sizeof(request));
+	return this->events ? this->events->get_fd(this->events) : -1;
+}
 
-	nl_nested_end(hdr, info_data);
-	nl_nested_end(hdr, linkinfo);
+static const nl_xfrmi_info_t *_nl_xfrmi_get_by_name(nl_xfrmi_t *public,
+													const char *name)
+{
+	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
+	nl_xfrmi_mgr_t *entry;
+
+	HASH_FIND(hh, this->by_name, name, strlen(name), entry);
+	return entry ? &entry->info : NULL;
+}
+
+static const nl_xfrmi_info_t *_nl_xfrmi_get_by_index(nl_xfrmi_t *public,
+													 unsigned int ifindex)
+{
+	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
+	nl_xfrmi_mgr_t *entry;
+
+	HASH_FIND(hh_index, this->by_index, &ifindex, sizeof(ifindex), entry);
+	return entry ? &entry->info : NULL;
+}
+
+static const nl_xfrmi_info_t *_nl_xfrmi_get_by_if_id(nl_xfrmi_t *public,
+													 unsigned int if_id)
+{
+	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
+	nl_xfrmi_mgr_t *entry;
+
+	HASH_FIND(hh_if_id, this->by_if_id, &if_id, sizeof(if_id), entry);
+	return entry ? &entry->info : NULL;
+}
+
+/**
+ * Create the cache, an error is not fatal as requests work without it
+ */
+static void cache_init(private_nl_xfrmi_t *this)
+{
+	this->events = nl_socket_create(NETLINK_ROUTE);
+	if (!this->events ||
+		this->events->subscribe(this->events, RTNLGRP_LINK, cache_event,
+								this) != 0 ||
+		cache_dump(this) != 0)
+	{
+		fprintf(stderr, "XFRM interface cache not available\n");
+		if (this->events)
+		{
+			this->events->destroy(this->events);
+			this->events = NULL;
+		}
+		cache_flush(this);
+		return;
+	}
+	/* apply changes that happened during the dump */
+	this->events->receive(this->events);
+}
+
+static int _nl_xfrmi_create(nl_xfrmi_t *public, char *name,
+                    unsigned int if_id, char *phys, unsigned int mtu, int up)
+{
+    private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
+	struct nlmsghdr *hdr;
+	unsigned int link;
+
+	if (_nl_xfrmi_sync(public) == 0 &&
+		(_nl_xfrmi_get_by_name(public, name) ||
+		 _nl_xfrmi_get_by_if_id(public, if_id)))
+	{
+		fprintf(stderr, "XFRM interface '%s' already exists\n", name);
+		return -1;
+	}
+
+	if (resolve_phys(this, phys, &link) != 0)
+	{
+		return -1;
+	}
+	hdr = nl_build_create(this->socket->get_msg(this->socket), name, if_id,
+						  link, mtu, up);
+	if (!hdr)
+	{
+		return -1;
+	}
 
 	switch (this->socket->send_ack(this->socket, hdr))
 	{
 		case 0:
-			return this->public.up(&this->public, name);
+			return 0;
 		case 3:
 			fprintf(stderr, "XFRM interface '%s' already exists\n", name);
 			break;
@@ -223,27 +576,21 @@ static int _nl_xfrmi_create(nl_xfrmi_t *public, char *name,
 
 static int _nl_xfrmi_up(nl_xfrmi_t *public, char *name)
 {
-	netlink_buf_t request;
-	struct nlmsghdr *hdr;
-	struct ifinfomsg *msg;
 	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
+	const nl_xfrmi_info_t *info;
+	struct nlmsghdr *hdr;
 
-	memset(&request, 0, sizeof(request));
-
-	hdr = &request.hdr;
-	hdr->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-	hdr->nlmsg_type = RTM_SETLINK;
-	hdr->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-
-	msg = NLMSG_DATA(hdr);
-	msg->ifi_family = AF_UNSPEC;
-	msg->ifi_change |= IFF_UP;
-	msg->ifi_flags |= IFF_UP;
-
-	nl_add_attribute(hdr, IFLA_IFNAME, (unsigned char *)name, strlen(name),
-						  sizeof(request));
+	if (_nl_xfrmi_sync(public) == 0)
+	{
+		info = _nl_xfrmi_get_by_name(public, name);
+		if (info && (info->flags & IFF_UP))
+		{
+			return 0;
+		}
+	}
 
-	if (this->socket->send_ack(this->socket, hdr) != 0)
+	hdr = nl_build_up(this->socket->get_msg(this->socket), name);
+	if (!hdr || this->socket->send_ack(this->socket, hdr) != 0)
 	{
 		fprintf(stderr, "failed to bring up XFRM interface '%s'", name);
 		return -1;
@@ -253,28 +600,20 @@ static int _nl_xfrmi_up(nl_xfrmi_t *public, char *name)
 
 static int _nl_xfrmi_delete(nl_xfrmi_t *public, char *name)
 {
-	struct nlmsghdr *hdr;
-	struct ifinfomsg *msg;
-	struct rtattr *linkinfo;
 	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
-	netlink_buf_t request;
-
-	memset(&request, 0, sizeof(request));
-
-	hdr = &request.hdr;
-	hdr->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-	hdr->nlmsg_type = RTM_DELLINK;
-	hdr->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	struct nlmsghdr *hdr;
 
-	msg = NLMSG_DATA(hdr);
-	msg->ifi_family = AF_UNSPEC;
+	if (_nl_xfrmi_sync(public) == 0 && !_nl_xfrmi_get_by_name(public, name))
+	{
+		fprintf(stderr, "XFRM interface '%s' not found to delete\n", name);
+		return -1;
+	}
 
-    nl_add_attribute(hdr, IFLA_IFNAME, 
-			(unsigned char *)name, strlen(name), sizeof(request));
-	
-	linkinfo = nl_nested_start(hdr, sizeof(request), IFLA_LINKINFO);
-	nl_add_attribute(hdr, IFLA_INFO_KIND, (unsigned char *)"xfrm", strlen("xfrm"), sizeof(request));
-	nl_nested_end(hdr, linkinfo);
+	hdr = nl_build_delete(this->socket->get_msg(this->socket), name);
+	if (!hdr)
+	{
+		return -1;
+	}
 
 	switch (this->socket->send_ack(this->socket, hdr))
 	{
@@ -282,6 +621,7 @@ static int _nl_xfrmi_delete(nl_xfrmi_t *public, char *name)
             return 0;
 		case 6:
 			fprintf(stderr, "XFRM interface '%s' not found to delete\n", name);
+			break;
 		default:
 			fprintf(stderr, "failed to delete XFRM interface '%s'\n", name);
 			break;
@@ -289,40 +629,139 @@ static int _nl_xfrmi_delete(nl_xfrmi_t *public, char *name)
     return -1;
 }
 
-static void _nl_xfrmi_destory(nl_xfrmi_t *public)
+static int _nl_xfrmi_batch_create(nl_xfrmi_batch_t *public, char *name,
+						unsigned int if_id, char *phys, unsigned int mtu,
+						int up)
 {
-	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
-	if (this->socket)
+	private_nl_xfrmi_batch_t *this = (private_nl_xfrmi_batch_t*)public;
+	unsigned int link;
+	nl_msg_t *msg;
+
+	if (resolve_phys(this->xfrmi, phys, &link) != 0)
 	{
-		this->socket->destroy(this->socket);
+		return -1;
 	}
-	free(this);
+	msg = this->batch->next(this->batch);
+	if (!msg)
+	{
+		return -1;
+	}
+	return this->batch->queued(this->batch,
+						nl_build_create(msg, name, if_id, link, mtu, up));
 }
 
-static void _nl_socket_destory(nl_socket_t *this)
+static int _nl_xfrmi_batch_up(nl_xfrmi_batch_t *public, char *name)
 {
-	if (this->fd != -1)
+	private_nl_xfrmi_batch_t *this = (private_nl_xfrmi_batch_t*)public;
+	nl_msg_t *msg = this->batch->next(this->batch);
+
+	if (!msg)
+	{
+		return -1;
+	}
+	return this->batch->queued(this->batch, nl_build_up(msg, name));
+}
+
+static int _nl_xfrmi_batch_delete(nl_xfrmi_batch_t *public, char *name)
+{
+	private_nl_xfrmi_batch_t *this = (private_nl_xfrmi_batch_t*)public;
+	nl_msg_t *msg = this->batch->next(this->batch);
+
+	if (!msg)
 	{
-		close(this->fd);
+		return -1;
 	}
+	return this->batch->queued(this->batch, nl_build_delete(msg, name));
+}
+
+static int _nl_xfrmi_batch_send(nl_xfrmi_batch_t *public,
+								nl_xfrmi_batch_cb_t cb, void *user)
+{
+	private_nl_xfrmi_batch_t *this = (private_nl_xfrmi_batch_t*)public;
+
+	return this->batch->send(this->batch, cb, user);
+}
+
+static int _nl_xfrmi_batch_commit(nl_xfrmi_batch_t *public)
+{
+	private_nl_xfrmi_batch_t *this = (private_nl_xfrmi_batch_t*)public;
+
+	return this->batch->commit(this->batch);
+}
+
+static int _nl_xfrmi_batch_get_error(nl_xfrmi_batch_t *public, int item)
+{
+	private_nl_xfrmi_batch_t *this = (private_nl_xfrmi_batch_t*)public;
+
+	return this->batch->get_error(this->batch, item);
+}
+
+static void _nl_xfrmi_batch_destroy(nl_xfrmi_batch_t *public)
+{
+	private_nl_xfrmi_batch_t *this = (private_nl_xfrmi_batch_t*)public;
+
+	this->batch->destroy(this->batch);
 	free(this);
 }
 
-static nl_socket_t *nl_socket_create(int protocol)
+static nl_xfrmi_batch_t *_nl_xfrmi_batch(nl_xfrmi_t *public)
 {
-    nl_socket_t *this;
-    this = calloc(1, sizeof(*this));
-    this->fd = socket(AF_NETLINK, SOCK_RAW, protocol);
+	private_nl_xfrmi_t *xfrmi = (private_nl_xfrmi_t*)public;
+	private_nl_xfrmi_batch_t *this;
+
+	this = calloc(1, sizeof(*this));
+	this->xfrmi = xfrmi;
+	this->batch = nl_batch_create(xfrmi->socket);
+	if (!this->batch)
+	{
+		free(this);
+		return NULL;
+	}
+	this->public.create = _nl_xfrmi_batch_create;
+	this->public.up = _nl_xfrmi_batch_up;
+	this->public.delete = _nl_xfrmi_batch_delete;
+	this->public.send = _nl_xfrmi_batch_send;
+	this->public.commit = _nl_xfrmi_batch_commit;
+	this->public.get_error = _nl_xfrmi_batch_get_error;
+	this->public.destroy = _nl_xfrmi_batch_destroy;
+	return &this->public;
+}
+
+static nl_socket_t *_nl_xfrmi_get_socket(nl_xfrmi_t *public)
+{
+	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
+
+	return this->socket;
+}
+
+static nl_xfrm_t *_nl_xfrmi_get_xfrm(nl_xfrmi_t *public)
+{
+	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
 
-    if (this->fd < 0)
-    {
-        free(this);
-        return NULL;
-    }
+	if (!this->xfrm)
+	{
+		this->xfrm = nl_xfrm_create();
+	}
+	return this->xfrm;
+}
 
-    this->send_ack = _nl_socket_send_ack;
-    this->destroy = _nl_socket_destory;
-    return this;
+static void _nl_xfrmi_destory(nl_xfrmi_t *public)
+{
+	private_nl_xfrmi_t *this = (private_nl_xfrmi_t*)public;
+	if (this->xfrm)
+	{
+		this->xfrm->destroy(this->xfrm);
+	}
+	if (this->socket)
+	{
+		this->socket->destroy(this->socket);
+	}
+	if (this->events)
+	{
+		this->events->destroy(this->events);
+	}
+	cache_flush(this);
+	free(this);
 }
 
 nl_xfrmi_t *nl_xfrmi_create()
@@ -333,6 +772,14 @@ nl_xfrmi_t *nl_xfrmi_create()
     this->public.create = _nl_xfrmi_create;
 	this->public.up = _nl_xfrmi_up;
     this->public.delete = _nl_xfrmi_delete;
+	this->public.batch = _nl_xfrmi_batch;
+	this->public.get_socket = _nl_xfrmi_get_socket;
+	this->public.sync = _nl_xfrmi_sync;
+	this->public.get_event_fd = _nl_xfrmi_get_event_fd;
+	this->public.get_by_name = _nl_xfrmi_get_by_name;
+	this->public.get_by_index = _nl_xfrmi_get_by_index;
+	this->public.get_by_if_id = _nl_xfrmi_get_by_if_id;
+	this->public.get_xfrm = _nl_xfrmi_get_xfrm;
 	this->public.destroy = _nl_xfrmi_destory;
     this->socket = nl_socket_create(NETLINK_ROUTE);
 
@@ -341,5 +788,6 @@ nl_xfrmi_t *nl_xfrmi_create()
 		free(this);
 		return NULL;
 	}
+	cache_init(this);
 	return &this->public;
 }
\ No newline at end of file
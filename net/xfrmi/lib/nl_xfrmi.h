@@ -1,22 +1,153 @@
 #ifndef __NL_XFRMI_H__
 #define __NL_XFRMI_H__
 
+#include <net/if.h>
+
+#include "nl_socket.h"
+#include "nl_batch.h"
+#include "nl_xfrm.h"
+
 typedef struct nl_xfrmi_t nl_xfrmi_t;
-typedef struct nl_xfrmi_mgr_t nl_xfrmi_mgr_t;
+typedef struct nl_xfrmi_batch_t nl_xfrmi_batch_t;
+typedef struct nl_xfrmi_info_t nl_xfrmi_info_t;
+
+/**
+ * XFRM interface as cached from the kernel
+ */
+struct nl_xfrmi_info_t
+{
+	char name[IFNAMSIZ];
+	unsigned int ifindex;
+	unsigned int if_id;
+	/* ifindex of the physical interface, 0 if none */
+	unsigned int link;
+	unsigned int mtu;
+	/* IFF_* flags */
+	unsigned int flags;
+};
+
+/**
+ * Callback of an item of a batch sent with nl_xfrmi_batch_t.send().
+ */
+typedef nl_batch_cb_t nl_xfrmi_batch_cb_t;
 
 struct nl_xfrmi_t
 {
+	/**
+	 * Create an XFRM interface.
+	 *
+	 * The ifindex of phys is resolved once and cached, following renames
+	 * and removals by notification. Without the cache it is resolved on
+	 * every call.
+	 *
+	 * @param phys		physical interface, NULL if none
+	 * @param mtu		MTU, 0 for the default
+	 * @param up		set it up in the same request
+	 * @return			0 on success, -1 on error
+	 */
 	int (*create)(nl_xfrmi_t *this, char *name, unsigned int if_id,
-				   char *phys, unsigned int mtu);
+				   char *phys, unsigned int mtu, int up);
 
 	int (*up)(nl_xfrmi_t *public, char *name);
 
 	int (*delete)(nl_xfrmi_t *this, char *name);
 
+	/**
+	 * Create a batch sending many requests at once, see nl_xfrmi_batch_t.
+	 */
+	nl_xfrmi_batch_t *(*batch)(nl_xfrmi_t *this);
+
+	/**
+	 * Get the netlink socket, to receive() replies to batches sent
+	 * without waiting once its fd gets readable.
+	 */
+	nl_socket_t *(*get_socket)(nl_xfrmi_t *this);
+
+	/**
+	 * Apply pending RTNLGRP_LINK notifications to the cache of XFRM
+	 * interfaces, dumped once on creation. Done by create(), up() and
+	 * delete() to skip redundant requests, call it before lookups or once
+	 * the fd of get_event_fd() gets readable.
+	 *
+	 * @return			0 on success, negative errno otherwise,
+	 *					-ENOTSUP if the cache is not available
+	 */
+	int (*sync)(nl_xfrmi_t *this);
+
+	/**
+	 * Get the fd receiving notifications, -1 if the cache is not available.
+	 */
+	int (*get_event_fd)(nl_xfrmi_t *this);
+
+	/**
+	 * Look up cached XFRM interfaces, without asking the kernel. Returned
+	 * entries are valid until the next sync().
+	 */
+	const nl_xfrmi_info_t *(*get_by_name)(nl_xfrmi_t *this, const char *name);
+
+	const nl_xfrmi_info_t *(*get_by_index)(nl_xfrmi_t *this,
+										   unsigned int ifindex);
+
+	const nl_xfrmi_info_t *(*get_by_if_id)(nl_xfrmi_t *this,
+										   unsigned int if_id);
+
+	/**
+	 * Get the SAs and policies of the network namespace, to bind them to
+	 * interfaces by if_id. Created on first use, destroyed with this.
+	 *
+	 * @return			SA and policy manager, NULL on error
+	 */
+	nl_xfrm_t *(*get_xfrm)(nl_xfrmi_t *this);
+
 	void (*destroy)(nl_xfrmi_t *this);									
 };
 
-extern nl_xfrmi_mgr_t *xfrmi_tables;
+/**
+ * Requests queued to be sent together, each with its own sequence number.
+ *
+ * Queueing returns the index of the item, or -1 if it could not be built.
+ */
+struct nl_xfrmi_batch_t
+{
+	/**
+	 * Queue creating an XFRM interface, as nl_xfrmi_t.create(). A cached
+	 * phys is as current as the last sync() of the nl_xfrmi_t.
+	 */
+	int (*create)(nl_xfrmi_batch_t *this, char *name, unsigned int if_id,
+				   char *phys, unsigned int mtu, int up);
+
+	int (*up)(nl_xfrmi_batch_t *this, char *name);
+
+	int (*delete)(nl_xfrmi_batch_t *this, char *name);
+
+	/**
+	 * Send the queued requests without waiting for their ACKs. Items
+	 * can't be queued until all completed, then they start a new batch.
+	 *
+	 * @param cb		invoked for each item as its ACK arrives, or NULL
+	 * @return			0 on success, negative errno otherwise
+	 */
+	int (*send)(nl_xfrmi_batch_t *this, nl_xfrmi_batch_cb_t cb, void *user);
+
+	/**
+	 * Send the queued requests and wait for their ACKs. Items queued
+	 * afterwards start a new batch.
+	 *
+	 * @return			number of failed items, negative errno if the
+	 *					batch could not be sent
+	 */
+	int (*commit)(nl_xfrmi_batch_t *this);
+
+	/**
+	 * Get the result of an item of the committed batch.
+	 *
+	 * @return			0 on success, -EINPROGRESS if pending, negative
+	 *					errno otherwise
+	 */
+	int (*get_error)(nl_xfrmi_batch_t *this, int item);
+
+	void (*destroy)(nl_xfrmi_batch_t *this);
+};
 
 nl_xfrmi_t *nl_xfrmi_create();
 
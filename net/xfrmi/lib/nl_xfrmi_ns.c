@@ -0,0 +1,446 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <net/if.h>
+
+#include "mutex.h"
+#include "condvar.h"
+#include "nl_xfrmi_ns.h"
+
+typedef enum {
+	OP_CREATE,
+	OP_UP,
+	OP_DELETE,
+} op_type_t;
+
+/**
+ * Queued request, built once in the namespace as the physical interface is
+ * looked up there
+ */
+typedef struct {
+	op_type_t type;
+	char name[IFNAMSIZ];
+	/* empty if none */
+	char phys[IFNAMSIZ];
+	unsigned int if_id;
+	unsigned int mtu;
+	int up;
+	/* result of the last commit */
+	int error;
+} op_t;
+
+typedef struct {
+	/* namespace file */
+	int fd;
+	/* opened in the namespace on the first commit */
+	nl_xfrmi_t *xfrmi;
+	nl_xfrmi_batch_t *batch;
+	op_t *ops;
+	int count;
+	int size;
+	int committed;
+	/* failed items of the last commit */
+	int failed;
+} netns_t;
+
+typedef struct private_nl_xfrmi_ns_t private_nl_xfrmi_ns_t;
+
+struct private_nl_xfrmi_ns_t {
+	nl_xfrmi_ns_t public;
+	processor_t *processor;
+	netns_t *ns;
+	int count;
+	/* number of jobs not done yet, and signaled once they are */
+	mutex_t *mutex;
+	condvar_t *done;
+	int pending;
+};
+
+/**
+ * Job sending the requests of a namespace
+ */
+typedef struct {
+	job_t public;
+	private_nl_xfrmi_ns_t *engine;
+	netns_t *ns;
+	/* not set if the job gets dropped or canceled while queued */
+	int executed;
+} ns_job_t;
+
+/**
+ * Build and commit the queued requests, in the namespace
+ */
+static void run_ops(netns_t *ns)
+{
+	op_t *op;
+	int i, err, *items;
+
+	if (!ns->xfrmi)
+	{
+		ns->xfrmi = nl_xfrmi_create();
+	}
+	if (!ns->batch && ns->xfrmi)
+	{
+		ns->batch = ns->xfrmi->batch(ns->xfrmi);
+	}
+	items = malloc(ns->count * sizeof(*items));
+	if (!ns->batch || (ns->count && !items))
+	{
+		for (i = 0; i < ns->count; i++)
+		{
+			ns->ops[i].error = -ENOMEM;
+		}
+		free(items);
+		return;
+	}
+	for (i = 0; i < ns->count; i++)
+	{
+		op = &ns->ops[i];
+		switch (op->type)
+		{
+			case OP_CREATE:
+				items[i] = ns->batch->create(ns->batch, op->name, op->if_id,
+									op->phys[0] ? op->phys : NULL, op->mtu,
+									op->up);
+				break;
+			case OP_UP:
+				items[i] = ns->batch->up(ns->batch, op->name);
+				break;
+			case OP_DELETE:
+				items[i] = ns->batch->delete(ns->batch, op->name);
+				break;
+		}
+	}
+	err = ns->batch->commit(ns->batch);
+	for (i = 0; i < ns->count; i++)
+	{
+		/* not built, e.g. the physical interface is not found */
+		ns->ops[i].error = items[i] < 0 ? -EINVAL : err < 0 ? err :
+							ns->batch->get_error(ns->batch, items[i]);
+	}
+	if (err < 0)
+	{	/* drop the messages it still holds, they'd go with the next run */
+		ns->batch->destroy(ns->batch);
+		ns->batch = NULL;
+	}
+	free(items);
+}
+
+/**
+ * Enter the namespace, run its requests and return to where we came from
+ */
+static job_requeue_t ns_job_execute(job_t *public)
+{
+	ns_job_t *this = (ns_job_t*)public;
+	netns_t *ns = this->ns;
+	int self, err = 0, i;
+
+	self = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+	if (self < 0 || setns(ns->fd, CLONE_NEWNET) != 0)
+	{
+		err = -errno;
+		fprintf(stderr, "entering network namespace failed: %s(%d)\n",
+				strerror(-err), -err);
+	}
+	else
+	{
+		run_ops(ns);
+		if (setns(self, CLONE_NEWNET) != 0)
+		{
+			fprintf(stderr, "returning to network namespace failed: %s\n",
+					strerror(errno));
+		}
+	}
+	if (self >= 0)
+	{
+		close(self);
+	}
+
+	ns->failed = 0;
+	for (i = 0; i < ns->count; i++)
+	{
+		if (err)
+		{
+			ns->ops[i].error = err;
+		}
+		if (ns->ops[i].error)
+		{
+			ns->failed++;
+		}
+	}
+	this->executed = 1;
+	return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_NONE };
+}
+
+static job_priority_t ns_job_get_priority(job_t *public)
+{
+	/* blocks on netlink */
+	return JOB_PRIO_LOW;
+}
+
+/**
+ * The job is done once destroyed, whether it ran or not
+ */
+static void ns_job_destroy(job_t *public)
+{
+	ns_job_t *this = (ns_job_t*)public;
+	private_nl_xfrmi_ns_t *engine = this->engine;
+	netns_t *ns = this->ns;
+	int i;
+
+	if (!this->executed)
+	{
+		for (i = 0; i < ns->count; i++)
+		{
+			ns->ops[i].error = -ECANCELED;
+		}
+		ns->failed = ns->count;
+	}
+
+	engine->mutex->lock(engine->mutex);
+	if (--engine->pending == 0)
+	{
+		engine->done->broadcast(engine->done);
+	}
+	engine->mutex->unlock(engine->mutex);
+	free(this);
+}
+
+static job_t *ns_job_create(private_nl_xfrmi_ns_t *engine, netns_t *ns)
+{
+	ns_job_t *this = calloc(1, sizeof(*this));
+
+	this->public.execute = ns_job_execute;
+	this->public.get_priority = ns_job_get_priority;
+	this->public.destroy = ns_job_destroy;
+	this->engine = engine;
+	this->ns = ns;
+	return &this->public;
+}
+
+static int _nl_xfrmi_ns_add_netns(nl_xfrmi_ns_t *public, const char *path)
+{
+	private_nl_xfrmi_ns_t *this = (private_nl_xfrmi_ns_t*)public;
+	netns_t *ns;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		fprintf(stderr, "opening network namespace '%s' failed: %s\n", path,
+				strerror(errno));
+		return -1;
+	}
+	ns = realloc(this->ns, (this->count + 1) * sizeof(*ns));
+	if (!ns)
+	{
+		close(fd);
+		return -1;
+	}
+	this->ns = ns;
+	this->ns[this->count] = (netns_t){
+		.fd = fd,
+	};
+	return this->count++;
+}
+
+/**
+ * Get a new request of a namespace, starts a new batch if the last one got
+ * committed
+ */
+static op_t *op_next(private_nl_xfrmi_ns_t *this, int index, op_type_t type,
+					 char *name)
+{
+	netns_t *ns;
+	op_t *ops;
+	int size;
+
+	if (index < 0 || index >= this->count)
+	{
+		return NULL;
+	}
+	ns = &this->ns[index];
+	if (ns->committed)
+	{
+		ns->count = ns->committed = ns->failed = 0;
+	}
+	if (ns->count == ns->size)
+	{
+		size = ns->size ? ns->size * 2 : 64;
+		ops = realloc(ns->ops, size * sizeof(*ops));
+		if (!ops)
+		{
+			return NULL;
+		}
+		ns->ops = ops;
+		ns->size = size;
+	}
+	ops = &ns->ops[ns->count];
+	*ops = (op_t){
+		.type = type,
+	};
+	snprintf(ops->name, sizeof(ops->name), "%s", name);
+	return ops;
+}
+
+static int _nl_xfrmi_ns_create(nl_xfrmi_ns_t *public, int ns, char *name,
+				unsigned int if_id, char *phys, unsigned int mtu, int up)
+{
+	private_nl_xfrmi_ns_t *this = (private_nl_xfrmi_ns_t*)public;
+	op_t *op = op_next(this, ns, OP_CREATE, name);
+
+	if (!op)
+	{
+		return -1;
+	}
+	if (phys)
+	{
+		snprintf(op->phys, sizeof(op->phys), "%s", phys);
+	}
+	op->if_id = if_id;
+	op->mtu = mtu;
+	op->up = up;
+	return this->ns[ns].count++;
+}
+
+static int _nl_xfrmi_ns_up(nl_xfrmi_ns_t *public, int ns, char *name)
+{
+	private_nl_xfrmi_ns_t *this = (private_nl_xfrmi_ns_t*)public;
+
+	if (!op_next(this, ns, OP_UP, name))
+	{
+		return -1;
+	}
+	return this->ns[ns].count++;
+}
+
+static int _nl_xfrmi_ns_delete(nl_xfrmi_ns_t *public, int ns, char *name)
+{
+	private_nl_xfrmi_ns_t *this = (private_nl_xfrmi_ns_t*)public;
+
+	if (!op_next(this, ns, OP_DELETE, name))
+	{
+		return -1;
+	}
+	return this->ns[ns].count++;
+}
+
+static int _nl_xfrmi_ns_commit(nl_xfrmi_ns_t *public)
+{
+	private_nl_xfrmi_ns_t *this = (private_nl_xfrmi_ns_t*)public;
+	netns_t *ns;
+	job_t *job;
+	int i, j, err, failed = 0;
+
+	for (i = 0; i < this->count; i++)
+	{
+		ns = &this->ns[i];
+		if (ns->committed || !ns->count)
+		{
+			continue;
+		}
+		ns->committed = 1;
+		this->mutex->lock(this->mutex);
+		this->pending++;
+		this->mutex->unlock(this->mutex);
+
+		job = ns_job_create(this, ns);
+		err = this->processor->queue_job(this->processor, job);
+		if (err)
+		{
+			/* not destroyed if not queued, completes it as canceled */
+			job->destroy(job);
+			for (j = 0; j < ns->count; j++)
+			{
+				ns->ops[j].error = err;
+			}
+			ns->failed = ns->count;
+		}
+	}
+
+	this->mutex->lock(this->mutex);
+	while (this->pending)
+	{
+		this->done->wait(this->done, this->mutex);
+	}
+	this->mutex->unlock(this->mutex);
+
+	for (i = 0; i < this->count; i++)
+	{
+		failed += this->ns[i].failed;
+	}
+	return failed;
+}
+
+static int _nl_xfrmi_ns_get_failed(nl_xfrmi_ns_t *public, int ns)
+{
+	private_nl_xfrmi_ns_t *this = (private_nl_xfrmi_ns_t*)public;
+
+	if (ns < 0 || ns >= this->count)
+	{
+		return -1;
+	}
+	return this->ns[ns].failed;
+}
+
+static int _nl_xfrmi_ns_get_error(nl_xfrmi_ns_t *public, int ns, int item)
+{
+	private_nl_xfrmi_ns_t *this = (private_nl_xfrmi_ns_t*)public;
+
+	if (ns < 0 || ns >= this->count || !this->ns[ns].committed ||
+		item < 0 || item >= this->ns[ns].count)
+	{
+		return -EINVAL;
+	}
+	return this->ns[ns].ops[item].error;
+}
+
+static void _nl_xfrmi_ns_destroy(nl_xfrmi_ns_t *public)
+{
+	private_nl_xfrmi_ns_t *this = (private_nl_xfrmi_ns_t*)public;
+	netns_t *ns;
+	int i;
+
+	for (i = 0; i < this->count; i++)
+	{
+		ns = &this->ns[i];
+		if (ns->batch)
+		{
+			ns->batch->destroy(ns->batch);
+		}
+		if (ns->xfrmi)
+		{
+			ns->xfrmi->destroy(ns->xfrmi);
+		}
+		close(ns->fd);
+		free(ns->ops);
+	}
+	free(this->ns);
+	this->done->destroy(this->done);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+nl_xfrmi_ns_t *nl_xfrmi_ns_create(processor_t *processor)
+{
+	private_nl_xfrmi_ns_t *this;
+
+	this = calloc(1, sizeof(*this));
+	this->public.add_netns = _nl_xfrmi_ns_add_netns;
+	this->public.create = _nl_xfrmi_ns_create;
+	this->public.up = _nl_xfrmi_ns_up;
+	this->public.delete = _nl_xfrmi_ns_delete;
+	this->public.commit = _nl_xfrmi_ns_commit;
+	this->public.get_failed = _nl_xfrmi_ns_get_failed;
+	this->public.get_error = _nl_xfrmi_ns_get_error;
+	this->public.destroy = _nl_xfrmi_ns_destroy;
+	this->processor = processor;
+	this->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	this->done = condvar_create(CONDVAR_TYPE_DEFAULT);
+	return &this->public;
+}
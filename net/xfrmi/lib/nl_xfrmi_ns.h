@@ -0,0 +1,73 @@
+#ifndef __NL_XFRMI_NS_H__
+#define __NL_XFRMI_NS_H__
+
+#include "processor.h"
+#include "nl_xfrmi.h"
+
+typedef struct nl_xfrmi_ns_t nl_xfrmi_ns_t;
+
+/**
+ * XFRM interfaces provisioned across network namespaces in parallel.
+ *
+ * Requests are queued per namespace and committed together. Each namespace
+ * with requests gets a job on the processor, which enters the namespace on
+ * its worker thread with setns(), sends the requests as a batch over the
+ * sockets of the namespace and returns to the namespace it came from. The
+ * sockets are opened on the first commit and kept until destroy().
+ *
+ * Queueing returns the index of the item within its namespace, or -1.
+ */
+struct nl_xfrmi_ns_t
+{
+	/**
+	 * Add a network namespace.
+	 *
+	 * @param path		namespace file, e.g. /var/run/netns/NAME or
+	 *					/proc/PID/ns/net
+	 * @return			index of the namespace, -1 on error
+	 */
+	int (*add_netns)(nl_xfrmi_ns_t *this, const char *path);
+
+	/**
+	 * Queue creating an XFRM interface, set up in the same request if up
+	 * is set.
+	 */
+	int (*create)(nl_xfrmi_ns_t *this, int ns, char *name, unsigned int if_id,
+				  char *phys, unsigned int mtu, int up);
+
+	int (*up)(nl_xfrmi_ns_t *this, int ns, char *name);
+
+	int (*delete)(nl_xfrmi_ns_t *this, int ns, char *name);
+
+	/**
+	 * Send the queued requests of all namespaces and wait for them. Items
+	 * queued afterwards start new batches. The items of a namespace fail
+	 * with -ECANCELED if the processor drops or cancels its job.
+	 *
+	 * @return			number of failed items in all namespaces
+	 */
+	int (*commit)(nl_xfrmi_ns_t *this);
+
+	/**
+	 * Get the number of failed items of a namespace in the last commit.
+	 */
+	int (*get_failed)(nl_xfrmi_ns_t *this, int ns);
+
+	/**
+	 * Get the result of an item of a namespace in the last commit.
+	 *
+	 * @return			0 on success, negative errno otherwise
+	 */
+	int (*get_error)(nl_xfrmi_ns_t *this, int ns, int item);
+
+	void (*destroy)(nl_xfrmi_ns_t *this);
+};
+
+/**
+ * Create a provisioning engine running jobs on a processor, which must
+ * outlive it. Requests of different namespaces run in parallel as far as
+ * the processor has threads.
+ */
+nl_xfrmi_ns_t *nl_xfrmi_ns_create(processor_t *processor);
+
+#endif
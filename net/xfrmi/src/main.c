@@ -15,16 +15,11 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    if (xfrmi->create(xfrmi, XFRMI_NAME, 443, XFRMI_PHY, XFRMI_MTU) != 0) {
+    if (xfrmi->create(xfrmi, XFRMI_NAME, 443, XFRMI_PHY, XFRMI_MTU, 1) != 0) {
         printf("xfrmi create failed\n");
         goto destory;
     }
 
-    if (xfrmi->up(xfrmi, XFRMI_NAME) != 0) {
-        printf("xfrmi up failed\n");
-        goto destory;
-    }
-
     if (xfrmi->delete(xfrmi, XFRMI_NAME) != 0) {
         printf("xfrmi delete failed\n");
         goto destory;
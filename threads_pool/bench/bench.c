@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "time_util.h"
+#include "bench.h"
+
+static job_priority_t bench_job_get_priority(job_t *public)
+{
+	bench_job_t *this = (bench_job_t*)public;
+
+	return this->prio;
+}
+
+static void bench_job_destroy(job_t *public)
+{
+	free(public);
+}
+
+void *bench_job_create(size_t size, job_priority_t prio,
+					   job_requeue_t (*execute)(job_t *job))
+{
+	bench_job_t *this = calloc(1, size);
+
+	this->public.execute = execute;
+	this->public.get_priority = bench_job_get_priority;
+	this->public.destroy = bench_job_destroy;
+	this->prio = prio;
+	this->queued = time_monotonic_us();
+	return this;
+}
+
+void spin(uint64_t us)
+{
+	uint64_t end = time_monotonic_us() + us;
+
+	while (time_monotonic_us() < end);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+void sort_u64(uint64_t *values, int count)
+{
+	qsort(values, count, sizeof(uint64_t), cmp_u64);
+}
+
+void print_latency(uint64_t *sorted, int count)
+{
+	printf("p50 %8lu us  p99 %8lu us  max %8lu us",
+		   count ? sorted[count / 2] : 0, count ? sorted[count * 99 / 100] : 0,
+		   count ? sorted[count - 1] : 0);
+}
@@ -0,0 +1,63 @@
+#ifndef __MY_BENCH_H__
+#define __MY_BENCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "processor.h"
+
+/**
+ * Helpers shared by the benches, linked into each of them.
+ */
+
+#define countof(array) (sizeof(array) / sizeof((array)[0]))
+
+/**
+ * Run a bench once for each entry of an array of scenarios.
+ */
+#define run_scenarios(scenarios, run) ({ \
+	for (int _i = 0; _i < countof(scenarios); _i++) \
+	{ \
+		run(&(scenarios)[_i]); \
+	} \
+})
+
+/**
+ * Job of a bench, embedded at the start of its own job struct.
+ */
+typedef struct {
+	job_t public;
+	job_priority_t prio;
+	/* time of creation, to measure how long it waited */
+	uint64_t queued;
+} bench_job_t;
+
+/**
+ * Allocate a zeroed job that gets freed once destroyed.
+ *
+ * @param size			size of the job struct, starting with a bench_job_t
+ * @param prio			priority returned by get_priority()
+ * @param execute		execute() of the job
+ * @return				allocated job
+ */
+void *bench_job_create(size_t size, job_priority_t prio,
+					   job_requeue_t (*execute)(job_t *job));
+
+/**
+ * Busy wait, simulates work that occupies a worker.
+ *
+ * @param us			time to spin in microseconds
+ */
+void spin(uint64_t us);
+
+/**
+ * Sort wait times in place, for print_latency() and percentile lookups.
+ */
+void sort_u64(uint64_t *values, int count);
+
+/**
+ * Print the p50, p99 and maximum of sorted wait times, without a newline.
+ */
+void print_latency(uint64_t *sorted, int count);
+
+#endif
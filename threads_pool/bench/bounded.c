@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "thread.h"
+#include "processor.h"
+#include "time_util.h"
+#include "bench.h"
+
+/**
+ * A producer queues jobs much faster than the workers execute them. Shows the
+ * queue depth, rejections and drops reported for each queue policy.
+ */
+
+#define THREADS		2
+#define JOBS		200000
+#define MAX_DEPTH	1000
+#define WORK_US		5
+#define TIMEOUT_MS	1
+
+typedef struct {
+	const char *name;
+	queue_policy_t policy;
+	int max_depth;
+} scenario_t;
+
+typedef struct {
+	bench_job_t public;
+	int *done;
+} bounded_job_t;
+
+static job_requeue_t execute(job_t *public)
+{
+	bounded_job_t *this = (bounded_job_t*)public;
+
+	spin(WORK_US);
+	__sync_fetch_and_add(this->done, 1);
+	return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_NONE };
+}
+
+static void run(scenario_t *scenario)
+{
+	processor_queue_stats_t stats;
+	processor_t *processor;
+	bounded_job_t *job;
+	uint64_t start;
+	int i, done = 0, failed = 0;
+
+	processor = processor_create();
+	processor->set_queue_limit(processor, JOB_PRIO_MEDIUM, scenario->max_depth,
+							   scenario->policy, TIMEOUT_MS);
+	processor->set_threads(processor, THREADS);
+
+	start = time_monotonic_us();
+	for (i = 0; i < JOBS; i++)
+	{
+		job = bench_job_create(sizeof(*job), JOB_PRIO_MEDIUM, execute);
+		job->done = &done;
+		if (processor->queue_job(processor, &job->public.public))
+		{	/* not queued, still ours */
+			free(job);
+			failed++;
+		}
+	}
+	processor->get_queue_stats(processor, JOB_PRIO_MEDIUM, &stats);
+	printf("%-11s queued in %5lu ms  depth %6d  peak %6d  rejected %6lu  "
+		   "dropped %6lu  blocked %6lu  failed %6d\n", scenario->name,
+		   (time_monotonic_us() - start) / 1000, stats.depth, stats.peak,
+		   stats.rejected, stats.dropped, stats.blocked, failed);
+	processor->destroy(processor);
+}
+
+int main(int argc, char *argv[])
+{
+	scenario_t scenarios[] = {
+		{ "unbounded",   QUEUE_POLICY_UNBOUNDED,   0 },
+		{ "block",       QUEUE_POLICY_BLOCK,       MAX_DEPTH },
+		{ "reject",      QUEUE_POLICY_REJECT,      MAX_DEPTH },
+		{ "drop-oldest", QUEUE_POLICY_DROP_OLDEST, MAX_DEPTH },
+	};
+
+	threads_init();
+	run_scenarios(scenarios, run);
+	threads_deinit();
+	return 0;
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "thread.h"
+#include "processor.h"
+#include "time_util.h"
+#include "bench.h"
+
+/**
+ * Short jobs arrive alone or in bursts, separated by pauses, so workers go
+ * idle right before the next arrival. Compares the wakeup latency and the
+ * CPU time used when idle workers block immediately, yield or spin first.
+ *
+ * Pauses range from below to above MAX_SPIN. Workers spin for about twice
+ * the time they recently waited for a job, which bridges pauses up to
+ * MAX_SPIN, with single jobs as with bursts, as jobs of a burst are taken
+ * without waiting. Workers never spin on a single CPU.
+ */
+
+#define THREADS		2
+#define ROUNDS		2000
+#define WORK_US		2
+#define MAX_SPIN	50
+#define YIELDS		4
+
+typedef struct {
+	const char *name;
+	unsigned int max_spin;
+	unsigned int yields;
+} scenario_t;
+
+typedef struct {
+	/* jobs queued at once */
+	int burst;
+	/* pause after the jobs of a round completed */
+	unsigned int gap;
+} pattern_t;
+
+typedef struct {
+	uint64_t wall;
+	uint64_t cpu;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+} result_t;
+
+typedef struct {
+	bench_job_t public;
+	uint64_t *wait;
+	int *done;
+} idle_job_t;
+
+static job_requeue_t execute(job_t *public)
+{
+	idle_job_t *this = (idle_job_t*)public;
+
+	*this->wait = time_monotonic_us() - this->public.queued;
+	spin(WORK_US);
+	__atomic_add_fetch(this->done, 1, __ATOMIC_RELEASE);
+	return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_NONE };
+}
+
+static uint64_t cpu_time_us()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec +
+		   usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
+}
+
+static void run(scenario_t *scenario, pattern_t *pattern, result_t *result)
+{
+	processor_t *processor;
+	idle_job_t *job;
+	uint64_t *wait, start, cpu;
+	int i, j, done = 0, samples = ROUNDS * pattern->burst;
+
+	wait = calloc(samples, sizeof(uint64_t));
+	processor = processor_create();
+	processor->set_idle_strategy(processor, scenario->max_spin,
+								 scenario->yields);
+	processor->set_threads(processor, THREADS);
+
+	start = time_monotonic_us();
+	cpu = cpu_time_us();
+	for (i = 0; i < ROUNDS; i++)
+	{
+		for (j = 0; j < pattern->burst; j++)
+		{
+			job = bench_job_create(sizeof(*job), JOB_PRIO_MEDIUM, execute);
+			job->wait = &wait[i * pattern->burst + j];
+			job->done = &done;
+			processor->queue_job(processor, &job->public.public);
+		}
+		while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) <
+			   (i + 1) * pattern->burst)
+		{
+			sched_yield();
+		}
+		spin(pattern->gap);
+	}
+	result->wall = time_monotonic_us() - start;
+	result->cpu = cpu_time_us() - cpu;
+	processor->destroy(processor);
+
+	sort_u64(wait, samples);
+	result->p50 = wait[samples / 2];
+	result->p99 = wait[samples * 99 / 100];
+	result->p999 = wait[samples * 999 / 1000];
+	free(wait);
+}
+
+int main(int argc, char *argv[])
+{
+	scenario_t scenarios[] = {
+		{ "park",  0,        0 },
+		{ "yield", 0,        YIELDS },
+		{ "spin",  MAX_SPIN, YIELDS },
+	};
+	pattern_t patterns[] = {
+		{ 1, MAX_SPIN / 4 },
+		{ 1, MAX_SPIN / 2 },
+		{ 1, MAX_SPIN * 2 },
+		{ 4, MAX_SPIN / 4 },
+		{ 4, MAX_SPIN / 2 },
+		{ 4, MAX_SPIN * 2 },
+	};
+	result_t park, result;
+	int i, j;
+
+	if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
+	{
+		printf("single CPU: workers never spin, spin only yields\n");
+	}
+	threads_init();
+	for (i = 0; i < countof(patterns); i++)
+	{
+		printf("burst %d, gap %u us, max spin %u us:\n", patterns[i].burst,
+			   patterns[i].gap, MAX_SPIN);
+		for (j = 0; j < countof(scenarios); j++)
+		{
+			run(&scenarios[j], &patterns[i], &result);
+			if (j == 0)
+			{
+				park = result;
+			}
+			printf("  %-6s wall %5lu ms  cpu %5lu ms  p50 %5lu us  "
+				   "p99 %5lu us  p999 %5lu us  p99 %4.2fx park\n",
+				   scenarios[j].name, result.wall / 1000, result.cpu / 1000,
+				   result.p50, result.p99, result.p999,
+				   (double)result.p99 / (park.p99 ? park.p99 : 1));
+		}
+	}
+	threads_deinit();
+	return 0;
+}
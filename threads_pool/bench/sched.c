@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "thread.h"
+#include "mutex.h"
+#include "processor.h"
+#include "time_util.h"
+#include "bench.h"
+
+/**
+ * Synthetic mixed-priority load: a fixed set of HIGH priority jobs requeue
+ * themselves forever and keep all workers busy, while MEDIUM and LOW jobs
+ * trickle in at a fixed rate. Reports how many of the lower priority jobs got
+ * executed and how long they waited under each scheduling policy.
+ */
+
+#define THREADS		4
+#define HOGS		(THREADS * 4)
+#define WORK_US		100
+#define RUN_MS		1000
+#define MAX_SAMPLES	4096
+
+typedef struct {
+	const char *name;
+	processor_policy_t policy;
+	unsigned int max_wait;
+} scenario_t;
+
+typedef struct {
+	mutex_t *mutex;
+	volatile bool stop;
+	int queued[JOB_PRIO_MAX];
+	int done[JOB_PRIO_MAX];
+	uint64_t wait[JOB_PRIO_MAX][MAX_SAMPLES];
+} stats_t;
+
+typedef struct {
+	bench_job_t public;
+	stats_t *stats;
+} sched_job_t;
+
+static job_requeue_t execute(job_t *public)
+{
+	sched_job_t *this = (sched_job_t*)public;
+	stats_t *stats = this->stats;
+	job_priority_t prio = this->public.prio;
+	uint64_t wait;
+
+	wait = time_monotonic_us() - this->public.queued;
+	spin(WORK_US);
+
+	stats->mutex->lock(stats->mutex);
+	if (stats->done[prio] < MAX_SAMPLES)
+	{
+		stats->wait[prio][stats->done[prio]] = wait;
+	}
+	stats->done[prio]++;
+	stats->mutex->unlock(stats->mutex);
+
+	if (prio == JOB_PRIO_HIGH && !stats->stop)
+	{
+		this->public.queued = time_monotonic_us();
+		return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_FAIR };
+	}
+	return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_NONE };
+}
+
+static void queue(processor_t *processor, stats_t *stats, job_priority_t prio)
+{
+	sched_job_t *job = bench_job_create(sizeof(*job), prio, execute);
+
+	job->stats = stats;
+	stats->queued[prio]++;
+	processor->queue_job(processor, &job->public.public);
+}
+
+static void report(const char *name, stats_t *stats)
+{
+	static const char *prios[] = { "critical", "high", "medium", "low" };
+	int i, n;
+
+	for (i = JOB_PRIO_MEDIUM; i < JOB_PRIO_MAX; i++)
+	{
+		n = stats->done[i] < MAX_SAMPLES ? stats->done[i] : MAX_SAMPLES;
+		sort_u64(stats->wait[i], n);
+		printf("%-10s %-7s %6d/%-6d ", name, prios[i],
+			   stats->done[i], stats->queued[i]);
+		if (n)
+		{
+			print_latency(stats->wait[i], n);
+			printf("\n");
+		}
+		else
+		{
+			printf("starved\n");
+		}
+	}
+}
+
+static void run(scenario_t *scenario)
+{
+	processor_t *processor;
+	stats_t *stats;
+	uint64_t start;
+	int i;
+
+	stats = calloc(1, sizeof(*stats));
+	stats->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+
+	processor = processor_create();
+	processor->set_policy(processor, scenario->policy);
+	processor->set_max_wait(processor, scenario->max_wait);
+	for (i = 0; i < HOGS; i++)
+	{
+		queue(processor, stats, JOB_PRIO_HIGH);
+	}
+	processor->set_threads(processor, THREADS);
+
+	start = time_monotonic_us();
+	for (i = 0; time_monotonic_us() - start < RUN_MS * 1000; i++)
+	{
+		queue(processor, stats, i % 2 ? JOB_PRIO_LOW : JOB_PRIO_MEDIUM);
+		usleep(1000);
+	}
+	stats->stop = true;
+	processor->destroy(processor);
+
+	report(scenario->name, stats);
+	stats->mutex->destroy(stats->mutex);
+	free(stats);
+}
+
+int main(int argc, char *argv[])
+{
+	scenario_t scenarios[] = {
+		{ "strict",   PROCESSOR_POLICY_STRICT,   0 },
+		{ "weighted", PROCESSOR_POLICY_WEIGHTED, 0 },
+		{ "aging",    PROCESSOR_POLICY_STRICT,   20 },
+	};
+
+	threads_init();
+	run_scenarios(scenarios, run);
+	threads_deinit();
+	return 0;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "thread.h"
+#include "mutex.h"
+#include "processor.h"
+#include "serial_executor.h"
+#include "time_util.h"
+#include "bench.h"
+
+/**
+ * A few hot objects get lots of jobs that must not run concurrently, mixed
+ * with independent jobs. Compares taking a per-object mutex in execute() with
+ * queueing the object jobs to a serial executor per object.
+ */
+
+#define THREADS		4
+#define OBJECTS		2
+#define OBJECT_JOBS	5000
+#define OTHER_JOBS	20000
+#define WORK_US		20
+
+typedef struct {
+	const char *name;
+	bool serial;
+} scenario_t;
+
+typedef struct {
+	mutex_t *mutex;
+	serial_executor_t *executor;
+	/* detects overlapping execution, only modified while serialized */
+	int running;
+	int overlaps;
+	int done;
+} object_t;
+
+typedef struct {
+	mutex_t *mutex;
+	int done;
+	uint64_t blocked;
+	uint64_t others_done;
+} stats_t;
+
+typedef struct {
+	bench_job_t public;
+	object_t *object;
+	bool locked;
+	stats_t *stats;
+} serial_job_t;
+
+static uint64_t start;
+
+static job_requeue_t execute(job_t *public)
+{
+	serial_job_t *this = (serial_job_t*)public;
+	object_t *object = this->object;
+	stats_t *stats = this->stats;
+	uint64_t blocked = 0;
+
+	if (object && this->locked)
+	{
+		blocked = time_monotonic_us();
+		object->mutex->lock(object->mutex);
+		blocked = time_monotonic_us() - blocked;
+	}
+	if (object && object->running++)
+	{
+		object->overlaps++;
+	}
+	spin(WORK_US);
+	if (object)
+	{
+		object->running--;
+		object->done++;
+	}
+	if (object && this->locked)
+	{
+		object->mutex->unlock(object->mutex);
+	}
+
+	stats->mutex->lock(stats->mutex);
+	stats->blocked += blocked;
+	stats->done++;
+	if (!object)
+	{
+		stats->others_done = time_monotonic_us() - start;
+	}
+	stats->mutex->unlock(stats->mutex);
+	return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_NONE };
+}
+
+static job_t *create_job(stats_t *stats, object_t *object, bool locked)
+{
+	serial_job_t *job = bench_job_create(sizeof(*job), JOB_PRIO_MEDIUM,
+										 execute);
+
+	job->object = object;
+	job->locked = locked;
+	job->stats = stats;
+	return &job->public.public;
+}
+
+static void run(scenario_t *scenario)
+{
+	object_t objects[OBJECTS] = {};
+	processor_t *processor;
+	stats_t stats = {};
+	int i, j, overlaps = 0, total;
+
+	total = OTHER_JOBS + OBJECTS * OBJECT_JOBS;
+	stats.mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	processor = processor_create();
+	for (i = 0; i < OBJECTS; i++)
+	{
+		objects[i].mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+		objects[i].executor = serial_executor_create(processor,
+													 JOB_PRIO_MEDIUM);
+	}
+	processor->set_threads(processor, THREADS);
+
+	start = time_monotonic_us();
+	for (i = 0; i < OBJECT_JOBS; i++)
+	{
+		for (j = 0; j < OBJECTS; j++)
+		{
+			if (scenario->serial)
+			{
+				objects[j].executor->queue_job(objects[j].executor,
+								create_job(&stats, &objects[j], false));
+			}
+			else
+			{
+				processor->queue_job(processor,
+								create_job(&stats, &objects[j], true));
+			}
+		}
+		for (j = 0; j < OTHER_JOBS / OBJECT_JOBS; j++)
+		{
+			processor->queue_job(processor, create_job(&stats, NULL, false));
+		}
+	}
+	while (stats.done < total)
+	{
+		usleep(1000);
+	}
+	printf("%-7s total %6lu ms  independent jobs done after %6lu ms  "
+		   "workers blocked %6lu ms", scenario->name,
+		   (time_monotonic_us() - start) / 1000, stats.others_done / 1000,
+		   stats.blocked / 1000);
+
+	processor->destroy(processor);
+	for (i = 0; i < OBJECTS; i++)
+	{
+		overlaps += objects[i].overlaps;
+		objects[i].executor->destroy(objects[i].executor);
+		objects[i].mutex->destroy(objects[i].mutex);
+	}
+	printf("  overlaps %d\n", overlaps);
+	stats.mutex->destroy(stats.mutex);
+}
+
+int main(int argc, char *argv[])
+{
+	scenario_t scenarios[] = {
+		{ "mutex",  false },
+		{ "serial", true },
+	};
+
+	threads_init();
+	run_scenarios(scenarios, run);
+	threads_deinit();
+	return 0;
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "thread.h"
+#include "mutex.h"
+#include "processor.h"
+#include "time_util.h"
+#include "bench.h"
+
+/**
+ * A noisy tenant floods the MEDIUM queue while a few quiet tenants queue a
+ * job every millisecond. Compares the wait of the quiet tenants with a shared
+ * queue and with per-tenant sub-queues, then checks the limits of an ordered
+ * and rate limited tenant.
+ */
+
+#define THREADS		4
+#define QUIET		8
+#define FLOOD		20000
+#define WORK_US		20
+#define RUN_MS		500
+#define MAX_SAMPLES	8192
+
+typedef struct {
+	mutex_t *mutex;
+	int done;
+	int samples;
+	uint64_t wait[MAX_SAMPLES];
+	/* ordered tenant: jobs running concurrently and execution order */
+	int running;
+	int max_running;
+	int next_seq;
+	bool out_of_order;
+	uint64_t first, last;
+} stats_t;
+
+typedef struct {
+	const char *name;
+	bool tenants;
+} scenario_t;
+
+typedef struct {
+	bench_job_t public;
+	bool quiet;
+	int seq;
+	stats_t *stats;
+} tenant_job_t;
+
+static job_requeue_t execute(job_t *public)
+{
+	tenant_job_t *this = (tenant_job_t*)public;
+	stats_t *stats = this->stats;
+	uint64_t now;
+
+	now = time_monotonic_us();
+	stats->mutex->lock(stats->mutex);
+	if (this->quiet && stats->samples < MAX_SAMPLES)
+	{
+		stats->wait[stats->samples++] = now - this->public.queued;
+	}
+	if (this->seq)
+	{
+		if (this->seq != ++stats->next_seq)
+		{
+			stats->out_of_order = true;
+		}
+		if (++stats->running > stats->max_running)
+		{
+			stats->max_running = stats->running;
+		}
+		if (!stats->first)
+		{
+			stats->first = now;
+		}
+		stats->last = now;
+	}
+	stats->mutex->unlock(stats->mutex);
+
+	spin(WORK_US);
+
+	stats->mutex->lock(stats->mutex);
+	if (this->seq)
+	{
+		stats->running--;
+	}
+	stats->done++;
+	stats->mutex->unlock(stats->mutex);
+	return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_NONE };
+}
+
+static job_t *create_job(stats_t *stats, bool quiet, int seq)
+{
+	tenant_job_t *job = bench_job_create(sizeof(*job), JOB_PRIO_MEDIUM,
+										 execute);
+
+	job->quiet = quiet;
+	job->seq = seq;
+	job->stats = stats;
+	return &job->public.public;
+}
+
+static void queue(processor_t *processor, bool tenants, uint64_t key,
+				  job_t *job)
+{
+	if (tenants)
+	{
+		processor->queue_tenant_job(processor, key, job);
+	}
+	else
+	{
+		processor->queue_job(processor, job);
+	}
+}
+
+static stats_t *stats_create()
+{
+	stats_t *stats = calloc(1, sizeof(*stats));
+
+	stats->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	return stats;
+}
+
+static void stats_destroy(stats_t *stats)
+{
+	stats->mutex->destroy(stats->mutex);
+	free(stats);
+}
+
+static void run_noisy(scenario_t *scenario)
+{
+	processor_t *processor;
+	stats_t *stats;
+	uint64_t start;
+	int i;
+
+	stats = stats_create();
+	processor = processor_create();
+	processor->set_threads(processor, THREADS);
+
+	for (i = 0; i < FLOOD; i++)
+	{
+		queue(processor, scenario->tenants, 0, create_job(stats, false, 0));
+	}
+	start = time_monotonic_us();
+	while (time_monotonic_us() - start < RUN_MS * 1000)
+	{
+		for (i = 1; i <= QUIET; i++)
+		{
+			queue(processor, scenario->tenants, i,
+				  create_job(stats, true, 0));
+		}
+		usleep(1000);
+	}
+	processor->destroy(processor);
+
+	sort_u64(stats->wait, stats->samples);
+	printf("%-8s quiet jobs %5d  ", scenario->name, stats->samples);
+	print_latency(stats->wait, stats->samples);
+	printf("\n");
+	stats_destroy(stats);
+}
+
+static void run_limits()
+{
+	tenant_limits_t limits = {
+		.rate = 1000,
+		.burst = 10,
+		.ordered = true,
+	};
+	processor_t *processor;
+	stats_t *stats;
+	int i, jobs = 200;
+
+	stats = stats_create();
+	processor = processor_create();
+	processor->set_tenant_limits(processor, 1, &limits);
+	processor->set_threads(processor, THREADS);
+
+	for (i = 1; i <= jobs; i++)
+	{
+		processor->queue_tenant_job(processor, 1, create_job(stats, false, i));
+	}
+	while (processor->get_job_load(processor, JOB_PRIO_MEDIUM) ||
+		   stats->done < jobs)
+	{
+		usleep(1000);
+	}
+	processor->destroy(processor);
+
+	printf("limited  %d jobs at %u/s, burst %u: %.0f jobs/s, "
+		   "max concurrent %d, %s\n", jobs, limits.rate, limits.burst,
+		   (jobs - limits.burst) * 1000000.0 / (stats->last - stats->first),
+		   stats->max_running, stats->out_of_order ? "out of order" : "ordered");
+	stats_destroy(stats);
+}
+
+int main(int argc, char *argv[])
+{
+	scenario_t scenarios[] = {
+		{ "shared",  false },
+		{ "tenants", true },
+	};
+
+	threads_init();
+	run_scenarios(scenarios, run_noisy);
+	run_limits();
+	threads_deinit();
+	return 0;
+}
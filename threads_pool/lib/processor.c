@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
 #include <sys/queue.h>
 
 #include "processor.h"
@@ -9,8 +13,23 @@
 #include "mutex.h"
 #include "condvar.h"
 #include "job.h"
+#include "time_util.h"
+#include "uthash.h"
 
 typedef struct private_processor_t private_processor_t;
+typedef struct tenant_t tenant_t;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax()
+#endif
+
+/**
+ * One job worth of token bucket credit, tokens are kept in millionths so
+ * that refilling works at microsecond granularity
+ */
+#define TOKEN 1000000
 
 static int reserved[JOB_PRIO_MAX] = 
 {
@@ -20,11 +39,21 @@ static int reserved[JOB_PRIO_MAX] =
     [JOB_PRIO_LOW]      = 0,
 };
 
+static int weights[JOB_PRIO_MAX] =
+{
+    [JOB_PRIO_CRITICAL] = 8,
+    [JOB_PRIO_HIGH]     = 4,
+    [JOB_PRIO_MEDIUM]   = 2,
+    [JOB_PRIO_LOW]      = 1,
+};
+
 typedef struct {
 	private_processor_t *processor;
 	thread_t *thread;
 	job_t *job;
 	job_priority_t priority;
+	/* tenant the job was taken from, if any */
+	tenant_t *tenant;
 } worker_thread_t;
 
 struct worker_entry
@@ -37,12 +66,51 @@ TAILQ_HEAD(threadlist, worker_entry);
 
 struct job_entry
 {
-    job_t job;
+    job_t *job;
+    /* if set, this entry is the turn of a tenant in a priority queue, the job
+     * to execute is the first in its sub-queue of class prio */
+    tenant_t *tenant;
+    job_priority_t prio;
+    /* monotonic time the job entered its current queue, in us */
+    uint64_t queued;
     TAILQ_ENTRY(job_entry) entries;
 };
 
 TAILQ_HEAD(joblist, job_entry);
 
+struct tenant_t
+{
+    uint64_t key;
+    tenant_limits_t limits;
+    /* limits have been set explicitly, keep the tenant while idle */
+    bool configured;
+    /* sub-queues of jobs per priority class */
+    struct joblist jobs[JOB_PRIO_MAX];
+    /* number of jobs in all sub-queues */
+    int queued;
+    /* turn of the tenant currently queued in each priority queue, if any */
+    struct job_entry *turn[JOB_PRIO_MAX];
+    /* number of jobs currently executing */
+    int inflight;
+    /* token bucket fill level and time of last refill */
+    uint64_t tokens;
+    uint64_t refilled;
+    /* waiting for the token bucket to refill */
+    bool throttled;
+    TAILQ_ENTRY(tenant_t) throttled_entries;
+    UT_hash_handle hh;
+};
+
+TAILQ_HEAD(tenantlist, tenant_t);
+
+typedef struct {
+	/* maximum number of queued jobs, 0 for no limit */
+	int max_depth;
+	queue_policy_t policy;
+	/* time to block producers with QUEUE_POLICY_BLOCK, in ms, 0 forever */
+	unsigned int timeout;
+} queue_limit_t;
+
 struct private_processor_t {
 	processor_t public;
 	int total_threads;
@@ -50,9 +118,41 @@ struct private_processor_t {
 	int working_threads[JOB_PRIO_MAX];
     struct threadlist threads;
     struct joblist jobs[JOB_PRIO_MAX];
+	int job_load[JOB_PRIO_MAX];
 	int prio_threads[JOB_PRIO_MAX];
+	processor_policy_t policy;
+	int weights[JOB_PRIO_MAX];
+	/* jobs each class may still dequeue in the current weighted round */
+	int credits[JOB_PRIO_MAX];
+	/* maximum queue wait before a job gets promoted, in us, 0 to disable */
+	uint64_t max_wait;
+	/* tenants with sub-queues, by key */
+	tenant_t *tenants;
+	/* tenants with queued jobs that ran out of tokens */
+	struct tenantlist throttled;
+	/* earliest time a throttled tenant gets a token, in us, 0 if none */
+	uint64_t next_refill;
+	queue_limit_t limits[JOB_PRIO_MAX];
+	processor_queue_stats_t stats[JOB_PRIO_MAX];
+	/* producers waiting for room in a bounded queue */
+	int blocked_producers;
+	/* set by cancel(), no jobs are accepted anymore */
+	bool shutdown;
+	/* upper bound for idle workers to spin, in us, 0 to never spin */
+	unsigned int max_spin;
+	/* number of sched_yield() calls after spinning before blocking */
+	unsigned int idle_yields;
+	/* moving average of how long idle workers waited for a job, in us */
+	uint64_t idle_avg;
+	/* bumped whenever work is queued, polled by spinning workers */
+	unsigned int queued_seq;
+	/* workers in idle_spin(), they take queued jobs without a signal */
+	int spinning;
+	/* spinning does not help if producer and worker share a single CPU */
+	bool single_cpu;
 	mutex_t *mutex;
 	condvar_t *job_added;
+	condvar_t *job_removed;
 	condvar_t *thread_terminated;
 };
 
@@ -91,6 +191,530 @@ int _get_idle_threads(processor_t *public)
     return count;
 }
 
+/**
+ * Make sure a priority is in the valid range
+ */
+static job_priority_t sane_prio(job_priority_t prio)
+{
+	if ((int)prio < 0 || prio >= JOB_PRIO_MAX)
+	{
+		return JOB_PRIO_MAX - 1;
+	}
+	return prio;
+}
+
+static int _get_working_threads(processor_t *public, job_priority_t prio)
+{
+    private_processor_t *this = (private_processor_t *)public;
+    int count;
+
+    this->mutex->lock(this->mutex);
+    count = this->working_threads[sane_prio(prio)];
+    this->mutex->unlock(this->mutex);
+
+    return count;
+}
+
+static int _get_job_load(processor_t *public, job_priority_t prio)
+{
+    private_processor_t *this = (private_processor_t *)public;
+    int load;
+
+    this->mutex->lock(this->mutex);
+    load = this->job_load[sane_prio(prio)];
+    this->mutex->unlock(this->mutex);
+
+    return load;
+}
+
+/**
+ * Track how long a worker was idle until it got a job, to tune the idle spin
+ * budget, mutex must be held.
+ *
+ * Unlike the time between queued jobs, this is not dragged down by the jobs
+ * of a burst queued back to back, but follows the gaps between bursts that
+ * spinning has to bridge.
+ */
+static void note_idle(private_processor_t *this, uint64_t idle)
+{
+	/* exponentially weighted, 1/8 per sample */
+	this->idle_avg = (this->idle_avg * 7 + idle) / 8;
+}
+
+/**
+ * Wake up a worker for a queued job, unless workers spinning in idle_spin()
+ * are left over to take it, mutex must be held
+ */
+static void signal_job_added(private_processor_t *this)
+{
+	int i, queued = 0;
+
+	if (this->spinning)
+	{
+		for (i = 0; i < JOB_PRIO_MAX; i++)
+		{
+			queued += this->job_load[i];
+		}
+		if (this->spinning > queued)
+		{
+			return;
+		}
+	}
+	this->job_added->signal(this->job_added);
+}
+
+/**
+ * Append a job to the queue of the given priority, mutex must be held
+ */
+static void enqueue_job(private_processor_t *this, struct job_entry *entry,
+						job_priority_t prio)
+{
+	entry->job->status = JOB_STATUS_QUEUED;
+	entry->queued = time_monotonic_us();
+	TAILQ_INSERT_TAIL(&this->jobs[prio], entry, entries);
+	if (++this->job_load[prio] > this->stats[prio].peak)
+	{
+		this->stats[prio].peak = this->job_load[prio];
+	}
+	__atomic_add_fetch(&this->queued_seq, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * A queued job has been removed, wake up producers waiting for room
+ */
+static void job_removed(private_processor_t *this)
+{
+	if (this->blocked_producers)
+	{
+		this->job_removed->broadcast(this->job_removed);
+	}
+}
+
+/**
+ * Add the tokens a tenant earned since the last refill
+ */
+static void tenant_refill(tenant_t *tenant, uint64_t now)
+{
+	uint64_t burst, elapsed;
+
+	burst = (uint64_t)(tenant->limits.burst ?: 1) * TOKEN;
+	elapsed = now - tenant->refilled;
+	tenant->refilled = now;
+	if (elapsed >= burst / tenant->limits.rate)
+	{
+		tenant->tokens = burst;
+		return;
+	}
+	tenant->tokens += elapsed * tenant->limits.rate;
+	if (tenant->tokens > burst)
+	{
+		tenant->tokens = burst;
+	}
+}
+
+/**
+ * Make idle workers wake up for a throttled tenant once it gets its next
+ * token, mutex must be held
+ */
+static void tenant_schedule_refill(private_processor_t *this, tenant_t *tenant,
+								   uint64_t now)
+{
+	uint64_t ready;
+
+	ready = now + (TOKEN - tenant->tokens + tenant->limits.rate - 1) /
+												tenant->limits.rate;
+	if (!this->next_refill || ready < this->next_refill)
+	{
+		this->next_refill = ready;
+	}
+}
+
+/**
+ * Check if a tenant may start a job now, mutex must be held.
+ *
+ * Tenants that are out of tokens get throttled until their bucket refills.
+ */
+static bool tenant_ready(private_processor_t *this, tenant_t *tenant)
+{
+	uint64_t now;
+
+	if (tenant->limits.max_inflight &&
+		tenant->inflight >= tenant->limits.max_inflight)
+	{
+		return false;
+	}
+	if (tenant->limits.ordered && tenant->inflight)
+	{
+		return false;
+	}
+	if (tenant->limits.rate)
+	{
+		now = time_monotonic_us();
+		tenant_refill(tenant, now);
+		if (tenant->tokens < TOKEN)
+		{
+			if (!tenant->throttled)
+			{
+				tenant->throttled = true;
+				TAILQ_INSERT_TAIL(&this->throttled, tenant, throttled_entries);
+				/* known before any worker decides how long to wait */
+				tenant_schedule_refill(this, tenant, now);
+				signal_job_added(this);
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Queue the turn of a tenant in the queue of a priority class
+ */
+static void tenant_queue_turn(private_processor_t *this, tenant_t *tenant,
+							  struct job_entry *turn, job_priority_t prio)
+{
+	if (!turn)
+	{
+		turn = calloc(1, sizeof(*turn));
+	}
+	turn->tenant = tenant;
+	turn->prio = prio;
+	turn->queued = time_monotonic_us();
+	tenant->turn[prio] = turn;
+	TAILQ_INSERT_TAIL(&this->jobs[prio], turn, entries);
+	__atomic_add_fetch(&this->queued_seq, 1, __ATOMIC_RELEASE);
+	signal_job_added(this);
+}
+
+/**
+ * Queue turns for all classes a tenant has jobs in, if it is ready to run
+ */
+static void tenant_rearm(private_processor_t *this, tenant_t *tenant)
+{
+	int i;
+
+	if (!tenant->queued || !tenant_ready(this, tenant))
+	{
+		return;
+	}
+	for (i = 0; i < JOB_PRIO_MAX; i++)
+	{
+		if (!tenant->turn[i] && !TAILQ_EMPTY(&tenant->jobs[i]))
+		{
+			tenant_queue_turn(this, tenant, NULL, i);
+		}
+	}
+}
+
+static tenant_t *get_tenant(private_processor_t *this, uint64_t key)
+{
+	tenant_t *tenant;
+
+	HASH_FIND(hh, this->tenants, &key, sizeof(key), tenant);
+	if (!tenant)
+	{
+		tenant = calloc(1, sizeof(*tenant));
+		tenant->key = key;
+		for (int i = 0; i < JOB_PRIO_MAX; i++)
+			TAILQ_INIT(&tenant->jobs[i]);
+		HASH_ADD(hh, this->tenants, key, sizeof(tenant->key), tenant);
+	}
+	return tenant;
+}
+
+/**
+ * Free a tenant if it has neither limits nor jobs, mutex must be held
+ */
+static void tenant_gc(private_processor_t *this, tenant_t *tenant)
+{
+	if (tenant->configured || tenant->queued || tenant->inflight ||
+		tenant->throttled)
+	{
+		return;
+	}
+	for (int i = 0; i < JOB_PRIO_MAX; i++)
+	{
+		if (tenant->turn[i])
+		{	/* freed once the turn got dequeued */
+			return;
+		}
+	}
+	HASH_DEL(this->tenants, tenant);
+	free(tenant);
+}
+
+/**
+ * Append a job to the sub-queue of a tenant, mutex must be held
+ */
+static void tenant_enqueue(private_processor_t *this, tenant_t *tenant,
+						   struct job_entry *entry, job_priority_t prio)
+{
+	entry->job->status = JOB_STATUS_QUEUED;
+	entry->queued = time_monotonic_us();
+	TAILQ_INSERT_TAIL(&tenant->jobs[prio], entry, entries);
+	tenant->queued++;
+	if (++this->job_load[prio] > this->stats[prio].peak)
+	{
+		this->stats[prio].peak = this->job_load[prio];
+	}
+
+	if (!tenant->turn[prio] && tenant_ready(this, tenant))
+	{
+		tenant_queue_turn(this, tenant, NULL, prio);
+	}
+}
+
+/**
+ * A job of a tenant finished, mutex must be held
+ */
+static void tenant_release(private_processor_t *this, tenant_t *tenant)
+{
+	tenant->inflight--;
+	tenant_rearm(this, tenant);
+	tenant_gc(this, tenant);
+}
+
+/**
+ * Queue turns of throttled tenants that got a token in the meantime and
+ * update next_refill, mutex must be held
+ */
+static void refill_tenants(private_processor_t *this)
+{
+	tenant_t *tenant, *next;
+	uint64_t now;
+
+	now = time_monotonic_us();
+	this->next_refill = 0;
+	for (tenant = TAILQ_FIRST(&this->throttled); tenant; tenant = next)
+	{
+		next = TAILQ_NEXT(tenant, throttled_entries);
+		tenant_refill(tenant, now);
+		if (tenant->tokens >= TOKEN)
+		{
+			TAILQ_REMOVE(&this->throttled, tenant, throttled_entries);
+			tenant->throttled = false;
+			tenant_rearm(this, tenant);
+			tenant_gc(this, tenant);
+			continue;
+		}
+		tenant_schedule_refill(this, tenant, now);
+	}
+}
+
+/**
+ * Remove the job of a priority class that has been queued the longest,
+ * mutex must be held
+ */
+static job_t *drop_oldest(private_processor_t *this, job_priority_t prio)
+{
+	struct job_entry *entry, *oldest = NULL;
+	tenant_t *tenant, *tmp, *owner = NULL;
+	job_t *job;
+
+	TAILQ_FOREACH(entry, &this->jobs[prio], entries)
+	{
+		if (!entry->tenant)
+		{
+			oldest = entry;
+			break;
+		}
+	}
+	HASH_ITER(hh, this->tenants, tenant, tmp)
+	{
+		entry = TAILQ_FIRST(&tenant->jobs[prio]);
+		if (entry && (!oldest || entry->queued < oldest->queued))
+		{
+			oldest = entry;
+			owner = tenant;
+		}
+	}
+	if (!oldest)
+	{
+		return NULL;
+	}
+	if (owner)
+	{	/* a queued turn of the tenant gets discarded when dequeued */
+		TAILQ_REMOVE(&owner->jobs[prio], oldest, entries);
+		owner->queued--;
+	}
+	else
+	{
+		TAILQ_REMOVE(&this->jobs[prio], oldest, entries);
+	}
+	this->job_load[prio]--;
+	this->stats[prio].dropped++;
+	job = oldest->job;
+	free(oldest);
+	return job;
+}
+
+/**
+ * Make room for a job in the queue of a priority class as configured,
+ * mutex must be held.
+ *
+ * @param prio			priority class of the job to queue
+ * @param dropped		set to a job to destroy if one was dropped
+ * @return				0 if the job can be queued, negative errno otherwise
+ */
+static int make_room(private_processor_t *this, job_priority_t prio,
+					 job_t **dropped)
+{
+	queue_limit_t *limit = &this->limits[prio];
+	uint64_t deadline = 0;
+	struct timeval tv;
+
+	if (this->shutdown)
+	{
+		return -ESHUTDOWN;
+	}
+	if (!limit->max_depth || this->job_load[prio] < limit->max_depth)
+	{
+		return 0;
+	}
+	switch (limit->policy)
+	{
+		case QUEUE_POLICY_REJECT:
+			this->stats[prio].rejected++;
+			return -ENOBUFS;
+		case QUEUE_POLICY_DROP_OLDEST:
+			*dropped = drop_oldest(this, prio);
+			return 0;
+		case QUEUE_POLICY_BLOCK:
+			this->stats[prio].blocked++;
+			if (limit->timeout)
+			{
+				deadline = time_monotonic_us() + (uint64_t)limit->timeout * 1000;
+				tv.tv_sec = deadline / 1000000;
+				tv.tv_usec = deadline % 1000000;
+			}
+			this->blocked_producers++;
+			while (!this->shutdown && limit->max_depth &&
+				   this->job_load[prio] >= limit->max_depth)
+			{
+				if (!deadline)
+				{
+					this->job_removed->wait(this->job_removed, this->mutex);
+				}
+				else if (this->job_removed->timed_wait_abs(this->job_removed,
+													this->mutex, tv) &&
+						 this->job_load[prio] >= limit->max_depth)
+				{
+					this->blocked_producers--;
+					this->stats[prio].rejected++;
+					return -ETIMEDOUT;
+				}
+			}
+			this->blocked_producers--;
+			return this->shutdown ? -ESHUTDOWN : 0;
+		case QUEUE_POLICY_UNBOUNDED:
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Destroy a job that got dropped from a full queue
+ */
+static void destroy_dropped(job_t *job)
+{
+	if (job)
+	{
+		job->status = JOB_STATUS_CANCELED;
+		job->destroy(job);
+	}
+}
+
+static int _queue_job(processor_t *public, job_t *job)
+{
+    private_processor_t *this = (private_processor_t *)public;
+    struct job_entry *entry;
+    job_priority_t prio;
+    job_t *dropped = NULL;
+    int err;
+
+    prio = sane_prio(job->get_priority(job));
+    entry = calloc(1, sizeof(*entry));
+    entry->job = job;
+
+    this->mutex->lock(this->mutex);
+    err = make_room(this, prio, &dropped);
+    if (!err)
+    {
+        enqueue_job(this, entry, prio);
+        signal_job_added(this);
+    }
+    this->mutex->unlock(this->mutex);
+
+    /* release mutex to avoid deadlocks if the same lock is required
+     * during queue_job() and in the destructor called here */
+    destroy_dropped(dropped);
+    if (err)
+    {
+        free(entry);
+    }
+    return err;
+}
+
+static int _queue_tenant_job(processor_t *public, uint64_t key, job_t *job)
+{
+    private_processor_t *this = (private_processor_t *)public;
+    struct job_entry *entry;
+    job_priority_t prio;
+    job_t *dropped = NULL;
+    int err;
+
+    prio = sane_prio(job->get_priority(job));
+    entry = calloc(1, sizeof(*entry));
+    entry->job = job;
+
+    this->mutex->lock(this->mutex);
+    err = make_room(this, prio, &dropped);
+    if (!err)
+    {
+        tenant_enqueue(this, get_tenant(this, key), entry, prio);
+    }
+    this->mutex->unlock(this->mutex);
+
+    destroy_dropped(dropped);
+    if (err)
+    {
+        free(entry);
+    }
+    return err;
+}
+
+static void _set_tenant_limits(processor_t *public, uint64_t key,
+							   tenant_limits_t *limits)
+{
+    private_processor_t *this = (private_processor_t *)public;
+    tenant_t *tenant;
+
+    this->mutex->lock(this->mutex);
+    tenant = get_tenant(this, key);
+    if (limits)
+    {
+        tenant->limits = *limits;
+        tenant->configured = true;
+        tenant->tokens = (uint64_t)(limits->burst ?: 1) * TOKEN;
+        tenant->refilled = time_monotonic_us();
+    }
+    else
+    {
+        memset(&tenant->limits, 0, sizeof(tenant->limits));
+        tenant->configured = false;
+    }
+    if (tenant->throttled)
+    {
+        TAILQ_REMOVE(&this->throttled, tenant, throttled_entries);
+        tenant->throttled = false;
+        /* the deadline might have been this tenant's */
+        refill_tenants(this);
+    }
+    tenant_rearm(this, tenant);
+    tenant_gc(this, tenant);
+    this->mutex->unlock(this->mutex);
+}
+
 static void *_cb_process_jobs(struct worker_entry *entry);
 
 static void restart(worker_thread_t *worker)
@@ -108,6 +732,11 @@ static void restart(worker_thread_t *worker)
 	/* unset the job before releasing the mutex, otherwise cancel() might
 	 * interfere */
 	worker->job = NULL;
+	if (worker->tenant)
+	{
+		tenant_release(this, worker->tenant);
+		worker->tenant = NULL;
+	}
 	/* release mutex to avoid deadlocks if the same lock is required
 	 * during queue_job() and in the destructor called here */
 	this->mutex->unlock(this->mutex);
@@ -174,13 +803,22 @@ static void process_job(private_processor_t *this, worker_thread_t *worker)
 				to_destroy = worker->job;
 				break;
 			case JOB_REQUEUE_TYPE_FAIR:
-            #if 0
-				worker->job->status = JOB_STATUS_QUEUED;
-				this->jobs[worker->priority]->insert_last(
-									this->jobs[worker->priority], worker->job);
-				this->job_added->signal(this->job_added);
-            #endif
+			{
+				struct job_entry *entry = calloc(1, sizeof(*entry));
+				job_priority_t prio;
+
+				entry->job = worker->job;
+				/* aged jobs go back to the class they were queued with */
+				prio = sane_prio(worker->job->get_priority(worker->job));
+				if (worker->tenant)
+				{
+					tenant_enqueue(this, worker->tenant, entry, prio);
+					break;
+				}
+				enqueue_job(this, entry, prio);
+				signal_job_added(this);
 				break;
+			}
 			case JOB_REQUEUE_TYPE_SCHEDULE:
 				/* scheduler_t does not hold its lock when queuing jobs
 				 * so this should be safe without unlocking our mutex */
@@ -209,6 +847,11 @@ static void process_job(private_processor_t *this, worker_thread_t *worker)
 	/* unset the current job to avoid interference with cancel() when
 	 * destroying the job below */
 	worker->job = NULL;
+	if (worker->tenant)
+	{
+		tenant_release(this, worker->tenant);
+		worker->tenant = NULL;
+	}
 
 	if (to_destroy)
 	{	/* release mutex to avoid deadlocks if the same lock is required
@@ -219,41 +862,220 @@ static void process_job(private_processor_t *this, worker_thread_t *worker)
 	}
 }
 
+/**
+ * Promote jobs that waited longer than max_wait to the next higher priority
+ * class, mutex must be held
+ */
+static void age_jobs(private_processor_t *this)
+{
+	struct job_entry *entry;
+	uint64_t now;
+	int i;
+
+	now = time_monotonic_us();
+	/* queues are FIFO, so only the heads have to be checked. Critical jobs
+	 * must always be served first, so nothing gets promoted above HIGH */
+	for (i = JOB_PRIO_HIGH + 1; i < JOB_PRIO_MAX; i++)
+	{
+		while ((entry = TAILQ_FIRST(&this->jobs[i])) &&
+			   now - entry->queued >= this->max_wait)
+		{
+			TAILQ_REMOVE(&this->jobs[i], entry, entries);
+			entry->queued = now;
+			TAILQ_INSERT_TAIL(&this->jobs[i - 1], entry, entries);
+			if (!entry->tenant)
+			{	/* jobs of tenants stay accounted to their own class */
+				this->job_load[i]--;
+				this->job_load[i - 1]++;
+			}
+		}
+	}
+}
+
+/**
+ * Take the next job from the queue of a priority class, mutex must be held
+ */
+static bool dequeue_job(private_processor_t *this, int i,
+						worker_thread_t *worker)
+{
+	struct job_entry *entry, *turn;
+	tenant_t *tenant;
+
+	while ((turn = TAILQ_FIRST(&this->jobs[i])))
+	{
+		TAILQ_REMOVE(&this->jobs[i], turn, entries);
+		tenant = turn->tenant;
+		if (!tenant)
+		{
+			this->job_load[i]--;
+			job_removed(this);
+			worker->job = turn->job;
+			worker->priority = i;
+			worker->tenant = NULL;
+			free(turn);
+			return true;
+		}
+		tenant->turn[turn->prio] = NULL;
+		if (TAILQ_EMPTY(&tenant->jobs[turn->prio]))
+		{	/* its jobs got dropped meanwhile */
+			free(turn);
+			tenant_gc(this, tenant);
+			continue;
+		}
+		if (!tenant_ready(this, tenant))
+		{	/* the turn is queued again once the tenant gets ready */
+			free(turn);
+			continue;
+		}
+		entry = TAILQ_FIRST(&tenant->jobs[turn->prio]);
+		TAILQ_REMOVE(&tenant->jobs[turn->prio], entry, entries);
+		tenant->queued--;
+		this->job_load[turn->prio]--;
+		job_removed(this);
+		tenant->inflight++;
+		if (tenant->limits.rate)
+		{
+			tenant->tokens -= TOKEN;
+		}
+		worker->job = entry->job;
+		worker->priority = i;
+		worker->tenant = tenant;
+		free(entry);
+
+		/* round-robin, queue the next turn of the tenant at the end of its
+		 * class */
+		if (!TAILQ_EMPTY(&tenant->jobs[turn->prio]) &&
+			tenant_ready(this, tenant))
+		{
+			tenant_queue_turn(this, tenant, turn, turn->prio);
+		}
+		else
+		{
+			free(turn);
+		}
+		return true;
+	}
+	return false;
+}
+
 static bool get_job(private_processor_t *this, worker_thread_t *worker)
 {
-	int i, reserved = 0, idle;
+	int i, pass, reserved, idle;
+	bool pending;
 
 	idle = get_idle_threads_nolock(this);
 
-	for (i = 0; i < JOB_PRIO_MAX; i++)
+	if (this->max_wait)
 	{
-		if (reserved && reserved >= idle)
+		age_jobs(this);
+	}
+	if (!TAILQ_EMPTY(&this->throttled))
+	{
+		refill_tenants(this);
+	}
+
+	/* the second pass starts a new weighted round if every class with pending
+	 * jobs used up its share */
+	for (pass = 0; pass < 2; pass++)
+	{
+		reserved = 0;
+		pending = false;
+		for (i = 0; i < JOB_PRIO_MAX; i++)
 		{
-			fprintf(stderr, "delaying %d priority jobs: %d threads idle, "
-				 "but %d reserved for higher priorities", i, idle, reserved);
-			/* wait until a job of higher priority gets queued */
-			return false;
+			if (reserved && reserved >= idle)
+			{	/* idle threads are reserved for higher priorities, wait
+				 * until a job of one of them gets queued */
+				break;
+			}
+			if (this->working_threads[i] < this->prio_threads[i])
+			{
+				reserved += this->prio_threads[i] - this->working_threads[i];
+			}
+			if (TAILQ_EMPTY(&this->jobs[i]))
+			{
+				continue;
+			}
+			if (this->policy == PROCESSOR_POLICY_WEIGHTED &&
+				this->credits[i] <= 0)
+			{
+				pending = true;
+				continue;
+			}
+			if (dequeue_job(this, i, worker))
+			{
+				if (this->policy == PROCESSOR_POLICY_WEIGHTED)
+				{
+					this->credits[i]--;
+				}
+				return true;
+			}
+		}
+		if (!pending)
+		{
+			break;
 		}
-		if (this->working_threads[i] < this->prio_threads[i])
+		memcpy(this->credits, this->weights, sizeof(this->credits));
+	}
+	return false;
+}
+
+/**
+ * Wait for new jobs without blocking for a while, mutex must be held.
+ *
+ * Spins for about twice the time idle workers recently waited for jobs, up
+ * to max_spin, then yields the CPU a few times. Returns false if the worker
+ * should block right away.
+ */
+static bool idle_spin(private_processor_t *this)
+{
+	uint64_t budget = 0, end;
+	unsigned int seq, i;
+
+	if (this->max_spin && !this->single_cpu && this->idle_avg &&
+		this->idle_avg <= this->max_spin)
+	{	/* the next job likely arrives before we would be woken up */
+		budget = this->idle_avg * 2;
+		if (budget > this->max_spin)
 		{
-			reserved += this->prio_threads[i] - this->working_threads[i];
+			budget = this->max_spin;
 		}
+	}
+	if (!budget && !this->idle_yields)
+	{
+		return false;
+	}
+	seq = this->queued_seq;
+	this->spinning++;
+	this->mutex->unlock(this->mutex);
 
-        struct job_entry *first = TAILQ_FIRST(&this->jobs[i]);
-		if (first)
-        {
-			TAILQ_REMOVE(&this->jobs[i], first, entries);
-        	worker->job = &first->job; 
-        	worker->priority = i;
-			return true;
+	if (budget)
+	{
+		end = time_monotonic_us() + budget;
+		while (__atomic_load_n(&this->queued_seq, __ATOMIC_ACQUIRE) == seq &&
+			   time_monotonic_us() < end)
+		{
+			for (i = 0; i < 64; i++)
+			{
+				cpu_relax();
+			}
 		}
 	}
-	return false;
+	for (i = 0; i < this->idle_yields &&
+		 __atomic_load_n(&this->queued_seq, __ATOMIC_ACQUIRE) == seq; i++)
+	{
+		sched_yield();
+	}
+
+	this->mutex->lock(this->mutex);
+	this->spinning--;
+	return true;
 }
 
 static void *_cb_process_jobs(struct worker_entry *entry)
 {
     private_processor_t *this = entry->worker.processor;
+    uint64_t idle_since = 0;
+    bool spun = false;
 
 	/* worker threads are not cancelable by default */
 	thread_cancelability(false);
@@ -265,7 +1087,33 @@ static void *_cb_process_jobs(struct worker_entry *entry)
 	{
 		if (get_job(this, &entry->worker))
 		{
+			if (idle_since)
+			{
+				note_idle(this, time_monotonic_us() - idle_since);
+				idle_since = 0;
+			}
 			process_job(this, &entry->worker);
+			spun = false;
+			continue;
+		}
+		if (!idle_since && this->max_spin)
+		{
+			idle_since = time_monotonic_us();
+		}
+		if (!spun && idle_spin(this))
+		{	/* check the queues once more before blocking */
+			spun = true;
+			continue;
+		}
+		spun = false;
+		if (this->next_refill)
+		{	/* wake up when the first throttled tenant may run again */
+			struct timeval tv = {
+				.tv_sec = this->next_refill / 1000000,
+				.tv_usec = this->next_refill % 1000000,
+			};
+
+			this->job_added->timed_wait_abs(this->job_added, this->mutex, tv);
 		}
 		else
 		{
@@ -283,11 +1131,6 @@ void _set_threads(processor_t *public, int count)
     private_processor_t *this = (private_processor_t *)public;
 
     this->mutex->lock(this->mutex);
-    for (int i = 0; i < JOB_PRIO_MAX; i++)
-    {
-        this->prio_threads[i] = reserved[i];
-    }
-
     if (count > this->total_threads)
     {
         /* increase */
@@ -320,6 +1163,188 @@ void _set_threads(processor_t *public, int count)
     this->mutex->unlock(this->mutex);
 }
 
+static void _set_policy(processor_t *public, processor_policy_t policy)
+{
+    private_processor_t *this = (private_processor_t *)public;
+
+    this->mutex->lock(this->mutex);
+    this->policy = policy;
+    memcpy(this->credits, this->weights, sizeof(this->credits));
+    this->mutex->unlock(this->mutex);
+}
+
+static void _set_weight(processor_t *public, job_priority_t prio, int weight)
+{
+    private_processor_t *this = (private_processor_t *)public;
+
+    this->mutex->lock(this->mutex);
+    this->weights[sane_prio(prio)] = weight < 1 ? 1 : weight;
+    this->mutex->unlock(this->mutex);
+}
+
+static void _set_reserved(processor_t *public, job_priority_t prio, int threads)
+{
+    private_processor_t *this = (private_processor_t *)public;
+
+    this->mutex->lock(this->mutex);
+    this->prio_threads[sane_prio(prio)] = threads < 0 ? 0 : threads;
+    /* lower priority jobs might have been waiting for reserved threads */
+    this->job_added->broadcast(this->job_added);
+    this->mutex->unlock(this->mutex);
+}
+
+static void _set_max_wait(processor_t *public, unsigned int ms)
+{
+    private_processor_t *this = (private_processor_t *)public;
+
+    this->mutex->lock(this->mutex);
+    this->max_wait = (uint64_t)ms * 1000;
+    this->mutex->unlock(this->mutex);
+}
+
+static void _set_idle_strategy(processor_t *public, unsigned int max_spin,
+							   unsigned int yields)
+{
+    private_processor_t *this = (private_processor_t *)public;
+
+    this->mutex->lock(this->mutex);
+    this->max_spin = max_spin;
+    this->idle_yields = yields;
+    this->idle_avg = 0;
+    this->mutex->unlock(this->mutex);
+}
+
+static void _set_queue_limit(processor_t *public, job_priority_t prio,
+							 int max_depth, queue_policy_t policy,
+							 unsigned int timeout)
+{
+    private_processor_t *this = (private_processor_t *)public;
+    queue_limit_t *limit;
+
+    this->mutex->lock(this->mutex);
+    limit = &this->limits[sane_prio(prio)];
+    limit->max_depth = max_depth < 0 ? 0 : max_depth;
+    limit->policy = policy;
+    limit->timeout = timeout;
+    /* blocked producers might fit now */
+    this->job_removed->broadcast(this->job_removed);
+    this->mutex->unlock(this->mutex);
+}
+
+static void _get_queue_stats(processor_t *public, job_priority_t prio,
+							 processor_queue_stats_t *stats)
+{
+    private_processor_t *this = (private_processor_t *)public;
+
+    this->mutex->lock(this->mutex);
+    prio = sane_prio(prio);
+    *stats = this->stats[prio];
+    stats->depth = this->job_load[prio];
+    this->mutex->unlock(this->mutex);
+}
+
+static void _cancel(processor_t *public)
+{
+    private_processor_t *this = (private_processor_t *)public;
+    struct worker_entry *entry;
+    struct job_entry *job;
+    struct joblist canceled;
+    worker_thread_t *worker;
+    tenant_t *tenant, *tmp;
+
+    TAILQ_INIT(&canceled);
+    this->mutex->lock(this->mutex);
+    this->desired_threads = 0;
+    this->shutdown = true;
+    this->job_removed->broadcast(this->job_removed);
+    /* cancel potentially blocking jobs */
+    TAILQ_FOREACH(entry, &this->threads, entries)
+    {
+        worker = &entry->worker;
+        if (worker->job && worker->job->cancel)
+        {
+            worker->job->status = JOB_STATUS_CANCELED;
+            if (!worker->job->cancel(worker->job))
+            {	/* job requests to be canceled explicitly */
+                worker->thread->cancel(worker->thread);
+            }
+        }
+    }
+    while (this->total_threads > 0)
+    {
+        this->job_added->broadcast(this->job_added);
+        this->thread_terminated->wait(this->thread_terminated, this->mutex);
+    }
+    while ((entry = TAILQ_FIRST(&this->threads)))
+    {
+        TAILQ_REMOVE(&this->threads, entry, entries);
+        entry->worker.thread->join(entry->worker.thread);
+        free(entry);
+    }
+    for (int i = 0; i < JOB_PRIO_MAX; i++)
+    {
+        while ((job = TAILQ_FIRST(&this->jobs[i])))
+        {
+            TAILQ_REMOVE(&this->jobs[i], job, entries);
+            if (job->tenant)
+            {   /* turns reference jobs in the tenant sub-queues */
+                job->tenant->turn[job->prio] = NULL;
+                free(job);
+                continue;
+            }
+            this->job_load[i]--;
+            TAILQ_INSERT_TAIL(&canceled, job, entries);
+        }
+    }
+    HASH_ITER(hh, this->tenants, tenant, tmp)
+    {
+        for (int i = 0; i < JOB_PRIO_MAX; i++)
+        {
+            while ((job = TAILQ_FIRST(&tenant->jobs[i])))
+            {
+                TAILQ_REMOVE(&tenant->jobs[i], job, entries);
+                tenant->queued--;
+                this->job_load[i]--;
+                TAILQ_INSERT_TAIL(&canceled, job, entries);
+            }
+        }
+        if (tenant->throttled)
+        {
+            TAILQ_REMOVE(&this->throttled, tenant, throttled_entries);
+            tenant->throttled = false;
+        }
+        tenant_gc(this, tenant);
+    }
+    this->next_refill = 0;
+    this->mutex->unlock(this->mutex);
+
+    /* destructors may need the same lock, e.g. to queue a job */
+    while ((job = TAILQ_FIRST(&canceled)))
+    {
+        TAILQ_REMOVE(&canceled, job, entries);
+        job->job->destroy(job->job);
+        free(job);
+    }
+}
+
+static void _destroy(processor_t *public)
+{
+    private_processor_t *this = (private_processor_t *)public;
+    tenant_t *tenant, *tmp;
+
+    _cancel(public);
+    HASH_ITER(hh, this->tenants, tenant, tmp)
+    {
+        HASH_DEL(this->tenants, tenant);
+        free(tenant);
+    }
+    this->thread_terminated->destroy(this->thread_terminated);
+    this->job_removed->destroy(this->job_removed);
+    this->job_added->destroy(this->job_added);
+    this->mutex->destroy(this->mutex);
+    free(this);
+}
+
 processor_t *processor_create()
 {
     private_processor_t *this;
@@ -329,16 +1354,37 @@ processor_t *processor_create()
 
 	this->public.get_total_threads = _get_total_threads;
     this->public.get_idle_threads = _get_idle_threads;
+    this->public.get_working_threads = _get_working_threads;
+    this->public.get_job_load = _get_job_load;
+    this->public.queue_job = _queue_job;
+    this->public.queue_tenant_job = _queue_tenant_job;
+    this->public.set_tenant_limits = _set_tenant_limits;
+    this->public.set_policy = _set_policy;
+    this->public.set_weight = _set_weight;
+    this->public.set_reserved = _set_reserved;
+    this->public.set_max_wait = _set_max_wait;
+    this->public.set_queue_limit = _set_queue_limit;
+    this->public.set_idle_strategy = _set_idle_strategy;
+    this->public.get_queue_stats = _get_queue_stats;
     this->public.set_threads = _set_threads;
+    this->public.cancel = _cancel;
+    this->public.destroy = _destroy;
 
     this->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
     this->job_added = condvar_create(CONDVAR_TYPE_DEFAULT);
+    this->job_removed = condvar_create(CONDVAR_TYPE_DEFAULT);
     this->thread_terminated = condvar_create(CONDVAR_TYPE_DEFAULT);
     
     TAILQ_INIT(&this->threads);
+    TAILQ_INIT(&this->throttled);
 
     for (int i = 0; i < JOB_PRIO_MAX; i++)
         TAILQ_INIT(&this->jobs[i]);
 
+    memcpy(this->prio_threads, reserved, sizeof(this->prio_threads));
+    memcpy(this->weights, weights, sizeof(this->weights));
+    memcpy(this->credits, weights, sizeof(this->credits));
+    this->single_cpu = sysconf(_SC_NPROCESSORS_ONLN) <= 1;
+
     return &this->public;
-}
\ No newline at end of file
+}
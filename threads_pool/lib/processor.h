@@ -1,7 +1,70 @@
+
 #ifndef __MY_PROCESSOR_H__
 #define __MY_PROCESSOR_H__
 
+#include <stdint.h>
+
+#include "job.h"
+
 typedef struct processor_t processor_t;
+typedef enum processor_policy_t processor_policy_t;
+typedef struct tenant_limits_t tenant_limits_t;
+typedef enum queue_policy_t queue_policy_t;
+typedef struct processor_queue_stats_t processor_queue_stats_t;
+
+/**
+ * How idle workers pick the next job from the priority queues.
+ */
+enum processor_policy_t {
+	/** Always serve the highest priority queue first, lower ones may starve */
+	PROCESSOR_POLICY_STRICT = 0,
+	/** Serve each priority class proportionally to its configured weight */
+	PROCESSOR_POLICY_WEIGHTED,
+};
+
+/**
+ * Limits applied to the jobs of a single tenant.
+ */
+struct tenant_limits_t {
+	/** maximum number of jobs executing concurrently, 0 for no limit */
+	int max_inflight;
+	/** maximum number of jobs started per second, 0 for no limit */
+	unsigned int rate;
+	/** number of jobs that may start back to back before the rate applies */
+	unsigned int burst;
+	/** execute jobs one at a time, in the order they were queued per priority */
+	bool ordered;
+};
+
+/**
+ * What to do with a new job if the queue of its priority class is full.
+ */
+enum queue_policy_t {
+	/** Queue the job anyway */
+	QUEUE_POLICY_UNBOUNDED = 0,
+	/** Block the producer until there is room or the timeout expires */
+	QUEUE_POLICY_BLOCK,
+	/** Reject the job with -ENOBUFS */
+	QUEUE_POLICY_REJECT,
+	/** Destroy the oldest queued job of the class to make room */
+	QUEUE_POLICY_DROP_OLDEST,
+};
+
+/**
+ * Metrics of the queue of a priority class.
+ */
+struct processor_queue_stats_t {
+	/** number of jobs currently queued */
+	int depth;
+	/** highest number of jobs queued at once */
+	int peak;
+	/** jobs rejected because the queue was full, including block timeouts */
+	uint64_t rejected;
+	/** queued jobs destroyed to make room for new ones */
+	uint64_t dropped;
+	/** number of times a producer had to wait for room */
+	uint64_t blocked;
+};
 
 struct processor_t {
 
@@ -15,7 +78,7 @@ struct processor_t {
 	 * @param				priority to check
 	 * @return				number of threads in priority working
 	 */
-	// int (*get_working_threads)(processor_t *this, job_priority_t prio);
+	int (*get_working_threads)(processor_t *this, job_priority_t prio);
 
 	/**
 	 * Get the number of queued jobs for a specified priority.
@@ -23,16 +86,46 @@ struct processor_t {
 	 * @param prio			priority class to get job load for
 	 * @return				number of items in queue
 	 */
-	// int (*get_job_load) (processor_t *this, job_priority_t prio);
+	int (*get_job_load) (processor_t *this, job_priority_t prio);
 
 	/**
 	 * Adds a job to the queue.
 	 *
-	 * This function is non blocking and adds a job_t to the queue.
+	 * This function is non blocking and adds a job_t to the queue, unless
+	 * the queue of the job's priority is full and configured to block.
+	 * If the job is not queued, it is not destroyed either.
+	 *
+	 * @param job			job to add to the queue
+	 * @return				0 if queued, -ENOBUFS if the queue is full,
+	 *						-ETIMEDOUT if blocking timed out, -ESHUTDOWN
+	 *						after cancel()
+	 */
+	int (*queue_job) (processor_t *this, job_t *job);
+
+	/**
+	 * Adds a job to the sub-queue of a tenant.
+	 *
+	 * Within each priority class, tenants with queued jobs take turns with
+	 * each other and with jobs queued via queue_job(), so a single tenant
+	 * flooding the queue does not delay everyone else. Tenants are created
+	 * on demand and freed once idle, unless limits are set for them.
+	 *
+	 * Queue limits apply as with queue_job().
 	 *
+	 * @param key			tenant or flow key
 	 * @param job			job to add to the queue
+	 * @return				0 if queued, negative errno as with queue_job()
+	 */
+	int (*queue_tenant_job)(processor_t *this, uint64_t key, job_t *job);
+
+	/**
+	 * Set the limits applied to the jobs of a tenant.
+	 *
+	 * @param key			tenant or flow key
+	 * @param limits		limits to apply, NULL to remove any limits
 	 */
-	// void (*queue_job) (processor_t *this, job_t *job);
+	void (*set_tenant_limits)(processor_t *this, uint64_t key,
+							  tenant_limits_t *limits);
 
 	/**
 	 * Directly execute a job with an idle worker thread.
@@ -44,6 +137,90 @@ struct processor_t {
 	 */
 	// void (*execute_job)(processor_t *this, job_t *job);
 
+	/**
+	 * Select the policy used to pick jobs from the priority queues.
+	 *
+	 * PROCESSOR_POLICY_STRICT is the default.
+	 *
+	 * @param policy		scheduling policy to use
+	 */
+	void (*set_policy)(processor_t *this, processor_policy_t policy);
+
+	/**
+	 * Set the weight of a priority class for PROCESSOR_POLICY_WEIGHTED.
+	 *
+	 * Per scheduling round, a class gets as many jobs dequeued as its weight,
+	 * as long as it has jobs queued.
+	 *
+	 * @param prio			priority class to configure
+	 * @param weight		weight of the class, at least 1
+	 */
+	void (*set_weight)(processor_t *this, job_priority_t prio, int weight);
+
+	/**
+	 * Set the number of threads reserved for a priority class.
+	 *
+	 * Jobs of lower priority are delayed while fewer threads than reserved
+	 * for higher priority classes are idle.
+	 *
+	 * @param prio			priority class to configure
+	 * @param threads		number of threads to reserve
+	 */
+	void (*set_reserved)(processor_t *this, job_priority_t prio, int threads);
+
+	/**
+	 * Set the maximum time a job waits in a queue before it gets aged.
+	 *
+	 * A job that has been queued longer is promoted to the next higher
+	 * priority class, down to JOB_PRIO_HIGH. Critical jobs are never
+	 * preempted by aged jobs.
+	 *
+	 * @param ms			maximum queue wait in ms, 0 to disable aging
+	 */
+	void (*set_max_wait)(processor_t *this, unsigned int ms);
+
+	/**
+	 * Limit the number of jobs queued in a priority class.
+	 *
+	 * The limit applies to newly queued jobs, jobs requeued after execution
+	 * are always accepted.
+	 *
+	 * @param prio			priority class to configure
+	 * @param max_depth		maximum number of queued jobs, 0 for no limit
+	 * @param policy		what to do with jobs if the queue is full
+	 * @param timeout		time to block with QUEUE_POLICY_BLOCK in ms,
+	 *						0 to block until there is room
+	 */
+	void (*set_queue_limit)(processor_t *this, job_priority_t prio,
+							int max_depth, queue_policy_t policy,
+							unsigned int timeout);
+
+	/**
+	 * Configure how idle workers wait for new jobs.
+	 *
+	 * Instead of blocking right away, an idle worker first spins on the queue
+	 * for about twice the time idle workers recently waited for a job, at
+	 * most max_spin. It does not spin if they waited longer or on a single
+	 * CPU. Then it yields the CPU up to yields times before it blocks. Jobs
+	 * queued while workers spin don't wake up blocked workers. This trades
+	 * CPU time for lower latency with bursty load. Both 0, the default,
+	 * blocks immediately.
+	 *
+	 * @param max_spin		maximum time to spin in us, 0 to never spin
+	 * @param yields		number of times to yield before blocking
+	 */
+	void (*set_idle_strategy)(processor_t *this, unsigned int max_spin,
+							  unsigned int yields);
+
+	/**
+	 * Get the metrics of the queue of a priority class.
+	 *
+	 * @param prio			priority class to get metrics for
+	 * @param stats			receives the metrics
+	 */
+	void (*get_queue_stats)(processor_t *this, job_priority_t prio,
+							processor_queue_stats_t *stats);
+
 	/**
 	 * Set the number of threads to use in the processor.
 	 *
@@ -71,4 +248,4 @@ struct processor_t {
 
 processor_t *processor_create();
 
-#endif
\ No newline at end of file
+#endif
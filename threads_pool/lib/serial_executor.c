@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/queue.h>
+
+#include "serial_executor.h"
+#include "mutex.h"
+
+/**
+ * Maximum number of jobs executed per turn, before the executor requeues
+ * itself behind the other jobs of its priority
+ */
+#define SERIAL_BATCH 8
+
+typedef struct private_serial_executor_t private_serial_executor_t;
+
+/**
+ * Job queued to the processor while the executor has pending jobs
+ */
+typedef struct {
+	job_t public;
+	private_serial_executor_t *executor;
+} runner_t;
+
+struct serial_entry
+{
+    job_t *job;
+    TAILQ_ENTRY(serial_entry) entries;
+};
+
+TAILQ_HEAD(seriallist, serial_entry);
+
+struct private_serial_executor_t {
+	serial_executor_t public;
+	processor_t *processor;
+	job_priority_t prio;
+	struct seriallist jobs;
+	int job_load;
+	/* runner currently queued or executing, NULL while idle */
+	runner_t *runner;
+	/* number of runners not yet destroyed by the processor */
+	int runners;
+	bool destroyed;
+	mutex_t *mutex;
+};
+
+static void executor_free(private_serial_executor_t *this)
+{
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/**
+ * Run a single job, returns true if it has to be queued again
+ */
+static bool run_job(job_t *job)
+{
+	job_requeue_t requeue;
+
+	job->status = JOB_STATUS_EXECUTING;
+	requeue = job->execute(job);
+	switch (requeue.type)
+	{
+		case JOB_REQUEUE_TYPE_FAIR:
+		case JOB_REQUEUE_TYPE_DIRECT:
+			/* requeue at the end, jobs queued meanwhile go first */
+			job->status = JOB_STATUS_QUEUED;
+			return true;
+		case JOB_REQUEUE_TYPE_SCHEDULE:
+			fprintf(stderr, "serial executor can not reschedule jobs\n");
+			/* fall-through */
+		case JOB_REQUEUE_TYPE_NONE:
+		default:
+			job->status = JOB_STATUS_DONE;
+			return false;
+	}
+}
+
+static job_requeue_t _runner_execute(job_t *public)
+{
+	runner_t *runner = (runner_t*)public;
+	private_serial_executor_t *this = runner->executor;
+	struct serial_entry *entry;
+	int i;
+
+	for (i = 0; i < SERIAL_BATCH; i++)
+	{
+		this->mutex->lock(this->mutex);
+		entry = TAILQ_FIRST(&this->jobs);
+		if (!entry || this->destroyed)
+		{
+			this->runner = NULL;
+			this->mutex->unlock(this->mutex);
+			return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_NONE };
+		}
+		TAILQ_REMOVE(&this->jobs, entry, entries);
+		this->job_load--;
+		this->mutex->unlock(this->mutex);
+
+		/* no lock is held while executing, the runner is the only consumer
+		 * so jobs can not overlap */
+		if (run_job(entry->job))
+		{
+			this->mutex->lock(this->mutex);
+			if (!this->destroyed)
+			{
+				TAILQ_INSERT_TAIL(&this->jobs, entry, entries);
+				this->job_load++;
+				this->mutex->unlock(this->mutex);
+				continue;
+			}
+			this->mutex->unlock(this->mutex);
+			entry->job->status = JOB_STATUS_CANCELED;
+		}
+		entry->job->destroy(entry->job);
+		free(entry);
+	}
+
+	this->mutex->lock(this->mutex);
+	if (TAILQ_EMPTY(&this->jobs) || this->destroyed)
+	{
+		this->runner = NULL;
+		this->mutex->unlock(this->mutex);
+		return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_NONE };
+	}
+	this->mutex->unlock(this->mutex);
+	/* give other jobs of the same priority a turn */
+	return (job_requeue_t){ .type = JOB_REQUEUE_TYPE_FAIR };
+}
+
+static job_priority_t _runner_get_priority(job_t *public)
+{
+	runner_t *runner = (runner_t*)public;
+
+	return runner->executor->prio;
+}
+
+static void _runner_destroy(job_t *public)
+{
+	runner_t *runner = (runner_t*)public;
+	private_serial_executor_t *this = runner->executor;
+	bool last;
+
+	this->mutex->lock(this->mutex);
+	if (this->runner == runner)
+	{	/* canceled by the processor before it completed */
+		this->runner = NULL;
+	}
+	last = --this->runners == 0 && this->destroyed;
+	this->mutex->unlock(this->mutex);
+
+	free(runner);
+	if (last)
+	{
+		executor_free(this);
+	}
+}
+
+static int _queue_job(serial_executor_t *public, job_t *job)
+{
+	private_serial_executor_t *this = (private_serial_executor_t*)public;
+	struct serial_entry *entry;
+	struct seriallist orphans;
+	runner_t *runner = NULL;
+	int err;
+
+	entry = calloc(1, sizeof(*entry));
+	entry->job = job;
+	job->status = JOB_STATUS_QUEUED;
+
+	this->mutex->lock(this->mutex);
+	TAILQ_INSERT_TAIL(&this->jobs, entry, entries);
+	this->job_load++;
+	if (!this->runner)
+	{	/* schedule ourselves, as we have work now */
+		runner = calloc(1, sizeof(*runner));
+		runner->public.execute = _runner_execute;
+		runner->public.get_priority = _runner_get_priority;
+		runner->public.destroy = _runner_destroy;
+		runner->executor = this;
+		this->runner = runner;
+		this->runners++;
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (!runner)
+	{
+		return 0;
+	}
+	err = this->processor->queue_job(this->processor, &runner->public);
+	if (err)
+	{	/* nobody consumes the queue without a runner, take the job back and
+		 * cancel those other threads queued behind it in the meantime */
+		TAILQ_INIT(&orphans);
+		this->mutex->lock(this->mutex);
+		TAILQ_REMOVE(&this->jobs, entry, entries);
+		TAILQ_CONCAT(&orphans, &this->jobs, entries);
+		this->job_load = 0;
+		if (this->runner == runner)
+		{
+			this->runner = NULL;
+		}
+		this->runners--;
+		this->mutex->unlock(this->mutex);
+		free(runner);
+		free(entry);
+
+		while ((entry = TAILQ_FIRST(&orphans)))
+		{
+			TAILQ_REMOVE(&orphans, entry, entries);
+			entry->job->status = JOB_STATUS_CANCELED;
+			entry->job->destroy(entry->job);
+			free(entry);
+		}
+	}
+	return err;
+}
+
+static int _get_job_load(serial_executor_t *public)
+{
+	private_serial_executor_t *this = (private_serial_executor_t*)public;
+	int load;
+
+	this->mutex->lock(this->mutex);
+	load = this->job_load;
+	this->mutex->unlock(this->mutex);
+
+	return load;
+}
+
+static void _destroy(serial_executor_t *public)
+{
+	private_serial_executor_t *this = (private_serial_executor_t*)public;
+	struct serial_entry *entry;
+	struct seriallist jobs;
+	bool idle;
+
+	TAILQ_INIT(&jobs);
+
+	this->mutex->lock(this->mutex);
+	this->destroyed = true;
+	TAILQ_CONCAT(&jobs, &this->jobs, entries);
+	this->job_load = 0;
+	idle = this->runners == 0;
+	this->mutex->unlock(this->mutex);
+
+	/* release mutex to avoid deadlocks if the destructors queue jobs */
+	while ((entry = TAILQ_FIRST(&jobs)))
+	{
+		TAILQ_REMOVE(&jobs, entry, entries);
+		entry->job->status = JOB_STATUS_CANCELED;
+		entry->job->destroy(entry->job);
+		free(entry);
+	}
+	if (idle)
+	{
+		executor_free(this);
+	}
+}
+
+serial_executor_t *serial_executor_create(processor_t *processor,
+										  job_priority_t prio)
+{
+	private_serial_executor_t *this;
+
+	this = calloc(1, sizeof(*this));
+	this->public.queue_job = _queue_job;
+	this->public.get_job_load = _get_job_load;
+	this->public.destroy = _destroy;
+	this->processor = processor;
+	this->prio = prio;
+	this->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	TAILQ_INIT(&this->jobs);
+
+	return &this->public;
+}
@@ -0,0 +1,63 @@
+#ifndef __MY_SERIAL_EXECUTOR_H__
+#define __MY_SERIAL_EXECUTOR_H__
+
+#include "job.h"
+#include "processor.h"
+
+typedef struct serial_executor_t serial_executor_t;
+
+/**
+ * Executes jobs one at a time and in FIFO order on a processor_t.
+ *
+ * Jobs that operate on the same object can be queued to one executor instead
+ * of taking a per-object lock in execute(). The executor queues itself to the
+ * processor only while it has pending jobs, so no worker thread waits on it
+ * while it is idle or blocks on a lock held by another worker.
+ *
+ * Jobs queued to an executor must not block, cancel() is never called.
+ */
+struct serial_executor_t {
+
+	/**
+	 * Adds a job to the executor.
+	 *
+	 * This function is non blocking. The job is executed after all jobs
+	 * queued earlier to this executor have completed.
+	 *
+	 * If the executor has to schedule itself and the processor does not
+	 * accept it, the job is not queued and not destroyed. Jobs other
+	 * threads queued behind it meanwhile get canceled. If the processor
+	 * drops the queued executor, pending jobs continue once the next job
+	 * gets queued.
+	 *
+	 * @param job			job to add to the queue
+	 * @return				0 if queued, negative errno from the processor
+	 */
+	int (*queue_job)(serial_executor_t *this, job_t *job);
+
+	/**
+	 * Get the number of jobs waiting in this executor.
+	 *
+	 * @return				number of queued jobs
+	 */
+	int (*get_job_load)(serial_executor_t *this);
+
+	/**
+	 * Destroy the executor, pending jobs are destroyed without being
+	 * executed. A job currently executing completes before the executor
+	 * gets freed.
+	 */
+	void (*destroy)(serial_executor_t *this);
+};
+
+/**
+ * Create a serial executor on top of a processor.
+ *
+ * @param processor		processor executing the jobs
+ * @param prio			priority the executor gets queued with
+ * @return				executor
+ */
+serial_executor_t *serial_executor_create(processor_t *processor,
+										  job_priority_t prio);
+
+#endif
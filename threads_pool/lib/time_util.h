@@ -0,0 +1,13 @@
+#ifndef __MY_TIME_UTIL_H__
+#define __MY_TIME_UTIL_H__
+
+#include <stdint.h>
+
+/**
+ * Get the current monotonic time, unaffected by wall clock changes.
+ *
+ * @return				monotonic time in microseconds
+ */
+uint64_t time_monotonic_us();
+
+#endif